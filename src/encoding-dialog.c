@@ -131,17 +131,12 @@ encoding_dialog_new(GtkWindow* parent)
     GtkDialog* dialog;
     GtkWidget* combobox;
     GtkTreeModel* model;
-    gchar* ui_path;
 
     dialog = NULL;
 
-    ui_path = repairer_utils_get_ui_path("encoding-dialog.ui");
-
     builder = gtk_builder_new();
-    gtk_builder_add_from_file(builder, ui_path, NULL);
     gtk_builder_set_translation_domain(builder, GETTEXT_PACKAGE);
-
-    g_free(ui_path);
+    repairer_utils_add_ui(builder, "encoding-dialog.ui", NULL);
 
     object = gtk_builder_get_object(builder, "encoding_dialog");
     if (object == NULL)
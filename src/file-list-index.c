@@ -0,0 +1,223 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <glib.h>
+
+#include "file-list-index.h"
+
+/*
+ * An index of the trigrams of the names in the file list, so the filter
+ * only looks at the names which have all the trigrams of what is typed.
+ * The trigrams are of the bytes of the case folded UTF-8 names, three
+ * bytes packed in an integer; every trigram has the list of the rows
+ * which have it, in the order of the rows.
+ *
+ * The rows are added in their order, once, so the lists stay sorted and
+ * never have a row twice.
+ */
+#define FILE_LIST_INDEX_NO_NAME   G_MAXUINT32
+
+#define TRIGRAM(s) \
+    (((guint32)(guchar)(s)[0] << 16) | ((guint32)(guchar)(s)[1] << 8) | \
+     (guint32)(guchar)(s)[2])
+
+struct _FileListIndex {
+    guint32 n_rows;
+    GArray* offsets;            /* of the folded names, one per row */
+    GByteArray* names;
+    GHashTable* trigrams;       /* trigram -> GArray of rows */
+};
+
+static void
+file_list_index_free_rows(gpointer data)
+{
+    g_array_free(data, TRUE);
+}
+
+FileListIndex*
+file_list_index_new(void)
+{
+    FileListIndex* index;
+
+    index = g_new(FileListIndex, 1);
+    index->n_rows = 0;
+    index->offsets = g_array_new(FALSE, FALSE, sizeof(guint32));
+    index->names = g_byte_array_new();
+    index->trigrams = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	    NULL, file_list_index_free_rows);
+
+    return index;
+}
+
+void
+file_list_index_free(FileListIndex* index)
+{
+    if (index == NULL)
+	return;
+
+    g_array_free(index->offsets, TRUE);
+    g_byte_array_free(index->names, TRUE);
+    g_hash_table_destroy(index->trigrams);
+    g_free(index);
+}
+
+void
+file_list_index_clear(FileListIndex* index)
+{
+    index->n_rows = 0;
+    g_array_set_size(index->offsets, 0);
+    g_byte_array_set_size(index->names, 0);
+    g_hash_table_remove_all(index->trigrams);
+}
+
+/*
+ * The rows below this are in the index, or have no name.
+ */
+guint32
+file_list_index_get_n_rows(FileListIndex* index)
+{
+    return index->n_rows;
+}
+
+char*
+file_list_index_fold(const char* text)
+{
+    char* normalized;
+    char* folded;
+
+    normalized = g_utf8_normalize(text, -1, G_NORMALIZE_ALL);
+    if (normalized == NULL)
+	return g_strdup(text);
+
+    folded = g_utf8_casefold(normalized, -1);
+    g_free(normalized);
+
+    return folded;
+}
+
+void
+file_list_index_add(FileListIndex* index, guint32 row, const char* name)
+{
+    guint32 none = FILE_LIST_INDEX_NO_NAME;
+    guint32 offset;
+    const char* folded;
+    char* str;
+    gsize len;
+    gsize i;
+
+    g_return_if_fail(row >= index->n_rows);
+
+    while (index->offsets->len < row)
+	g_array_append_val(index->offsets, none);
+
+    str = file_list_index_fold(name);
+    len = strlen(str);
+    offset = index->names->len;
+    g_byte_array_append(index->names, (const guint8*)str, len + 1);
+    g_array_append_val(index->offsets, offset);
+    g_free(str);
+
+    folded = (const char*)index->names->data + offset;
+    for (i = 0; i + 3 <= len; i++) {
+	gpointer key = GUINT_TO_POINTER(TRIGRAM(folded + i));
+	GArray* rows;
+
+	rows = g_hash_table_lookup(index->trigrams, key);
+	if (rows == NULL) {
+	    rows = g_array_new(FALSE, FALSE, sizeof(guint32));
+	    g_hash_table_insert(index->trigrams, key, rows);
+	} else if (g_array_index(rows, guint32, rows->len - 1) == row) {
+	    continue;
+	}
+	g_array_append_val(rows, row);
+    }
+
+    index->n_rows = row + 1;
+}
+
+gboolean
+file_list_index_row_contains(FileListIndex* index, guint32 row,
+	const char* folded)
+{
+    guint32 offset;
+
+    if (row >= index->offsets->len)
+	return FALSE;
+
+    offset = g_array_index(index->offsets, guint32, row);
+    if (offset == FILE_LIST_INDEX_NO_NAME)
+	return FALSE;
+
+    return strstr((const char*)index->names->data + offset, folded) != NULL;
+}
+
+/*
+ * Returns the rows whose names have the folded text, in their order.
+ * Only the rows with the rarest trigram of the text are compared; text
+ * shorter than a trigram is looked for in every name.
+ */
+GArray*
+file_list_index_find(FileListIndex* index, const char* folded)
+{
+    GArray* found;
+    GArray* rows;
+    gsize len;
+    gsize i;
+
+    found = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+    len = strlen(folded);
+    rows = NULL;
+    for (i = 0; i + 3 <= len; i++) {
+	GArray* candidates;
+
+	candidates = g_hash_table_lookup(index->trigrams,
+		GUINT_TO_POINTER(TRIGRAM(folded + i)));
+	if (candidates == NULL)
+	    return found;
+	if (rows == NULL || candidates->len < rows->len)
+	    rows = candidates;
+    }
+
+    if (rows != NULL) {
+	for (i = 0; i < rows->len; i++) {
+	    guint32 row = g_array_index(rows, guint32, i);
+
+	    if (file_list_index_row_contains(index, row, folded))
+		g_array_append_val(found, row);
+	}
+    } else {
+	guint32 row;
+
+	for (row = 0; row < index->offsets->len; row++) {
+	    if (file_list_index_row_contains(index, row, folded))
+		g_array_append_val(found, row);
+	}
+    }
+
+    return found;
+}
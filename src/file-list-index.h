@@ -0,0 +1,43 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_file_list_index_h
+#define nautilus_filename_repairer_file_list_index_h
+
+#include <glib.h>
+
+typedef struct _FileListIndex FileListIndex;
+
+FileListIndex* file_list_index_new(void);
+void           file_list_index_free(FileListIndex* index);
+void           file_list_index_clear(FileListIndex* index);
+
+guint32        file_list_index_get_n_rows(FileListIndex* index);
+void           file_list_index_add(FileListIndex* index,
+		    guint32 row, const char* name);
+
+char*          file_list_index_fold(const char* text);
+GArray*        file_list_index_find(FileListIndex* index, const char* folded);
+gboolean       file_list_index_row_contains(FileListIndex* index,
+		    guint32 row, const char* folded);
+
+#endif // nautilus_filename_repairer_file_list_index_h
@@ -0,0 +1,119 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <gtk/gtk.h>
+
+#include "file-list-model.h"
+
+/*
+ * Times appending the entries of one flat directory to the file list
+ * model, the way the repair dialog fills it: with a row-inserted for
+ * every row as in an expanded directory, in a batch as in a collapsed
+ * one, and sorted by name.  The numbers of entries are given on the
+ * command line, 300000 and 1000000 by default.
+ *
+ *   ./file-list-model-benchmark [N...]
+ */
+
+typedef enum {
+    BENCHMARK_SIGNALS,
+    BENCHMARK_BATCH,
+    BENCHMARK_SORTED
+} BenchmarkMode;
+
+static const char* mode_names[] = {
+    "row by row",
+    "in a batch",
+    "sorted"
+};
+
+static double
+append_rows(guint n, BenchmarkMode mode)
+{
+    FileListModel* model;
+    GtkTreeIter dir;
+    GtkTreeIter iter;
+    GFile* file;
+    char name[32];
+    gint64 start;
+    gint64 end;
+    guint i;
+
+    model = file_list_model_new();
+    if (mode == BENCHMARK_SORTED)
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(model),
+		FILE_COLUMN_NAME, GTK_SORT_ASCENDING);
+
+    file = g_file_new_for_path("/benchmark");
+    file_list_model_append(model, &dir, NULL, file, "benchmark");
+    g_object_unref(file);
+
+    start = g_get_monotonic_time();
+    if (mode == BENCHMARK_BATCH)
+	file_list_model_begin_batch(model);
+
+    // Backwards, so sorting has something to do.
+    for (i = 0; i < n; i++) {
+	g_snprintf(name, sizeof(name), "entry-%08u", n - i);
+	file_list_model_append(model, &iter, &dir, NULL, name);
+    }
+
+    if (mode == BENCHMARK_BATCH)
+	file_list_model_end_batch(model);
+    else if (mode == BENCHMARK_SORTED)
+	file_list_model_sort_pending(model);
+    end = g_get_monotonic_time();
+
+    g_object_unref(model);
+
+    return (double)(end - start) / G_USEC_PER_SEC;
+}
+
+int main(int argc, char** argv)
+{
+    static const guint default_sizes[] = { 300000, 1000000 };
+    guint n_sizes;
+    guint i;
+    int mode;
+
+    n_sizes = argc > 1 ? (guint)argc - 1 : G_N_ELEMENTS(default_sizes);
+    for (i = 0; i < n_sizes; i++) {
+	guint n;
+
+	n = argc > 1 ? (guint)strtoul(argv[i + 1], NULL, 10) : default_sizes[i];
+	if (n == 0)
+	    continue;
+
+	for (mode = BENCHMARK_SIGNALS; mode <= BENCHMARK_SORTED; mode++) {
+	    double seconds = append_rows(n, mode);
+	    g_print("%8u rows %-10s %8.3f s %8.1f ns/row\n", n, mode_names[mode],
+		    seconds, seconds * 1e9 / n);
+	}
+    }
+
+    return 0;
+}
@@ -0,0 +1,2424 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <sys/stat.h>
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+
+#include "nautilus-filename-repairer-i18n.h"
+#include "filename-converter.h"
+#include "file-list-index.h"
+#include "file-list-model.h"
+
+#if !GLIB_CHECK_VERSION(2, 68, 0)
+static gpointer
+g_memdup2(gconstpointer mem, gsize byte_size)
+{
+    return byte_size > 0 ? memcpy(g_malloc(byte_size), mem, byte_size) : NULL;
+}
+#endif
+
+/*
+ * The rows live in parallel arrays indexed by the row number, which is
+ * also what an iter holds.  Row 0 is the invisible root, so 0 can mean
+ * "no row" in the links: the root is nobody's child or sibling.  The
+ * names are kept back to back in one byte array, the new names in
+ * another one, and the rows only keep offsets into them.  Nothing is
+ * freed row by row; clearing the model drops the arrays at once.
+ *
+ * The display names and the new names are made when somebody asks for
+ * them, which is mostly the view drawing the rows on the screen, or by a
+ * worker thread for the rest.  The new names are kept in a table per
+ * encoding, and the tables of the last few encodings are kept when the
+ * encoding changes.  The display names are only in a small cache.
+ *
+ * When the model is sorted, every row gets a collation key as it is added,
+ * and sorting only compares the keys.  The rows added to a directory are
+ * put at its end first and merged into their places in batches, so
+ * filling a big directory does not sort it again for every row.
+ *
+ * With a filter the model shows a flat list of the rows which have all
+ * the words of the filter in their paths.  The words are looked up in a
+ * trigram index of the names, made as the rows are added, and in one of
+ * the new names of every table, made as the worker's names are merged.
+ * A row gets the words of its parent in one pass over the rows, since a
+ * parent is always added before its children.
+ *
+ * The worker which makes the new names also looks for the renames which
+ * cannot be done, because another file of the directory would have the
+ * name or because it is too long.  It goes through the rows of every
+ * directory with a RenameDirIndex, and looks on the disk for the names
+ * which are not in the model, since the model may not have all the files
+ * of a directory.
+ */
+#define FILE_LIST_ROOT        0
+#define FILE_LIST_NO_ROW      0
+
+// offsets which are not in the byte arrays
+#define FILE_LIST_NO_NAME     G_MAXUINT32
+#define FILE_LIST_SAME_NAME   (G_MAXUINT32 - 1)
+#define FILE_LIST_NOT_YET     (G_MAXUINT32 - 2)
+
+#define FILE_LIST_DISPLAY_CACHE_SIZE  256
+#define FILE_LIST_MAX_OLD_ENCODINGS   3
+#define FILE_LIST_RESOLVE_CHUNK_SIZE  4096
+#define FILE_LIST_SORT_BATCH_SIZE     256
+
+// positions which are not among the siblings or in the filtered list
+#define FILE_LIST_REMOVED     G_MAXUINT32
+#define FILE_LIST_NOT_SHOWN   G_MAXUINT32
+
+// a bit for every word of the filter, and one for the removed rows
+#define FILE_LIST_MAX_FILTER_WORDS    7
+#define FILE_LIST_GONE                0x80
+
+#define ROW(array, row)       g_array_index((array), guint32, (row))
+
+typedef struct _NewNameTable {
+    char* encoding;
+    GArray* offsets;            /* in bytes, one per row */
+    GByteArray* bytes;
+    guint32 n_resolved;         /* the new names of the rows below are made */
+    guint n_failures;
+    GByteArray* problems;       /* RenameDirIndexProblem per row, or NULL
+				   until the worker has looked */
+    guint n_problems;
+    GArray* sort_keys;          /* of the new names, in sort_key_bytes;
+				   FILE_LIST_NOT_YET until made */
+    GByteArray* sort_key_bytes;
+    FileListIndex* index;       /* of the new names the worker has made */
+} NewNameTable;
+
+/*
+ * What the worker threads get: copies of the names, so the model can grow
+ * meanwhile, and the rows to do.  The rows are cut into chunks, which the
+ * threads of a pool take one by one; each chunk has its own bytes for the
+ * new names, so the threads share nothing but the job.
+ */
+typedef struct _ResolveChunk {
+    guint32 start;
+    guint32 end;
+    GByteArray* bytes;
+    GByteArray* key_bytes;
+} ResolveChunk;
+
+typedef struct _ResolveJob {
+    gint stamp;
+    char* encoding;
+    guint32 n_rows;
+    guint32* names;             /* FILE_LIST_NO_NAME for the rows not shown */
+    char* name_bytes;
+    guint32* parents;
+    GHashTable* dirs;           /* top level row -> path of its directory */
+    guint32* known;             /* the new names made before, in known_bytes;
+				   FILE_LIST_NOT_YET for the rows to do */
+    char* known_bytes;
+    guint32* offsets;           /* the results, in the bytes of the chunk */
+    gboolean make_keys;         /* when the model is sorted by new name */
+    guint32* known_keys;        /* the sort keys made before */
+    guint32* key_offsets;       /* the keys made, in the key bytes of the
+				   chunk */
+    ResolveChunk* chunks;
+    guint n_chunks;
+    guint8* problems;           /* NULL if not looked for */
+    guint n_problems;
+    GCancellable* cancellable;
+    gint cancelled;
+} ResolveJob;
+
+struct _FileListModel {
+    GObject parent;
+
+    gint stamp;
+    guint batch;                /* no signals while it is not 0 */
+
+    GArray* parents;
+    GArray* first_children;
+    GArray* last_children;
+    GArray* next_siblings;
+    GArray* prev_siblings;
+    GArray* positions;          /* among the siblings, so paths are quick */
+    GArray* n_children;
+    GArray* names;              /* FILE_LIST_NO_NAME for a placeholder */
+    GByteArray* name_bytes;
+    GArray* sort_keys;          /* of the names as shown,
+				   FILE_LIST_NOT_YET until sorted */
+    GByteArray* sort_key_bytes;
+
+    gint sort_column_id;
+    GtkSortType sort_order;
+    GHashTable* unsorted;       /* row -> number of children at the end
+				   which are not in their places yet */
+
+    FileListIndex* index;
+    char** filter;              /* folded words, NULL without a filter */
+    guint8 filter_mask;
+    GByteArray* filter_hits;    /* row -> bits of the words in its path */
+    GArray* filter_rows;        /* the rows shown, by their position */
+    GArray* filter_positions;   /* row -> position, or FILE_LIST_NOT_SHOWN */
+
+    NewNameTable* new_names;    /* for the current encoding */
+    GQueue* old_new_names;      /* the last used first */
+
+    GHashTable* files;          /* row -> GFile, for the top level rows */
+    GHashTable* summaries;      /* row -> string */
+
+    guint32 display_cache_rows[FILE_LIST_DISPLAY_CACHE_SIZE];
+    char* display_cache[FILE_LIST_DISPLAY_CACHE_SIZE];
+    guint32 path_cache_rows[FILE_LIST_DISPLAY_CACHE_SIZE];
+    char* path_cache[FILE_LIST_DISPLAY_CACHE_SIZE];
+};
+
+struct _FileListModelClass {
+    GObjectClass parent;
+};
+
+static void file_list_model_tree_model_init(GtkTreeModelIface* iface);
+static void file_list_model_tree_sortable_init(GtkTreeSortableIface* iface);
+static void file_list_model_free_filter(FileListModel* model);
+
+G_DEFINE_TYPE_WITH_CODE(FileListModel, file_list_model, G_TYPE_OBJECT,
+	G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL,
+	    file_list_model_tree_model_init)
+	G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_SORTABLE,
+	    file_list_model_tree_sortable_init))
+
+static NewNameTable*
+new_name_table_new(const char* encoding)
+{
+    NewNameTable* table;
+
+    table = g_new(NewNameTable, 1);
+    table->encoding = g_strdup(encoding);
+    table->offsets = g_array_new(FALSE, FALSE, sizeof(guint32));
+    table->bytes = g_byte_array_new();
+    table->n_resolved = 1;
+    table->n_failures = 0;
+    table->problems = NULL;
+    table->n_problems = 0;
+    table->sort_keys = g_array_new(FALSE, FALSE, sizeof(guint32));
+    table->sort_key_bytes = g_byte_array_new();
+    table->index = file_list_index_new();
+
+    return table;
+}
+
+static void
+new_name_table_free(NewNameTable* table)
+{
+    g_free(table->encoding);
+    g_array_free(table->offsets, TRUE);
+    g_byte_array_free(table->bytes, TRUE);
+    if (table->problems != NULL)
+	g_byte_array_free(table->problems, TRUE);
+    g_array_free(table->sort_keys, TRUE);
+    g_byte_array_free(table->sort_key_bytes, TRUE);
+    file_list_index_free(table->index);
+    g_free(table);
+}
+
+static void
+file_list_model_init_rows(FileListModel* model)
+{
+    guint32 none = 0;
+
+    model->parents = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->first_children = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->last_children = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->next_siblings = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->prev_siblings = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->positions = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->n_children = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->names = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->name_bytes = g_byte_array_new();
+    model->sort_keys = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->sort_key_bytes = g_byte_array_new();
+
+    // the root
+    g_array_append_val(model->parents, none);
+    g_array_append_val(model->first_children, none);
+    g_array_append_val(model->last_children, none);
+    g_array_append_val(model->next_siblings, none);
+    g_array_append_val(model->prev_siblings, none);
+    g_array_append_val(model->positions, none);
+    g_array_append_val(model->n_children, none);
+    g_array_append_val(model->names, none);
+    g_array_append_val(model->sort_keys, none);
+}
+
+static void
+file_list_model_free_rows(FileListModel* model)
+{
+    g_array_free(model->parents, TRUE);
+    g_array_free(model->first_children, TRUE);
+    g_array_free(model->last_children, TRUE);
+    g_array_free(model->next_siblings, TRUE);
+    g_array_free(model->prev_siblings, TRUE);
+    g_array_free(model->positions, TRUE);
+    g_array_free(model->n_children, TRUE);
+    g_array_free(model->names, TRUE);
+    g_byte_array_free(model->name_bytes, TRUE);
+    g_array_free(model->sort_keys, TRUE);
+    g_byte_array_free(model->sort_key_bytes, TRUE);
+}
+
+/*
+ * Gives the table an entry for every row, for the rows added since the
+ * table was last used.
+ */
+static void
+file_list_model_fill_new_names(FileListModel* model, NewNameTable* table)
+{
+    guint32 row;
+
+    for (row = table->offsets->len; row < model->names->len; row++) {
+	guint32 offset = FILE_LIST_NOT_YET;
+
+	g_array_append_val(table->sort_keys, offset);
+	if (row == FILE_LIST_ROOT || ROW(model->names, row) == FILE_LIST_NO_NAME)
+	    offset = FILE_LIST_NO_NAME;
+	g_array_append_val(table->offsets, offset);
+    }
+}
+
+/*
+ * The row numbers change when the model is cleared, so the old tables
+ * are of no use any more.
+ */
+static void
+file_list_model_reset_new_names(FileListModel* model)
+{
+    NewNameTable* table;
+    char* encoding = NULL;
+
+    if (model->new_names != NULL) {
+	encoding = g_strdup(model->new_names->encoding);
+	new_name_table_free(model->new_names);
+    }
+
+    while ((table = g_queue_pop_head(model->old_new_names)) != NULL)
+	new_name_table_free(table);
+
+    model->new_names = new_name_table_new(encoding);
+    file_list_model_fill_new_names(model, model->new_names);
+    g_free(encoding);
+}
+
+static void
+file_list_model_clear_display_cache(FileListModel* model)
+{
+    int i;
+
+    for (i = 0; i < FILE_LIST_DISPLAY_CACHE_SIZE; i++) {
+	g_free(model->display_cache[i]);
+	model->display_cache[i] = NULL;
+	model->display_cache_rows[i] = FILE_LIST_NO_ROW;
+	g_free(model->path_cache[i]);
+	model->path_cache[i] = NULL;
+	model->path_cache_rows[i] = FILE_LIST_NO_ROW;
+    }
+}
+
+static void
+file_list_model_init(FileListModel* model)
+{
+    model->stamp = g_random_int();
+    file_list_model_init_rows(model);
+    model->files = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	    NULL, g_object_unref);
+    model->summaries = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	    NULL, g_free);
+    model->sort_column_id = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+    model->sort_order = GTK_SORT_ASCENDING;
+    model->unsorted = g_hash_table_new(g_direct_hash, g_direct_equal);
+    model->index = file_list_index_new();
+    model->new_names = NULL;
+    model->old_new_names = g_queue_new();
+    file_list_model_reset_new_names(model);
+}
+
+static void
+file_list_model_finalize(GObject* object)
+{
+    FileListModel* model = FILE_LIST_MODEL(object);
+
+    file_list_model_free_rows(model);
+    file_list_model_clear_display_cache(model);
+    g_hash_table_destroy(model->files);
+    g_hash_table_destroy(model->summaries);
+    g_hash_table_destroy(model->unsorted);
+    file_list_model_free_filter(model);
+    file_list_index_free(model->index);
+    g_queue_foreach(model->old_new_names, (GFunc)new_name_table_free, NULL);
+    g_queue_free(model->old_new_names);
+    new_name_table_free(model->new_names);
+
+    G_OBJECT_CLASS(file_list_model_parent_class)->finalize(object);
+}
+
+static void
+file_list_model_class_init(FileListModelClass* klass)
+{
+    GObjectClass* object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = file_list_model_finalize;
+}
+
+static guint32
+file_list_model_get_row(FileListModel* model, GtkTreeIter* iter)
+{
+    if (iter == NULL)
+	return FILE_LIST_ROOT;
+
+    return GPOINTER_TO_UINT(iter->user_data);
+}
+
+static gboolean
+file_list_model_set_iter(FileListModel* model, GtkTreeIter* iter, guint32 row)
+{
+    if (row == FILE_LIST_NO_ROW) {
+	iter->stamp = 0;
+	return FALSE;
+    }
+
+    iter->stamp = model->stamp;
+    iter->user_data = GUINT_TO_POINTER(row);
+    iter->user_data2 = NULL;
+    iter->user_data3 = NULL;
+    return TRUE;
+}
+
+static const char*
+file_list_model_row_name(FileListModel* model, guint32 row)
+{
+    guint32 offset = ROW(model->names, row);
+
+    if (offset == FILE_LIST_NO_NAME)
+	return NULL;
+    return (const char*)model->name_bytes->data + offset;
+}
+
+/*
+ * Only the names which are not valid UTF-8 have a display name of their
+ * own, and they are few in the rows on the screen.
+ */
+static const char*
+file_list_model_row_display_name(FileListModel* model, guint32 row)
+{
+    const char* name;
+    guint slot;
+
+    name = file_list_model_row_name(model, row);
+    if (name == NULL)
+	return _("Loading...");
+    if (g_utf8_validate(name, -1, NULL))
+	return name;
+
+    slot = row % FILE_LIST_DISPLAY_CACHE_SIZE;
+    if (model->display_cache_rows[slot] != row) {
+	g_free(model->display_cache[slot]);
+	model->display_cache[slot] = filename_converter_get_display_name(name);
+	model->display_cache_rows[slot] = row;
+    }
+
+    return model->display_cache[slot];
+}
+
+static guint32
+file_list_model_add_bytes(GByteArray* bytes, const char* str)
+{
+    guint32 offset = bytes->len;
+
+    g_byte_array_append(bytes, (const guint8*)str, strlen(str) + 1);
+    return offset;
+}
+
+/*
+ * Most names need no change, so the new name of a row is often only a
+ * mark that it is the same as the name.
+ */
+static guint32
+file_list_model_add_new_name(GByteArray* bytes,
+	const char* name, const char* new_name)
+{
+    if (new_name == NULL)
+	return FILE_LIST_NO_NAME;
+    if (strcmp(name, new_name) == 0)
+	return FILE_LIST_SAME_NAME;
+    return file_list_model_add_bytes(bytes, new_name);
+}
+
+static void
+file_list_model_resolve_row(FileListModel* model, guint32 row)
+{
+    NewNameTable* table = model->new_names;
+    const char* name;
+    char* new_name;
+
+    name = file_list_model_row_name(model, row);
+    new_name = filename_converter_get_new_name(name, table->encoding);
+    ROW(table->offsets, row) = file_list_model_add_new_name(table->bytes,
+	    name, new_name);
+    if (new_name == NULL)
+	table->n_failures++;
+    g_free(new_name);
+}
+
+static const char*
+file_list_model_row_new_name(FileListModel* model, guint32 row)
+{
+    guint32 offset = ROW(model->new_names->offsets, row);
+
+    if (offset == FILE_LIST_NOT_YET) {
+	file_list_model_resolve_row(model, row);
+	offset = ROW(model->new_names->offsets, row);
+    }
+
+    if (offset == FILE_LIST_NO_NAME)
+	return NULL;
+    if (offset == FILE_LIST_SAME_NAME)
+	return file_list_model_row_name(model, row);
+    return (const char*)model->new_names->bytes->data + offset;
+}
+
+static GtkTreePath*
+file_list_model_row_path(FileListModel* model, guint32 row)
+{
+    GtkTreePath* path;
+
+    path = gtk_tree_path_new();
+    while (row != FILE_LIST_ROOT) {
+	gtk_tree_path_prepend_index(path, ROW(model->positions, row));
+	row = ROW(model->parents, row);
+    }
+
+    return path;
+}
+
+static guint32
+file_list_model_new_row(FileListModel* model, guint32 parent)
+{
+    guint32 row = model->parents->len;
+    guint32 last = ROW(model->last_children, parent);
+    guint32 position = ROW(model->n_children, parent)++;
+    guint32 none = FILE_LIST_NO_ROW;
+
+    g_array_append_val(model->parents, parent);
+    g_array_append_val(model->first_children, none);
+    g_array_append_val(model->last_children, none);
+    g_array_append_val(model->next_siblings, none);
+    g_array_append_val(model->prev_siblings, last);
+    g_array_append_val(model->positions, position);
+    g_array_append_val(model->n_children, none);
+
+    if (last != FILE_LIST_NO_ROW)
+	ROW(model->next_siblings, last) = row;
+    else
+	ROW(model->first_children, parent) = row;
+    ROW(model->last_children, parent) = row;
+
+    return row;
+}
+
+static void
+file_list_model_unlink_row(FileListModel* model, guint32 row)
+{
+    guint32 parent = ROW(model->parents, row);
+    guint32 prev = ROW(model->prev_siblings, row);
+    guint32 next = ROW(model->next_siblings, row);
+    guint32 sibling;
+
+    // Only the placeholders are removed from big directories, and
+    // they come first, so this is once per directory.
+    for (sibling = next; sibling != FILE_LIST_NO_ROW;
+	 sibling = ROW(model->next_siblings, sibling))
+	ROW(model->positions, sibling)--;
+    ROW(model->n_children, parent)--;
+
+    if (prev != FILE_LIST_NO_ROW)
+	ROW(model->next_siblings, prev) = next;
+    else
+	ROW(model->first_children, parent) = next;
+
+    if (next != FILE_LIST_NO_ROW)
+	ROW(model->prev_siblings, next) = prev;
+    else
+	ROW(model->last_children, parent) = prev;
+
+    ROW(model->prev_siblings, row) = FILE_LIST_NO_ROW;
+    ROW(model->next_siblings, row) = FILE_LIST_NO_ROW;
+    ROW(model->positions, row) = FILE_LIST_REMOVED;
+}
+
+/*
+ * Walks from whichever end of the siblings is nearer.
+ */
+static guint32
+file_list_model_nth_child(FileListModel* model, guint32 parent, gint n)
+{
+    guint32 n_children = ROW(model->n_children, parent);
+    guint32 row;
+
+    if (n < 0 || (guint32)n >= n_children)
+	return FILE_LIST_NO_ROW;
+
+    if (n <= n_children / 2) {
+	row = ROW(model->first_children, parent);
+	for (; n > 0; n--)
+	    row = ROW(model->next_siblings, row);
+    } else {
+	row = ROW(model->last_children, parent);
+	for (n = n_children - 1 - n; n > 0; n--)
+	    row = ROW(model->prev_siblings, row);
+    }
+
+    return row;
+}
+
+static gboolean
+file_list_model_is_sorted(FileListModel* model)
+{
+    return model->sort_column_id >= 0;
+}
+
+static gboolean
+file_list_model_shows_tree(FileListModel* model)
+{
+    return model->batch == 0 && model->filter == NULL;
+}
+
+static guint32
+file_list_model_add_sort_key(GByteArray* bytes, const char* name)
+{
+    char* key;
+    guint32 offset;
+
+    key = g_utf8_collate_key_for_filename(name, -1);
+    offset = file_list_model_add_bytes(bytes, key);
+    g_free(key);
+
+    return offset;
+}
+
+/*
+ * The keys are made from the names as they are shown, which are valid
+ * UTF-8, so the order is the one of the locale.  The keys of the new
+ * names are kept with them in the table of their encoding, and are made
+ * by the worker which makes the new names.  A row whose new name is not
+ * made yet goes by its name here, and the worker sorts it again when it
+ * is done, so sorting never converts a name.
+ */
+static const char*
+file_list_model_row_sort_key(FileListModel* model, guint32 row)
+{
+    NewNameTable* table = model->new_names;
+    guint32 offset;
+
+    if (model->sort_column_id == FILE_COLUMN_NEW_NAME) {
+	offset = ROW(table->sort_keys, row);
+	if (offset == FILE_LIST_NOT_YET &&
+	    ROW(table->offsets, row) != FILE_LIST_NOT_YET) {
+	    const char* name = file_list_model_row_new_name(model, row);
+
+	    if (name == NULL)
+		name = file_list_model_row_display_name(model, row);
+	    offset = file_list_model_add_sort_key(table->sort_key_bytes, name);
+	    ROW(table->sort_keys, row) = offset;
+	}
+	if (offset != FILE_LIST_NOT_YET)
+	    return (const char*)table->sort_key_bytes->data + offset;
+    }
+
+    offset = ROW(model->sort_keys, row);
+    if (offset == FILE_LIST_NOT_YET) {
+	offset = file_list_model_add_sort_key(model->sort_key_bytes,
+		file_list_model_row_display_name(model, row));
+	ROW(model->sort_keys, row) = offset;
+    }
+
+    return (const char*)model->sort_key_bytes->data + offset;
+}
+
+/*
+ * The placeholder stays the first child in both orders, where the scan
+ * looks for it.  The sort is stable, so equal keys keep their order.
+ * The keys of the rows are made before, so this only looks them up.
+ */
+static gint
+file_list_model_compare_rows(gconstpointer a, gconstpointer b, gpointer data)
+{
+    FileListModel* model = data;
+    guint32 row_a = *(const guint32*)a;
+    guint32 row_b = *(const guint32*)b;
+    gboolean placeholder_a = ROW(model->names, row_a) == FILE_LIST_NO_NAME;
+    gboolean placeholder_b = ROW(model->names, row_b) == FILE_LIST_NO_NAME;
+    gint res;
+
+    if (placeholder_a || placeholder_b)
+	return placeholder_b - placeholder_a;
+
+    res = strcmp(file_list_model_row_sort_key(model, row_a),
+		 file_list_model_row_sort_key(model, row_b));
+    if (model->sort_order == GTK_SORT_DESCENDING)
+	res = -res;
+    return res;
+}
+
+/*
+ * Sorts the last n_unsorted children of the row and merges them with the
+ * ones before, which are in order already.
+ */
+static void
+file_list_model_sort_children(FileListModel* model, guint32 parent,
+	guint32 n_unsorted)
+{
+    guint32 n = ROW(model->n_children, parent);
+    guint32 n_sorted;
+    guint32* rows;
+    guint32* sorted;
+    gint* new_order;
+    guint32 row;
+    guint32 i, j, k;
+
+    g_hash_table_remove(model->unsorted, GUINT_TO_POINTER(parent));
+    if (n < 2)
+	return;
+
+    rows = g_new(guint32, n);
+    row = ROW(model->first_children, parent);
+    for (i = 0; i < n; i++) {
+	rows[i] = row;
+	file_list_model_row_sort_key(model, row);
+	row = ROW(model->next_siblings, row);
+    }
+
+    n_sorted = n - MIN(n_unsorted, n);
+    g_qsort_with_data(rows + n_sorted, n - n_sorted, sizeof(guint32),
+	    file_list_model_compare_rows, model);
+
+    sorted = g_new(guint32, n);
+    i = 0;
+    j = n_sorted;
+    for (k = 0; k < n; k++) {
+	if (j == n || (i < n_sorted &&
+		file_list_model_compare_rows(&rows[i], &rows[j], model) <= 0))
+	    sorted[k] = rows[i++];
+	else
+	    sorted[k] = rows[j++];
+    }
+    g_free(rows);
+
+    new_order = g_new(gint, n);
+    row = FILE_LIST_NO_ROW;
+    for (k = 0; k < n; k++) {
+	new_order[k] = ROW(model->positions, sorted[k]);
+	ROW(model->positions, sorted[k]) = k;
+	ROW(model->prev_siblings, sorted[k]) = row;
+	if (row != FILE_LIST_NO_ROW)
+	    ROW(model->next_siblings, row) = sorted[k];
+	row = sorted[k];
+    }
+    ROW(model->next_siblings, row) = FILE_LIST_NO_ROW;
+    ROW(model->first_children, parent) = sorted[0];
+    ROW(model->last_children, parent) = row;
+    g_free(sorted);
+
+    if (file_list_model_shows_tree(model)) {
+	GtkTreePath* path;
+	GtkTreeIter iter;
+
+	path = file_list_model_row_path(model, parent);
+	file_list_model_set_iter(model, &iter, parent);
+	gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model), path,
+		parent != FILE_LIST_ROOT ? &iter : NULL, new_order);
+	gtk_tree_path_free(path);
+    }
+    g_free(new_order);
+}
+
+/*
+ * Sorts every directory, the parents before their children.
+ */
+static void
+file_list_model_sort_all(FileListModel* model)
+{
+    GArray* stack;
+    guint32 parent;
+    guint32 row;
+
+    g_hash_table_remove_all(model->unsorted);
+
+    stack = g_array_new(FALSE, FALSE, sizeof(guint32));
+    parent = FILE_LIST_ROOT;
+    g_array_append_val(stack, parent);
+    while (stack->len > 0) {
+	parent = ROW(stack, stack->len - 1);
+	g_array_set_size(stack, stack->len - 1);
+
+	file_list_model_sort_children(model, parent,
+		ROW(model->n_children, parent));
+
+	row = ROW(model->first_children, parent);
+	for (; row != FILE_LIST_NO_ROW; row = ROW(model->next_siblings, row)) {
+	    if (ROW(model->first_children, row) != FILE_LIST_NO_ROW)
+		g_array_append_val(stack, row);
+	}
+    }
+    g_array_free(stack, TRUE);
+}
+
+/*
+ * The new row waits at the end until enough rows are added to its
+ * directory, as many as there are in their places, so every row is
+ * merged only a few times.
+ */
+static void
+file_list_model_add_unsorted(FileListModel* model, guint32 parent)
+{
+    guint32 n_unsorted;
+    guint32 n_sorted;
+
+    n_unsorted = GPOINTER_TO_UINT(g_hash_table_lookup(model->unsorted,
+		GUINT_TO_POINTER(parent))) + 1;
+    n_sorted = ROW(model->n_children, parent) - MIN(n_unsorted,
+	    ROW(model->n_children, parent));
+
+    if (n_unsorted >= MAX(n_sorted, FILE_LIST_SORT_BATCH_SIZE))
+	file_list_model_sort_children(model, parent, n_unsorted);
+    else
+	g_hash_table_insert(model->unsorted, GUINT_TO_POINTER(parent),
+		GUINT_TO_POINTER(n_unsorted));
+}
+
+static guint32
+file_list_model_filter_position(FileListModel* model, guint32 row)
+{
+    if (row >= model->filter_positions->len)
+	return FILE_LIST_NOT_SHOWN;
+    return ROW(model->filter_positions, row);
+}
+
+static guint32
+file_list_model_filter_row(FileListModel* model, guint32 position)
+{
+    if (position >= model->filter_rows->len)
+	return FILE_LIST_NO_ROW;
+    return ROW(model->filter_rows, position);
+}
+
+/*
+ * Whether the name or the new name of the row has the folded word.
+ */
+static gboolean
+file_list_model_row_contains(FileListModel* model, guint32 row,
+	const char* folded)
+{
+    return file_list_index_row_contains(model->index, row, folded) ||
+	   file_list_index_row_contains(model->new_names->index, row, folded);
+}
+
+/*
+ * The words are separated by spaces or slashes, so a path can be typed.
+ */
+static char**
+file_list_model_split_filter(const char* text)
+{
+    char* folded;
+    char** words;
+    guint i, n;
+
+    if (text == NULL)
+	return NULL;
+
+    folded = file_list_index_fold(text);
+    words = g_strsplit_set(folded, " \t/", -1);
+    g_free(folded);
+
+    n = 0;
+    for (i = 0; words[i] != NULL; i++) {
+	if (words[i][0] == '\0' || n == FILE_LIST_MAX_FILTER_WORDS) {
+	    g_free(words[i]);
+	    continue;
+	}
+	words[n++] = words[i];
+    }
+    words[n] = NULL;
+
+    if (n == 0) {
+	g_free(words);
+	return NULL;
+    }
+
+    return words;
+}
+
+static void
+file_list_model_free_filter(FileListModel* model)
+{
+    if (model->filter == NULL)
+	return;
+
+    g_strfreev(model->filter);
+    model->filter = NULL;
+    g_byte_array_free(model->filter_hits, TRUE);
+    g_array_free(model->filter_rows, TRUE);
+    g_array_free(model->filter_positions, TRUE);
+}
+
+static void
+file_list_model_reset_filter(FileListModel* model)
+{
+    guint8 hits = 0;
+    guint32 none = FILE_LIST_NOT_SHOWN;
+
+    g_byte_array_set_size(model->filter_hits, 0);
+    g_byte_array_append(model->filter_hits, &hits, 1);
+    g_array_set_size(model->filter_rows, 0);
+    g_array_set_size(model->filter_positions, 0);
+    g_array_append_val(model->filter_positions, none);
+}
+
+static void
+file_list_model_show_row(FileListModel* model, guint32 row)
+{
+    guint32 position = model->filter_rows->len;
+
+    g_array_append_val(model->filter_rows, row);
+    ROW(model->filter_positions, row) = position;
+
+    if (model->batch == 0) {
+	GtkTreePath* path;
+	GtkTreeIter iter;
+
+	path = gtk_tree_path_new_from_indices(position, -1);
+	file_list_model_set_iter(model, &iter, row);
+	gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, &iter);
+	gtk_tree_path_free(path);
+    }
+}
+
+static void
+file_list_model_hide_row(FileListModel* model, guint32 row)
+{
+    guint32 position = file_list_model_filter_position(model, row);
+    guint32 i;
+
+    if (position == FILE_LIST_NOT_SHOWN)
+	return;
+
+    g_array_remove_index(model->filter_rows, position);
+    ROW(model->filter_positions, row) = FILE_LIST_NOT_SHOWN;
+    for (i = position; i < model->filter_rows->len; i++)
+	ROW(model->filter_positions, ROW(model->filter_rows, i)) = i;
+
+    if (model->batch == 0) {
+	GtkTreePath* path;
+
+	path = gtk_tree_path_new_from_indices(position, -1);
+	gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+	gtk_tree_path_free(path);
+    }
+}
+
+/*
+ * A row added while the model is filtered is shown at the end of the
+ * list, if it matches.
+ */
+static void
+file_list_model_filter_new_row(FileListModel* model, guint32 row)
+{
+    guint32 none = FILE_LIST_NOT_SHOWN;
+    guint8 hits;
+    guint i;
+
+    hits = model->filter_hits->data[ROW(model->parents, row)];
+    if ((hits & FILE_LIST_GONE) == 0) {
+	for (i = 0; model->filter[i] != NULL; i++) {
+	    if (file_list_model_row_contains(model, row, model->filter[i]))
+		hits |= 1 << i;
+	}
+    }
+    g_byte_array_append(model->filter_hits, &hits, 1);
+    g_array_append_val(model->filter_positions, none);
+
+    if (hits == model->filter_mask && ROW(model->names, row) != FILE_LIST_NO_NAME)
+	file_list_model_show_row(model, row);
+}
+
+/*
+ * The path from the top level, for the rows of the filtered list.
+ */
+static const char*
+file_list_model_row_display_path(FileListModel* model, guint32 row)
+{
+    GArray* rows;
+    GString* path;
+    guint slot;
+    guint32 ancestor;
+    guint i;
+
+    if (model->filter == NULL || ROW(model->names, row) == FILE_LIST_NO_NAME)
+	return file_list_model_row_display_name(model, row);
+
+    slot = row % FILE_LIST_DISPLAY_CACHE_SIZE;
+    if (model->path_cache_rows[slot] == row)
+	return model->path_cache[slot];
+
+    rows = g_array_new(FALSE, FALSE, sizeof(guint32));
+    for (ancestor = row; ancestor != FILE_LIST_ROOT;
+	 ancestor = ROW(model->parents, ancestor))
+	g_array_append_val(rows, ancestor);
+
+    path = g_string_new(NULL);
+    for (i = rows->len; i > 0; i--) {
+	if (path->len > 0)
+	    g_string_append_c(path, G_DIR_SEPARATOR);
+	g_string_append(path,
+		file_list_model_row_display_name(model, ROW(rows, i - 1)));
+    }
+    g_array_free(rows, TRUE);
+
+    g_free(model->path_cache[slot]);
+    model->path_cache[slot] = g_string_free(path, FALSE);
+    model->path_cache_rows[slot] = row;
+
+    return model->path_cache[slot];
+}
+
+/*
+ * What the view sees: the tree, or the filtered list under the root.
+ */
+static guint32
+file_list_model_view_first_child(FileListModel* model, guint32 row)
+{
+    if (model->filter == NULL)
+	return ROW(model->first_children, row);
+    if (row != FILE_LIST_ROOT)
+	return FILE_LIST_NO_ROW;
+    return file_list_model_filter_row(model, 0);
+}
+
+static guint32
+file_list_model_view_next(FileListModel* model, guint32 row)
+{
+    if (model->filter == NULL)
+	return ROW(model->next_siblings, row);
+    return file_list_model_filter_row(model,
+	    file_list_model_filter_position(model, row) + 1);
+}
+
+static guint32
+file_list_model_view_previous(FileListModel* model, guint32 row)
+{
+    guint32 position;
+
+    if (model->filter == NULL)
+	return ROW(model->prev_siblings, row);
+
+    position = file_list_model_filter_position(model, row);
+    if (position == 0 || position == FILE_LIST_NOT_SHOWN)
+	return FILE_LIST_NO_ROW;
+    return file_list_model_filter_row(model, position - 1);
+}
+
+static guint32
+file_list_model_view_n_children(FileListModel* model, guint32 row)
+{
+    if (model->filter == NULL)
+	return ROW(model->n_children, row);
+    return row == FILE_LIST_ROOT ? model->filter_rows->len : 0;
+}
+
+static guint32
+file_list_model_view_nth_child(FileListModel* model, guint32 row, gint n)
+{
+    if (model->filter == NULL)
+	return file_list_model_nth_child(model, row, n);
+    if (row != FILE_LIST_ROOT || n < 0)
+	return FILE_LIST_NO_ROW;
+    return file_list_model_filter_row(model, n);
+}
+
+static guint32
+file_list_model_view_parent(FileListModel* model, guint32 row)
+{
+    if (model->filter == NULL)
+	return ROW(model->parents, row);
+    return FILE_LIST_ROOT;
+}
+
+static GtkTreePath*
+file_list_model_view_path(FileListModel* model, guint32 row)
+{
+    if (model->filter == NULL)
+	return file_list_model_row_path(model, row);
+    return gtk_tree_path_new_from_indices(
+	    file_list_model_filter_position(model, row), -1);
+}
+
+static GtkTreeModelFlags
+file_list_model_get_flags(GtkTreeModel* tree_model)
+{
+    return GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint
+file_list_model_get_n_columns(GtkTreeModel* tree_model)
+{
+    return FILE_NUM_COLUMNS;
+}
+
+static GType
+file_list_model_get_column_type(GtkTreeModel* tree_model, gint index)
+{
+    if (index == FILE_COLUMN_GFILE)
+	return G_TYPE_POINTER;
+    return G_TYPE_STRING;
+}
+
+static gboolean
+file_list_model_get_iter(GtkTreeModel* tree_model, GtkTreeIter* iter,
+	GtkTreePath* path)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    gint* indices;
+    gint depth;
+    gint i;
+    guint32 row;
+
+    indices = gtk_tree_path_get_indices(path);
+    depth = gtk_tree_path_get_depth(path);
+
+    row = FILE_LIST_ROOT;
+    for (i = 0; i < depth; i++) {
+	row = file_list_model_view_nth_child(model, row, indices[i]);
+	if (row == FILE_LIST_NO_ROW)
+	    break;
+    }
+
+    return file_list_model_set_iter(model, iter, row);
+}
+
+static GtkTreePath*
+file_list_model_get_path(GtkTreeModel* tree_model, GtkTreeIter* iter)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+
+    return file_list_model_view_path(model, file_list_model_get_row(model, iter));
+}
+
+/*
+ * The strings point into the byte arrays; whoever gets the value copies
+ * them before the model can change.
+ */
+static void
+file_list_model_get_value(GtkTreeModel* tree_model, GtkTreeIter* iter,
+	gint column, GValue* value)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    guint32 row = file_list_model_get_row(model, iter);
+
+    g_return_if_fail(iter->stamp == model->stamp);
+
+    switch (column) {
+    case FILE_COLUMN_GFILE:
+	g_value_init(value, G_TYPE_POINTER);
+	g_value_set_pointer(value,
+		g_hash_table_lookup(model->files, GUINT_TO_POINTER(row)));
+	break;
+    case FILE_COLUMN_NAME:
+	g_value_init(value, G_TYPE_STRING);
+	g_value_set_static_string(value, file_list_model_row_name(model, row));
+	break;
+    case FILE_COLUMN_DISPLAY_NAME:
+	g_value_init(value, G_TYPE_STRING);
+	g_value_set_string(value,
+		file_list_model_row_display_path(model, row));
+	break;
+    case FILE_COLUMN_NEW_NAME:
+	g_value_init(value, G_TYPE_STRING);
+	g_value_set_static_string(value,
+		file_list_model_row_new_name(model, row));
+	break;
+    case FILE_COLUMN_SUMMARY:
+	g_value_init(value, G_TYPE_STRING);
+	g_value_set_static_string(value,
+		g_hash_table_lookup(model->summaries, GUINT_TO_POINTER(row)));
+	break;
+    default:
+	g_warn_if_reached();
+	break;
+    }
+}
+
+static gboolean
+file_list_model_iter_next(GtkTreeModel* tree_model, GtkTreeIter* iter)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    guint32 row = file_list_model_get_row(model, iter);
+
+    return file_list_model_set_iter(model, iter,
+	    file_list_model_view_next(model, row));
+}
+
+static gboolean
+file_list_model_iter_previous(GtkTreeModel* tree_model, GtkTreeIter* iter)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    guint32 row = file_list_model_get_row(model, iter);
+
+    return file_list_model_set_iter(model, iter,
+	    file_list_model_view_previous(model, row));
+}
+
+static gboolean
+file_list_model_iter_children(GtkTreeModel* tree_model, GtkTreeIter* iter,
+	GtkTreeIter* parent)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    guint32 row = file_list_model_get_row(model, parent);
+
+    return file_list_model_set_iter(model, iter,
+	    file_list_model_view_first_child(model, row));
+}
+
+static gboolean
+file_list_model_iter_has_child(GtkTreeModel* tree_model, GtkTreeIter* iter)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    guint32 row = file_list_model_get_row(model, iter);
+
+    return file_list_model_view_first_child(model, row) != FILE_LIST_NO_ROW;
+}
+
+static gint
+file_list_model_iter_n_children(GtkTreeModel* tree_model, GtkTreeIter* iter)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    guint32 row = file_list_model_get_row(model, iter);
+
+    return file_list_model_view_n_children(model, row);
+}
+
+static gboolean
+file_list_model_iter_nth_child(GtkTreeModel* tree_model, GtkTreeIter* iter,
+	GtkTreeIter* parent, gint n)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    guint32 row = file_list_model_get_row(model, parent);
+
+    row = file_list_model_view_nth_child(model, row, n);
+    return file_list_model_set_iter(model, iter, row);
+}
+
+static gboolean
+file_list_model_iter_parent(GtkTreeModel* tree_model, GtkTreeIter* iter,
+	GtkTreeIter* child)
+{
+    FileListModel* model = FILE_LIST_MODEL(tree_model);
+    guint32 row = file_list_model_get_row(model, child);
+
+    row = file_list_model_view_parent(model, row);
+    if (row == FILE_LIST_ROOT)
+	row = FILE_LIST_NO_ROW;
+
+    return file_list_model_set_iter(model, iter, row);
+}
+
+static void
+file_list_model_tree_model_init(GtkTreeModelIface* iface)
+{
+    iface->get_flags = file_list_model_get_flags;
+    iface->get_n_columns = file_list_model_get_n_columns;
+    iface->get_column_type = file_list_model_get_column_type;
+    iface->get_iter = file_list_model_get_iter;
+    iface->get_path = file_list_model_get_path;
+    iface->get_value = file_list_model_get_value;
+    iface->iter_next = file_list_model_iter_next;
+    iface->iter_previous = file_list_model_iter_previous;
+    iface->iter_children = file_list_model_iter_children;
+    iface->iter_has_child = file_list_model_iter_has_child;
+    iface->iter_n_children = file_list_model_iter_n_children;
+    iface->iter_nth_child = file_list_model_iter_nth_child;
+    iface->iter_parent = file_list_model_iter_parent;
+}
+
+static gboolean
+file_list_model_get_sort_column_id(GtkTreeSortable* sortable,
+	gint* sort_column_id, GtkSortType* order)
+{
+    FileListModel* model = FILE_LIST_MODEL(sortable);
+
+    if (sort_column_id != NULL)
+	*sort_column_id = model->sort_column_id;
+    if (order != NULL)
+	*order = model->sort_order;
+
+    return file_list_model_is_sorted(model);
+}
+
+/*
+ * Only the name columns can be sorted, on their keys.  Without a sort
+ * column the rows stay as they are and new rows go to the end.
+ */
+static void
+file_list_model_set_sort_column_id(GtkTreeSortable* sortable,
+	gint sort_column_id, GtkSortType order)
+{
+    FileListModel* model = FILE_LIST_MODEL(sortable);
+
+    if (sort_column_id == FILE_COLUMN_DISPLAY_NAME)
+	sort_column_id = FILE_COLUMN_NAME;
+
+    g_return_if_fail(sort_column_id < 0 ||
+		     sort_column_id == FILE_COLUMN_NAME ||
+		     sort_column_id == FILE_COLUMN_NEW_NAME);
+
+    if (sort_column_id == model->sort_column_id && order == model->sort_order)
+	return;
+
+    // the keys do for both orders, and those of the new names are kept
+    // apart from those of the names
+    model->sort_column_id = sort_column_id;
+    model->sort_order = order;
+    if (file_list_model_is_sorted(model))
+	file_list_model_sort_all(model);
+    else
+	g_hash_table_remove_all(model->unsorted);
+
+    gtk_tree_sortable_sort_column_changed(sortable);
+}
+
+static gboolean
+file_list_model_has_default_sort_func(GtkTreeSortable* sortable)
+{
+    return FALSE;
+}
+
+static void
+file_list_model_tree_sortable_init(GtkTreeSortableIface* iface)
+{
+    iface->get_sort_column_id = file_list_model_get_sort_column_id;
+    iface->set_sort_column_id = file_list_model_set_sort_column_id;
+    iface->has_default_sort_func = file_list_model_has_default_sort_func;
+}
+
+FileListModel*
+file_list_model_new(void)
+{
+    return g_object_new(FILE_LIST_TYPE_MODEL, NULL);
+}
+
+/*
+ * Only the top level rows keep a GFile.  A NULL name makes a placeholder
+ * row, which shows "Loading..." until it is removed.
+ */
+void
+file_list_model_append(FileListModel* model,
+	GtkTreeIter* iter, GtkTreeIter* parent_iter,
+	GFile* file, const char* name)
+{
+    GtkTreePath* path;
+    guint32 parent;
+    guint32 row;
+    guint32 offset;
+
+    parent = file_list_model_get_row(model, parent_iter);
+    row = file_list_model_new_row(model, parent);
+
+    offset = FILE_LIST_NO_NAME;
+    if (name != NULL)
+	offset = file_list_model_add_bytes(model->name_bytes, name);
+    g_array_append_val(model->names, offset);
+
+    offset = name != NULL ? FILE_LIST_NOT_YET : FILE_LIST_NO_NAME;
+    g_array_append_val(model->new_names->offsets, offset);
+    offset = FILE_LIST_NOT_YET;
+    g_array_append_val(model->new_names->sort_keys, offset);
+
+    offset = FILE_LIST_NOT_YET;
+    g_array_append_val(model->sort_keys, offset);
+
+    if (name != NULL)
+	file_list_index_add(model->index, row,
+		file_list_model_row_display_name(model, row));
+
+    if (file != NULL)
+	g_hash_table_insert(model->files, GUINT_TO_POINTER(row), g_object_ref(file));
+
+    file_list_model_set_iter(model, iter, row);
+    if (model->filter != NULL)
+	file_list_model_filter_new_row(model, row);
+
+    if (file_list_model_shows_tree(model)) {
+	path = file_list_model_row_path(model, row);
+	gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, iter);
+
+	if (parent != FILE_LIST_ROOT && ROW(model->first_children, parent) == row) {
+	    gtk_tree_path_up(path);
+	    gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(model),
+		    path, parent_iter);
+	}
+
+	gtk_tree_path_free(path);
+    }
+
+    if (file_list_model_is_sorted(model) && name != NULL)
+	file_list_model_add_unsorted(model, parent);
+}
+
+/*
+ * The row and its subtree stay in the arrays until the model is cleared.
+ */
+void
+file_list_model_remove(FileListModel* model, GtkTreeIter* iter)
+{
+    GtkTreePath* path;
+    guint32 row;
+    guint32 parent;
+
+    g_return_if_fail(iter->stamp == model->stamp);
+
+    row = file_list_model_get_row(model, iter);
+    parent = ROW(model->parents, row);
+
+    path = file_list_model_row_path(model, row);
+    file_list_model_unlink_row(model, row);
+    g_hash_table_remove(model->files, GUINT_TO_POINTER(row));
+    g_hash_table_remove(model->summaries, GUINT_TO_POINTER(row));
+    g_hash_table_remove(model->unsorted, GUINT_TO_POINTER(row));
+    iter->stamp = 0;
+
+    if (model->filter != NULL) {
+	model->filter_hits->data[row] = FILE_LIST_GONE;
+	file_list_model_hide_row(model, row);
+    }
+
+    if (!file_list_model_shows_tree(model)) {
+	gtk_tree_path_free(path);
+	return;
+    }
+
+    gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+
+    if (parent != FILE_LIST_ROOT &&
+	ROW(model->first_children, parent) == FILE_LIST_NO_ROW) {
+	GtkTreeIter parent_iter;
+
+	gtk_tree_path_up(path);
+	file_list_model_set_iter(model, &parent_iter, parent);
+	gtk_tree_model_row_has_child_toggled(GTK_TREE_MODEL(model),
+		path, &parent_iter);
+    }
+
+    gtk_tree_path_free(path);
+}
+
+void
+file_list_model_clear(FileListModel* model)
+{
+    guint32 row;
+
+    // The view drops a whole subtree with its top level row.
+    while ((row = ROW(model->first_children, FILE_LIST_ROOT)) != FILE_LIST_NO_ROW) {
+	GtkTreePath* path;
+
+	file_list_model_unlink_row(model, row);
+	if (!file_list_model_shows_tree(model))
+	    continue;
+	path = gtk_tree_path_new_first();
+	gtk_tree_model_row_deleted(GTK_TREE_MODEL(model), path);
+	gtk_tree_path_free(path);
+    }
+
+    if (model->filter != NULL) {
+	while (model->filter_rows->len > 0)
+	    file_list_model_hide_row(model, ROW(model->filter_rows, 0));
+	file_list_model_reset_filter(model);
+    }
+    file_list_index_clear(model->index);
+
+    g_hash_table_remove_all(model->files);
+    g_hash_table_remove_all(model->summaries);
+    g_hash_table_remove_all(model->unsorted);
+    file_list_model_free_rows(model);
+    file_list_model_init_rows(model);
+    file_list_model_reset_new_names(model);
+    file_list_model_clear_display_cache(model);
+
+    // the iters of the old rows are no longer valid
+    model->stamp++;
+}
+
+typedef struct _TopLevelRow {
+    GFile* file;
+    char* name;
+} TopLevelRow;
+
+/*
+ * Removing a top level row takes its subtree with it in one signal, which
+ * is much cheaper than removing the children one by one.  So we take the
+ * top level rows out and put them back, which also frees the rows which
+ * were below them.
+ */
+void
+file_list_model_drop_children(FileListModel* model)
+{
+    GArray* rows;
+    GtkTreeIter iter;
+    guint32 row;
+    guint i;
+
+    rows = g_array_new(FALSE, FALSE, sizeof(TopLevelRow));
+    row = ROW(model->first_children, FILE_LIST_ROOT);
+    while (row != FILE_LIST_NO_ROW) {
+	TopLevelRow top;
+	GFile* file;
+
+	file = g_hash_table_lookup(model->files, GUINT_TO_POINTER(row));
+	top.file = file != NULL ? g_object_ref(file) : NULL;
+	top.name = g_strdup(file_list_model_row_name(model, row));
+	g_array_append_val(rows, top);
+
+	row = ROW(model->next_siblings, row);
+    }
+
+    file_list_model_clear(model);
+
+    for (i = 0; i < rows->len; i++) {
+	TopLevelRow* top = &g_array_index(rows, TopLevelRow, i);
+
+	file_list_model_append(model, &iter, NULL, top->file, top->name);
+
+	if (top->file != NULL)
+	    g_object_unref(top->file);
+	g_free(top->name);
+    }
+    g_array_free(rows, TRUE);
+
+    file_list_model_sort_pending(model);
+}
+
+/*
+ * Puts the rows which wait at the end of their directories in their
+ * places.  Called when a directory is loaded.
+ */
+void
+file_list_model_sort_pending(FileListModel* model)
+{
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    GArray* parents;
+    guint i;
+
+    parents = g_array_new(FALSE, FALSE, sizeof(guint32));
+    g_hash_table_iter_init(&iter, model->unsorted);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+	guint32 parent = GPOINTER_TO_UINT(key);
+
+	g_array_append_val(parents, parent);
+    }
+
+    for (i = 0; i < parents->len; i++) {
+	guint32 parent = ROW(parents, i);
+	guint32 n_unsorted;
+
+	n_unsorted = GPOINTER_TO_UINT(g_hash_table_lookup(model->unsorted,
+		    GUINT_TO_POINTER(parent)));
+	file_list_model_sort_children(model, parent, n_unsorted);
+    }
+    g_array_free(parents, TRUE);
+}
+
+/*
+ * Between these the model sends no signals, so a big number of rows can be
+ * added without the cost of the signals.  Only for a model which no view
+ * shows: a view attached afterwards reads the rows by itself.
+ */
+void
+file_list_model_begin_batch(FileListModel* model)
+{
+    model->batch++;
+}
+
+void
+file_list_model_end_batch(FileListModel* model)
+{
+    g_return_if_fail(model->batch > 0);
+
+    model->batch--;
+}
+
+/*
+ * Shows only the rows which have all the words of the text in their
+ * paths, as a flat list, or the tree again when the text has no words.
+ * The rows change at once without signals, so no view may show the
+ * model meanwhile.
+ */
+void
+file_list_model_set_filter(FileListModel* model, const char* text)
+{
+    GArray* found;
+    guint8* hits;
+    guint32 n_rows;
+    guint32 row;
+    guint i, j;
+
+    file_list_model_free_filter(model);
+    file_list_model_clear_display_cache(model);
+
+    model->filter = file_list_model_split_filter(text);
+    if (model->filter == NULL)
+	return;
+
+    model->filter_mask = (1 << g_strv_length(model->filter)) - 1;
+    model->filter_hits = g_byte_array_new();
+    model->filter_rows = g_array_new(FALSE, FALSE, sizeof(guint32));
+    model->filter_positions = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+    n_rows = model->names->len;
+    g_byte_array_set_size(model->filter_hits, n_rows);
+    hits = model->filter_hits->data;
+    memset(hits, 0, n_rows);
+    g_array_set_size(model->filter_positions, n_rows);
+
+    model->batch++;
+    for (i = 0; model->filter[i] != NULL; i++) {
+	found = file_list_index_find(model->index, model->filter[i]);
+	for (j = 0; j < found->len; j++)
+	    hits[ROW(found, j)] |= 1 << i;
+	g_array_free(found, TRUE);
+
+	found = file_list_index_find(model->new_names->index, model->filter[i]);
+	for (j = 0; j < found->len; j++)
+	    hits[ROW(found, j)] |= 1 << i;
+	g_array_free(found, TRUE);
+    }
+
+    ROW(model->filter_positions, FILE_LIST_ROOT) = FILE_LIST_NOT_SHOWN;
+    for (row = 1; row < n_rows; row++) {
+	guint8 parent_hits = hits[ROW(model->parents, row)];
+
+	if (ROW(model->positions, row) == FILE_LIST_REMOVED ||
+	    (parent_hits & FILE_LIST_GONE) != 0)
+	    hits[row] = FILE_LIST_GONE;
+	else
+	    hits[row] |= parent_hits;
+
+	ROW(model->filter_positions, row) = FILE_LIST_NOT_SHOWN;
+	if (hits[row] == model->filter_mask &&
+	    ROW(model->names, row) != FILE_LIST_NO_NAME)
+	    file_list_model_show_row(model, row);
+    }
+    model->batch--;
+}
+
+/*
+ * Tells whether an iter taken before the model changed is still good.
+ */
+gboolean
+file_list_model_iter_is_valid(FileListModel* model, GtkTreeIter* iter)
+{
+    guint32 row = file_list_model_get_row(model, iter);
+
+    return iter->stamp == model->stamp && row < model->names->len &&
+	   ROW(model->positions, row) != FILE_LIST_REMOVED;
+}
+
+/*
+ * A directory row gets a placeholder child, so it can be expanded before
+ * its contents are loaded.
+ */
+void
+file_list_model_add_placeholder(FileListModel* model, GtkTreeIter* iter)
+{
+    GtkTreeIter child;
+
+    file_list_model_append(model, &child, iter, NULL, NULL);
+}
+
+gboolean
+file_list_model_get_placeholder(FileListModel* model, GtkTreeIter* iter,
+	GtkTreeIter* placeholder)
+{
+    guint32 row;
+
+    row = ROW(model->first_children, file_list_model_get_row(model, iter));
+    if (row == FILE_LIST_NO_ROW || ROW(model->names, row) != FILE_LIST_NO_NAME)
+	return FALSE;
+
+    return file_list_model_set_iter(model, placeholder, row);
+}
+
+/*
+ * Counts the rows ever added since the last clear, the root excluded.
+ */
+guint
+file_list_model_get_n_rows(FileListModel* model)
+{
+    return model->names->len - 1;
+}
+
+gint
+file_list_model_iter_depth(FileListModel* model, GtkTreeIter* iter)
+{
+    guint32 row;
+    gint depth;
+
+    depth = 0;
+    row = ROW(model->parents, file_list_model_get_row(model, iter));
+    while (row != FILE_LIST_ROOT) {
+	row = ROW(model->parents, row);
+	depth++;
+    }
+
+    return depth;
+}
+
+/*
+ * The file of a row below the top level is made from the names of its
+ * ancestors.
+ */
+GFile*
+file_list_model_get_file(FileListModel* model, GtkTreeIter* iter)
+{
+    GSList* names;
+    GSList* item;
+    GFile* file;
+    guint32 row;
+
+    file = NULL;
+    names = NULL;
+    row = file_list_model_get_row(model, iter);
+    while (row != FILE_LIST_ROOT) {
+	file = g_hash_table_lookup(model->files, GUINT_TO_POINTER(row));
+	if (file != NULL)
+	    break;
+	names = g_slist_prepend(names, (char*)file_list_model_row_name(model, row));
+	row = ROW(model->parents, row);
+    }
+
+    if (file == NULL) {
+	g_slist_free(names);
+	return NULL;
+    }
+
+    file = g_object_ref(file);
+    for (item = names; item != NULL; item = item->next) {
+	GFile* child = g_file_get_child(file, item->data);
+	g_object_unref(file);
+	file = child;
+    }
+    g_slist_free(names);
+
+    return file;
+}
+
+/*
+ * The names are returned without a copy, they are valid until the model
+ * is changed.  The display name is only valid until the next call.
+ */
+const char*
+file_list_model_get_name(FileListModel* model, GtkTreeIter* iter)
+{
+    return file_list_model_row_name(model, file_list_model_get_row(model, iter));
+}
+
+const char*
+file_list_model_get_display_name(FileListModel* model, GtkTreeIter* iter)
+{
+    return file_list_model_row_display_path(model,
+	    file_list_model_get_row(model, iter));
+}
+
+const char*
+file_list_model_get_new_name(FileListModel* model, GtkTreeIter* iter)
+{
+    return file_list_model_row_new_name(model, file_list_model_get_row(model, iter));
+}
+
+void
+file_list_model_set_summary(FileListModel* model, GtkTreeIter* iter,
+	const char* summary)
+{
+    GtkTreePath* path;
+    guint32 row;
+
+    row = file_list_model_get_row(model, iter);
+    g_hash_table_insert(model->summaries, GUINT_TO_POINTER(row),
+	    g_strdup(summary));
+    if (model->batch > 0 ||
+	(model->filter != NULL &&
+	 file_list_model_filter_position(model, row) == FILE_LIST_NOT_SHOWN))
+	return;
+
+    path = file_list_model_view_path(model, row);
+    gtk_tree_model_row_changed(GTK_TREE_MODEL(model), path, iter);
+    gtk_tree_path_free(path);
+}
+
+/*
+ * Switches to the new names of the encoding.  The table of an encoding
+ * used a short while ago is taken back as it is, otherwise the new names
+ * are made again when they are asked for.  The model does not tell the
+ * view, which should update the rows it shows.
+ */
+void
+file_list_model_set_encoding(FileListModel* model, const char* encoding)
+{
+    NewNameTable* table;
+    GList* item;
+
+    if (g_strcmp0(model->new_names->encoding, encoding) == 0)
+	return;
+
+    table = NULL;
+    for (item = model->old_new_names->head; item != NULL; item = item->next) {
+	NewNameTable* old = item->data;
+
+	if (g_strcmp0(old->encoding, encoding) == 0) {
+	    table = old;
+	    g_queue_delete_link(model->old_new_names, item);
+	    break;
+	}
+    }
+    if (table == NULL)
+	table = new_name_table_new(encoding);
+    file_list_model_fill_new_names(model, table);
+
+    g_queue_push_head(model->old_new_names, model->new_names);
+    if (g_queue_get_length(model->old_new_names) > FILE_LIST_MAX_OLD_ENCODINGS)
+	new_name_table_free(g_queue_pop_tail(model->old_new_names));
+
+    model->new_names = table;
+
+    // Sorted now only when no name has to be converted for it; otherwise
+    // the worker sorts the rows when it has made the new names.
+    if (model->sort_column_id == FILE_COLUMN_NEW_NAME &&
+	table->n_resolved >= model->names->len)
+	file_list_model_sort_all(model);
+}
+
+static void
+resolve_job_free(ResolveJob* job)
+{
+    guint i;
+
+    for (i = 0; i < job->n_chunks; i++) {
+	g_byte_array_free(job->chunks[i].bytes, TRUE);
+	g_byte_array_free(job->chunks[i].key_bytes, TRUE);
+    }
+    g_free(job->chunks);
+    g_free(job->encoding);
+    g_free(job->names);
+    g_free(job->name_bytes);
+    g_free(job->parents);
+    g_hash_table_destroy(job->dirs);
+    g_free(job->known);
+    g_free(job->known_bytes);
+    g_free(job->offsets);
+    g_free(job->known_keys);
+    g_free(job->key_offsets);
+    g_free(job->problems);
+    g_free(job);
+}
+
+static const char* resolve_job_new_name(ResolveJob* job, guint32 row);
+
+/*
+ * The same key as file_list_model_row_sort_key() makes on the main thread.
+ */
+static void
+resolve_chunk_add_sort_key(ResolveChunk* chunk, ResolveJob* job, guint32 row)
+{
+    const char* name;
+    char* display_name = NULL;
+
+    name = resolve_job_new_name(job, row);
+    if (name == NULL) {
+	name = job->name_bytes + job->names[row];
+	if (!g_utf8_validate(name, -1, NULL))
+	    name = display_name = filename_converter_get_display_name(name);
+    }
+
+    job->key_offsets[row] = file_list_model_add_sort_key(chunk->key_bytes, name);
+    g_free(display_name);
+}
+
+static void
+resolve_chunk_run(ResolveChunk* chunk, ResolveJob* job)
+{
+    guint32 row;
+
+    for (row = chunk->start; row < chunk->end; row++) {
+	const char* name;
+	char* new_name;
+
+	if (job->names[row] == FILE_LIST_NO_NAME)
+	    continue;
+	if (job->known[row] != FILE_LIST_NOT_YET &&
+	    (!job->make_keys || job->known_keys[row] != FILE_LIST_NOT_YET))
+	    continue;
+
+	if ((row & 0xff) == 0 && g_cancellable_is_cancelled(job->cancellable)) {
+	    // what is done so far is still kept
+	    g_atomic_int_set(&job->cancelled, TRUE);
+	    break;
+	}
+
+	if (job->known[row] == FILE_LIST_NOT_YET) {
+	    name = job->name_bytes + job->names[row];
+	    new_name = filename_converter_get_new_name(name, job->encoding);
+	    job->offsets[row] = file_list_model_add_new_name(chunk->bytes,
+		    name, new_name);
+	    g_free(new_name);
+	}
+	if (job->make_keys)
+	    resolve_chunk_add_sort_key(chunk, job, row);
+    }
+}
+
+static const char*
+resolve_job_new_name(ResolveJob* job, guint32 row)
+{
+    const char* bytes;
+    guint32 offset;
+
+    offset = job->offsets[row];
+    if (offset != FILE_LIST_NOT_YET) {
+	bytes = (const char*)
+	    job->chunks[row / FILE_LIST_RESOLVE_CHUNK_SIZE].bytes->data;
+    } else {
+	offset = job->known[row];
+	bytes = job->known_bytes;
+    }
+
+    if (offset == FILE_LIST_NO_NAME || offset == FILE_LIST_NOT_YET)
+	return NULL;
+    if (offset == FILE_LIST_SAME_NAME)
+	return job->name_bytes + job->names[row];
+    return bytes + offset;
+}
+
+/*
+ * The path of a directory row, from the directory of its top level row
+ * and the names of the rows between.  NULL when the top level row is not
+ * a local file.
+ */
+static char*
+resolve_job_get_path(ResolveJob* job, guint32 row)
+{
+    GPtrArray* names;
+    const char* dir;
+    char** parts;
+    char* path;
+    guint i;
+
+    names = g_ptr_array_new();
+    while (job->parents[row] != FILE_LIST_ROOT) {
+	g_ptr_array_add(names, job->name_bytes + job->names[row]);
+	row = job->parents[row];
+    }
+    g_ptr_array_add(names, job->name_bytes + job->names[row]);
+
+    dir = g_hash_table_lookup(job->dirs, GUINT_TO_POINTER(row));
+    if (dir == NULL) {
+	g_ptr_array_free(names, TRUE);
+	return NULL;
+    }
+
+    parts = g_new(char*, names->len + 2);
+    parts[0] = (char*)dir;
+    for (i = 0; i < names->len; i++)
+	parts[i + 1] = g_ptr_array_index(names, names->len - 1 - i);
+    parts[names->len + 1] = NULL;
+    path = g_build_filenamev(parts);
+    g_free(parts);
+    g_ptr_array_free(names, TRUE);
+
+    return path;
+}
+
+static void
+resolve_job_set_problem(guint32 row, const char* name, const char* new_name,
+	RenameDirIndexProblem problem, ResolveJob* job)
+{
+    if (problem != RENAME_DIR_INDEX_OK) {
+	job->problems[row] = problem;
+	job->n_problems++;
+    }
+}
+
+/*
+ * Checks the rows of one directory.  A new name which is none of the
+ * names in the rows may still be a file which is not in the model, which
+ * then keeps the name.
+ */
+static void
+resolve_job_check_dir(ResolveJob* job, RenameDirIndex* index,
+	const char* dir, const guint32* rows, guint n_rows)
+{
+    GHashTable* names;
+    guint i;
+
+    names = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < n_rows; i++)
+	g_hash_table_add(names, job->name_bytes + job->names[rows[i]]);
+
+    rename_dir_index_clear(index);
+    for (i = 0; i < n_rows; i++) {
+	const char* name = job->name_bytes + job->names[rows[i]];
+	const char* new_name = resolve_job_new_name(job, rows[i]);
+
+	rename_dir_index_add(index, rows[i], name, new_name);
+	if (dir != NULL && new_name != NULL && strcmp(name, new_name) != 0 &&
+	    !g_hash_table_contains(names, new_name)) {
+	    GStatBuf buf;
+	    char* path;
+
+	    path = g_build_filename(dir, new_name, NULL);
+	    if (g_lstat(path, &buf) == 0) {
+		g_hash_table_add(names, (gpointer)new_name);
+		rename_dir_index_add(index, FILE_LIST_NO_ROW, new_name, NULL);
+	    }
+	    g_free(path);
+	}
+    }
+    rename_dir_index_foreach(index,
+	    (RenameDirIndexFunc)resolve_job_set_problem, job);
+
+    g_hash_table_destroy(names);
+}
+
+/*
+ * Goes through the rows by their parents, which a counting sort of the
+ * rows puts together.  The top level rows are put together by the
+ * directories they are in.
+ */
+static void
+resolve_job_check(ResolveJob* job)
+{
+    RenameDirIndex* index;
+    GHashTable* top_level;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    guint32* starts;
+    guint32* rows;
+    guint32* next;
+    guint32 row;
+    guint32 parent;
+
+    job->problems = g_new0(guint8, job->n_rows);
+    starts = g_new0(guint32, job->n_rows + 1);
+    for (row = 1; row < job->n_rows; row++) {
+	if (job->names[row] != FILE_LIST_NO_NAME)
+	    starts[job->parents[row] + 1]++;
+    }
+    for (parent = 0; parent < job->n_rows; parent++)
+	starts[parent + 1] += starts[parent];
+
+    rows = g_new(guint32, starts[job->n_rows]);
+    next = g_memdup2(starts, sizeof(guint32) * job->n_rows);
+    for (row = 1; row < job->n_rows; row++) {
+	if (job->names[row] != FILE_LIST_NO_NAME)
+	    rows[next[job->parents[row]]++] = row;
+    }
+    g_free(next);
+
+    index = rename_dir_index_new();
+
+    top_level = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    NULL, (GDestroyNotify)g_array_unref);
+    for (row = starts[FILE_LIST_ROOT]; row < starts[FILE_LIST_ROOT + 1]; row++) {
+	const char* dir;
+	GArray* array;
+
+	dir = g_hash_table_lookup(job->dirs, GUINT_TO_POINTER(rows[row]));
+	if (dir == NULL) {
+	    resolve_job_check_dir(job, index, NULL, &rows[row], 1);
+	    continue;
+	}
+
+	array = g_hash_table_lookup(top_level, dir);
+	if (array == NULL) {
+	    array = g_array_new(FALSE, FALSE, sizeof(guint32));
+	    g_hash_table_insert(top_level, (gpointer)dir, array);
+	}
+	g_array_append_val(array, rows[row]);
+    }
+    g_hash_table_iter_init(&iter, top_level);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+	GArray* array = value;
+
+	resolve_job_check_dir(job, index, key,
+		(const guint32*)array->data, array->len);
+    }
+    g_hash_table_destroy(top_level);
+
+    for (parent = 1; parent < job->n_rows; parent++) {
+	char* dir;
+
+	if (starts[parent] == starts[parent + 1])
+	    continue;
+
+	if (g_cancellable_is_cancelled(job->cancellable)) {
+	    g_atomic_int_set(&job->cancelled, TRUE);
+	    break;
+	}
+
+	dir = resolve_job_get_path(job, parent);
+	resolve_job_check_dir(job, index, dir, &rows[starts[parent]],
+		starts[parent + 1] - starts[parent]);
+	g_free(dir);
+    }
+
+    rename_dir_index_free(index);
+    g_free(rows);
+    g_free(starts);
+}
+
+/*
+ * The conversion is all that takes time and the chunks are independent,
+ * so it runs on as many threads as there are processors.  The check of
+ * the new names needs all of them, so it comes after.
+ */
+static void
+resolve_job_run(GTask* task, FileListModel* model, ResolveJob* job,
+	GCancellable* cancellable)
+{
+    GThreadPool* pool;
+    guint i;
+
+    job->cancellable = cancellable;
+    pool = g_thread_pool_new((GFunc)resolve_chunk_run, job,
+	    g_get_num_processors(), FALSE, NULL);
+    for (i = 0; i < job->n_chunks; i++)
+	g_thread_pool_push(pool, &job->chunks[i], NULL);
+    // waits for the chunks in the queue
+    g_thread_pool_free(pool, FALSE, TRUE);
+    if (!job->cancelled)
+	resolve_job_check(job);
+    job->cancellable = NULL;
+
+    g_task_return_pointer(task, job, (GDestroyNotify)resolve_job_free);
+}
+
+/*
+ * Makes the new names of the current encoding which are not made yet, in
+ * a worker thread.  When the operation is cancelled, the names made until
+ * then are kept all the same, in the table of their encoding, so going
+ * back to it costs nothing.
+ */
+void
+file_list_model_resolve_new_names_async(FileListModel* model,
+	GCancellable* cancellable,
+	GAsyncReadyCallback callback, gpointer user_data)
+{
+    NewNameTable* table;
+    ResolveJob* job;
+    GTask* task;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    guint32 row;
+    guint i;
+
+    table = model->new_names;
+
+    job = g_new0(ResolveJob, 1);
+    job->stamp = model->stamp;
+    job->encoding = g_strdup(table->encoding);
+    job->n_rows = model->names->len;
+    job->names = g_memdup2(model->names->data, sizeof(guint32) * job->n_rows);
+    job->name_bytes = g_memdup2(model->name_bytes->data, model->name_bytes->len);
+    job->parents = g_memdup2(model->parents->data,
+	    sizeof(guint32) * job->n_rows);
+    job->known = g_memdup2(table->offsets->data, sizeof(guint32) * job->n_rows);
+    job->known_bytes = g_memdup2(table->bytes->data, table->bytes->len);
+    job->offsets = g_new(guint32, job->n_rows);
+    for (row = 0; row < job->n_rows; row++) {
+	job->offsets[row] = FILE_LIST_NOT_YET;
+	if (ROW(model->positions, row) == FILE_LIST_REMOVED)
+	    job->names[row] = FILE_LIST_NO_NAME;
+    }
+
+    job->make_keys = model->sort_column_id == FILE_COLUMN_NEW_NAME;
+    if (job->make_keys) {
+	job->known_keys = g_memdup2(table->sort_keys->data,
+		sizeof(guint32) * job->n_rows);
+	job->key_offsets = g_new(guint32, job->n_rows);
+	for (row = 0; row < job->n_rows; row++)
+	    job->key_offsets[row] = FILE_LIST_NOT_YET;
+    }
+
+    job->dirs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	    NULL, g_free);
+    g_hash_table_iter_init(&iter, model->files);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+	GFile* parent = g_file_get_parent(value);
+
+	if (parent != NULL) {
+	    g_hash_table_insert(job->dirs, key, g_file_get_path(parent));
+	    g_object_unref(parent);
+	}
+    }
+
+    job->n_chunks = (job->n_rows + FILE_LIST_RESOLVE_CHUNK_SIZE - 1) /
+		    FILE_LIST_RESOLVE_CHUNK_SIZE;
+    job->chunks = g_new(ResolveChunk, job->n_chunks);
+    for (i = 0; i < job->n_chunks; i++) {
+	job->chunks[i].start = i * FILE_LIST_RESOLVE_CHUNK_SIZE;
+	job->chunks[i].end = MIN(job->chunks[i].start +
+		FILE_LIST_RESOLVE_CHUNK_SIZE, job->n_rows);
+	job->chunks[i].bytes = g_byte_array_new();
+	job->chunks[i].key_bytes = g_byte_array_new();
+    }
+
+    task = g_task_new(model, cancellable, callback, user_data);
+    g_task_set_check_cancellable(task, FALSE);
+    g_task_set_task_data(task, job, NULL);
+    g_task_run_in_thread(task, (GTaskThreadFunc)resolve_job_run);
+    g_object_unref(task);
+}
+
+/*
+ * Adds the new names the table has got since its index was last made to
+ * it.  The names which stay the same are in the index of the names
+ * already.  Returns whether any was added.
+ */
+static gboolean
+file_list_model_index_new_names(FileListModel* model, NewNameTable* table)
+{
+    guint32 row;
+    guint32 end;
+    gboolean added = FALSE;
+
+    end = MIN(table->n_resolved, table->offsets->len);
+    for (row = file_list_index_get_n_rows(table->index); row < end; row++) {
+	guint32 offset = ROW(table->offsets, row);
+
+	if (offset == FILE_LIST_NOT_YET || offset == FILE_LIST_NO_NAME ||
+	    offset == FILE_LIST_SAME_NAME)
+	    continue;
+
+	file_list_index_add(table->index, row,
+		(const char*)table->bytes->data + offset);
+	added = TRUE;
+    }
+
+    return added;
+}
+
+/*
+ * Shows the rows which match the filter with the new names just indexed.
+ * New names only add words to the rows, so the rows shown stay; the new
+ * ones go to the end of the list, like the rows added meanwhile.
+ */
+static void
+file_list_model_filter_new_names(FileListModel* model)
+{
+    GArray* found;
+    guint8* hits;
+    guint32 row;
+    guint i, j;
+
+    hits = model->filter_hits->data;
+    for (i = 0; model->filter[i] != NULL; i++) {
+	found = file_list_index_find(model->new_names->index, model->filter[i]);
+	for (j = 0; j < found->len; j++) {
+	    if ((hits[ROW(found, j)] & FILE_LIST_GONE) == 0)
+		hits[ROW(found, j)] |= 1 << i;
+	}
+	g_array_free(found, TRUE);
+    }
+
+    for (row = 1; row < model->filter_hits->len; row++) {
+	guint8 parent_hits = hits[ROW(model->parents, row)];
+
+	if ((hits[row] & FILE_LIST_GONE) != 0 ||
+	    (parent_hits & FILE_LIST_GONE) != 0 ||
+	    ROW(model->positions, row) == FILE_LIST_REMOVED)
+	    continue;
+
+	hits[row] |= parent_hits;
+	if (hits[row] == model->filter_mask &&
+	    ROW(model->names, row) != FILE_LIST_NO_NAME &&
+	    file_list_model_filter_position(model, row) == FILE_LIST_NOT_SHOWN)
+	    file_list_model_show_row(model, row);
+    }
+}
+
+/*
+ * Puts the names made by the workers into the table of their encoding,
+ * unless the rows were cleared meanwhile.  The rows drawn meanwhile have
+ * their new names already.  A model sorted by the new names is sorted
+ * again with them.
+ */
+static void
+file_list_model_merge_job(FileListModel* model, ResolveJob* job)
+{
+    NewNameTable* table;
+    GList* item;
+    guint32 row;
+    guint i;
+    gboolean changed = FALSE;
+
+    if (job->stamp != model->stamp)
+	return;
+
+    table = NULL;
+    if (g_strcmp0(model->new_names->encoding, job->encoding) == 0) {
+	table = model->new_names;
+    } else {
+	for (item = model->old_new_names->head; item != NULL; item = item->next) {
+	    NewNameTable* old = item->data;
+
+	    if (g_strcmp0(old->encoding, job->encoding) == 0) {
+		table = old;
+		break;
+	    }
+	}
+    }
+    if (table == NULL)
+	return;
+
+    for (i = 0; i < job->n_chunks; i++) {
+	ResolveChunk* chunk = &job->chunks[i];
+
+	for (row = chunk->start; row < chunk->end; row++) {
+	    guint32 offset = job->offsets[row];
+
+	    if (offset == FILE_LIST_NOT_YET ||
+		ROW(table->offsets, row) != FILE_LIST_NOT_YET)
+		continue;
+
+	    if (offset != FILE_LIST_NO_NAME && offset != FILE_LIST_SAME_NAME) {
+		offset = file_list_model_add_bytes(table->bytes,
+			(const char*)chunk->bytes->data + offset);
+	    }
+	    ROW(table->offsets, row) = offset;
+	    if (offset == FILE_LIST_NO_NAME)
+		table->n_failures++;
+	    changed = TRUE;
+	}
+
+	for (row = chunk->start; job->make_keys && row < chunk->end; row++) {
+	    guint32 offset = job->key_offsets[row];
+
+	    if (offset == FILE_LIST_NOT_YET ||
+		ROW(table->sort_keys, row) != FILE_LIST_NOT_YET)
+		continue;
+
+	    ROW(table->sort_keys, row) = file_list_model_add_bytes(
+		    table->sort_key_bytes,
+		    (const char*)chunk->key_bytes->data + offset);
+	    changed = TRUE;
+	}
+    }
+
+    if (changed && table == model->new_names &&
+	model->sort_column_id == FILE_COLUMN_NEW_NAME)
+	file_list_model_sort_all(model);
+
+    if (job->cancelled)
+	return;
+
+    if (table->n_resolved < job->n_rows)
+	table->n_resolved = job->n_rows;
+
+    if (file_list_model_index_new_names(model, table) &&
+	table == model->new_names && model->filter != NULL)
+	file_list_model_filter_new_names(model);
+
+    if (table->problems != NULL)
+	g_byte_array_free(table->problems, TRUE);
+    table->problems = g_byte_array_sized_new(job->n_rows);
+    g_byte_array_append(table->problems, job->problems, job->n_rows);
+    table->n_problems = job->n_problems;
+}
+
+/*
+ * Returns FALSE with G_IO_ERROR_CANCELLED if the operation was cancelled,
+ * even if it got to the end.  The rows added after the operation started
+ * are not done.
+ */
+gboolean
+file_list_model_resolve_new_names_finish(FileListModel* model,
+	GAsyncResult* result, GError** error)
+{
+    ResolveJob* job;
+    gboolean res;
+
+    job = g_task_propagate_pointer(G_TASK(result), error);
+    if (job == NULL)
+	return FALSE;
+
+    file_list_model_merge_job(model, job);
+
+    // It may have been cancelled after the worker was done.
+    res = !g_cancellable_set_error_if_cancelled(
+	    g_task_get_cancellable(G_TASK(result)), error);
+    resolve_job_free(job);
+
+    return res;
+}
+
+/*
+ * Tells whether the new name of the row can be taken, as found by the
+ * last file_list_model_resolve_new_names_async() which got to the end.
+ * The rows added since are taken as fine.
+ */
+RenameDirIndexProblem
+file_list_model_get_problem(FileListModel* model, GtkTreeIter* iter)
+{
+    GByteArray* problems = model->new_names->problems;
+    guint32 row;
+
+    row = file_list_model_get_row(model, iter);
+    if (problems == NULL || row >= problems->len)
+	return RENAME_DIR_INDEX_OK;
+    return problems->data[row];
+}
+
+guint
+file_list_model_get_n_problems(FileListModel* model)
+{
+    if (model->new_names->problems == NULL)
+	return 0;
+    return model->new_names->n_problems;
+}
+
+/*
+ * Tells whether all the new names made so far could be converted.
+ */
+gboolean
+file_list_model_can_convert_all(FileListModel* model)
+{
+    return model->new_names->n_failures == 0;
+}
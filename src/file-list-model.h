@@ -0,0 +1,89 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_file_list_model_h
+#define nautilus_filename_repairer_file_list_model_h
+
+#include <gtk/gtk.h>
+
+#include "rename-dir-index.h"
+
+#define FILE_LIST_TYPE_MODEL      (file_list_model_get_type())
+#define FILE_LIST_MODEL(obj)      (G_TYPE_CHECK_INSTANCE_CAST((obj), FILE_LIST_TYPE_MODEL, FileListModel))
+#define FILE_LIST_IS_MODEL(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj), FILE_LIST_TYPE_MODEL))
+
+enum {
+    FILE_COLUMN_GFILE,
+    FILE_COLUMN_NAME,
+    FILE_COLUMN_DISPLAY_NAME,
+    FILE_COLUMN_NEW_NAME,
+    FILE_COLUMN_SUMMARY,
+    FILE_NUM_COLUMNS
+};
+
+typedef struct _FileListModel       FileListModel;
+typedef struct _FileListModelClass  FileListModelClass;
+
+G_BEGIN_DECLS
+
+GType          file_list_model_get_type(void);
+FileListModel* file_list_model_new(void);
+
+void        file_list_model_append(FileListModel* model,
+		GtkTreeIter* iter, GtkTreeIter* parent_iter,
+		GFile* file, const char* name);
+void        file_list_model_remove(FileListModel* model, GtkTreeIter* iter);
+void        file_list_model_clear(FileListModel* model);
+void        file_list_model_drop_children(FileListModel* model);
+void        file_list_model_sort_pending(FileListModel* model);
+void        file_list_model_begin_batch(FileListModel* model);
+void        file_list_model_end_batch(FileListModel* model);
+void        file_list_model_set_filter(FileListModel* model, const char* text);
+gboolean    file_list_model_iter_is_valid(FileListModel* model, GtkTreeIter* iter);
+
+void        file_list_model_add_placeholder(FileListModel* model, GtkTreeIter* iter);
+gboolean    file_list_model_get_placeholder(FileListModel* model,
+		GtkTreeIter* iter, GtkTreeIter* placeholder);
+
+guint       file_list_model_get_n_rows(FileListModel* model);
+gint        file_list_model_iter_depth(FileListModel* model, GtkTreeIter* iter);
+GFile*      file_list_model_get_file(FileListModel* model, GtkTreeIter* iter);
+const char* file_list_model_get_name(FileListModel* model, GtkTreeIter* iter);
+const char* file_list_model_get_display_name(FileListModel* model, GtkTreeIter* iter);
+const char* file_list_model_get_new_name(FileListModel* model, GtkTreeIter* iter);
+void        file_list_model_set_summary(FileListModel* model,
+		GtkTreeIter* iter, const char* summary);
+
+void        file_list_model_set_encoding(FileListModel* model, const char* encoding);
+void        file_list_model_resolve_new_names_async(FileListModel* model,
+		GCancellable* cancellable,
+		GAsyncReadyCallback callback, gpointer user_data);
+gboolean    file_list_model_resolve_new_names_finish(FileListModel* model,
+		GAsyncResult* result, GError** error);
+gboolean    file_list_model_can_convert_all(FileListModel* model);
+RenameDirIndexProblem
+	    file_list_model_get_problem(FileListModel* model, GtkTreeIter* iter);
+guint       file_list_model_get_n_problems(FileListModel* model);
+
+G_END_DECLS
+
+#endif // nautilus_filename_repairer_file_list_model_h
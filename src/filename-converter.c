@@ -0,0 +1,211 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <locale.h>
+#include <glib.h>
+
+#include "filename-converter.h"
+
+char*
+filename_converter_get_display_name(const char* name)
+{
+    size_t i;
+    size_t len;
+    GString* display_name;
+
+    if (g_utf8_validate(name, -1, NULL))
+	return g_strdup(name);
+
+    len = strlen(name);
+
+    display_name = g_string_sized_new(len * 3 + 1);
+    for (i = 0; i < len; i++) {
+	if ((guchar)name[i] < 0x80) {
+	    g_string_append_c(display_name, name[i]);
+	} else {
+	    g_string_append_printf(display_name, "%%%2x", (guchar)name[i]);
+	}
+    }
+
+    return g_string_free(display_name, FALSE);
+}
+
+static char*
+get_reconverted_name(const char* str, const char* encoding)
+{
+    // The usual misselected encoding is CP1252
+    char* cp1252 = g_convert(str, -1, "CP1252", "UTF-8", NULL, NULL, NULL);
+    if (cp1252 != NULL) {
+	char* utf8 = g_convert(cp1252, -1, "UTF-8", encoding, NULL, NULL, NULL);
+	g_free(cp1252);
+	return utf8;
+    }
+    return NULL;
+}
+
+char*
+filename_converter_get_new_name(const char* name, const char* encoding)
+{
+    char* new_name = NULL;
+
+    if (encoding == NULL)
+	return NULL;
+
+    if (g_utf8_validate(name, -1, NULL)) {
+	char* unescaped = g_uri_unescape_string(name, NULL);
+	if (g_utf8_validate(unescaped, -1, NULL)) {
+	    // A filename from MacOSX is usually in NFD.
+	    // So, if the filename is not in NFC, try to make it NFC.
+	    char* normalized = g_utf8_normalize(unescaped, -1, G_NORMALIZE_NFC);
+	    if (normalized != NULL) {
+		// Som filenames are valid UTF-8 form,
+		// but are misconverted with wrong encoding.
+		// In that case, the names are illegible.
+		// So, we try to reconvert it with the user selected encoding
+		new_name = get_reconverted_name(normalized, encoding);
+		if (new_name != NULL) {
+		    g_free(normalized);
+		} else {
+		    new_name = normalized;
+		}
+	    }
+	    g_free(unescaped);
+	} else {
+	    new_name = g_convert(unescaped, -1, "UTF-8", encoding, NULL, NULL, NULL);
+	    g_free(unescaped);
+	}
+    } else {
+	new_name = g_convert(name, -1, "UTF-8", encoding, NULL, NULL, NULL);
+    }
+
+    return new_name;
+}
+
+/*
+ * Tells whether the name is broken regardless of the encoding:
+ * it is not valid UTF-8, it has URI escapes or it is not in NFC.
+ * These are the same cases that get_new_name() handles without
+ * guessing, so the result does not depend on the user's choice.
+ */
+gboolean
+filename_converter_need_repair(const char* name)
+{
+    gboolean res;
+    char* normalized;
+
+    if (!g_utf8_validate(name, -1, NULL))
+	return TRUE;
+
+    if (strchr(name, '%') != NULL) {
+	char* unescaped = g_uri_unescape_string(name, NULL);
+	if (unescaped != NULL) {
+	    res = strcmp(name, unescaped) != 0;
+	    g_free(unescaped);
+	    if (res)
+		return TRUE;
+	}
+    }
+
+    normalized = g_utf8_normalize(name, -1, G_NORMALIZE_NFC);
+    if (normalized == NULL)
+	return FALSE;
+
+    res = strcmp(name, normalized) != 0;
+    g_free(normalized);
+
+    return res;
+}
+
+/*
+ * Returns the legacy codepage which was most likely used for the file names
+ * on a system with the current locale.
+ */
+const char*
+filename_converter_get_default_encoding(void)
+{
+    static const char* codepage_table[][2] = {
+	{ "ar",    "CP1256"  },
+	{ "az",    "CP1251"  },
+	{ "az",    "CP1254"  },
+	{ "be",    "CP1251"  },
+	{ "bg",    "CP1251"  },
+	{ "cs",    "CP1250"  },
+	{ "cy",    "CP1253"  },
+	{ "el",    "CP1253"  },
+	{ "et",    "CP1257"  },
+	{ "fa",    "CP1256"  },
+	{ "he",    "CP1255"  },
+	{ "hr",    "CP1250"  },
+	{ "hu",    "CP1250"  },
+	{ "ja",    "CP932"   },
+	{ "kk",    "CP1251"  },
+	{ "ko",    "CP949"   },
+	{ "ky",    "CP1251"  },
+	{ "lt",    "CP1257"  },
+	{ "lv",    "CP1257"  },
+	{ "mk",    "CP1251"  },
+	{ "mn",    "CP1251"  },
+	{ "pl",    "CP1250"  },
+	{ "ro",    "CP1250"  },
+	{ "ru",    "CP1251"  },
+	{ "sk",    "CP1250"  },
+	{ "sl",    "CP1250"  },
+	{ "sq",    "CP1250"  },
+	{ "sr",    "CP1250"  },
+	{ "sr",    "CP1251"  },
+	{ "th",    "CP874"   },
+	{ "tr",    "CP1254"  },
+	{ "tt",    "CP1251"  },
+	{ "uk",    "CP1251"  },
+	{ "ur",    "CP1256"  },
+	{ "uz",    "CP1251"  },
+	{ "uz",    "CP1254"  },
+	{ "vi",    "CP1258"  },
+	{ "zh_CN", "CP936"   },
+	{ "zh_HK", "CP950"   },
+	{ "zh_MO", "CP950"   },
+	{ "zh_SG", "CP936"   },
+	{ "zh_TW", "CP950"   },
+	{ NULL,    NULL      }
+    };
+
+    int i;
+    const char* locale;
+    size_t len;
+
+    locale = setlocale(LC_CTYPE, NULL);
+    i = 0;
+    while (codepage_table[i][0] != NULL) {
+	len = strlen(codepage_table[i][0]);
+	if (strncmp(codepage_table[i][0], locale, len) == 0) {
+	    return codepage_table[i][1];
+	}
+	i++;
+    }
+
+    return "CP1252";
+}
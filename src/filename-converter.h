@@ -0,0 +1,34 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_filename_converter_h
+#define nautilus_filename_repairer_filename_converter_h
+
+#include <glib.h>
+
+char*    filename_converter_get_display_name(const char* name);
+char*    filename_converter_get_new_name(const char* name, const char* encoding);
+gboolean filename_converter_need_repair(const char* name);
+
+const char* filename_converter_get_default_encoding(void);
+
+#endif /* nautilus_filename_repairer_filename_converter_h */
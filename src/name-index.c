@@ -0,0 +1,881 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#ifdef HAVE_SYS_FANOTIFY_H
+#include <sys/fanotify.h>
+#endif
+
+#include <glib.h>
+
+#include "name-index.h"
+#include "filename-converter.h"
+
+#if defined(HAVE_SYS_FANOTIFY_H) && defined(FAN_REPORT_DFID_NAME)
+#define HAVE_FANOTIFY_DFID_NAME 1
+#else
+#define HAVE_FANOTIFY_DFID_NAME 0
+#endif
+
+#define INOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		      IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+#if HAVE_FANOTIFY_DFID_NAME
+#define FANOTIFY_MASK (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | \
+		       FAN_MOVED_TO | FAN_ONDIR)
+#endif
+
+// the roots indexed at once; the one asked about the longest ago goes
+#define NAME_INDEX_MAX_ROOTS    4
+// the directories watched at once, at most half of the inotify limit
+#define NAME_INDEX_MAX_DIRS     16384
+// the roots remembered as failed
+#define NAME_INDEX_MAX_FAILED   64
+
+/*
+ * The index keeps the full paths of broken entries below a few roots,
+ * the directories which are right-clicked.  The tables are filled by a
+ * walker thread and kept up to date by inotify, or by fanotify when we
+ * are allowed to resolve the file handles it gives.  Either way every
+ * directory has its own watch or mark, so only the indexed trees send
+ * events.
+ *
+ * The paths are kept in the order of compare_paths(), where the paths
+ * below a directory come right after it, so a subtree is a range: it is
+ * found with one search and dropped without looking at the rest.
+ *
+ * A root whose tree has more directories than may be watched is given
+ * up and remembered, so it is not walked again every time it is asked
+ * about.
+ */
+struct _NameIndex {
+    GMutex lock;
+    GSequence* broken;      /* paths */
+    GSequence* dirs;        /* NameIndexDir, the watched directories */
+    guint n_dirs;
+    guint max_dirs;
+    GQueue* roots;          /* NameIndexRoot, the last asked about first */
+    GHashTable* failed;     /* roots which could not be watched */
+    GAsyncQueue* walks;
+    GThread* walker;
+    gboolean closing;
+
+    int fd;
+    gboolean use_fanotify;
+    guint watch_id;
+    GHashTable* wd_table;   /* inotify: wd -> GSequenceIter in dirs */
+};
+
+typedef struct _NameIndexRoot {
+    char* path;
+    gboolean ready;         /* the first walk is done */
+    int mount_fd;           /* fanotify: to resolve the file handles */
+} NameIndexRoot;
+
+typedef struct _NameIndexDir {
+    char* path;
+    int wd;                 /* -1 with fanotify */
+} NameIndexDir;
+
+typedef struct _NameIndexWalk {
+    char* path;
+    gboolean is_root;
+} NameIndexWalk;
+
+static gboolean
+is_under(const char* path, const char* dir)
+{
+    size_t len;
+
+    if (strcmp(dir, "/") == 0)
+	return path[0] == '/';
+
+    len = strlen(dir);
+    if (strncmp(path, dir, len) != 0)
+	return FALSE;
+
+    return path[len] == '\0' || path[len] == '/';
+}
+
+/*
+ * Like strcmp(), but the slash comes before any other byte, so the paths
+ * below a directory come right after it.
+ */
+static gint
+compare_paths(const char* a, const char* b)
+{
+    while (*a != '\0' && *a == *b) {
+	a++;
+	b++;
+    }
+
+    return (*a == '/' ? 1 : (guchar)*a) - (*b == '/' ? 1 : (guchar)*b);
+}
+
+static gint
+name_index_compare_broken(gconstpointer a, gconstpointer b, gpointer data)
+{
+    return compare_paths(a, b);
+}
+
+static gint
+name_index_compare_dirs(gconstpointer a, gconstpointer b, gpointer data)
+{
+    return compare_paths(((const NameIndexDir*)a)->path,
+			 ((const NameIndexDir*)b)->path);
+}
+
+static void
+name_index_dir_free(NameIndexDir* dir)
+{
+    g_free(dir->path);
+    g_free(dir);
+}
+
+/*
+ * The first item which is the key or comes after it.  The sequences
+ * never have an item twice.
+ */
+static GSequenceIter*
+name_index_search(GSequence* seq, gpointer key, GCompareDataFunc compare)
+{
+    GSequenceIter* iter;
+    GSequenceIter* prev;
+
+    iter = g_sequence_search(seq, key, compare, NULL);
+    if (g_sequence_iter_is_begin(iter))
+	return iter;
+
+    prev = g_sequence_iter_prev(iter);
+    if (compare(g_sequence_get(prev), key, NULL) == 0)
+	return prev;
+    return iter;
+}
+
+static GSequenceIter*
+name_index_lookup(GSequence* seq, gpointer key, GCompareDataFunc compare)
+{
+    GSequenceIter* iter;
+
+    iter = name_index_search(seq, key, compare);
+    if (g_sequence_iter_is_end(iter) ||
+	compare(g_sequence_get(iter), key, NULL) != 0)
+	return NULL;
+    return iter;
+}
+
+/*
+ * Half of what inotify allows, since the rest of the session watches
+ * directories too.
+ */
+static guint
+name_index_get_max_dirs(void)
+{
+    char* contents;
+    guint64 n = 0;
+
+    if (g_file_get_contents("/proc/sys/fs/inotify/max_user_watches",
+		&contents, NULL, NULL)) {
+	n = g_ascii_strtoull(contents, NULL, 10);
+	g_free(contents);
+    }
+
+    if (n == 0)
+	return NAME_INDEX_MAX_DIRS;
+    return MIN(NAME_INDEX_MAX_DIRS, n / 2);
+}
+
+/* the caller must hold the lock */
+static NameIndexRoot*
+name_index_find_root(NameIndex* index, const char* path)
+{
+    GList* item;
+
+    for (item = index->roots->head; item != NULL; item = item->next) {
+	NameIndexRoot* root = item->data;
+
+	if (is_under(path, root->path))
+	    return root;
+    }
+
+    return NULL;
+}
+
+/* the caller must hold the lock */
+static void
+name_index_add_broken(NameIndex* index, const char* path)
+{
+    // the root may have been dropped while it was walked
+    if (name_index_find_root(index, path) == NULL)
+	return;
+
+    if (name_index_lookup(index->broken, (gpointer)path,
+		name_index_compare_broken) != NULL)
+	return;
+
+    g_sequence_insert_sorted(index->broken, g_strdup(path),
+	    name_index_compare_broken, NULL);
+}
+
+/* the caller must hold the lock */
+static void
+name_index_remove_dir(NameIndex* index, GSequenceIter* iter)
+{
+    NameIndexDir* dir = g_sequence_get(iter);
+
+#if HAVE_FANOTIFY_DFID_NAME
+    // A directory moved away keeps its mark until it is gone; its
+    // events are dropped, as it is under no root.
+    if (index->use_fanotify)
+	fanotify_mark(index->fd, FAN_MARK_REMOVE, FANOTIFY_MASK,
+		AT_FDCWD, dir->path);
+#endif
+    if (dir->wd >= 0) {
+	inotify_rm_watch(index->fd, dir->wd);
+	g_hash_table_remove(index->wd_table, GINT_TO_POINTER(dir->wd));
+    }
+
+    g_sequence_remove(iter);
+    index->n_dirs--;
+}
+
+/* the caller must hold the lock */
+static void
+name_index_remove_subtree(NameIndex* index, const char* path)
+{
+    NameIndexDir key = { (char*)path, -1 };
+    GSequenceIter* iter;
+
+    iter = name_index_search(index->broken, (gpointer)path,
+	    name_index_compare_broken);
+    while (!g_sequence_iter_is_end(iter) &&
+	   is_under(g_sequence_get(iter), path)) {
+	GSequenceIter* next = g_sequence_iter_next(iter);
+
+	g_sequence_remove(iter);
+	iter = next;
+    }
+
+    iter = name_index_search(index->dirs, &key, name_index_compare_dirs);
+    while (!g_sequence_iter_is_end(iter) &&
+	   is_under(((NameIndexDir*)g_sequence_get(iter))->path, path)) {
+	GSequenceIter* next = g_sequence_iter_next(iter);
+
+	name_index_remove_dir(index, iter);
+	iter = next;
+    }
+}
+
+/* the caller must hold the lock */
+static void
+name_index_add_failed(NameIndex* index, const char* path)
+{
+    if (g_hash_table_size(index->failed) >= NAME_INDEX_MAX_FAILED)
+	g_hash_table_remove_all(index->failed);
+    g_hash_table_add(index->failed, g_strdup(path));
+}
+
+/* the caller must hold the lock */
+static void
+name_index_drop_root(NameIndex* index, NameIndexRoot* root, gboolean failed)
+{
+    g_queue_remove(index->roots, root);
+    name_index_remove_subtree(index, root->path);
+
+    if (failed)
+	name_index_add_failed(index, root->path);
+
+    if (root->mount_fd >= 0)
+	close(root->mount_fd);
+    g_free(root->path);
+    g_free(root);
+}
+
+/*
+ * Returns FALSE when no more directories may be watched.
+ * The caller must hold the lock.
+ */
+static gboolean
+name_index_add_dir(NameIndex* index, const char* path)
+{
+    NameIndexDir key = { (char*)path, -1 };
+    NameIndexDir* dir;
+    GSequenceIter* iter;
+    int wd = -1;
+
+    if (name_index_lookup(index->dirs, &key, name_index_compare_dirs) != NULL)
+	return TRUE;
+    if (index->n_dirs >= index->max_dirs)
+	return FALSE;
+
+#if HAVE_FANOTIFY_DFID_NAME
+    if (index->use_fanotify) {
+	if (fanotify_mark(index->fd, FAN_MARK_ADD, FANOTIFY_MASK,
+		    AT_FDCWD, path) != 0)
+	    return errno != ENOSPC;
+    } else
+#endif
+    {
+	wd = inotify_add_watch(index->fd, path, INOTIFY_MASK);
+	if (wd < 0)
+	    return errno != ENOSPC;
+    }
+
+    dir = g_new(NameIndexDir, 1);
+    dir->path = g_strdup(path);
+    dir->wd = wd;
+    iter = g_sequence_insert_sorted(index->dirs, dir,
+	    name_index_compare_dirs, NULL);
+    if (wd >= 0)
+	g_hash_table_replace(index->wd_table, GINT_TO_POINTER(wd), iter);
+    index->n_dirs++;
+
+    return TRUE;
+}
+
+static gboolean
+is_directory(DIR* d, struct dirent* ent)
+{
+    struct stat st;
+
+    if (ent->d_type != DT_UNKNOWN)
+	return ent->d_type == DT_DIR;
+
+    if (fstatat(dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+	return FALSE;
+
+    return S_ISDIR(st.st_mode);
+}
+
+/*
+ * The walk stops when its root is dropped, and drops its root when the
+ * tree has more directories than may be watched.
+ */
+static void
+name_index_walk(NameIndex* index, const char* root)
+{
+    GQueue queue = G_QUEUE_INIT;
+    char* dir;
+
+    g_queue_push_tail(&queue, g_strdup(root));
+
+    while ((dir = g_queue_pop_head(&queue)) != NULL) {
+	DIR* d;
+	struct dirent* ent;
+	NameIndexRoot* owner;
+	gboolean skip;
+
+	g_mutex_lock(&index->lock);
+	owner = name_index_find_root(index, dir);
+	skip = index->closing || owner == NULL;
+	if (!skip && !name_index_add_dir(index, dir)) {
+	    name_index_drop_root(index, owner, TRUE);
+	    skip = TRUE;
+	}
+	g_mutex_unlock(&index->lock);
+
+	if (skip) {
+	    g_free(dir);
+	    continue;
+	}
+
+	d = opendir(dir);
+	if (d == NULL) {
+	    g_free(dir);
+	    continue;
+	}
+
+	while ((ent = readdir(d)) != NULL) {
+	    char* path;
+
+	    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+		continue;
+
+	    path = g_build_filename(dir, ent->d_name, NULL);
+
+	    if (filename_converter_need_repair(ent->d_name)) {
+		g_mutex_lock(&index->lock);
+		name_index_add_broken(index, path);
+		g_mutex_unlock(&index->lock);
+	    }
+
+	    if (is_directory(d, ent)) {
+		g_queue_push_tail(&queue, path);
+	    } else {
+		g_free(path);
+	    }
+	}
+	closedir(d);
+	g_free(dir);
+    }
+}
+
+static gpointer
+name_index_walk_thread(NameIndex* index)
+{
+    NameIndexWalk* walk;
+
+    // A walk without a path is the request to quit from name_index_free().
+    while ((walk = g_async_queue_pop(index->walks))->path != NULL) {
+	name_index_walk(index, walk->path);
+
+	if (walk->is_root) {
+	    NameIndexRoot* root;
+
+	    g_mutex_lock(&index->lock);
+	    root = name_index_find_root(index, walk->path);
+	    if (root != NULL && strcmp(root->path, walk->path) == 0)
+		root->ready = !index->closing;
+	    g_mutex_unlock(&index->lock);
+	}
+
+	g_free(walk->path);
+	g_free(walk);
+    }
+    g_free(walk);
+
+    return NULL;
+}
+
+static void
+name_index_walk_async(NameIndex* index, const char* path, gboolean is_root)
+{
+    NameIndexWalk* walk;
+
+    walk = g_new(NameIndexWalk, 1);
+    walk->path = g_strdup(path);
+    walk->is_root = is_root;
+    g_async_queue_push(index->walks, walk);
+}
+
+/* the caller must hold the lock */
+static void
+name_index_rescan(NameIndex* index)
+{
+    GList* item;
+
+    g_sequence_remove_range(g_sequence_get_begin_iter(index->broken),
+	    g_sequence_get_end_iter(index->broken));
+
+    for (item = index->roots->head; item != NULL; item = item->next) {
+	NameIndexRoot* root = item->data;
+
+	root->ready = FALSE;
+	name_index_walk_async(index, root->path, TRUE);
+    }
+}
+
+static void
+name_index_on_entry_added(NameIndex* index, const char* dir,
+	const char* name, gboolean is_dir)
+{
+    char* path;
+
+    path = g_build_filename(dir, name, NULL);
+    if (filename_converter_need_repair(name))
+	name_index_add_broken(index, path);
+
+    if (is_dir) {
+	// A directory moved into a watched tree comes with its contents.
+	name_index_walk_async(index, path, FALSE);
+    }
+    g_free(path);
+}
+
+static void
+name_index_on_entry_removed(NameIndex* index, const char* dir, const char* name)
+{
+    char* path;
+
+    path = g_build_filename(dir, name, NULL);
+    name_index_remove_subtree(index, path);
+    g_free(path);
+}
+
+static void
+name_index_read_inotify(NameIndex* index)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event* event;
+    ssize_t len;
+    char* p;
+
+    while ((len = read(index->fd, buf, sizeof(buf))) > 0) {
+	for (p = buf; p < buf + len; p += sizeof(*event) + event->len) {
+	    GSequenceIter* iter;
+	    const char* dir;
+
+	    event = (const struct inotify_event*)p;
+
+	    if (event->mask & IN_Q_OVERFLOW) {
+		name_index_rescan(index);
+		continue;
+	    }
+
+	    iter = g_hash_table_lookup(index->wd_table,
+		    GINT_TO_POINTER(event->wd));
+	    if (iter == NULL)
+		continue;
+
+	    if (event->mask & IN_IGNORED) {
+		// the directory is gone, and its watch with it
+		g_hash_table_remove(index->wd_table, GINT_TO_POINTER(event->wd));
+		g_sequence_remove(iter);
+		index->n_dirs--;
+		continue;
+	    }
+
+	    dir = ((NameIndexDir*)g_sequence_get(iter))->path;
+	    if (event->len == 0)
+		continue;
+
+	    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		name_index_on_entry_removed(index, dir, event->name);
+	    } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+		name_index_on_entry_added(index, dir, event->name,
+			(event->mask & IN_ISDIR) != 0);
+	    }
+	}
+    }
+}
+
+#if HAVE_FANOTIFY_DFID_NAME
+static char*
+name_index_resolve_handle(NameIndex* index, struct file_handle* handle)
+{
+    GList* item;
+
+    for (item = index->roots->head; item != NULL; item = item->next) {
+	NameIndexRoot* root = item->data;
+	char proc_path[64];
+	char* path;
+	int fd;
+
+	fd = open_by_handle_at(root->mount_fd, handle, O_PATH);
+	if (fd < 0)
+	    continue;
+
+	g_snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+	path = g_file_read_link(proc_path, NULL);
+	close(fd);
+
+	if (path != NULL)
+	    return path;
+    }
+
+    return NULL;
+}
+
+static void
+name_index_read_fanotify(NameIndex* index)
+{
+    char buf[8192] __attribute__ ((aligned(__alignof__(struct fanotify_event_metadata))));
+    struct fanotify_event_metadata* metadata;
+    ssize_t len;
+
+    while ((len = read(index->fd, buf, sizeof(buf))) > 0) {
+	metadata = (struct fanotify_event_metadata*)buf;
+	for (; FAN_EVENT_OK(metadata, len); metadata = FAN_EVENT_NEXT(metadata, len)) {
+	    struct fanotify_event_info_fid* fid;
+	    struct file_handle* handle;
+	    const char* name;
+	    char* dir;
+
+	    if (metadata->vers != FANOTIFY_METADATA_VERSION)
+		return;
+
+	    if (metadata->mask & FAN_Q_OVERFLOW) {
+		name_index_rescan(index);
+		continue;
+	    }
+
+	    fid = (struct fanotify_event_info_fid*)(metadata + 1);
+	    if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+		continue;
+
+	    handle = (struct file_handle*)fid->handle;
+	    name = (const char*)(handle->f_handle + handle->handle_bytes);
+
+	    dir = name_index_resolve_handle(index, handle);
+	    if (dir == NULL)
+		continue;
+
+	    if (name_index_find_root(index, dir) != NULL) {
+		if (metadata->mask & (FAN_DELETE | FAN_MOVED_FROM)) {
+		    name_index_on_entry_removed(index, dir, name);
+		} else if (metadata->mask & (FAN_CREATE | FAN_MOVED_TO)) {
+		    name_index_on_entry_added(index, dir, name,
+			    (metadata->mask & FAN_ONDIR) != 0);
+		}
+	    }
+	    g_free(dir);
+	}
+    }
+}
+#endif
+
+static gboolean
+name_index_on_event(GIOChannel* channel, GIOCondition condition, NameIndex* index)
+{
+    g_mutex_lock(&index->lock);
+#if HAVE_FANOTIFY_DFID_NAME
+    if (index->use_fanotify)
+	name_index_read_fanotify(index);
+    else
+#endif
+	name_index_read_inotify(index);
+    g_mutex_unlock(&index->lock);
+
+    return TRUE;
+}
+
+NameIndex*
+name_index_new(void)
+{
+    NameIndex* index;
+    GIOChannel* channel;
+
+    index = g_new0(NameIndex, 1);
+    g_mutex_init(&index->lock);
+    index->broken = g_sequence_new(g_free);
+    index->dirs = g_sequence_new((GDestroyNotify)name_index_dir_free);
+    index->max_dirs = name_index_get_max_dirs();
+    index->roots = g_queue_new();
+    index->failed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    index->wd_table = g_hash_table_new(NULL, NULL);
+    index->walks = g_async_queue_new();
+
+    index->fd = -1;
+#if HAVE_FANOTIFY_DFID_NAME
+    // Resolving the file handles of the events needs privileges, and so
+    // does a mark on a whole filesystem, so one on / tells whether we
+    // have them.  It is taken back at once: the marks are put on the
+    // directories, like the inotify watches.  Newer kernels let anyone
+    // init fanotify and only refuse the mark, and then we use inotify.
+    index->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK |
+	    FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+    if (index->fd >= 0) {
+	if (fanotify_mark(index->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+		    FANOTIFY_MASK, AT_FDCWD, "/") == 0) {
+	    fanotify_mark(index->fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM,
+		    FANOTIFY_MASK, AT_FDCWD, "/");
+	    index->use_fanotify = TRUE;
+	} else {
+	    close(index->fd);
+	    index->fd = -1;
+	}
+    }
+#endif
+    if (index->fd < 0)
+	index->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (index->fd >= 0) {
+	channel = g_io_channel_unix_new(index->fd);
+	index->watch_id = g_io_add_watch(channel, G_IO_IN,
+		(GIOFunc)name_index_on_event, index);
+	g_io_channel_unref(channel);
+
+	index->walker = g_thread_new("name-index",
+		(GThreadFunc)name_index_walk_thread, index);
+    }
+
+    return index;
+}
+
+void
+name_index_free(NameIndex* index)
+{
+    NameIndexRoot* root;
+
+    if (index == NULL)
+	return;
+
+    if (index->walker != NULL) {
+	// Pending walks return at once when closing is set.
+	g_mutex_lock(&index->lock);
+	index->closing = TRUE;
+	g_mutex_unlock(&index->lock);
+	g_async_queue_push(index->walks, g_new0(NameIndexWalk, 1));
+	g_thread_join(index->walker);
+    }
+
+    if (index->watch_id != 0)
+	g_source_remove(index->watch_id);
+    if (index->fd >= 0)
+	close(index->fd);
+
+    while ((root = g_queue_pop_head(index->roots)) != NULL) {
+	if (root->mount_fd >= 0)
+	    close(root->mount_fd);
+	g_free(root->path);
+	g_free(root);
+    }
+    g_queue_free(index->roots);
+
+    g_sequence_free(index->broken);
+    g_sequence_free(index->dirs);
+    g_hash_table_destroy(index->failed);
+    g_hash_table_destroy(index->wd_table);
+    g_async_queue_unref(index->walks);
+    g_mutex_clear(&index->lock);
+    g_free(index);
+}
+
+/*
+ * The roots below the new one are dropped, as it covers them, and the
+ * one asked about the longest ago makes room when there are too many.
+ * A root which cannot be watched is remembered, so it is not tried again
+ * every time it is asked about.
+ */
+void
+name_index_add_root(NameIndex* index, const char* path)
+{
+    NameIndexRoot* root;
+    GList* item;
+    int mount_fd = -1;
+
+    if (index->fd < 0)
+	return;
+
+    g_mutex_lock(&index->lock);
+    if (g_hash_table_contains(index->failed, path) ||
+	name_index_find_root(index, path) != NULL) {
+	g_mutex_unlock(&index->lock);
+	return;
+    }
+
+#if HAVE_FANOTIFY_DFID_NAME
+    if (index->use_fanotify) {
+	mount_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (mount_fd < 0) {
+	    name_index_add_failed(index, path);
+	    g_mutex_unlock(&index->lock);
+	    return;
+	}
+    }
+#endif
+
+    item = index->roots->head;
+    while (item != NULL) {
+	GList* next = item->next;
+
+	root = item->data;
+	if (is_under(root->path, path))
+	    name_index_drop_root(index, root, FALSE);
+	item = next;
+    }
+
+    if (g_queue_get_length(index->roots) >= NAME_INDEX_MAX_ROOTS)
+	name_index_drop_root(index, g_queue_peek_tail(index->roots), FALSE);
+
+    root = g_new(NameIndexRoot, 1);
+    root->path = g_strdup(path);
+    root->ready = FALSE;
+    root->mount_fd = mount_fd;
+    g_queue_push_head(index->roots, root);
+    g_mutex_unlock(&index->lock);
+
+    name_index_walk_async(index, path, TRUE);
+}
+
+/*
+ * Whether the first walk of a root above the path is done.  That root is
+ * the last asked about then.
+ */
+gboolean
+name_index_covers(NameIndex* index, const char* path)
+{
+    NameIndexRoot* root;
+    gboolean res;
+
+    g_mutex_lock(&index->lock);
+    root = name_index_find_root(index, path);
+    res = root != NULL && root->ready;
+    if (root != NULL) {
+	g_queue_remove(index->roots, root);
+	g_queue_push_head(index->roots, root);
+    }
+    g_mutex_unlock(&index->lock);
+
+    return res;
+}
+
+/*
+ * Returns the directories at or below dir which have broken entries, at
+ * most max of them, or NULL when there is none.
+ */
+char**
+name_index_get_broken_dirs(NameIndex* index, const char* dir, guint max)
+{
+    GPtrArray* dirs;
+    GHashTable* seen;
+    GSequenceIter* iter;
+
+    dirs = g_ptr_array_new();
+    seen = g_hash_table_new(g_str_hash, g_str_equal);
+
+    g_mutex_lock(&index->lock);
+    iter = name_index_search(index->broken, (gpointer)dir,
+	    name_index_compare_broken);
+    for (; !g_sequence_iter_is_end(iter) && dirs->len < max;
+	 iter = g_sequence_iter_next(iter)) {
+	const char* path = g_sequence_get(iter);
+	char* parent;
+
+	if (!is_under(path, dir))
+	    break;
+	if (strcmp(path, dir) == 0)
+	    continue;
+
+	parent = g_path_get_dirname(path);
+	if (g_hash_table_contains(seen, parent)) {
+	    g_free(parent);
+	    continue;
+	}
+	g_hash_table_add(seen, parent);
+	g_ptr_array_add(dirs, parent);
+    }
+    g_mutex_unlock(&index->lock);
+
+    g_hash_table_destroy(seen);
+
+    if (dirs->len == 0) {
+	g_ptr_array_free(dirs, TRUE);
+	return NULL;
+    }
+
+    g_ptr_array_add(dirs, NULL);
+    return (char**)g_ptr_array_free(dirs, FALSE);
+}
@@ -0,0 +1,38 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_name_index_h
+#define nautilus_filename_repairer_name_index_h
+
+#include <glib.h>
+
+typedef struct _NameIndex NameIndex;
+
+NameIndex* name_index_new(void);
+void       name_index_free(NameIndex* index);
+
+void       name_index_add_root(NameIndex* index, const char* path);
+gboolean   name_index_covers(NameIndex* index, const char* path);
+char**     name_index_get_broken_dirs(NameIndex* index, const char* dir,
+		guint max);
+
+#endif /* nautilus_filename_repairer_name_index_h */
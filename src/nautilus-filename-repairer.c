@@ -37,8 +37,19 @@
 #include "nautilus-filename-repairer.h"
 #include "nautilus-filename-repairer-i18n.h"
 
+#ifdef ENABLE_NAME_INDEX
+#include "name-index.h"
+#endif
+
 static GType filename_repairer_type = 0;
 
+#ifdef ENABLE_NAME_INDEX
+// the directories given to the dialog, to keep its command line short
+#define MAX_BROKEN_DIR_ARGS 64
+
+static NameIndex* name_index = NULL;
+#endif
+
 // from http://www.microsoft.com/globaldev/reference/wincp.mspx
 // Code Pages Supported by Windows
 static const char* encoding_list[] = {
@@ -175,19 +186,28 @@ static void
 on_repair_dialog_activated(NautilusMenuItem* item, gpointer data)
 {
     GList* files;
-    guint i;
-    guint n;
+    gchar** broken_dirs;
+    guint i, j;
+    guint n, m;
     gchar** argv;
     GError *error = NULL;
 
     files = (GList*)g_object_get_data(G_OBJECT(item), "Repairer::files");
+    broken_dirs = (gchar**)g_object_get_data(G_OBJECT(item),
+	    "Repairer::broken_dirs");
 
     n = g_list_length(files);
-    argv = g_new(gchar*, n + 2);
+    m = broken_dirs != NULL ? g_strv_length(broken_dirs) : 0;
+    argv = g_new(gchar*, n + 2 * m + 2);
 
     argv[0] = g_strdup("nautilus-filename-repairer");
 
     i = 1;
+    for (j = 0; j < m; j++) {
+	argv[i++] = g_strdup("--broken-dir");
+	argv[i++] = g_strdup(broken_dirs[j]);
+    }
+
     while (files != NULL) {
 	GFile* file;
 
@@ -205,7 +225,7 @@ on_repair_dialog_activated(NautilusMenuItem* item, gpointer data)
 }
 
 static NautilusMenuItem*
-repair_dialog_menu_item_new(GList* files)
+repair_dialog_menu_item_new(GList* files, char** broken_dirs)
 {
     const char* name;
     const char* label;
@@ -215,12 +235,16 @@ repair_dialog_menu_item_new(GList* files)
     name    = "Repairer::manual_rename";
     label   = _("Repair filename ...");
     tooltip = _("Repair filename");
+    if (broken_dirs != NULL)
+	tooltip = _("Some filenames in this folder need to be repaired");
 
     files = nautilus_file_info_list_copy(files);
 
     item = nautilus_menu_item_new(name, label, tooltip, NULL);
     g_object_set_data_full(G_OBJECT(item), "Repairer::files",
 	    files, (GDestroyNotify) nautilus_file_info_list_free);
+    g_object_set_data_full(G_OBJECT(item), "Repairer::broken_dirs",
+	    broken_dirs, (GDestroyNotify) g_strfreev);
 
     g_signal_connect(G_OBJECT(item), "activate",
 		     G_CALLBACK(on_repair_dialog_activated), NULL);
@@ -473,6 +497,46 @@ append_repair_menu_items(GList* menu, GtkWidget *window, GList *files)
     return menu;
 }
 
+/*
+ * The index knows the names which are not valid UTF-8, have escapes or
+ * are not in NFC, but not the ones which are valid UTF-8 in the wrong
+ * encoding.  So it can tell that a directory has broken names, never
+ * that it has none.  The directories which have them are given to the
+ * dialog, which loads them first.
+ */
+static char**
+get_broken_dirs(NautilusFileInfo* file_info)
+{
+#ifdef ENABLE_NAME_INDEX
+    GFile* file;
+    char* path;
+    char** res;
+
+    if (name_index == NULL)
+	return NULL;
+
+    file = nautilus_file_info_get_location(file_info);
+    path = g_file_get_path(file);
+    g_object_unref(file);
+    if (path == NULL)
+	return NULL;
+
+    // Until the first walk of the directory is done, we don't know.
+    res = NULL;
+    if (name_index_covers(name_index, path)) {
+	res = name_index_get_broken_dirs(name_index, path,
+		MAX_BROKEN_DIR_ARGS);
+    } else {
+	name_index_add_root(name_index, path);
+    }
+    g_free(path);
+
+    return res;
+#else
+    return NULL;
+#endif
+}
+
 static gboolean
 need_repair_dialog(GList* files)
 {
@@ -502,12 +566,17 @@ nautilus_filename_repairer_get_file_items(NautilusMenuProvider *provider,
 {
     NautilusMenuItem* item;
     GList* menu;
+    char** broken_dirs;
 
     menu = NULL;
     menu = append_repair_menu_items(menu, window, files);
 
     if (need_repair_dialog(files)) {
-	item = repair_dialog_menu_item_new(files);
+	broken_dirs = NULL;
+	if (files != NULL && files->next == NULL &&
+	    nautilus_file_info_is_directory(files->data))
+	    broken_dirs = get_broken_dirs(files->data);
+	item = repair_dialog_menu_item_new(files, broken_dirs);
 	menu = g_list_append(menu, item);
     }
 
@@ -570,8 +639,15 @@ nautilus_filename_repairer_register_type(GTypeModule *module)
 
 void  nautilus_filename_repairer_on_module_init(void)
 {
+#ifdef ENABLE_NAME_INDEX
+    name_index = name_index_new();
+#endif
 }
 
 void  nautilus_filename_repairer_on_module_shutdown(void)
 {
+#ifdef ENABLE_NAME_INDEX
+    name_index_free(name_index);
+    name_index = NULL;
+#endif
 }
@@ -0,0 +1,360 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "rename-dir-index.h"
+
+#ifndef NAME_MAX
+#define NAME_MAX 255
+#endif
+
+/*
+ * The names one directory will have after the renames, to find the
+ * renames which cannot be done before any is.  Every entry of the
+ * directory is added, with its new name when it is to be renamed, and
+ * the index keeps which entry ends up with each name.
+ *
+ * When two entries would end up with the same name, one of them keeps
+ * its old name instead: the one which is renamed, or the later one when
+ * both are.  That old name is then claimed again, which may take it from
+ * a rename added before, and so on; an entry which keeps its name never
+ * loses it, since the names in a directory are all different, so this
+ * ends.  A new name longer than NAME_MAX bytes, which the UTF-8 of a
+ * legacy encoded name can easily be, is not done either.
+ *
+ * The renames which are left are not checked against each other's old
+ * names: A to B and B to C are both fine, as long as they are done in
+ * the right order, which rename_dir_index_foreach_move() finds.
+ */
+typedef struct _RenameDirEntry {
+    guint32 id;
+    const char* name;
+    const char* new_name;       /* NULL when it keeps its name */
+    RenameDirIndexProblem problem;
+} RenameDirEntry;
+
+struct _RenameDirIndex {
+    GStringChunk* names;
+    GArray* entries;
+    GHashTable* owners;         /* name -> entry number + 1 */
+    guint n_renames;            /* entries with a new name and no problem */
+};
+
+RenameDirIndex*
+rename_dir_index_new(void)
+{
+    RenameDirIndex* index;
+
+    index = g_new(RenameDirIndex, 1);
+    index->names = g_string_chunk_new(4096);
+    index->entries = g_array_new(FALSE, FALSE, sizeof(RenameDirEntry));
+    index->owners = g_hash_table_new(g_str_hash, g_str_equal);
+    index->n_renames = 0;
+
+    return index;
+}
+
+void
+rename_dir_index_free(RenameDirIndex* index)
+{
+    g_string_chunk_free(index->names);
+    g_array_free(index->entries, TRUE);
+    g_hash_table_destroy(index->owners);
+    g_free(index);
+}
+
+/*
+ * Makes it ready for the next directory.
+ */
+void
+rename_dir_index_clear(RenameDirIndex* index)
+{
+    g_string_chunk_clear(index->names);
+    g_array_set_size(index->entries, 0);
+    g_hash_table_remove_all(index->owners);
+    index->n_renames = 0;
+}
+
+static RenameDirEntry*
+rename_dir_index_entry(RenameDirIndex* index, guint i)
+{
+    return &g_array_index(index->entries, RenameDirEntry, i);
+}
+
+static const char*
+rename_dir_entry_final_name(RenameDirEntry* entry)
+{
+    if (entry->new_name != NULL && entry->problem == RENAME_DIR_INDEX_OK)
+	return entry->new_name;
+    return entry->name;
+}
+
+static void
+rename_dir_index_claim(RenameDirIndex* index, guint i)
+{
+    RenameDirEntry* entry;
+    RenameDirEntry* owner;
+    const char* name;
+    gpointer value;
+    guint loser;
+
+    entry = rename_dir_index_entry(index, i);
+    name = rename_dir_entry_final_name(entry);
+    value = g_hash_table_lookup(index->owners, name);
+    if (value == NULL) {
+	g_hash_table_insert(index->owners, (gpointer)name,
+		GUINT_TO_POINTER(i + 1));
+	return;
+    }
+
+    owner = rename_dir_index_entry(index, GPOINTER_TO_UINT(value) - 1);
+    if (name == entry->name) {
+	// Two entries with one name don't happen in a directory.
+	if (rename_dir_entry_final_name(owner) == owner->name)
+	    return;
+
+	// The owner is renamed, and gives the name back.
+	loser = GPOINTER_TO_UINT(value) - 1;
+	g_hash_table_insert(index->owners, (gpointer)name,
+		GUINT_TO_POINTER(i + 1));
+    } else {
+	loser = i;
+    }
+
+    rename_dir_index_entry(index, loser)->problem = RENAME_DIR_INDEX_COLLISION;
+    index->n_renames--;
+    rename_dir_index_claim(index, loser);
+}
+
+/*
+ * Adds an entry of the directory.  The id is for the caller, to tell the
+ * entries apart in rename_dir_index_foreach().
+ */
+void
+rename_dir_index_add(RenameDirIndex* index, guint32 id,
+	const char* name, const char* new_name)
+{
+    RenameDirEntry entry;
+
+    entry.id = id;
+    entry.name = g_string_chunk_insert(index->names, name);
+    entry.new_name = NULL;
+    entry.problem = RENAME_DIR_INDEX_OK;
+    if (new_name != NULL && strcmp(name, new_name) != 0) {
+	entry.new_name = g_string_chunk_insert(index->names, new_name);
+	if (strlen(new_name) > NAME_MAX)
+	    entry.problem = RENAME_DIR_INDEX_TOO_LONG;
+	else
+	    index->n_renames++;
+    }
+
+    g_array_append_val(index->entries, entry);
+    rename_dir_index_claim(index, index->entries->len - 1);
+}
+
+/*
+ * The renames which can be done.
+ */
+guint
+rename_dir_index_get_n_renames(RenameDirIndex* index)
+{
+    return index->n_renames;
+}
+
+/*
+ * Calls func for every entry with a new name, in the order they were
+ * added, and tells whether it can be renamed.
+ */
+void
+rename_dir_index_foreach(RenameDirIndex* index, RenameDirIndexFunc func,
+	gpointer data)
+{
+    guint i;
+
+    for (i = 0; i < index->entries->len; i++) {
+	RenameDirEntry* entry = rename_dir_index_entry(index, i);
+
+	if (entry->new_name != NULL)
+	    func(entry->id, entry->name, entry->new_name, entry->problem, data);
+    }
+}
+
+static gboolean
+rename_dir_entry_is_move(RenameDirEntry* entry)
+{
+    return entry->new_name != NULL && entry->problem == RENAME_DIR_INDEX_OK;
+}
+
+/*
+ * A name which no entry has before or after the renames.
+ */
+static const char*
+rename_dir_index_temp_name(RenameDirIndex* index, GHashTable* old_names,
+	guint* counter)
+{
+    char name[32];
+
+    do {
+	g_snprintf(name, sizeof(name), ".filename-repairer-%u", (*counter)++);
+    } while (g_hash_table_contains(old_names, name) ||
+	     g_hash_table_contains(index->owners, name));
+
+    return g_string_chunk_insert(index->names, name);
+}
+
+enum {
+    RENAME_DIR_MOVE_TODO,
+    RENAME_DIR_MOVE_ON_PATH,
+    RENAME_DIR_MOVE_DONE
+};
+
+/*
+ * Calls func for the renames which can be done, in an order in which no
+ * rename takes a name that is still there.  A rename waits for the entry
+ * which has its new name, and that one for the entry which has its new
+ * name, and so on.  Since no two renames end up with the same name, an
+ * entry waits for at most one other, and at most one waits for it, so
+ * the renames make chains and cycles, and nothing else.  A chain is done
+ * from its end.  A cycle is opened by renaming one of its entries to a
+ * temporary name first and to its new name last; func sees both steps.
+ *
+ * The steps of one directory only depend on each other through their
+ * names, so the directories can still be done at the same time.
+ */
+void
+rename_dir_index_foreach_move(RenameDirIndex* index,
+	RenameDirIndexMoveFunc func, gpointer data)
+{
+    GHashTable* old_names;      /* name -> entry number + 1 */
+    GArray* path;
+    guint8* states;
+    guint counter;
+    guint i, n;
+
+    old_names = g_hash_table_new(g_str_hash, g_str_equal);
+    for (i = 0; i < index->entries->len; i++) {
+	g_hash_table_insert(old_names,
+		(gpointer)rename_dir_index_entry(index, i)->name,
+		GUINT_TO_POINTER(i + 1));
+    }
+
+    states = g_new0(guint8, index->entries->len);
+    path = g_array_new(FALSE, FALSE, sizeof(guint));
+    counter = 0;
+
+    for (i = 0; i < index->entries->len; i++) {
+	RenameDirEntry* entry;
+	gboolean cycle;
+	guint j;
+
+	entry = rename_dir_index_entry(index, i);
+	if (!rename_dir_entry_is_move(entry) || states[i] != RENAME_DIR_MOVE_TODO)
+	    continue;
+
+	// Follow what each rename waits for.
+	g_array_set_size(path, 0);
+	cycle = FALSE;
+	j = i;
+	for (;;) {
+	    gpointer value;
+	    guint k;
+
+	    states[j] = RENAME_DIR_MOVE_ON_PATH;
+	    g_array_append_val(path, j);
+
+	    value = g_hash_table_lookup(old_names,
+		    rename_dir_index_entry(index, j)->new_name);
+	    if (value == NULL)
+		break;
+
+	    k = GPOINTER_TO_UINT(value) - 1;
+	    if (!rename_dir_entry_is_move(rename_dir_index_entry(index, k)) ||
+		states[k] == RENAME_DIR_MOVE_DONE)
+		break;
+	    if (states[k] == RENAME_DIR_MOVE_ON_PATH) {
+		// Only the start of the path can be waited for twice.
+		cycle = TRUE;
+		break;
+	    }
+	    j = k;
+	}
+
+	if (cycle) {
+	    const char* temp_name;
+
+	    temp_name = rename_dir_index_temp_name(index, old_names, &counter);
+	    func(entry->id, entry->name, temp_name, data);
+	    for (n = path->len - 1; n > 0; n--) {
+		RenameDirEntry* other = rename_dir_index_entry(index,
+			g_array_index(path, guint, n));
+		func(other->id, other->name, other->new_name, data);
+	    }
+	    func(entry->id, temp_name, entry->new_name, data);
+	} else {
+	    for (n = path->len; n-- > 0; ) {
+		RenameDirEntry* other = rename_dir_index_entry(index,
+			g_array_index(path, guint, n));
+		func(other->id, other->name, other->new_name, data);
+	    }
+	}
+
+	for (n = 0; n < path->len; n++)
+	    states[g_array_index(path, guint, n)] = RENAME_DIR_MOVE_DONE;
+    }
+
+    g_array_free(path, TRUE);
+    g_free(states);
+    g_hash_table_destroy(old_names);
+}
+
+/*
+ * The error the rename would have failed with, for the error logs.
+ */
+void
+rename_dir_index_set_error(RenameDirIndexProblem problem, GError** error)
+{
+    int errsv;
+
+    switch (problem) {
+    case RENAME_DIR_INDEX_COLLISION:
+	errsv = EEXIST;
+	break;
+    case RENAME_DIR_INDEX_TOO_LONG:
+	errsv = ENAMETOOLONG;
+	break;
+    default:
+	return;
+    }
+
+    g_set_error_literal(error, G_IO_ERROR, g_io_error_from_errno(errsv),
+	    g_strerror(errsv));
+}
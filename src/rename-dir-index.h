@@ -0,0 +1,61 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_rename_dir_index_h
+#define nautilus_filename_repairer_rename_dir_index_h
+
+#include <glib.h>
+
+typedef enum {
+    RENAME_DIR_INDEX_OK,
+    RENAME_DIR_INDEX_COLLISION,    /* another entry ends up with the name */
+    RENAME_DIR_INDEX_TOO_LONG      /* more bytes than a name may have */
+} RenameDirIndexProblem;
+
+typedef struct _RenameDirIndex RenameDirIndex;
+
+/* new_name is NULL for the entries which keep their names */
+typedef void (*RenameDirIndexFunc)(guint32 id, const char* name,
+				   const char* new_name,
+				   RenameDirIndexProblem problem,
+				   gpointer data);
+typedef void (*RenameDirIndexMoveFunc)(guint32 id, const char* name,
+				       const char* new_name, gpointer data);
+
+RenameDirIndex* rename_dir_index_new(void);
+void            rename_dir_index_free(RenameDirIndex* index);
+void            rename_dir_index_clear(RenameDirIndex* index);
+
+void            rename_dir_index_add(RenameDirIndex* index, guint32 id,
+				     const char* name, const char* new_name);
+guint           rename_dir_index_get_n_renames(RenameDirIndex* index);
+void            rename_dir_index_foreach(RenameDirIndex* index,
+					 RenameDirIndexFunc func,
+					 gpointer data);
+void            rename_dir_index_foreach_move(RenameDirIndex* index,
+					      RenameDirIndexMoveFunc func,
+					      gpointer data);
+
+void            rename_dir_index_set_error(RenameDirIndexProblem problem,
+					   GError** error);
+
+#endif // nautilus_filename_repairer_rename_dir_index_h
@@ -0,0 +1,296 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "rename-engine.h"
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+/*
+ * Renames entries relative to an open descriptor of their directory, so
+ * the kernel never walks the path from the root again, however deep the
+ * directory is.  The descriptors of the directories from the root down to
+ * the current one are kept on a stack: rename_engine_enter() opens a
+ * child of the current directory and rename_engine_leave() closes it, so
+ * a directory is renamed after its contents, when it has been left.
+ *
+ * A rename never replaces an existing entry.  renameat2() with
+ * RENAME_NOREPLACE checks and renames in one step.  Where the kernel or
+ * the file system doesn't support it, the check is done with fstatat()
+ * before renameat(), which leaves the race that the flag closes.  A file
+ * system which doesn't know the flag is remembered by its device, so the
+ * others still get it.
+ */
+typedef struct _RenameEngineDir {
+    int fd;
+    int open_errno;     /* why fd is -1 */
+} RenameEngineDir;
+
+struct _RenameEngine {
+    GArray* dirs;
+};
+
+// set once renameat2() turned out not to be in the kernel
+static gint no_renameat2 = FALSE;
+
+// the devices whose file systems don't know RENAME_NOREPLACE
+G_LOCK_DEFINE_STATIC(no_noreplace);
+static GHashTable* no_noreplace_devs = NULL;
+static gint n_no_noreplace_devs = 0;
+
+RenameEngine*
+rename_engine_new(void)
+{
+    RenameEngine* engine;
+
+    engine = g_new(RenameEngine, 1);
+    engine->dirs = g_array_new(FALSE, FALSE, sizeof(RenameEngineDir));
+
+    return engine;
+}
+
+void
+rename_engine_free(RenameEngine* engine)
+{
+    rename_engine_close(engine);
+    g_array_free(engine->dirs, TRUE);
+    g_free(engine);
+}
+
+static void
+set_error_from_errno(GError** error, int errsv)
+{
+    g_set_error_literal(error, G_IO_ERROR, g_io_error_from_errno(errsv),
+	    g_strerror(errsv));
+}
+
+static void
+rename_engine_push(RenameEngine* engine, int fd, int errsv)
+{
+    RenameEngineDir dir;
+
+    dir.fd = fd;
+    dir.open_errno = fd < 0 ? errsv : 0;
+    g_array_append_val(engine->dirs, dir);
+}
+
+static RenameEngineDir*
+rename_engine_top(RenameEngine* engine)
+{
+    return &g_array_index(engine->dirs, RenameEngineDir, engine->dirs->len - 1);
+}
+
+/*
+ * Starts over at the directory path, with no directory entered.  Like
+ * with rename_engine_enter(), a failure still leaves the directory open
+ * for the renames to fail in.
+ */
+gboolean
+rename_engine_open(RenameEngine* engine, const char* path, GError** error)
+{
+    int fd;
+
+    rename_engine_close(engine);
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    rename_engine_push(engine, fd, errno);
+    if (fd < 0) {
+	set_error_from_errno(error, errno);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+rename_engine_close(RenameEngine* engine)
+{
+    while (engine->dirs->len > 0)
+	rename_engine_leave(engine);
+}
+
+/*
+ * A directory which cannot be opened is still entered, so that enter and
+ * leave stay paired; the renames in it fail with the reason.
+ */
+void
+rename_engine_enter(RenameEngine* engine, const char* name)
+{
+    RenameEngineDir* top;
+    int fd;
+
+    top = rename_engine_top(engine);
+    if (top->fd < 0) {
+	rename_engine_push(engine, -1, top->open_errno);
+	return;
+    }
+
+    fd = openat(top->fd, name,
+	    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    rename_engine_push(engine, fd, errno);
+}
+
+void
+rename_engine_leave(RenameEngine* engine)
+{
+    RenameEngineDir* top;
+
+    top = rename_engine_top(engine);
+    if (top->fd >= 0)
+	close(top->fd);
+    g_array_set_size(engine->dirs, engine->dirs->len - 1);
+}
+
+static void
+rename_engine_set_no_noreplace(int fd)
+{
+    struct stat st;
+    gint64* dev;
+
+    if (fstat(fd, &st) != 0)
+	return;
+
+    dev = g_new(gint64, 1);
+    *dev = st.st_dev;
+    G_LOCK(no_noreplace);
+    if (no_noreplace_devs == NULL)
+	no_noreplace_devs = g_hash_table_new_full(g_int64_hash,
+		g_int64_equal, g_free, NULL);
+    g_hash_table_add(no_noreplace_devs, dev);
+    g_atomic_int_set(&n_no_noreplace_devs,
+	    g_hash_table_size(no_noreplace_devs));
+    G_UNLOCK(no_noreplace);
+}
+
+/*
+ * Whether a rename in the directory fd can be done with
+ * RENAME_NOREPLACE, as far as is known yet.  Costs an fstat() only once
+ * some file system turned out not to know it.
+ */
+gboolean
+rename_engine_has_noreplace(int fd)
+{
+    struct stat st;
+    gint64 dev;
+    gboolean res;
+
+    if (g_atomic_int_get(&no_renameat2))
+	return FALSE;
+    if (g_atomic_int_get(&n_no_noreplace_devs) == 0)
+	return TRUE;
+    if (fstat(fd, &st) != 0)
+	return TRUE;
+
+    dev = st.st_dev;
+    G_LOCK(no_noreplace);
+    res = !g_hash_table_contains(no_noreplace_devs, &dev);
+    G_UNLOCK(no_noreplace);
+
+    return res;
+}
+
+static int
+rename_noreplace(int fd, const char* name, const char* new_name)
+{
+    struct stat st;
+    int res;
+
+    if (rename_engine_has_noreplace(fd)) {
+#if HAVE_RENAMEAT2
+	res = renameat2(fd, name, fd, new_name, RENAME_NOREPLACE);
+#elif defined(SYS_renameat2)
+	res = syscall(SYS_renameat2, fd, name, fd, new_name, RENAME_NOREPLACE);
+#else
+	res = -1;
+	errno = ENOSYS;
+#endif
+	if (res == 0 || (errno != ENOSYS && errno != EINVAL))
+	    return res;
+
+	// EINVAL is a file system which doesn't know the flag.
+	if (errno == ENOSYS)
+	    g_atomic_int_set(&no_renameat2, TRUE);
+	else
+	    rename_engine_set_no_noreplace(fd);
+    }
+
+    if (fstatat(fd, new_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+	errno = EEXIST;
+	return -1;
+    }
+    if (errno != ENOENT)
+	return -1;
+
+    return renameat(fd, name, fd, new_name);
+}
+
+/*
+ * Renames name to new_name in the directory fd, without the stack, for
+ * callers which keep their own descriptors.  It may be called from any
+ * thread.
+ */
+gboolean
+rename_engine_rename_at(int fd, const char* name, const char* new_name,
+	GError** error)
+{
+    if (rename_noreplace(fd, name, new_name) < 0) {
+	set_error_from_errno(error, errno);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Renames name to new_name in the current directory.
+ */
+gboolean
+rename_engine_rename(RenameEngine* engine, const char* name,
+	const char* new_name, GError** error)
+{
+    RenameEngineDir* top;
+
+    top = rename_engine_top(engine);
+    if (top->fd < 0) {
+	set_error_from_errno(error, top->open_errno);
+	return FALSE;
+    }
+
+    return rename_engine_rename_at(top->fd, name, new_name, error);
+}
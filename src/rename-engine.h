@@ -0,0 +1,44 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_rename_engine_h
+#define nautilus_filename_repairer_rename_engine_h
+
+#include <glib.h>
+
+typedef struct _RenameEngine RenameEngine;
+
+RenameEngine* rename_engine_new(void);
+void          rename_engine_free(RenameEngine* engine);
+
+gboolean      rename_engine_open(RenameEngine* engine, const char* path,
+				 GError** error);
+void          rename_engine_close(RenameEngine* engine);
+void          rename_engine_enter(RenameEngine* engine, const char* name);
+void          rename_engine_leave(RenameEngine* engine);
+gboolean      rename_engine_rename(RenameEngine* engine, const char* name,
+				   const char* new_name, GError** error);
+gboolean      rename_engine_rename_at(int fd, const char* name,
+				      const char* new_name, GError** error);
+gboolean      rename_engine_has_noreplace(int fd);
+
+#endif // nautilus_filename_repairer_rename_engine_h
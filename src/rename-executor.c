@@ -0,0 +1,600 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "rename-executor.h"
+#include "rename-engine.h"
+#ifdef HAVE_LIBURING
+#include "rename-uring.h"
+#endif
+
+// Above this many renames waiting in memory, the caller waits for the
+// workers.
+#define RENAME_EXECUTOR_MAX_BUFFERED  65536
+#define RENAME_EXECUTOR_POLL_INTERVAL (G_USEC_PER_SEC / 10)
+// renames in flight on the io_uring of each thread
+#define RENAME_EXECUTOR_URING_DEPTH   128
+// file descriptors left to the rest of the program, out of RLIMIT_NOFILE
+#define RENAME_EXECUTOR_RESERVED_FDS  128
+
+/*
+ * Runs the renames of different directories at the same time, on up to
+ * n_jobs threads.  The caller walks the tree the same way as with a
+ * RenameEngine, and the renames of each directory are collected in a
+ * batch.  A batch runs once it has been left and the batches of all its
+ * subdirectories have finished, so a directory is still renamed after
+ * its contents, and the renames in one directory keep their order.  The
+ * result is the same as when they are done one by one.
+ *
+ * The top level directories given to rename_executor_open() run in their
+ * order too: each waits for the one opened before it, which may be the
+ * same directory.  Only the directories below them run at the same time.
+ *
+ * The directories are opened by the caller when it enters them, relative
+ * to their parent, which stays open until they finish.  Each batch keeps
+ * its directory open, so the caller waits before it enters one more than
+ * the file descriptor limit leaves room for.  The failures are
+ * passed to the error function in the caller's thread, from
+ * rename_executor_rename() and rename_executor_finish(), and so is the
+ * progress reported; the workers only add to its counters.
+ *
+ * With a journal, the renames are written to it as they are added, and
+ * a batch waits until its renames are on disk before it runs.
+ *
+ * Where io_uring can rename, each thread submits the renames of its batch
+ * through a ring of its own, and does them one by one otherwise.  A
+ * throttle, which the threads share, holds back either.
+ */
+typedef struct _RenameBatch RenameBatch;
+
+struct _RenameBatch {
+    RenameExecutor* executor;
+    RenameBatch* parent;
+    RenameBatch* next;      /* the top level one opened after this one */
+    int fd;
+    int open_errno;         /* why fd is -1 */
+    char* path;             /* for the errors */
+    GByteArray* renames;    /* names and new names, each ending with 0 */
+    guint n_renames;
+    guint journal_dir;      /* 0 until the first rename */
+    guint64 journal_seq;    /* of the last rename */
+    gint n_pending;         /* unfinished subdirectories, and 1 until left */
+};
+
+typedef struct _RenameFailure {
+    char* path;
+    char* name;
+    char* new_name;
+    GError* error;
+} RenameFailure;
+
+struct _RenameExecutor {
+    GThreadPool* pool;
+    GPtrArray* stack;       /* of the entered batches, the current one last */
+    GAsyncQueue* failures;
+    RenameBatch* last_root; /* the last top level one, until it finishes */
+    GMutex lock;
+    GCond cond;
+    guint n_batches;        /* not finished */
+    guint max_batches;      /* open at once, from RLIMIT_NOFILE */
+    guint n_queued;         /* given to the pool and not finished */
+    guint64 n_buffered;     /* renames in the batches not finished */
+    gint stopped;
+    RenameJournal* journal;
+    RenameThrottle* throttle;
+    GAsyncQueue* rings;     /* of the idle io_urings */
+    gint no_uring;          /* set once io_uring turned out not to work */
+
+    RenamePlanErrorFunc func;
+    gpointer data;
+    RepairProgress* progress;
+};
+
+static void rename_executor_run(RenameBatch* batch, RenameExecutor* executor);
+
+/*
+ * Half of the descriptors the process may open, and no more than all but
+ * the reserved ones.
+ */
+static guint
+rename_executor_get_max_batches(void)
+{
+    struct rlimit limit;
+    rlim_t n;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+	limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > 65536 * 2)
+	n = 65536 * 2;
+    else
+	n = limit.rlim_cur;
+
+    if (n < RENAME_EXECUTOR_RESERVED_FDS * 2)
+	return 16;
+    return MIN(n / 2, n - RENAME_EXECUTOR_RESERVED_FDS);
+}
+
+RenameExecutor*
+rename_executor_new(guint n_jobs, RenamePlanErrorFunc func, gpointer data,
+	RepairProgress* progress)
+{
+    RenameExecutor* executor;
+
+    executor = g_new0(RenameExecutor, 1);
+    executor->pool = g_thread_pool_new((GFunc)rename_executor_run, executor,
+	    MAX(n_jobs, 1), FALSE, NULL);
+    executor->stack = g_ptr_array_new();
+    executor->failures = g_async_queue_new();
+    executor->rings = g_async_queue_new();
+    g_mutex_init(&executor->lock);
+    g_cond_init(&executor->cond);
+    executor->func = func;
+    executor->data = data;
+    executor->progress = progress;
+    executor->max_batches = rename_executor_get_max_batches();
+
+    return executor;
+}
+
+void
+rename_executor_free(RenameExecutor* executor)
+{
+    rename_executor_finish(executor);
+
+    g_thread_pool_free(executor->pool, FALSE, TRUE);
+    g_ptr_array_free(executor->stack, TRUE);
+    g_async_queue_unref(executor->failures);
+#ifdef HAVE_LIBURING
+    {
+	RenameUring* ring;
+
+	while ((ring = g_async_queue_try_pop(executor->rings)) != NULL)
+	    rename_uring_free(ring);
+    }
+#endif
+    g_async_queue_unref(executor->rings);
+    g_mutex_clear(&executor->lock);
+    g_cond_clear(&executor->cond);
+    g_free(executor);
+}
+
+static void
+rename_failure_free(RenameFailure* failure)
+{
+    g_free(failure->path);
+    g_free(failure->name);
+    g_free(failure->new_name);
+    g_error_free(failure->error);
+    g_free(failure);
+}
+
+static void
+rename_executor_push(RenameExecutor* executor, RenameBatch* parent,
+	int fd, int errsv, char* path)
+{
+    RenameBatch* batch;
+
+    batch = g_new(RenameBatch, 1);
+    batch->executor = executor;
+    batch->parent = parent;
+    batch->next = NULL;
+    batch->fd = fd;
+    batch->open_errno = fd < 0 ? errsv : 0;
+    batch->path = path;
+    batch->renames = g_byte_array_new();
+    batch->n_renames = 0;
+    batch->journal_dir = 0;
+    batch->journal_seq = 0;
+    batch->n_pending = 1;
+
+    if (parent != NULL)
+	g_atomic_int_inc(&parent->n_pending);
+
+    g_mutex_lock(&executor->lock);
+    executor->n_batches++;
+    g_mutex_unlock(&executor->lock);
+
+    g_ptr_array_add(executor->stack, batch);
+}
+
+static RenameBatch*
+rename_executor_top(RenameExecutor* executor)
+{
+    return g_ptr_array_index(executor->stack, executor->stack->len - 1);
+}
+
+static void
+rename_executor_release(RenameExecutor* executor, RenameBatch* batch)
+{
+    if (!g_atomic_int_dec_and_test(&batch->n_pending))
+	return;
+
+    g_mutex_lock(&executor->lock);
+    executor->n_queued++;
+    g_mutex_unlock(&executor->lock);
+
+    g_thread_pool_push(executor->pool, batch, NULL);
+}
+
+/*
+ * Called for each rename of the batch when it has been done, in the
+ * worker's thread.
+ */
+static gboolean
+rename_executor_done(const char* name, const char* new_name,
+	const GError* error, RenameBatch* batch)
+{
+    RenameExecutor* executor = batch->executor;
+
+    if (error == NULL && executor->journal != NULL)
+	rename_journal_add_done(executor->journal, batch->journal_dir, name);
+
+    if (error != NULL) {
+	RenameFailure* failure = g_new(RenameFailure, 1);
+
+	failure->path = g_strdup(batch->path);
+	failure->name = g_strdup(name);
+	failure->new_name = g_strdup(new_name);
+	failure->error = g_error_copy(error);
+	g_async_queue_push(executor->failures, failure);
+    }
+
+    repair_progress_add_entry(executor->progress, name);
+    repair_progress_add_done(executor->progress, 1);
+
+    return !g_atomic_int_get(&executor->stopped);
+}
+
+#ifdef HAVE_LIBURING
+/*
+ * Does the renames of the batch through an io_uring, and returns where it
+ * stopped, as rename_uring_run() does.  The rings are made as the threads
+ * need them and kept for the next batches.
+ */
+static const char*
+rename_executor_run_uring(RenameExecutor* executor, RenameBatch* batch,
+	const char* renames, const char* end)
+{
+    RenameUring* ring;
+    const char* name;
+
+    ring = g_async_queue_try_pop(executor->rings);
+    if (ring == NULL) {
+	if (g_atomic_int_get(&executor->no_uring))
+	    return renames;
+
+	ring = rename_uring_new(RENAME_EXECUTOR_URING_DEPTH, NULL);
+	if (ring == NULL) {
+	    g_atomic_int_set(&executor->no_uring, TRUE);
+	    return renames;
+	}
+    }
+
+    name = rename_uring_run(ring, batch->fd, renames, end, executor->throttle,
+	    (RenameUringFunc)rename_executor_done, batch);
+
+    if (rename_uring_is_broken(ring))
+	rename_uring_free(ring);
+    else
+	g_async_queue_push(executor->rings, ring);
+
+    return name;
+}
+#endif
+
+static void
+rename_executor_run(RenameBatch* batch, RenameExecutor* executor)
+{
+    RenameBatch* parent;
+    RenameBatch* next;
+    const char* name;
+    const char* new_name;
+    const char* end;
+    GError* batch_error = NULL;
+    GError* error = NULL;
+    guint n_renames;
+
+    // Without the directory or the journal, every rename fails with why.
+    if (batch->fd < 0) {
+	g_set_error_literal(&batch_error, G_IO_ERROR,
+		g_io_error_from_errno(batch->open_errno),
+		g_strerror(batch->open_errno));
+    } else if (executor->journal != NULL && batch->n_renames > 0) {
+	rename_journal_sync(executor->journal, batch->journal_seq,
+		&batch_error);
+    }
+
+    name = (const char*)batch->renames->data;
+    end = name + batch->renames->len;
+#ifdef HAVE_LIBURING
+    if (batch_error == NULL && name < end &&
+	rename_engine_has_noreplace(batch->fd))
+	name = rename_executor_run_uring(executor, batch, name, end);
+#endif
+    while (name < end && !g_atomic_int_get(&executor->stopped)) {
+	new_name = name + strlen(name) + 1;
+	if (batch_error == NULL) {
+	    gint64 start_time = rename_throttle_acquire(executor->throttle);
+
+	    rename_engine_rename_at(batch->fd, name, new_name, &error);
+	    rename_throttle_release(executor->throttle, start_time);
+	}
+
+	rename_executor_done(name, new_name,
+		batch_error != NULL ? batch_error : error, batch);
+	g_clear_error(&error);
+
+	name = new_name + strlen(new_name) + 1;
+    }
+
+    if (batch->fd >= 0)
+	close(batch->fd);
+    if (batch_error != NULL)
+	g_error_free(batch_error);
+
+    g_mutex_lock(&executor->lock);
+    next = batch->next;
+    if (executor->last_root == batch)
+	executor->last_root = NULL;
+    g_mutex_unlock(&executor->lock);
+
+    parent = batch->parent;
+    n_renames = batch->n_renames;
+    g_byte_array_free(batch->renames, TRUE);
+    g_free(batch->path);
+    g_free(batch);
+
+    if (parent != NULL)
+	rename_executor_release(executor, parent);
+    if (next != NULL)
+	rename_executor_release(executor, next);
+
+    g_mutex_lock(&executor->lock);
+    executor->n_batches--;
+    executor->n_queued--;
+    executor->n_buffered -= n_renames;
+    g_cond_broadcast(&executor->cond);
+    g_mutex_unlock(&executor->lock);
+}
+
+/*
+ * Passes the failures so far to the error function, which may stop the
+ * run; the failures after that are dropped.
+ */
+static void
+rename_executor_report(RenameExecutor* executor)
+{
+    RenameFailure* failure;
+
+    while ((failure = g_async_queue_try_pop(executor->failures)) != NULL) {
+	if (!g_atomic_int_get(&executor->stopped) && executor->func != NULL) {
+	    GFile* dir;
+	    GFile* file;
+
+	    dir = g_file_new_for_path(failure->path);
+	    file = g_file_get_child(dir, failure->name);
+	    if (!executor->func(file, failure->new_name, failure->error,
+			executor->data))
+		g_atomic_int_set(&executor->stopped, TRUE);
+	    g_object_unref(file);
+	    g_object_unref(dir);
+	}
+	rename_failure_free(failure);
+    }
+
+    repair_progress_tick(executor->progress);
+}
+
+/*
+ * Waits until at most max_buffered renames in at most max_batches
+ * batches are left, or only the ones which cannot run yet because their
+ * directories are still entered.
+ */
+static void
+rename_executor_wait(RenameExecutor* executor, guint64 max_buffered,
+	guint max_batches)
+{
+    gboolean done;
+
+    for (;;) {
+	gint64 end_time;
+
+	rename_executor_report(executor);
+
+	g_mutex_lock(&executor->lock);
+	done = executor->n_batches <= max_batches &&
+	       executor->n_buffered <= max_buffered;
+	done = done || executor->n_queued == 0;
+	if (!done) {
+	    end_time = g_get_monotonic_time() + RENAME_EXECUTOR_POLL_INTERVAL;
+	    g_cond_wait_until(&executor->cond, &executor->lock, end_time);
+	}
+	g_mutex_unlock(&executor->lock);
+
+	if (done)
+	    break;
+    }
+
+    rename_executor_report(executor);
+}
+
+/*
+ * Sets the journal the renames go to; call it before the first one.
+ */
+void
+rename_executor_set_journal(RenameExecutor* executor, RenameJournal* journal)
+{
+    executor->journal = journal;
+}
+
+/*
+ * Sets the throttle which holds the renames back, NULL for none; call it
+ * before the first rename.
+ */
+void
+rename_executor_set_throttle(RenameExecutor* executor, RenameThrottle* throttle)
+{
+    executor->throttle = throttle;
+}
+
+/*
+ * Starts over at the directory path.  The directories entered before are
+ * left and go on in the background.
+ */
+/*
+ * Waits for a batch to finish when as many as may be open are there.
+ */
+static void
+rename_executor_wait_for_fd(RenameExecutor* executor)
+{
+    gboolean wait;
+
+    g_mutex_lock(&executor->lock);
+    wait = executor->n_batches >= executor->max_batches;
+    g_mutex_unlock(&executor->lock);
+
+    if (wait)
+	rename_executor_wait(executor, G_MAXUINT64, executor->max_batches - 1);
+}
+
+void
+rename_executor_open(RenameExecutor* executor, const char* path)
+{
+    RenameBatch* root;
+    int fd;
+
+    while (executor->stack->len > 0)
+	rename_executor_leave(executor);
+
+    rename_executor_wait_for_fd(executor);
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    rename_executor_push(executor, NULL, fd, errno, g_strdup(path));
+    root = rename_executor_top(executor);
+
+    g_mutex_lock(&executor->lock);
+    if (executor->last_root != NULL) {
+	executor->last_root->next = root;
+	g_atomic_int_inc(&root->n_pending);
+    }
+    executor->last_root = root;
+    g_mutex_unlock(&executor->lock);
+}
+
+void
+rename_executor_enter(RenameExecutor* executor, const char* name)
+{
+    RenameBatch* top;
+    int fd;
+    int errsv;
+
+    rename_executor_wait_for_fd(executor);
+
+    top = rename_executor_top(executor);
+    if (top->fd >= 0) {
+	fd = openat(top->fd, name,
+		O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	errsv = errno;
+    } else {
+	fd = -1;
+	errsv = top->open_errno;
+    }
+
+    rename_executor_push(executor, top, fd, errsv,
+	    g_build_filename(top->path, name, NULL));
+}
+
+void
+rename_executor_leave(RenameExecutor* executor)
+{
+    RenameBatch* batch;
+
+    batch = rename_executor_top(executor);
+    g_ptr_array_set_size(executor->stack, executor->stack->len - 1);
+    rename_executor_release(executor, batch);
+}
+
+/*
+ * Adds the rename to the current directory.  Returns FALSE when the
+ * error function has stopped the run.
+ */
+gboolean
+rename_executor_rename(RenameExecutor* executor, const char* name,
+	const char* new_name)
+{
+    RenameBatch* top;
+    gboolean wait;
+
+    top = rename_executor_top(executor);
+    if (executor->journal != NULL) {
+	if (top->journal_dir == 0)
+	    top->journal_dir = rename_journal_add_dir(executor->journal,
+		    top->path);
+	top->journal_seq = rename_journal_add_rename(executor->journal,
+		top->journal_dir, name, new_name);
+    }
+    g_byte_array_append(top->renames, (const guint8*)name, strlen(name) + 1);
+    g_byte_array_append(top->renames,
+	    (const guint8*)new_name, strlen(new_name) + 1);
+    top->n_renames++;
+
+    g_mutex_lock(&executor->lock);
+    executor->n_buffered++;
+    wait = executor->n_buffered > RENAME_EXECUTOR_MAX_BUFFERED;
+    g_mutex_unlock(&executor->lock);
+
+    if (wait)
+	rename_executor_wait(executor, RENAME_EXECUTOR_MAX_BUFFERED / 2,
+		G_MAXUINT);
+    else
+	rename_executor_report(executor);
+
+    return !g_atomic_int_get(&executor->stopped);
+}
+
+/*
+ * Leaves all the directories and waits for all the renames.  Returns FALSE
+ * when the error function has stopped the run.
+ */
+gboolean
+rename_executor_finish(RenameExecutor* executor)
+{
+    while (executor->stack->len > 0)
+	rename_executor_leave(executor);
+
+    rename_executor_wait(executor, 0, 0);
+
+    return !g_atomic_int_get(&executor->stopped);
+}
@@ -0,0 +1,52 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_rename_executor_h
+#define nautilus_filename_repairer_rename_executor_h
+
+#include <glib.h>
+
+#include "rename-plan.h"
+#include "rename-journal.h"
+#include "rename-throttle.h"
+#include "repair-progress.h"
+
+typedef struct _RenameExecutor RenameExecutor;
+
+RenameExecutor* rename_executor_new(guint n_jobs, RenamePlanErrorFunc func,
+				    gpointer data, RepairProgress* progress);
+void            rename_executor_free(RenameExecutor* executor);
+
+void            rename_executor_set_journal(RenameExecutor* executor,
+					    RenameJournal* journal);
+void            rename_executor_set_throttle(RenameExecutor* executor,
+					     RenameThrottle* throttle);
+void            rename_executor_open(RenameExecutor* executor,
+				     const char* path);
+void            rename_executor_enter(RenameExecutor* executor,
+				      const char* name);
+void            rename_executor_leave(RenameExecutor* executor);
+gboolean        rename_executor_rename(RenameExecutor* executor,
+				       const char* name, const char* new_name);
+gboolean        rename_executor_finish(RenameExecutor* executor);
+
+#endif // nautilus_filename_repairer_rename_executor_h
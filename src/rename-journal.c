@@ -0,0 +1,757 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "rename-journal.h"
+#include "rename-engine.h"
+
+#define RENAME_JOURNAL_HEADER      "nautilus-filename-repairer journal 1\n"
+#define RENAME_JOURNAL_BUFFER_SIZE (64 * 1024)
+
+/*
+ * The journal of a run is written ahead of the renames, so that when the
+ * process dies halfway, a later one can finish the run or undo it.
+ *
+ * It is a stream of records, each a type byte followed by its fields,
+ * and each field ends with 0; the names are the raw bytes from the file
+ * system.
+ *
+ *   D id path        a directory, to which the records after refer by id
+ *   R dir name new   a rename which is going to be done in dir
+ *   C dir name       the first rename of name in dir which isn't done yet
+ *                    has been done
+ *   E                the run has ended
+ *
+ * The renames are in the order of the plan, which is one of the orders
+ * they may be done in, and the path of each directory is the one it had
+ * before the run.  The R records are synced before the renames run, with
+ * one fdatasync() for all the records written by then, whichever thread
+ * asks first.  The C records are not synced at all: whether a rename
+ * without one was done is seen in the file system.
+ */
+struct _RenameJournal {
+    FILE* fp;
+    char* path;
+    GMutex lock;            /* of fp and the counters */
+    GMutex sync_lock;
+    guint n_dirs;
+    guint64 n_renames;
+    guint64 n_synced;       /* the renames up to this one are on disk */
+    GError* error;          /* the first write which failed */
+};
+
+/*
+ * The journal is not in the cache: it is what makes a run undoable.
+ */
+char*
+rename_journal_get_default_path(void)
+{
+    return g_build_filename(g_get_user_data_dir(), PACKAGE, "last-run.journal",
+	    NULL);
+}
+
+static void
+set_error_from_errno(GError** error, const char* path, int errsv)
+{
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+	    "%s: %s", path, g_strerror(errsv));
+}
+
+/*
+ * All the runs share one journal, so a run holds an flock() on it until
+ * it ends, and so does an undo or a recovery.  A journal which is locked
+ * is in use by another process, not cut off.  Returns the locked file
+ * descriptor, or -1 with G_IO_ERROR_BUSY when another process has it.
+ */
+static int
+rename_journal_lock(const char* path, int flags, GError** error)
+{
+    int fd;
+    int errsv;
+
+    fd = open(path, flags | O_CLOEXEC, 0600);
+    if (fd < 0) {
+	set_error_from_errno(error, path, errno);
+	return -1;
+    }
+
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+	errsv = errno;
+	close(fd);
+	if (errsv == EWOULDBLOCK)
+	    g_set_error(error, G_IO_ERROR, G_IO_ERROR_BUSY,
+		    "%s: another run is using it", path);
+	else
+	    set_error_from_errno(error, path, errsv);
+	return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Whether another process is running, undoing or recovering a run.
+ */
+gboolean
+rename_journal_is_in_use(const char* path)
+{
+    gboolean res;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+	return FALSE;
+
+    res = flock(fd, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+    close(fd);
+
+    return res;
+}
+
+/*
+ * Starts the journal of a new run at path, over the one of the run
+ * before.  Fails with G_IO_ERROR_BUSY while another run is going on.
+ */
+RenameJournal*
+rename_journal_new(const char* path, GError** error)
+{
+    RenameJournal* journal;
+    char* dir;
+    FILE* fp;
+    int fd;
+
+    dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    // Truncated only once it is ours.
+    fd = rename_journal_lock(path, O_WRONLY | O_CREAT, error);
+    if (fd < 0)
+	return NULL;
+
+    fp = NULL;
+    if (ftruncate(fd, 0) == 0)
+	fp = fdopen(fd, "wb");
+    if (fp == NULL) {
+	set_error_from_errno(error, path, errno);
+	close(fd);
+	return NULL;
+    }
+
+    journal = g_new0(RenameJournal, 1);
+    journal->fp = fp;
+    journal->path = g_strdup(path);
+    g_mutex_init(&journal->lock);
+    g_mutex_init(&journal->sync_lock);
+    setvbuf(fp, NULL, _IOFBF, RENAME_JOURNAL_BUFFER_SIZE);
+    fputs(RENAME_JOURNAL_HEADER, fp);
+
+    return journal;
+}
+
+/*
+ * Closes the journal, which lets other runs have it.  Without
+ * rename_journal_finish() before, it looks like the run was cut off.
+ */
+void
+rename_journal_free(RenameJournal* journal)
+{
+    fclose(journal->fp);
+    g_free(journal->path);
+    g_mutex_clear(&journal->lock);
+    g_mutex_clear(&journal->sync_lock);
+    if (journal->error != NULL)
+	g_error_free(journal->error);
+    g_free(journal);
+}
+
+static void
+rename_journal_put(RenameJournal* journal, const char* field)
+{
+    fwrite(field, 1, strlen(field) + 1, journal->fp);
+}
+
+static void
+rename_journal_put_number(RenameJournal* journal, guint number)
+{
+    fprintf(journal->fp, "%u%c", number, '\0');
+}
+
+guint
+rename_journal_add_dir(RenameJournal* journal, const char* path)
+{
+    guint id;
+
+    g_mutex_lock(&journal->lock);
+    id = ++journal->n_dirs;
+    fputc('D', journal->fp);
+    rename_journal_put_number(journal, id);
+    rename_journal_put(journal, path);
+    g_mutex_unlock(&journal->lock);
+
+    return id;
+}
+
+/*
+ * Returns the number to pass to rename_journal_sync() before the rename
+ * is done.
+ */
+guint64
+rename_journal_add_rename(RenameJournal* journal, guint dir,
+	const char* name, const char* new_name)
+{
+    guint64 seq;
+
+    g_mutex_lock(&journal->lock);
+    seq = ++journal->n_renames;
+    fputc('R', journal->fp);
+    rename_journal_put_number(journal, dir);
+    rename_journal_put(journal, name);
+    rename_journal_put(journal, new_name);
+    g_mutex_unlock(&journal->lock);
+
+    return seq;
+}
+
+/*
+ * Makes sure the renames up to seq are on disk.  A thread which comes
+ * while another one syncs waits for it, and then has nothing more to do
+ * when its renames were written by then.
+ */
+gboolean
+rename_journal_sync(RenameJournal* journal, guint64 seq, GError** error)
+{
+    gboolean res = TRUE;
+
+    g_mutex_lock(&journal->sync_lock);
+    if (journal->n_synced < seq) {
+	guint64 n_renames;
+	int errsv = 0;
+
+	g_mutex_lock(&journal->lock);
+	n_renames = journal->n_renames;
+	if (journal->error == NULL && fflush(journal->fp) != 0)
+	    errsv = errno;
+	g_mutex_unlock(&journal->lock);
+
+	if (errsv == 0 && fdatasync(fileno(journal->fp)) != 0)
+	    errsv = errno;
+
+	g_mutex_lock(&journal->lock);
+	if (errsv != 0 && journal->error == NULL)
+	    set_error_from_errno(&journal->error, journal->path, errsv);
+	if (journal->error == NULL)
+	    journal->n_synced = n_renames;
+	g_mutex_unlock(&journal->lock);
+    }
+
+    g_mutex_lock(&journal->lock);
+    if (journal->error != NULL) {
+	g_propagate_error(error, g_error_copy(journal->error));
+	res = FALSE;
+    }
+    g_mutex_unlock(&journal->lock);
+    g_mutex_unlock(&journal->sync_lock);
+
+    return res;
+}
+
+void
+rename_journal_add_done(RenameJournal* journal, guint dir, const char* name)
+{
+    g_mutex_lock(&journal->lock);
+    fputc('C', journal->fp);
+    rename_journal_put_number(journal, dir);
+    rename_journal_put(journal, name);
+    g_mutex_unlock(&journal->lock);
+}
+
+/*
+ * Marks the end of the run, which may have stopped early, and syncs.
+ */
+gboolean
+rename_journal_finish(RenameJournal* journal, GError** error)
+{
+    g_mutex_lock(&journal->lock);
+    fputc('E', journal->fp);
+    fputc('\0', journal->fp);
+    g_mutex_unlock(&journal->lock);
+
+    return rename_journal_sync(journal, G_MAXUINT64, error);
+}
+
+/*
+ * A journal read back for rename_journal_undo() and
+ * rename_journal_recover().  The names are in one buffer, and each
+ * rename has the offsets of its names.
+ */
+typedef struct _RenameJournalEntry {
+    guint dir;
+    gsize name;
+    gsize new_name;
+    gboolean done;
+} RenameJournalEntry;
+
+typedef struct _RenameJournalData {
+    GPtrArray* dirs;        /* the path of dir id is at id - 1 */
+    GArray* entries;
+    GByteArray* names;
+    gboolean ended;
+    off_t end;              /* of the last record which is whole */
+} RenameJournalData;
+
+static void
+rename_journal_data_free(RenameJournalData* data)
+{
+    g_ptr_array_free(data->dirs, TRUE);
+    g_array_free(data->entries, TRUE);
+    g_byte_array_free(data->names, TRUE);
+}
+
+static gboolean
+read_field(FILE* fp, GByteArray* names, gsize* offset)
+{
+    int c;
+
+    *offset = names->len;
+    while ((c = getc(fp)) != EOF) {
+	guint8 byte = c;
+
+	g_byte_array_append(names, &byte, 1);
+	if (c == '\0')
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean
+read_number(FILE* fp, GByteArray* scratch, guint* number)
+{
+    gsize offset;
+    char* end;
+
+    g_byte_array_set_size(scratch, 0);
+    if (!read_field(fp, scratch, &offset))
+	return FALSE;
+
+    *number = strtoul((const char*)scratch->data, &end, 10);
+    return *end == '\0';
+}
+
+/*
+ * A record which was cut off by the end of the run is left out, and so
+ * is everything after it; so are the records of directories not in the
+ * journal.
+ */
+static gboolean
+rename_journal_load(const char* path, RenameJournalData* data,
+	GError** error)
+{
+    FILE* fp;
+    char header[sizeof(RENAME_JOURNAL_HEADER)];
+    GByteArray* scratch;
+    GHashTable* pending;
+    int type;
+
+    fp = fopen(path, "rbe");
+    if (fp == NULL) {
+	set_error_from_errno(error, path, errno);
+	return FALSE;
+    }
+
+    if (fgets(header, sizeof(header), fp) == NULL ||
+	strcmp(header, RENAME_JOURNAL_HEADER) != 0) {
+	g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		"%s: not a rename journal", path);
+	fclose(fp);
+	return FALSE;
+    }
+
+    data->dirs = g_ptr_array_new_with_free_func(g_free);
+    data->entries = g_array_new(FALSE, FALSE, sizeof(RenameJournalEntry));
+    data->names = g_byte_array_new();
+    data->ended = FALSE;
+    data->end = ftello(fp);
+
+    // the renames not done yet, by dir and name, the first one first
+    scratch = g_byte_array_new();
+    pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, (GDestroyNotify)g_queue_free);
+
+    while ((type = getc(fp)) != EOF) {
+	RenameJournalEntry entry;
+	GQueue* queue;
+	gsize offset;
+	char* key;
+	guint id;
+
+	if (type == 'E') {
+	    data->ended = TRUE;
+	    getc(fp);
+	    data->end = ftello(fp);
+	    break;
+	}
+
+	if (!read_number(fp, scratch, &id))
+	    break;
+
+	if (type == 'D') {
+	    g_byte_array_set_size(scratch, 0);
+	    if (!read_field(fp, scratch, &offset))
+		break;
+	    if (id == data->dirs->len + 1)
+		g_ptr_array_add(data->dirs, g_strdup((char*)scratch->data));
+	    data->end = ftello(fp);
+	} else if (type == 'R') {
+	    entry.dir = id;
+	    entry.done = FALSE;
+	    if (!read_field(fp, data->names, &entry.name) ||
+		!read_field(fp, data->names, &entry.new_name))
+		break;
+	    data->end = ftello(fp);
+	    if (id == 0 || id > data->dirs->len)
+		continue;
+
+	    key = g_strdup_printf("%u/%s", id, data->names->data + entry.name);
+	    queue = g_hash_table_lookup(pending, key);
+	    if (queue == NULL) {
+		queue = g_queue_new();
+		g_hash_table_insert(pending, key, queue);
+	    } else {
+		g_free(key);
+	    }
+	    g_queue_push_tail(queue, GUINT_TO_POINTER(data->entries->len));
+	    g_array_append_val(data->entries, entry);
+	} else if (type == 'C') {
+	    g_byte_array_set_size(scratch, 0);
+	    if (!read_field(fp, scratch, &offset))
+		break;
+	    data->end = ftello(fp);
+
+	    key = g_strdup_printf("%u/%s", id, (char*)scratch->data);
+	    queue = g_hash_table_lookup(pending, key);
+	    if (queue != NULL && !g_queue_is_empty(queue)) {
+		guint i = GPOINTER_TO_UINT(g_queue_pop_head(queue));
+		g_array_index(data->entries, RenameJournalEntry, i).done = TRUE;
+	    }
+	    g_free(key);
+	} else {
+	    break;
+	}
+    }
+
+    g_hash_table_destroy(pending);
+    g_byte_array_free(scratch, TRUE);
+    fclose(fp);
+
+    return TRUE;
+}
+
+/*
+ * Whether the journal at path is of a run which renamed something and
+ * was cut off, so that starting a new one over it would lose the only
+ * record of what is left to finish or undo.
+ */
+gboolean
+rename_journal_is_cut_off(const char* path)
+{
+    RenameJournalData journal;
+    gboolean res;
+
+    if (!g_file_test(path, G_FILE_TEST_EXISTS) ||
+	rename_journal_is_in_use(path))
+	return FALSE;
+
+    if (!rename_journal_load(path, &journal, NULL))
+	return FALSE;
+
+    res = !journal.ended && journal.entries->len > 0;
+    rename_journal_data_free(&journal);
+
+    return res;
+}
+
+/*
+ * The directories are opened one at a time, and the last one is kept
+ * open for the renames after it in the same directory.
+ */
+typedef struct _RenameJournalReplay {
+    RenameJournalData* data;
+    guint dir;
+    int fd;
+    int open_errno;         /* why fd is -1 */
+    RenamePlanErrorFunc func;
+    gpointer func_data;
+} RenameJournalReplay;
+
+static int
+rename_journal_replay_open(RenameJournalReplay* replay, guint dir)
+{
+    if (replay->dir != dir) {
+	if (replay->fd >= 0)
+	    close(replay->fd);
+	replay->fd = open(g_ptr_array_index(replay->data->dirs, dir - 1),
+		O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	replay->open_errno = errno;
+	replay->dir = dir;
+    }
+
+    return replay->fd;
+}
+
+static gboolean
+exists_at(int fd, const char* name)
+{
+    struct stat st;
+
+    return fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+/*
+ * Renames name to new_name in the directory of the entry, and returns
+ * FALSE when the error function says to stop.
+ */
+static gboolean
+rename_journal_replay_move(RenameJournalReplay* replay,
+	RenameJournalEntry* entry, const char* name, const char* new_name)
+{
+    GError* error = NULL;
+    gboolean go_on = TRUE;
+
+    if (replay->fd < 0) {
+	g_set_error_literal(&error, G_IO_ERROR,
+		g_io_error_from_errno(replay->open_errno),
+		g_strerror(replay->open_errno));
+    } else {
+	rename_engine_rename_at(replay->fd, name, new_name, &error);
+    }
+
+    if (error != NULL) {
+	if (replay->func != NULL) {
+	    GFile* dir;
+	    GFile* file;
+
+	    dir = g_file_new_for_path(g_ptr_array_index(replay->data->dirs,
+			entry->dir - 1));
+	    file = g_file_get_child(dir, name);
+	    go_on = replay->func(file, new_name, error, replay->func_data);
+	    g_object_unref(file);
+	    g_object_unref(dir);
+	}
+	g_error_free(error);
+    }
+
+    return go_on;
+}
+
+/*
+ * Renames back what the run renamed, the last rename first, so each
+ * directory has its old path again by the time the renames in it are
+ * undone.  A rename is undone when the journal says it was done, or when
+ * the file system says so: its new name is there and its old one is
+ * not.  One which was undone already is left alone, so an undo which
+ * stopped can be run again.  The journal is removed when everything was
+ * undone.
+ */
+gboolean
+rename_journal_undo(const char* path, RenamePlanErrorFunc func,
+	gpointer data, GError** error)
+{
+    RenameJournalData journal;
+    RenameJournalReplay replay;
+    gboolean failed = FALSE;
+    guint i;
+    int lock_fd;
+
+    lock_fd = rename_journal_lock(path, O_RDONLY, error);
+    if (lock_fd < 0)
+	return FALSE;
+
+    if (!rename_journal_load(path, &journal, error)) {
+	close(lock_fd);
+	return FALSE;
+    }
+
+    replay.data = &journal;
+    replay.dir = 0;
+    replay.fd = -1;
+    replay.func = func;
+    replay.func_data = data;
+
+    for (i = journal.entries->len; i > 0; i--) {
+	RenameJournalEntry* entry;
+	const char* name;
+	const char* new_name;
+	gboolean has_name;
+	gboolean has_new_name;
+
+	entry = &g_array_index(journal.entries, RenameJournalEntry, i - 1);
+	name = (const char*)journal.names->data + entry->name;
+	new_name = (const char*)journal.names->data + entry->new_name;
+
+	if (rename_journal_replay_open(&replay, entry->dir) < 0) {
+	    if (!entry->done)
+		continue;
+	} else {
+	    has_name = exists_at(replay.fd, name);
+	    has_new_name = exists_at(replay.fd, new_name);
+	    if (has_name && !has_new_name)
+		continue;
+	    if (!entry->done && !(has_new_name && !has_name))
+		continue;
+	}
+
+	// A directory which cannot be opened fails the rename with why.
+	if (!rename_journal_replay_move(&replay, entry, new_name, name)) {
+	    failed = TRUE;
+	    break;
+	}
+	if (replay.fd < 0 || exists_at(replay.fd, new_name))
+	    failed = TRUE;
+    }
+
+    if (replay.fd >= 0)
+	close(replay.fd);
+    rename_journal_data_free(&journal);
+
+    if (!failed)
+	g_unlink(path);
+    close(lock_fd);
+
+    return TRUE;
+}
+
+/*
+ * Does the renames of a run which was cut off, in their order, skipping
+ * the ones which were done: those the journal says were, and those whose
+ * old name is not there anymore, also because their directory has been
+ * renamed after them.  The renames done now go to the journal, after
+ * its last whole record, and it then ends like the run had, unless the
+ * error function stopped it.
+ */
+gboolean
+rename_journal_recover(const char* path, RenamePlanErrorFunc func,
+	gpointer data, GError** error)
+{
+    RenameJournalData journal;
+    RenameJournalReplay replay;
+    FILE* fp;
+    gboolean stopped = FALSE;
+    gboolean res = TRUE;
+    guint i;
+    int fd;
+
+    fd = rename_journal_lock(path, O_RDWR, error);
+    if (fd < 0)
+	return FALSE;
+
+    if (!rename_journal_load(path, &journal, error)) {
+	close(fd);
+	return FALSE;
+    }
+
+    if (journal.ended) {
+	rename_journal_data_free(&journal);
+	close(fd);
+	return TRUE;
+    }
+
+    // What the run wrote last may be a torn record.
+    fp = NULL;
+    if (ftruncate(fd, journal.end) == 0 && lseek(fd, journal.end, SEEK_SET) >= 0)
+	fp = fdopen(fd, "r+b");
+    if (fp == NULL) {
+	set_error_from_errno(error, path, errno);
+	close(fd);
+	rename_journal_data_free(&journal);
+	return FALSE;
+    }
+
+    replay.data = &journal;
+    replay.dir = 0;
+    replay.fd = -1;
+    replay.func = func;
+    replay.func_data = data;
+
+    for (i = 0; i < journal.entries->len; i++) {
+	RenameJournalEntry* entry;
+	const char* name;
+	const char* new_name;
+	gboolean go_on;
+
+	entry = &g_array_index(journal.entries, RenameJournalEntry, i);
+	if (entry->done)
+	    continue;
+
+	if (rename_journal_replay_open(&replay, entry->dir) < 0)
+	    continue;
+
+	name = (const char*)journal.names->data + entry->name;
+	new_name = (const char*)journal.names->data + entry->new_name;
+	if (!exists_at(replay.fd, name))
+	    continue;
+
+	go_on = rename_journal_replay_move(&replay, entry, name, new_name);
+	if (!exists_at(replay.fd, name))
+	    fprintf(fp, "C%u%c%s%c", entry->dir, '\0', name, '\0');
+	if (!go_on) {
+	    stopped = TRUE;
+	    break;
+	}
+    }
+
+    // A recovery which was stopped may be run again.
+    if (!stopped) {
+	fputc('E', fp);
+	fputc('\0', fp);
+    }
+    if (fflush(fp) != 0 || fdatasync(fileno(fp)) != 0) {
+	set_error_from_errno(error, path, errno);
+	res = FALSE;
+    }
+    fclose(fp);
+
+    if (replay.fd >= 0)
+	close(replay.fd);
+    rename_journal_data_free(&journal);
+
+    return res;
+}
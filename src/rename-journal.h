@@ -0,0 +1,57 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_rename_journal_h
+#define nautilus_filename_repairer_rename_journal_h
+
+#include <glib.h>
+
+#include "rename-plan.h"
+
+typedef struct _RenameJournal RenameJournal;
+
+char*          rename_journal_get_default_path(void);
+
+RenameJournal* rename_journal_new(const char* path, GError** error);
+void           rename_journal_free(RenameJournal* journal);
+
+guint          rename_journal_add_dir(RenameJournal* journal,
+				      const char* path);
+guint64        rename_journal_add_rename(RenameJournal* journal, guint dir,
+					 const char* name,
+					 const char* new_name);
+gboolean       rename_journal_sync(RenameJournal* journal, guint64 seq,
+				   GError** error);
+void           rename_journal_add_done(RenameJournal* journal, guint dir,
+				       const char* name);
+gboolean       rename_journal_finish(RenameJournal* journal, GError** error);
+
+gboolean       rename_journal_is_in_use(const char* path);
+gboolean       rename_journal_is_cut_off(const char* path);
+gboolean       rename_journal_undo(const char* path,
+				   RenamePlanErrorFunc func, gpointer data,
+				   GError** error);
+gboolean       rename_journal_recover(const char* path,
+				      RenamePlanErrorFunc func, gpointer data,
+				      GError** error);
+
+#endif // nautilus_filename_repairer_rename_journal_h
@@ -0,0 +1,636 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "rename-plan.h"
+#include "rename-engine.h"
+#include "rename-executor.h"
+#include "rename-journal.h"
+
+/*
+ * A rename plan is a stream of records in the order the renames must be
+ * done: the contents of a directory come before the directory itself.
+ * Each record is one op byte followed by its strings, and each string is
+ * a varint length and the raw bytes of the name.  Records are kept in
+ * memory until the memory budget is used up, and then they are spilled
+ * to a temporary run file, so a plan for any number of files fits in a
+ * fixed amount of memory.
+ */
+
+typedef struct _RenamePlanEnter {
+    gssize start;
+    gssize end;
+} RenamePlanEnter;
+
+struct _RenamePlan {
+    GByteArray* buffer;
+    gsize memory_budget;
+    GArray* enters;         /* open ENTER records still in the buffer */
+    FILE* spill;
+    char* spill_path;
+    gboolean keep_spill;    /* the run file is the caller's, don't unlink */
+    guint64 n_moves;
+    GError* error;
+    RepairProgress* progress;   /* of rename_plan_apply() */
+    guint n_jobs;               /* of rename_plan_apply() */
+    RenameJournal* journal;     /* of rename_plan_apply() */
+    RenameThrottle* throttle;   /* of rename_plan_apply() */
+};
+
+RenamePlan*
+rename_plan_new(gsize memory_budget)
+{
+    RenamePlan* plan;
+
+    plan = g_new0(RenamePlan, 1);
+    plan->buffer = g_byte_array_new();
+    plan->memory_budget = memory_budget;
+    plan->enters = g_array_new(FALSE, FALSE, sizeof(RenamePlanEnter));
+
+    return plan;
+}
+
+/*
+ * Creates a plan which spills into the file at path instead of a
+ * temporary file.  The file is kept when the plan is freed, so with
+ * rename_plan_sync() and rename_plan_open() a plan can outlive the
+ * process which made it.
+ */
+RenamePlan*
+rename_plan_new_with_file(gsize memory_budget, const char* path)
+{
+    RenamePlan* plan;
+
+    plan = rename_plan_new(memory_budget);
+    plan->spill_path = g_strdup(path);
+    plan->keep_spill = TRUE;
+
+    return plan;
+}
+
+/*
+ * Reopens a plan saved with rename_plan_sync().  Anything written after
+ * the sync is cut off, and depth is the number of directories entered
+ * at that time.
+ */
+RenamePlan*
+rename_plan_open(gsize memory_budget, const char* path,
+	guint64 size, guint64 n_moves, guint depth, GError** error)
+{
+    RenamePlan* plan;
+    RenamePlanEnter enter;
+    guint i;
+
+    plan = rename_plan_new_with_file(memory_budget, path);
+
+    plan->spill = fopen(path, "r+b");
+    if (plan->spill == NULL || ftruncate(fileno(plan->spill), size) != 0) {
+	g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+		"%s: %s", path, g_strerror(errno));
+	rename_plan_free(plan);
+	return NULL;
+    }
+
+    plan->n_moves = n_moves;
+
+    // The ENTER records are all on disk already.
+    enter.start = -1;
+    enter.end = -1;
+    for (i = 0; i < depth; i++) {
+	g_array_append_val(plan->enters, enter);
+    }
+
+    return plan;
+}
+
+void
+rename_plan_free(RenamePlan* plan)
+{
+    if (plan == NULL)
+	return;
+
+    if (plan->spill != NULL)
+	fclose(plan->spill);
+    if (plan->spill_path != NULL) {
+	if (!plan->keep_spill)
+	    g_unlink(plan->spill_path);
+	g_free(plan->spill_path);
+    }
+    if (plan->error != NULL)
+	g_error_free(plan->error);
+
+    g_byte_array_free(plan->buffer, TRUE);
+    g_array_free(plan->enters, TRUE);
+    g_free(plan);
+}
+
+static gboolean
+rename_plan_open_spill(RenamePlan* plan)
+{
+    int fd;
+
+    if (plan->keep_spill) {
+	plan->spill = fopen(plan->spill_path, "w+b");
+    } else {
+	fd = g_file_open_tmp("repairer-plan-XXXXXX", &plan->spill_path,
+		&plan->error);
+	if (fd < 0)
+	    return FALSE;
+
+	plan->spill = fdopen(fd, "w+b");
+	if (plan->spill == NULL)
+	    close(fd);
+    }
+
+    if (plan->spill == NULL) {
+	g_set_error(&plan->error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		"%s: %s", plan->spill_path, g_strerror(errno));
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+rename_plan_spill(RenamePlan* plan)
+{
+    guint i;
+
+    if (plan->error != NULL || plan->buffer->len == 0)
+	return;
+
+    if (plan->spill == NULL && !rename_plan_open_spill(plan))
+	return;
+
+    fseek(plan->spill, 0, SEEK_END);
+    if (fwrite(plan->buffer->data, 1, plan->buffer->len, plan->spill) !=
+	    plan->buffer->len) {
+	g_set_error(&plan->error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		"%s: %s", plan->spill_path, g_strerror(errno));
+	return;
+    }
+
+    g_byte_array_set_size(plan->buffer, 0);
+    for (i = 0; i < plan->enters->len; i++) {
+	g_array_index(plan->enters, RenamePlanEnter, i).start = -1;
+    }
+}
+
+static void
+rename_plan_put_op(RenamePlan* plan, RenamePlanOp op)
+{
+    guint8 byte = op;
+
+    g_byte_array_append(plan->buffer, &byte, 1);
+}
+
+static void
+rename_plan_put_string(RenamePlan* plan, const char* str)
+{
+    guint8 bytes[10];
+    gsize len;
+    guint n;
+
+    len = strlen(str);
+    n = 0;
+    do {
+	bytes[n] = len & 0x7f;
+	len >>= 7;
+	if (len != 0)
+	    bytes[n] |= 0x80;
+	n++;
+    } while (len != 0);
+
+    g_byte_array_append(plan->buffer, bytes, n);
+    g_byte_array_append(plan->buffer, (const guint8*)str, strlen(str));
+}
+
+static void
+rename_plan_check_budget(RenamePlan* plan)
+{
+    if (plan->buffer->len >= plan->memory_budget)
+	rename_plan_spill(plan);
+}
+
+void
+rename_plan_add_root(RenamePlan* plan, const char* dir)
+{
+    g_array_set_size(plan->enters, 0);
+
+    rename_plan_put_op(plan, RENAME_PLAN_ROOT);
+    rename_plan_put_string(plan, dir);
+    rename_plan_check_budget(plan);
+}
+
+void
+rename_plan_enter(RenamePlan* plan, const char* name)
+{
+    RenamePlanEnter enter;
+
+    enter.start = plan->buffer->len;
+    rename_plan_put_op(plan, RENAME_PLAN_ENTER);
+    rename_plan_put_string(plan, name);
+    enter.end = plan->buffer->len;
+    g_array_append_val(plan->enters, enter);
+
+    rename_plan_check_budget(plan);
+}
+
+void
+rename_plan_leave(RenamePlan* plan)
+{
+    RenamePlanEnter* enter;
+
+    g_return_if_fail(plan->enters->len > 0);
+
+    // Most directories have nothing to rename.  If nothing has been
+    // written since we entered, forget that we went there at all.
+    enter = &g_array_index(plan->enters, RenamePlanEnter, plan->enters->len - 1);
+    if (enter->start >= 0 && enter->end == plan->buffer->len) {
+	g_byte_array_set_size(plan->buffer, enter->start);
+    } else {
+	rename_plan_put_op(plan, RENAME_PLAN_LEAVE);
+    }
+    g_array_set_size(plan->enters, plan->enters->len - 1);
+
+    rename_plan_check_budget(plan);
+}
+
+void
+rename_plan_add_move(RenamePlan* plan, const char* name, const char* new_name)
+{
+    rename_plan_put_op(plan, RENAME_PLAN_MOVE);
+    rename_plan_put_string(plan, name);
+    rename_plan_put_string(plan, new_name);
+    plan->n_moves++;
+
+    rename_plan_check_budget(plan);
+}
+
+guint64
+rename_plan_get_n_moves(RenamePlan* plan)
+{
+    return plan->n_moves;
+}
+
+/*
+ * Writes out everything in memory and flushes the run file to the disk.
+ * size is set to the length of the plan, to be given to
+ * rename_plan_open() later.
+ */
+gboolean
+rename_plan_sync(RenamePlan* plan, guint64* size, GError** error)
+{
+    if (plan->spill == NULL && plan->error == NULL)
+	rename_plan_open_spill(plan);
+
+    rename_plan_spill(plan);
+
+    if (plan->error == NULL) {
+	if (fflush(plan->spill) != 0 || fsync(fileno(plan->spill)) != 0) {
+	    g_set_error(&plan->error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		    "%s: %s", plan->spill_path, g_strerror(errno));
+	}
+    }
+
+    if (plan->error != NULL) {
+	g_propagate_error(error, g_error_copy(plan->error));
+	return FALSE;
+    }
+
+    fseek(plan->spill, 0, SEEK_END);
+    *size = ftell(plan->spill);
+
+    return TRUE;
+}
+
+static gboolean
+read_string(FILE* fp, GString* str)
+{
+    guint64 len;
+    int shift;
+    int c;
+
+    len = 0;
+    shift = 0;
+    do {
+	// No name is 2^35 bytes long, so more is a corrupted plan; and
+	// shifting on past 64 bits would be undefined.
+	if (shift >= 35)
+	    return FALSE;
+	c = getc(fp);
+	if (c == EOF)
+	    return FALSE;
+	len |= (guint64)(c & 0x7f) << shift;
+	shift += 7;
+    } while (c & 0x80);
+
+    g_string_set_size(str, len);
+    if (len > 0 && fread(str->str, 1, len, fp) != len)
+	return FALSE;
+
+    return TRUE;
+}
+
+static gboolean
+rename_plan_read(FILE* fp, RenamePlanFunc func, gpointer data, GError** error)
+{
+    GString* name;
+    GString* new_name;
+    gboolean res;
+    int op;
+
+    name = g_string_new(NULL);
+    new_name = g_string_new(NULL);
+
+    res = TRUE;
+    while ((op = getc(fp)) != EOF) {
+	switch (op) {
+	case RENAME_PLAN_ROOT:
+	case RENAME_PLAN_ENTER:
+	    res = read_string(fp, name);
+	    break;
+	case RENAME_PLAN_LEAVE:
+	    break;
+	case RENAME_PLAN_MOVE:
+	    res = read_string(fp, name) && read_string(fp, new_name);
+	    break;
+	default:
+	    res = FALSE;
+	    break;
+	}
+
+	if (!res) {
+	    g_set_error_literal(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		    "The rename plan is corrupted");
+	    break;
+	}
+
+	if (!func(op, name->str, new_name->str, data))
+	    break;
+    }
+
+    g_string_free(name, TRUE);
+    g_string_free(new_name, TRUE);
+
+    return res;
+}
+
+gboolean
+rename_plan_foreach(RenamePlan* plan, RenamePlanFunc func,
+	gpointer data, GError** error)
+{
+    FILE* fp;
+    gboolean res;
+
+    if (plan->spill != NULL)
+	rename_plan_spill(plan);
+
+    if (plan->error != NULL) {
+	g_propagate_error(error, g_error_copy(plan->error));
+	return FALSE;
+    }
+
+    if (plan->spill != NULL) {
+	fflush(plan->spill);
+	fseek(plan->spill, 0, SEEK_SET);
+	return rename_plan_read(plan->spill, func, data, error);
+    }
+
+    if (plan->buffer->len == 0)
+	return TRUE;
+
+    fp = fmemopen(plan->buffer->data, plan->buffer->len, "rb");
+    if (fp == NULL) {
+	g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		"%s", g_strerror(errno));
+	return FALSE;
+    }
+    res = rename_plan_read(fp, func, data, error);
+    fclose(fp);
+
+    return res;
+}
+
+/*
+ * The path of the current directory is only kept for the error function;
+ * the renames are done by the engine relative to the open directory.
+ */
+typedef struct _RenamePlanApplyState {
+    RenameEngine* engine;
+    RenameExecutor* executor;
+    GString* path;
+    GArray* lengths;        /* of path before each ENTER */
+    RenamePlanErrorFunc func;
+    gpointer data;
+    RepairProgress* progress;
+    RenameThrottle* throttle;
+} RenamePlanApplyState;
+
+static gboolean
+rename_plan_apply_op(RenamePlanOp op, const char* name, const char* new_name,
+	RenamePlanApplyState* state)
+{
+    GFile* dir;
+    GFile* src;
+    GError* error = NULL;
+    gint64 start_time;
+    gsize len;
+    gboolean renamed;
+    gboolean res = TRUE;
+
+    switch (op) {
+    case RENAME_PLAN_ROOT:
+	// A root which cannot be opened fails each of its renames.
+	rename_engine_open(state->engine, name, NULL);
+	g_string_assign(state->path, name);
+	g_array_set_size(state->lengths, 0);
+	break;
+    case RENAME_PLAN_ENTER:
+	rename_engine_enter(state->engine, name);
+	len = state->path->len;
+	g_array_append_val(state->lengths, len);
+	if (len == 0 || state->path->str[len - 1] != G_DIR_SEPARATOR)
+	    g_string_append_c(state->path, G_DIR_SEPARATOR);
+	g_string_append(state->path, name);
+	repair_progress_add_pending_dirs(state->progress, 1);
+	break;
+    case RENAME_PLAN_LEAVE:
+	rename_engine_leave(state->engine);
+	len = g_array_index(state->lengths, gsize, state->lengths->len - 1);
+	g_array_set_size(state->lengths, state->lengths->len - 1);
+	g_string_truncate(state->path, len);
+	repair_progress_add_pending_dirs(state->progress, -1);
+	break;
+    case RENAME_PLAN_MOVE:
+	start_time = rename_throttle_acquire(state->throttle);
+	renamed = rename_engine_rename(state->engine, name, new_name, &error);
+	rename_throttle_release(state->throttle, start_time);
+	if (!renamed) {
+	    if (state->func != NULL) {
+		dir = g_file_new_for_path(state->path->str);
+		src = g_file_get_child(dir, name);
+		res = state->func(src, new_name, error, state->data);
+		g_object_unref(src);
+		g_object_unref(dir);
+	    }
+	    g_error_free(error);
+	}
+
+	repair_progress_add_entry(state->progress, name);
+	repair_progress_add_done(state->progress, 1);
+	repair_progress_tick(state->progress);
+	break;
+    }
+
+    return res;
+}
+
+/*
+ * The executor keeps its own directories and reports the errors itself.
+ */
+static gboolean
+rename_plan_apply_op_parallel(RenamePlanOp op, const char* name,
+	const char* new_name, RenamePlanApplyState* state)
+{
+    switch (op) {
+    case RENAME_PLAN_ROOT:
+	rename_executor_open(state->executor, name);
+	break;
+    case RENAME_PLAN_ENTER:
+	rename_executor_enter(state->executor, name);
+	repair_progress_add_pending_dirs(state->progress, 1);
+	break;
+    case RENAME_PLAN_LEAVE:
+	rename_executor_leave(state->executor);
+	repair_progress_add_pending_dirs(state->progress, -1);
+	break;
+    case RENAME_PLAN_MOVE:
+	return rename_executor_rename(state->executor, name, new_name);
+    }
+
+    return TRUE;
+}
+
+/*
+ * The progress counts the renames of rename_plan_apply().
+ */
+void
+rename_plan_set_progress(RenamePlan* plan, RepairProgress* progress)
+{
+    plan->progress = progress;
+}
+
+/*
+ * With more than one job, rename_plan_apply() renames in different
+ * directories at the same time.
+ */
+void
+rename_plan_set_jobs(RenamePlan* plan, guint n_jobs)
+{
+    plan->n_jobs = n_jobs;
+}
+
+/*
+ * The renames of rename_plan_apply() are written to the journal before
+ * they are done.
+ */
+void
+rename_plan_set_journal(RenamePlan* plan, RenameJournal* journal)
+{
+    plan->journal = journal;
+}
+
+/*
+ * rename_plan_apply() starts the renames as fast as the throttle lets it.
+ */
+void
+rename_plan_set_throttle(RenamePlan* plan, RenameThrottle* throttle)
+{
+    plan->throttle = throttle;
+}
+
+/*
+ * The renames go on after a failure unless the error function says to
+ * stop; stopping is not an error of the plan.
+ */
+gboolean
+rename_plan_apply(RenamePlan* plan, RenamePlanErrorFunc func,
+	gpointer data, GError** error)
+{
+    RenamePlanApplyState state;
+    RenamePlanFunc op_func;
+    gboolean parallel;
+    gboolean res;
+
+    // The executor submits the renames of a directory to io_uring in
+    // batches, which pays off even on one thread.
+#ifdef HAVE_LIBURING
+    parallel = TRUE;
+#else
+    // and only it keeps a journal
+    parallel = plan->n_jobs > 1 || plan->journal != NULL;
+#endif
+
+    state.engine = NULL;
+    state.executor = NULL;
+    if (parallel) {
+	state.executor = rename_executor_new(MAX(plan->n_jobs, 1), func, data,
+		plan->progress);
+	rename_executor_set_journal(state.executor, plan->journal);
+	rename_executor_set_throttle(state.executor, plan->throttle);
+	op_func = (RenamePlanFunc)rename_plan_apply_op_parallel;
+    } else {
+	state.engine = rename_engine_new();
+	op_func = (RenamePlanFunc)rename_plan_apply_op;
+    }
+    state.path = g_string_new(NULL);
+    state.lengths = g_array_new(FALSE, FALSE, sizeof(gsize));
+    state.func = func;
+    state.data = data;
+    state.progress = plan->progress;
+    state.throttle = plan->throttle;
+    if (plan->progress != NULL)
+	repair_progress_start(plan->progress, plan->n_moves);
+
+    res = rename_plan_foreach(plan, op_func, &state, error);
+    if (state.executor != NULL)
+	rename_executor_free(state.executor);
+    if (state.engine != NULL)
+	rename_engine_free(state.engine);
+    g_string_free(state.path, TRUE);
+    g_array_free(state.lengths, TRUE);
+
+    return res;
+}
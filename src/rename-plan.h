@@ -0,0 +1,76 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_rename_plan_h
+#define nautilus_filename_repairer_rename_plan_h
+
+#include <gio/gio.h>
+
+#include "repair-progress.h"
+#include "rename-throttle.h"
+
+typedef struct _RenamePlan RenamePlan;
+
+// rename-journal.h needs this header
+struct _RenameJournal;
+
+typedef enum {
+    RENAME_PLAN_ROOT,      /* name is the directory the next ops are in */
+    RENAME_PLAN_ENTER,     /* go down into the directory name */
+    RENAME_PLAN_LEAVE,     /* go back up to the parent */
+    RENAME_PLAN_MOVE       /* rename name to new_name */
+} RenamePlanOp;
+
+typedef gboolean (*RenamePlanFunc)(RenamePlanOp op, const char* name,
+				   const char* new_name, gpointer data);
+/* returns FALSE to stop the renames */
+typedef gboolean (*RenamePlanErrorFunc)(GFile* file, const char* new_name,
+					GError* error, gpointer data);
+
+RenamePlan* rename_plan_new(gsize memory_budget);
+RenamePlan* rename_plan_new_with_file(gsize memory_budget, const char* path);
+RenamePlan* rename_plan_open(gsize memory_budget, const char* path,
+			     guint64 size, guint64 n_moves, guint depth,
+			     GError** error);
+void        rename_plan_free(RenamePlan* plan);
+
+void        rename_plan_add_root(RenamePlan* plan, const char* dir);
+void        rename_plan_enter(RenamePlan* plan, const char* name);
+void        rename_plan_leave(RenamePlan* plan);
+void        rename_plan_add_move(RenamePlan* plan,
+				 const char* name, const char* new_name);
+
+guint64     rename_plan_get_n_moves(RenamePlan* plan);
+gboolean    rename_plan_sync(RenamePlan* plan, guint64* size, GError** error);
+gboolean    rename_plan_foreach(RenamePlan* plan, RenamePlanFunc func,
+				gpointer data, GError** error);
+void        rename_plan_set_progress(RenamePlan* plan,
+				     RepairProgress* progress);
+void        rename_plan_set_jobs(RenamePlan* plan, guint n_jobs);
+void        rename_plan_set_journal(RenamePlan* plan,
+				    struct _RenameJournal* journal);
+void        rename_plan_set_throttle(RenamePlan* plan,
+				     RenameThrottle* throttle);
+gboolean    rename_plan_apply(RenamePlan* plan, RenamePlanErrorFunc func,
+			      gpointer data, GError** error);
+
+#endif /* nautilus_filename_repairer_rename_plan_h */
@@ -0,0 +1,358 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "rename-dir-index.h"
+#include "rename-journal.h"
+
+/*
+ * Checks the order rename_dir_index_foreach_move() gives the renames of a
+ * directory, and the undo and the recovery of a journal whose last record
+ * was torn.  The journal tests work in a temporary directory.
+ *
+ *   ./rename-test
+ */
+
+/*
+ * The names of a directory, as the moves leave them.  A move must find
+ * its old name there and not its new one.
+ */
+typedef struct _MoveDir {
+    GHashTable* names;
+    guint n_moves;
+} MoveDir;
+
+typedef struct _MoveCase {
+    const char* name;
+    const char* new_name;       /* NULL when it keeps its name */
+} MoveCase;
+
+static void
+on_move(guint32 id, const char* name, const char* new_name, MoveDir* dir)
+{
+    g_assert_true(g_hash_table_contains(dir->names, name));
+    g_assert_false(g_hash_table_contains(dir->names, new_name));
+
+    g_hash_table_remove(dir->names, name);
+    g_hash_table_add(dir->names, g_strdup(new_name));
+    dir->n_moves++;
+}
+
+/*
+ * Adds the entries, does their moves on the names, and compares what is
+ * left with the names expected, which are separated by spaces.
+ */
+static void
+check_moves(const MoveCase* entries, guint n_entries, const char* expected,
+	guint n_moves)
+{
+    RenameDirIndex* index;
+    MoveDir dir;
+    char** names;
+    guint i;
+
+    index = rename_dir_index_new();
+    dir.names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    dir.n_moves = 0;
+    for (i = 0; i < n_entries; i++) {
+	rename_dir_index_add(index, i, entries[i].name, entries[i].new_name);
+	g_hash_table_add(dir.names, g_strdup(entries[i].name));
+    }
+
+    rename_dir_index_foreach_move(index,
+	    (RenameDirIndexMoveFunc)on_move, &dir);
+
+    names = g_strsplit(expected, " ", -1);
+    g_assert_cmpuint(g_hash_table_size(dir.names), ==, g_strv_length(names));
+    for (i = 0; names[i] != NULL; i++)
+	g_assert_true(g_hash_table_contains(dir.names, names[i]));
+    g_assert_cmpuint(dir.n_moves, ==, n_moves);
+
+    g_strfreev(names);
+    g_hash_table_destroy(dir.names);
+    rename_dir_index_free(index);
+}
+
+static void
+test_move_chain(void)
+{
+    // each waits for the next one, which is added after it
+    static const MoveCase entries[] = {
+	{ "a", "b" },
+	{ "b", "c" },
+	{ "c", "d" },
+	{ "x", NULL },
+    };
+
+    check_moves(entries, G_N_ELEMENTS(entries), "b c d x", 3);
+}
+
+static void
+test_move_cycles(void)
+{
+    // a cycle of two and one of three, next to a chain
+    static const MoveCase entries[] = {
+	{ "a", "b" },
+	{ "b", "a" },
+	{ "p", "q" },
+	{ "q", "r" },
+	{ "r", "p" },
+	{ "x", "y" },
+	{ "w", "x" },
+    };
+
+    // every cycle takes one more step, through a temporary name
+    check_moves(entries, G_N_ELEMENTS(entries), "a b p q r x y", 9);
+}
+
+static void
+test_move_collisions(void)
+{
+    // b loses x to a and keeps its name, which c then cannot have; d
+    // cannot have the name of e, which is not renamed
+    static const MoveCase entries[] = {
+	{ "a", "x" },
+	{ "b", "x" },
+	{ "c", "b" },
+	{ "d", "e" },
+	{ "e", NULL },
+    };
+
+    check_moves(entries, G_N_ELEMENTS(entries), "x b c d e", 1);
+}
+
+static void
+test_move_too_long(void)
+{
+    MoveCase entries[2];
+    char long_name[300];
+
+    memset(long_name, 'n', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = '\0';
+
+    // a keeps its name, so b cannot have it
+    entries[0].name = "a";
+    entries[0].new_name = long_name;
+    entries[1].name = "b";
+    entries[1].new_name = "a";
+    check_moves(entries, G_N_ELEMENTS(entries), "a b", 0);
+}
+
+/*
+ * A journal of a run in a directory with the files a1, b1 and c1, each
+ * to be renamed to the same letter with 2, which was cut off while it
+ * wrote its last record.
+ */
+typedef struct _JournalRun {
+    char* dir;
+    char* path;
+} JournalRun;
+
+static gboolean
+on_replay_error(GFile* file, const char* new_name, GError* error,
+	gpointer data)
+{
+    g_error("%s", error->message);
+    return FALSE;
+}
+
+static gboolean
+journal_run_has(JournalRun* run, const char* name)
+{
+    char* path;
+    gboolean res;
+
+    path = g_build_filename(run->dir, name, NULL);
+    res = g_file_test(path, G_FILE_TEST_EXISTS);
+    g_free(path);
+
+    return res;
+}
+
+static void
+journal_run_rename(JournalRun* run, const char* name, const char* new_name)
+{
+    char* path;
+    char* new_path;
+
+    path = g_build_filename(run->dir, name, NULL);
+    new_path = g_build_filename(run->dir, new_name, NULL);
+    g_assert_cmpint(g_rename(path, new_path), ==, 0);
+    g_free(path);
+    g_free(new_path);
+}
+
+/*
+ * Writes the records of the first n_records renames and does the first
+ * n_done of them, and then cuts off the last cut bytes of the journal,
+ * which tears the last record.
+ */
+static void
+journal_run_init(JournalRun* run, guint n_records, guint n_done, gsize cut)
+{
+    static const char* names[] = { "a", "b", "c" };
+    RenameJournal* journal;
+    GError* error = NULL;
+    GStatBuf st;
+    guint dir;
+    guint i;
+
+    run->dir = g_dir_make_tmp("rename-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    run->path = g_build_filename(run->dir, "journal", NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(names); i++) {
+	char* name = g_strdup_printf("%s1", names[i]);
+	char* path = g_build_filename(run->dir, name, NULL);
+
+	g_file_set_contents(path, "", 0, &error);
+	g_assert_no_error(error);
+	g_free(path);
+	g_free(name);
+    }
+
+    journal = rename_journal_new(run->path, &error);
+    g_assert_no_error(error);
+    dir = rename_journal_add_dir(journal, run->dir);
+
+    for (i = 0; i < n_records; i++) {
+	char* name = g_strdup_printf("%s1", names[i]);
+	char* new_name = g_strdup_printf("%s2", names[i]);
+	guint64 seq;
+
+	seq = rename_journal_add_rename(journal, dir, name, new_name);
+	if (i < n_done) {
+	    rename_journal_sync(journal, seq, &error);
+	    g_assert_no_error(error);
+	    journal_run_rename(run, name, new_name);
+	    rename_journal_add_done(journal, dir, name);
+	}
+	g_free(name);
+	g_free(new_name);
+    }
+
+    // cut off: no rename_journal_finish()
+    rename_journal_sync(journal, G_MAXUINT64, &error);
+    g_assert_no_error(error);
+    rename_journal_free(journal);
+
+    g_assert_cmpint(g_stat(run->path, &st), ==, 0);
+    g_assert_cmpint(truncate(run->path, st.st_size - cut), ==, 0);
+    g_assert_true(rename_journal_is_cut_off(run->path));
+}
+
+static void
+journal_run_free(JournalRun* run)
+{
+    static const char* names[] = {
+	"a1", "a2", "b1", "b2", "c1", "c2", "journal"
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(names); i++) {
+	char* path = g_build_filename(run->dir, names[i], NULL);
+	g_unlink(path);
+	g_free(path);
+    }
+    g_rmdir(run->dir);
+    g_free(run->dir);
+    g_free(run->path);
+}
+
+static void
+test_journal_undo_torn(void)
+{
+    JournalRun run;
+    GError* error = NULL;
+
+    // the record of b1 was torn in its new name, so it was not done
+    journal_run_init(&run, 2, 1, 2);
+    g_assert_true(journal_run_has(&run, "a2"));
+    g_assert_true(journal_run_has(&run, "b1"));
+
+    rename_journal_undo(run.path, on_replay_error, NULL, &error);
+    g_assert_no_error(error);
+
+    g_assert_true(journal_run_has(&run, "a1"));
+    g_assert_false(journal_run_has(&run, "a2"));
+    g_assert_true(journal_run_has(&run, "b1"));
+    g_assert_false(journal_run_has(&run, "b2"));
+    g_assert_false(g_file_test(run.path, G_FILE_TEST_EXISTS));
+
+    journal_run_free(&run);
+}
+
+static void
+test_journal_recover_torn(void)
+{
+    JournalRun run;
+    GError* error = NULL;
+
+    // the rename of b1 was synced but not done; the record of c1 was
+    // torn in the number of its directory
+    journal_run_init(&run, 3, 1, 7);
+    g_assert_true(journal_run_has(&run, "b1"));
+
+    rename_journal_recover(run.path, on_replay_error, NULL, &error);
+    g_assert_no_error(error);
+
+    g_assert_true(journal_run_has(&run, "a2"));
+    g_assert_true(journal_run_has(&run, "b2"));
+    g_assert_true(journal_run_has(&run, "c1"));
+    g_assert_false(journal_run_has(&run, "c2"));
+    g_assert_false(rename_journal_is_cut_off(run.path));
+
+    // what the recovery wrote after the torn record is read back
+    rename_journal_undo(run.path, on_replay_error, NULL, &error);
+    g_assert_no_error(error);
+
+    g_assert_true(journal_run_has(&run, "a1"));
+    g_assert_true(journal_run_has(&run, "b1"));
+    g_assert_true(journal_run_has(&run, "c1"));
+    g_assert_false(g_file_test(run.path, G_FILE_TEST_EXISTS));
+
+    journal_run_free(&run);
+}
+
+int main(int argc, char** argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/rename-dir-index/move-chain", test_move_chain);
+    g_test_add_func("/rename-dir-index/move-cycles", test_move_cycles);
+    g_test_add_func("/rename-dir-index/move-collisions", test_move_collisions);
+    g_test_add_func("/rename-dir-index/move-too-long", test_move_too_long);
+    g_test_add_func("/rename-journal/undo-torn", test_journal_undo_torn);
+    g_test_add_func("/rename-journal/recover-torn", test_journal_recover_torn);
+
+    return g_test_run();
+}
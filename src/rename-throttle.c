@@ -0,0 +1,252 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "rename-throttle.h"
+
+// the tokens which may pile up, in seconds of the rate
+#define RENAME_THROTTLE_BURST         0.1
+// the rate goes down at most this often
+#define RENAME_THROTTLE_BACKOFF_INTERVAL  G_USEC_PER_SEC
+// and up by this many renames per second, every second
+#define RENAME_THROTTLE_INCREASE      10.0
+#define RENAME_THROTTLE_MIN_RATE      1.0
+
+/*
+ * Holds the renames back so that a shared file server is not flooded: a
+ * token bucket gives out rate renames per second, and no more than
+ * max_in_flight are started and not finished.  The renames are started
+ * with rename_throttle_acquire() and finished with
+ * rename_throttle_release(), from any thread.
+ *
+ * With max_latency, a rename which takes longer than that many
+ * milliseconds halves the rate, at most once a second, and the rate then
+ * grows back by a few renames per second every second, up to the rate
+ * given.  Without a rate given, the first slow rename sets it to half the
+ * rate measured until then.  The current rate is shown by the progress.
+ *
+ * A NULL throttle holds nothing back, so the callers need not check.
+ */
+struct _RenameThrottle {
+    GMutex lock;
+    GCond cond;
+
+    gdouble max_rate;           /* as given, 0 for none */
+    gdouble rate;               /* now, 0 for none */
+    gdouble tokens;
+    gint64 last_fill;
+    guint max_in_flight;        /* 0 for any number */
+    guint n_in_flight;
+    gint64 max_latency;         /* in microseconds, 0 for any */
+    gint64 last_backoff;
+
+    gint64 start_time;
+    guint64 n_done;
+
+    RepairProgress* progress;
+};
+
+/*
+ * rate, max_in_flight and max_latency are 0 for no limit.
+ */
+RenameThrottle*
+rename_throttle_new(guint rate, guint max_in_flight, guint max_latency,
+	RepairProgress* progress)
+{
+    RenameThrottle* throttle;
+
+    throttle = g_new0(RenameThrottle, 1);
+    g_mutex_init(&throttle->lock);
+    g_cond_init(&throttle->cond);
+    throttle->max_rate = rate;
+    throttle->rate = rate;
+    throttle->tokens = MIN(rate, 1);
+    throttle->last_fill = g_get_monotonic_time();
+    throttle->max_in_flight = max_in_flight;
+    throttle->max_latency = (gint64)max_latency * 1000;
+    throttle->start_time = throttle->last_fill;
+    throttle->progress = progress;
+    repair_progress_set_rate_limit(progress, rate);
+
+    return throttle;
+}
+
+void
+rename_throttle_free(RenameThrottle* throttle)
+{
+    if (throttle == NULL)
+	return;
+
+    g_mutex_clear(&throttle->lock);
+    g_cond_clear(&throttle->cond);
+    g_free(throttle);
+}
+
+static void
+rename_throttle_fill(RenameThrottle* throttle, gint64 now)
+{
+    gdouble burst;
+
+    if (throttle->rate > 0) {
+	burst = MAX(throttle->rate * RENAME_THROTTLE_BURST, 1.0);
+	throttle->tokens += throttle->rate *
+			    (now - throttle->last_fill) / G_USEC_PER_SEC;
+	throttle->tokens = MIN(throttle->tokens, burst);
+    }
+    throttle->last_fill = now;
+}
+
+/*
+ * Returns how long to wait for a token, 0 when there is one, or -1 when
+ * only a finished rename can let the next one start.
+ */
+static gint64
+rename_throttle_take(RenameThrottle* throttle)
+{
+    if (throttle->max_in_flight > 0 &&
+	throttle->n_in_flight >= throttle->max_in_flight)
+	return -1;
+
+    rename_throttle_fill(throttle, g_get_monotonic_time());
+    if (throttle->rate > 0) {
+	if (throttle->tokens < 1.0) {
+	    return MAX((1.0 - throttle->tokens) * G_USEC_PER_SEC /
+		       throttle->rate, 1);
+	}
+	throttle->tokens -= 1.0;
+    }
+
+    throttle->n_in_flight++;
+    return 0;
+}
+
+/*
+ * Waits until a rename may start, and returns the time it starts, to be
+ * given to rename_throttle_release().
+ */
+gint64
+rename_throttle_acquire(RenameThrottle* throttle)
+{
+    gint64 wait;
+
+    if (throttle == NULL)
+	return 0;
+
+    g_mutex_lock(&throttle->lock);
+    while ((wait = rename_throttle_take(throttle)) != 0) {
+	if (wait < 0)
+	    g_cond_wait(&throttle->cond, &throttle->lock);
+	else
+	    g_cond_wait_until(&throttle->cond, &throttle->lock,
+		    g_get_monotonic_time() + wait);
+    }
+    g_mutex_unlock(&throttle->lock);
+
+    return g_get_monotonic_time();
+}
+
+/*
+ * Like rename_throttle_acquire(), for a caller which has renames of its
+ * own in flight and must not wait for them: returns FALSE at once when
+ * the rename may not start yet.
+ */
+gboolean
+rename_throttle_try_acquire(RenameThrottle* throttle, gint64* start_time)
+{
+    gboolean res;
+
+    *start_time = 0;
+    if (throttle == NULL)
+	return TRUE;
+
+    g_mutex_lock(&throttle->lock);
+    res = rename_throttle_take(throttle) == 0;
+    g_mutex_unlock(&throttle->lock);
+
+    if (res)
+	*start_time = g_get_monotonic_time();
+    return res;
+}
+
+static void
+rename_throttle_set_rate(RenameThrottle* throttle, gdouble rate)
+{
+    if ((guint)rate != (guint)throttle->rate)
+	repair_progress_set_rate_limit(throttle->progress, rate);
+    throttle->rate = rate;
+}
+
+/*
+ * Finishes a rename which was started at start_time, whether it
+ * succeeded or not; 0 is a rename which was not done after all.
+ */
+void
+rename_throttle_release(RenameThrottle* throttle, gint64 start_time)
+{
+    gint64 now;
+
+    if (throttle == NULL)
+	return;
+
+    now = g_get_monotonic_time();
+
+    g_mutex_lock(&throttle->lock);
+    throttle->n_in_flight--;
+
+    if (start_time > 0 && throttle->max_latency > 0) {
+	throttle->n_done++;
+	if (now - start_time > throttle->max_latency) {
+	    if (now - throttle->last_backoff >= RENAME_THROTTLE_BACKOFF_INTERVAL) {
+		gdouble rate = throttle->rate;
+
+		if (rate == 0) {
+		    rate = throttle->n_done * (gdouble)G_USEC_PER_SEC /
+			   MAX(now - throttle->start_time, 1);
+		}
+		rate = MAX(rate / 2, RENAME_THROTTLE_MIN_RATE);
+		rename_throttle_fill(throttle, now);
+		throttle->tokens = MIN(throttle->tokens, 1.0);
+		rename_throttle_set_rate(throttle, rate);
+		throttle->last_backoff = now;
+	    }
+	} else if (throttle->rate > 0 &&
+		   (throttle->max_rate == 0 ||
+		    throttle->rate < throttle->max_rate)) {
+	    // about RENAME_THROTTLE_INCREASE more every second
+	    gdouble rate;
+
+	    rate = throttle->rate + RENAME_THROTTLE_INCREASE / throttle->rate;
+	    if (throttle->max_rate > 0)
+		rate = MIN(rate, throttle->max_rate);
+	    rename_throttle_fill(throttle, now);
+	    rename_throttle_set_rate(throttle, rate);
+	}
+    }
+
+    g_cond_broadcast(&throttle->cond);
+    g_mutex_unlock(&throttle->lock);
+}
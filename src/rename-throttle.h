@@ -0,0 +1,43 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_rename_throttle_h
+#define nautilus_filename_repairer_rename_throttle_h
+
+#include <glib.h>
+
+#include "repair-progress.h"
+
+typedef struct _RenameThrottle RenameThrottle;
+
+RenameThrottle* rename_throttle_new(guint rate, guint max_in_flight,
+				    guint max_latency,
+				    RepairProgress* progress);
+void            rename_throttle_free(RenameThrottle* throttle);
+
+gint64          rename_throttle_acquire(RenameThrottle* throttle);
+gboolean        rename_throttle_try_acquire(RenameThrottle* throttle,
+					    gint64* start_time);
+void            rename_throttle_release(RenameThrottle* throttle,
+					gint64 start_time);
+
+#endif // nautilus_filename_repairer_rename_throttle_h
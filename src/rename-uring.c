@@ -0,0 +1,304 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <liburing.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "rename-uring.h"
+#include "rename-engine.h"
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+/*
+ * Renames the entries of one directory through io_uring
+ * (IORING_OP_RENAMEAT, Linux 5.11), up to depth of them at a time, so
+ * that a whole batch takes a few system calls and a network file system
+ * gets many requests at once.
+ *
+ * The renames are given as in a RenameBatch: each name and new name
+ * ending with 0, one after the other.  Renames which are in flight
+ * together may be done in any order, so a rename which has a name in
+ * common with one in flight waits until that one is done; the others
+ * don't depend on each other, and the result is the same as when they
+ * are done one by one.
+ *
+ * A throttle may hold the submissions back; a rename is started in the
+ * throttle when it is submitted and finished when it completes.
+ *
+ * A ring is used by one thread at a time.
+ */
+typedef struct _RenameUringOp {
+    const char* name;   /* NULL when not in flight */
+    gint64 start_time;  /* in the throttle */
+} RenameUringOp;
+
+struct _RenameUring {
+    struct io_uring ring;
+    guint depth;
+    guint n_in_flight;
+    GHashTable* names;  /* the names and new names in flight */
+    RenameUringOp* ops;
+    GPtrArray* free_ops;
+    gboolean broken;
+};
+
+/*
+ * Fails when the kernel has no io_uring or doesn't know IORING_OP_RENAMEAT;
+ * the renames are done one by one then.
+ */
+RenameUring*
+rename_uring_new(guint depth, GError** error)
+{
+    RenameUring* ring;
+    struct io_uring_probe* probe;
+    gboolean supported;
+    guint i;
+    int res;
+
+    ring = g_new0(RenameUring, 1);
+    res = io_uring_queue_init(depth, &ring->ring, 0);
+    if (res < 0) {
+	g_set_error_literal(error, G_IO_ERROR, g_io_error_from_errno(-res),
+		g_strerror(-res));
+	g_free(ring);
+	return NULL;
+    }
+
+    probe = io_uring_get_probe_ring(&ring->ring);
+    supported = probe != NULL &&
+		io_uring_opcode_supported(probe, IORING_OP_RENAMEAT);
+    if (probe != NULL)
+	io_uring_free_probe(probe);
+    if (!supported) {
+	g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+		"io_uring cannot rename here");
+	io_uring_queue_exit(&ring->ring);
+	g_free(ring);
+	return NULL;
+    }
+
+    ring->depth = depth;
+    ring->names = g_hash_table_new(g_str_hash, g_str_equal);
+    ring->ops = g_new0(RenameUringOp, depth);
+    ring->free_ops = g_ptr_array_sized_new(depth);
+    for (i = 0; i < depth; i++)
+	g_ptr_array_add(ring->free_ops, &ring->ops[i]);
+
+    return ring;
+}
+
+void
+rename_uring_free(RenameUring* ring)
+{
+    io_uring_queue_exit(&ring->ring);
+    g_hash_table_destroy(ring->names);
+    g_free(ring->ops);
+    g_ptr_array_free(ring->free_ops, TRUE);
+    g_free(ring);
+}
+
+/*
+ * A ring which failed to submit is not used again.
+ */
+gboolean
+rename_uring_is_broken(RenameUring* ring)
+{
+    return ring->broken;
+}
+
+static const char*
+next_name(const char* name)
+{
+    return name + strlen(name) + 1;
+}
+
+static gboolean
+rename_uring_complete(RenameUring* ring, int fd, RenameUringOp* op, int res,
+	RenameThrottle* throttle, RenameUringFunc func, gpointer data)
+{
+    const char* name;
+    const char* new_name;
+    GError* error = NULL;
+    gboolean go_on;
+
+    name = op->name;
+    new_name = next_name(name);
+    g_hash_table_remove(ring->names, name);
+    g_hash_table_remove(ring->names, new_name);
+    op->name = NULL;
+    g_ptr_array_add(ring->free_ops, op);
+    ring->n_in_flight--;
+    rename_throttle_release(throttle, op->start_time);
+
+    // EINVAL is a file system which doesn't know RENAME_NOREPLACE; the
+    // engine knows how to do without it.
+    if (res == -EINVAL)
+	rename_engine_rename_at(fd, name, new_name, &error);
+    else if (res < 0)
+	g_set_error_literal(&error, G_IO_ERROR, g_io_error_from_errno(-res),
+		g_strerror(-res));
+
+    go_on = func(name, new_name, error, data);
+    if (error != NULL)
+	g_error_free(error);
+
+    return go_on;
+}
+
+/*
+ * When the ring breaks nothing tells which of the renames in flight were
+ * done, so it is looked up in the directory: a rename whose name is gone
+ * and whose new name is there was done, and one whose name is still
+ * there is done again by rename_uring_complete(), as for a file system
+ * which doesn't know RENAME_NOREPLACE.  Each is passed to func, whatever
+ * it returns.
+ */
+static void
+rename_uring_settle(RenameUring* ring, int fd, RenameThrottle* throttle,
+	RenameUringFunc func, gpointer data)
+{
+    guint i;
+
+    for (i = 0; i < ring->depth; i++) {
+	RenameUringOp* op = &ring->ops[i];
+	struct stat st;
+	int res;
+
+	if (op->name == NULL)
+	    continue;
+
+	if (fstatat(fd, op->name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+	    res = -EINVAL;
+	else if (errno != ENOENT)
+	    res = -errno;
+	else if (fstatat(fd, next_name(op->name), &st,
+		    AT_SYMLINK_NOFOLLOW) == 0)
+	    res = 0;
+	else
+	    res = -errno;
+
+	rename_uring_complete(ring, fd, op, res, throttle, func, data);
+    }
+}
+
+/*
+ * Renames the entries from renames to end in the directory fd, and calls
+ * func for each.  Returns where it stopped: end when all were done, or
+ * the first rename which was not submitted, when func said to stop, when
+ * the file system turned out not to know RENAME_NOREPLACE or when the
+ * ring broke.  The caller does the rest one by one, if it wants to.
+ */
+const char*
+rename_uring_run(RenameUring* ring, int fd, const char* renames,
+	const char* end, RenameThrottle* throttle,
+	RenameUringFunc func, gpointer data)
+{
+    const char* name;
+    gboolean stop = FALSE;
+
+    name = renames;
+    g_hash_table_remove_all(ring->names);
+
+    while ((!stop && name < end) || ring->n_in_flight > 0) {
+	struct io_uring_cqe* cqe;
+	int res;
+
+	while (!stop && name < end && ring->n_in_flight < ring->depth) {
+	    struct io_uring_sqe* sqe;
+	    RenameUringOp* op;
+	    const char* new_name;
+	    gint64 start_time;
+
+	    new_name = next_name(name);
+	    if (g_hash_table_contains(ring->names, name) ||
+		g_hash_table_contains(ring->names, new_name))
+		break;
+
+	    // The renames in flight here may be what the throttle waits
+	    // for, so it is only waited for when there are none.
+	    if (!rename_throttle_try_acquire(throttle, &start_time)) {
+		if (ring->n_in_flight > 0)
+		    break;
+		start_time = rename_throttle_acquire(throttle);
+	    }
+
+	    sqe = io_uring_get_sqe(&ring->ring);
+	    if (sqe == NULL) {
+		rename_throttle_release(throttle, 0);
+		break;
+	    }
+
+	    op = g_ptr_array_remove_index_fast(ring->free_ops,
+		    ring->free_ops->len - 1);
+	    op->name = name;
+	    op->start_time = start_time;
+	    io_uring_prep_renameat(sqe, fd, name, fd, new_name,
+		    RENAME_NOREPLACE);
+	    io_uring_sqe_set_data(sqe, op);
+	    g_hash_table_add(ring->names, (gpointer)name);
+	    g_hash_table_add(ring->names, (gpointer)new_name);
+	    ring->n_in_flight++;
+
+	    name = next_name(new_name);
+	}
+
+	if (ring->n_in_flight == 0)
+	    break;
+
+	res = io_uring_submit_and_wait(&ring->ring, 1);
+	if (res < 0 && res != -EINTR && res != -EAGAIN && res != -EBUSY) {
+	    g_warning("io_uring: %s", g_strerror(-res));
+	    ring->broken = TRUE;
+	    rename_uring_settle(ring, fd, throttle, func, data);
+	    return name;
+	}
+
+	while (io_uring_peek_cqe(&ring->ring, &cqe) == 0) {
+	    RenameUringOp* op = io_uring_cqe_get_data(cqe);
+
+	    res = cqe->res;
+	    io_uring_cqe_seen(&ring->ring, cqe);
+
+	    if (res == -EINVAL)
+		stop = TRUE;
+	    if (!rename_uring_complete(ring, fd, op, res, throttle, func, data))
+		stop = TRUE;
+	}
+    }
+
+    return name;
+}
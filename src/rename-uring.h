@@ -0,0 +1,49 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_rename_uring_h
+#define nautilus_filename_repairer_rename_uring_h
+
+#include <glib.h>
+
+#include "rename-throttle.h"
+
+typedef struct _RenameUring RenameUring;
+
+/*
+ * Called for each rename when it has been done; error is NULL when it
+ * succeeded.  Returning FALSE stops the renames which are not submitted
+ * yet.
+ */
+typedef gboolean (*RenameUringFunc)(const char* name, const char* new_name,
+				    const GError* error, gpointer data);
+
+RenameUring* rename_uring_new(guint depth, GError** error);
+void         rename_uring_free(RenameUring* ring);
+gboolean     rename_uring_is_broken(RenameUring* ring);
+
+const char*  rename_uring_run(RenameUring* ring, int fd,
+			      const char* renames, const char* end,
+			      RenameThrottle* throttle,
+			      RenameUringFunc func, gpointer data);
+
+#endif // nautilus_filename_repairer_rename_uring_h
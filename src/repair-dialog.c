@@ -25,22 +25,30 @@
 #endif
 
 #include <string.h>
-#include <locale.h>
 #include <gtk/gtk.h>
 
 #include "nautilus-filename-repairer-i18n.h"
 #include "repair-dialog.h"
 #include "encoding-dialog.h"
 #include "repairer-utils.h"
-
-
-enum {
-    FILE_COLUMN_GFILE,
-    FILE_COLUMN_NAME,
-    FILE_COLUMN_DISPLAY_NAME,
-    FILE_COLUMN_NEW_NAME,
-    FILE_NUM_COLUMNS
-};
+#include "filename-converter.h"
+#include "rename-plan.h"
+#include "rename-executor.h"
+#include "rename-journal.h"
+#include "repair-scanner.h"
+#include "repair-progress.h"
+#include "repair-error-log.h"
+#include "file-list-model.h"
+
+// Above this many rows the dialog stops building the preview and only
+// counts the entries, keeping the renames in a RenamePlan.
+#define REPAIR_DIALOG_MAX_PREVIEW_ROWS  100000
+#define REPAIR_DIALOG_MEMORY_BUDGET     (64 * 1024 * 1024)
+#define REPAIR_DIALOG_FIRST_SCREEN_ROWS 100
+#define REPAIR_DIALOG_PROGRESS_INTERVAL (G_USEC_PER_SEC / 5)
+#define REPAIR_DIALOG_RESPONSE_SAVE     1
+#define REPAIR_DIALOG_RESPONSE_UNDO     2
+#define REPAIR_DIALOG_RESPONSE_RECOVER  3
 
 enum {
     ENCODING_COLUMN_LABEL,
@@ -48,34 +56,142 @@ enum {
     ENCODING_NUM_COLUMNS
 };
 
+enum {
+    ERROR_COLUMN_NAME,
+    ERROR_COLUMN_NEW_NAME,
+    ERROR_COLUMN_MESSAGE,
+    ERROR_NUM_COLUMNS
+};
+
+/*
+ * What the renames of one run share.
+ */
+typedef struct _RepairContext {
+    const char* encoding;
+    RepairProgress* progress;
+    RepairErrorLog* log;
+    RenameExecutor* executor;   /* NULL when the files are not local */
+    guint n_jobs;
+    RenameJournal* journal;     /* NULL when it cannot be written */
+    RenameThrottle* throttle;   /* NULL when the renames are not limited */
+    guint replay_depth;         /* in the plan of an unloaded directory */
+    GtkWidget* parent_window;
+} RepairContext;
+
+/*
+ * The renames of the rows of one directory, which are done after all its
+ * rows were walked.
+ */
+typedef struct _DirRenames {
+    GFile* dir;
+    RepairContext* context;
+} DirRenames;
+
+/*
+ * A directory whose row was expanded, waiting to be enumerated or being
+ * enumerated.  Only one level is loaded; the subdirectories get a
+ * placeholder row until they are expanded in turn.  The queue is
+ * breadth first, but the directories the user scrolls to go to the
+ * front.
+ */
+typedef struct _ScanDir {
+    GFile* file;
+    GtkTreeIter iter;
+    gboolean opened;
+    GFileEnumerator* e;
+    guint depth;
+    gboolean promoted;
+    guint64 serial;
+    GSequenceIter* queue_iter;
+} ScanDir;
+
 typedef struct _UpdateContext {
     GtkDialog* dialog;
     GtkTreeView* treeview;
-    GtkTreeStore* store;
-    GSList* file_stack;
-    GSList* iter_stack;
-    GSList* enum_stack;
+    FileListModel* store;
+    GSList* file_stack;     /* top level files not visited yet */
+    GSequence* queue;       /* ScanDirs in the order to enumerate them */
+    GHashTable* queued;     /* row number -> queued ScanDir */
+    ScanDir* current;
+    guint64 serial;
     char* encoding;
     gboolean include_subdir;
-    gboolean success_all;
+    gboolean only_broken;
+    guint n_rows;
+    guint source_id;
+    RepairProgress* progress;
+    gboolean loading_top_level; /* the view has let the model go */
+    gboolean holding;           /* a directory is loaded in a batch */
+    GtkTreeIter held_iter;
+    gboolean held_expanded;
 } UpdateContext;
 
+typedef struct _StreamContext {
+    RepairScanner* scanner;
+    RepairProgress* progress;
+    guint source_id;
+} StreamContext;
+
+/*
+ * The background pass which counts the entries below a directory row.
+ * It runs at a lower priority than the loading of expanded rows.  An
+ * entry needs repair when it gets a new name in the current encoding, as
+ * for the rows, so the finished jobs are kept to count again when the
+ * encoding changes.
+ */
+typedef struct _CountJob {
+    GtkTreeIter iter;
+    GFile* dir;
+    GSList* dir_stack;
+    GSList* enum_stack;
+    guint64 n_entries;
+    guint64 n_broken;
+} CountJob;
+
+typedef struct _CountContext {
+    GtkDialog* dialog;
+    FileListModel* store;
+    char* encoding;
+    GQueue* jobs;
+    GQueue* done;
+    guint source_id;
+} CountContext;
+
 static char* repair_dialog_get_current_encoding(GtkDialog* dialog);
 static gboolean repair_dialog_get_include_subdir_flag(GtkDialog* dialog);
+static gboolean repair_dialog_get_only_broken_flag(GtkDialog* dialog);
+static guint repair_dialog_get_max_errors(GtkDialog* dialog);
+static guint repair_dialog_get_n_jobs(GtkDialog* dialog);
+static RenameThrottle* repair_dialog_new_throttle(GtkDialog* dialog,
+	RepairProgress* progress);
 static void repair_dialog_set_conversion_state(GtkDialog* dialog, gboolean state);
 
 static GtkComboBox* repair_dialog_get_encoding_combo_box(GtkDialog* dialog);
 static void repair_dialog_set_encoding_combo_box(GtkDialog* dialog, GtkComboBox* combo);
 static GSList* repair_dialog_get_file_list(GtkDialog* dialog);
 static void repair_dialog_set_file_list(GtkDialog* dialog, GSList* list);
-static GtkTreeStore* repair_dialog_get_file_list_model(GtkDialog* dialog);
+static FileListModel* repair_dialog_get_file_list_model(GtkDialog* dialog);
 static void repair_dialog_set_file_list_model(GtkDialog* dialog, GtkTreeModel* model);
 static GtkTreeView* repair_dialog_get_file_list_view(GtkDialog* dialog);
 static void repair_dialog_set_file_list_view(GtkDialog* dialog, GtkTreeView* view);
-
-static void repair_dialog_update_file_list_model(GtkDialog* dialog, gboolean async);
+static UpdateContext* repair_dialog_get_update_context(GtkDialog* dialog);
+static void repair_dialog_add_count_job(GtkDialog* dialog, GtkTreeIter* iter, GFile* dir);
+static void repair_dialog_stop_counting(GtkDialog* dialog);
+static void repair_dialog_recount(GtkDialog* dialog, const char* encoding);
+
+static void repair_dialog_update_file_list_model(GtkDialog* dialog);
+static void repair_dialog_add_subdirs(GtkDialog* dialog);
+static void repair_dialog_remove_subdirs(GtkDialog* dialog);
 static gboolean repair_dialog_on_idle_update(GtkDialog* dialog);
-static void repair_dialog_on_update_end(GtkDialog* dialog, gboolean success_all);
+static void repair_dialog_on_update_end(GtkDialog* dialog);
+static void repair_dialog_start_resolving(GtkDialog* dialog);
+static void repair_dialog_stop_resolving(GtkDialog* dialog);
+static void repair_dialog_refresh_visible_rows(GtkDialog* dialog);
+static void repair_dialog_start_streaming(GtkDialog* dialog);
+static void repair_dialog_stop_streaming(GtkDialog* dialog, gboolean discard);
+static UpdateContext* repair_dialog_start_update(GtkDialog* dialog);
+static void repair_dialog_stop_update(GtkDialog* dialog);
+static StreamContext* repair_dialog_get_stream_context(GtkDialog* dialog);
 
 
 static const char* encoding_list[][2] = {
@@ -97,193 +213,532 @@ static const char* encoding_list[][2] = {
     { NULL,                               NULL     }
 };
 
-static char*
-get_display_name(const char* name)
+static void
+save_error_log(RepairErrorLog* log, GtkWidget* parent_window)
 {
-    size_t i;
-    size_t len;
-    GString* display_name;
+    GtkWidget* chooser;
+    char* filename;
+    GError* error = NULL;
+    gint res;
+
+    chooser = gtk_file_chooser_dialog_new(_("Save the Failed Renames"),
+	    GTK_WINDOW(parent_window), GTK_FILE_CHOOSER_ACTION_SAVE,
+	    GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+	    GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT,
+	    NULL);
+    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(chooser),
+	    TRUE);
+    gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(chooser),
+	    "rename-errors.txt");
+
+    res = gtk_dialog_run(GTK_DIALOG(chooser));
+    if (res == GTK_RESPONSE_ACCEPT) {
+	filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(chooser));
+	if (!repair_error_log_save(log, filename, &error)) {
+	    GtkWidget* message;
+
+	    message = gtk_message_dialog_new(GTK_WINDOW(chooser),
+		    GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+		    GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+		    "%s", error->message);
+	    gtk_dialog_run(GTK_DIALOG(message));
+	    gtk_widget_destroy(message);
+	    g_error_free(error);
+	}
+	g_free(filename);
+    }
 
-    if (g_utf8_validate(name, -1, NULL))
-	return g_strdup(name);
+    gtk_widget_destroy(chooser);
+}
+
+/*
+ * One dialog for all the renames which failed, shown after the run.
+ */
+static void
+show_rename_errors(RepairErrorLog* log, GtkWidget* parent_window)
+{
+    GtkWidget* dialog;
+    GtkWidget* area;
+    GtkWidget* scrolled;
+    GtkWidget* treeview;
+    GtkListStore* store;
+    GtkCellRenderer* renderer;
+    char* n_errors;
+    guint i, n;
 
-    len = strlen(name);
+    n = repair_error_log_get_n_errors(log);
+    if (n == 0)
+	return;
 
-    display_name = g_string_sized_new(len * 3 + 1);
-    for (i = 0; i < len; i++) {
-	if ((guchar)name[i] < 0x80) {
-	    g_string_append_c(display_name, name[i]);
-	} else {
-	    g_string_append_printf(display_name, "%%%2x", (guchar)name[i]);
-	}
+    n_errors = g_strdup_printf("%u", n);
+    dialog = gtk_message_dialog_new(GTK_WINDOW(parent_window),
+	    GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+	    GTK_MESSAGE_ERROR, GTK_BUTTONS_NONE,
+	    repair_error_log_is_stopped(log) ?
+		_("The renames were stopped after %s failures") :
+		_("%s files could not be renamed"),
+	    n_errors);
+    g_free(n_errors);
+    gtk_dialog_add_buttons(GTK_DIALOG(dialog),
+	    GTK_STOCK_SAVE_AS, REPAIR_DIALOG_RESPONSE_SAVE,
+	    GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE,
+	    NULL);
+    gtk_window_set_resizable(GTK_WINDOW(dialog), TRUE);
+
+    store = gtk_list_store_new(ERROR_NUM_COLUMNS,
+	    G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+    for (i = 0; i < n; i++) {
+	const char* new_name;
+	char* display_name;
+
+	display_name = filename_converter_get_display_name(
+		repair_error_log_get_path(log, i));
+	new_name = repair_error_log_get_new_name(log, i);
+	gtk_list_store_insert_with_values(store, NULL, -1,
+		ERROR_COLUMN_NAME, display_name,
+		ERROR_COLUMN_NEW_NAME, new_name != NULL ? new_name : "",
+		ERROR_COLUMN_MESSAGE, repair_error_log_get_message(log, i),
+		-1);
+	g_free(display_name);
     }
 
-    return g_string_free(display_name, FALSE);
+    treeview = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
+    g_object_unref(store);
+    renderer = gtk_cell_renderer_text_new();
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(treeview), -1,
+	    _("Original name"), renderer, "text", ERROR_COLUMN_NAME, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(treeview), -1,
+	    _("New name"), renderer, "text", ERROR_COLUMN_NEW_NAME, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(treeview), -1,
+	    _("Error"), renderer, "text", ERROR_COLUMN_MESSAGE, NULL);
+
+    scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_shadow_type(GTK_SCROLLED_WINDOW(scrolled),
+	    GTK_SHADOW_IN);
+    gtk_widget_set_size_request(scrolled, 600, 300);
+    gtk_container_add(GTK_CONTAINER(scrolled), treeview);
+
+    area = gtk_message_dialog_get_message_area(GTK_MESSAGE_DIALOG(dialog));
+    gtk_box_pack_start(GTK_BOX(area), scrolled, TRUE, TRUE, 0);
+    gtk_widget_show_all(scrolled);
+
+    while (gtk_dialog_run(GTK_DIALOG(dialog)) == REPAIR_DIALOG_RESPONSE_SAVE)
+	save_error_log(log, dialog);
+
+    gtk_widget_destroy(dialog);
 }
 
-static char*
-get_reconverted_name(const char* str, const char* encoding)
-{
-    // The usual misselected encoding is CP1252
-    char* cp1252 = g_convert(str, -1, "CP1252", "UTF-8", NULL, NULL, NULL);
-    if (cp1252 != NULL) {
-	char* utf8 = g_convert(cp1252, -1, "UTF-8", encoding, NULL, NULL, NULL);
-	g_free(cp1252);
-	return utf8;
-    }
-    return NULL;
+static gboolean
+on_plan_rename_error(GFile* file, const char* new_name, GError* error,
+	RepairContext* context)
+{
+    return repair_error_log_add(context->log, file, new_name, error);
 }
 
-static char*
-get_new_name(const char* name, const char* encoding)
+/*
+ * Local files are handed to the executor, which renames relative to the
+ * open directories and reports its failures through
+ * on_plan_rename_error(), as a plan does.  Others are renamed through
+ * GIO, and a failure is put in the log here.  Either way the run goes on
+ * unless the log says it has enough.
+ */
+static void
+change_filename(GFile* dir, const char* name, const char* new_name,
+	RepairContext* context)
 {
-    char* new_name = NULL;
+    GFile* src;
+    GFile* dst;
+    gint64 start_time;
+    gboolean res;
+    GError* error = NULL;
 
-    if (encoding == NULL)
-	return NULL;
+    if (context->executor != NULL) {
+	rename_executor_rename(context->executor, name, new_name);
+	return;
+    }
 
-    if (g_utf8_validate(name, -1, NULL)) {
-	char* unescaped = g_uri_unescape_string(name, NULL);
-	if (g_utf8_validate(unescaped, -1, NULL)) {
-	    // A filename from MacOSX is usually in NFD.
-	    // So, if the filename is not in NFC, try to make it NFC.
-	    char* normalized = g_utf8_normalize(unescaped, -1, G_NORMALIZE_NFC);
-	    if (normalized != NULL) {
-		// Som filenames are valid UTF-8 form,
-		// but are misconverted with wrong encoding.
-		// In that case, the names are illegible.
-		// So, we try to reconvert it with the user selected encoding
-		new_name = get_reconverted_name(normalized, encoding);
-		if (new_name != NULL) {
-		    g_free(normalized);
-		} else {
-		    new_name = normalized;
-		}	
-	    }
-	    g_free(unescaped);
-	} else {
-	    new_name = g_convert(unescaped, -1, "UTF-8", encoding, NULL, NULL, NULL);
-	    g_free(unescaped);
-	}
-    } else {
-	new_name = g_convert(name, -1, "UTF-8", encoding, NULL, NULL, NULL);
+    src = g_file_get_child(dir, name);
+    dst = g_file_get_child(dir, new_name);
+    start_time = rename_throttle_acquire(context->throttle);
+    res = g_file_move(src, dst, G_FILE_COPY_NOFOLLOW_SYMLINKS,
+	    NULL, NULL, NULL, &error);
+    rename_throttle_release(context->throttle, res ? start_time : 0);
+    if (!res) {
+	repair_error_log_add(context->log, src, new_name, error);
+	g_error_free(error);
     }
+    g_object_unref(G_OBJECT(src));
+    g_object_unref(G_OBJECT(dst));
 
-    return new_name;
+    repair_progress_add_entry(context->progress, name);
+    repair_progress_add_done(context->progress, 1);
 }
 
+/*
+ * The rows which are not renamed are done as soon as they are walked; the
+ * renames are counted when they are done.
+ */
 static void
-change_filename(GFile* src, const char* dst_name, GtkWidget* parent_window)
+repair_context_add_row(RepairContext* context, RenameDirIndex* index,
+	const char* name, const char* new_name)
+{
+    rename_dir_index_add(index, 0, name, new_name);
+    if (new_name == NULL || strcmp(name, new_name) == 0) {
+	repair_progress_add_entry(context->progress, name);
+	repair_progress_add_done(context->progress, 1);
+    }
+}
+
+/*
+ * The renames which were found to be taken or too long before the run are
+ * not tried, but go to the log all the same.
+ */
+static void
+log_rename_problem(GFile* file, const char* new_name,
+	RenameDirIndexProblem problem, RepairContext* context)
 {
-    char* src_name;
-    GFile* parent;
-    GFile* dst;
-    gboolean res;
     GError* error = NULL;
 
-    if (dst_name == NULL)
+    rename_dir_index_set_error(problem, &error);
+    repair_error_log_add(context->log, file, new_name, error);
+    g_error_free(error);
+}
+
+static const char*
+get_checked_new_name(FileListModel* store, GtkTreeIter* iter,
+	GFile* dir, const char* name, RepairContext* context)
+{
+    RenameDirIndexProblem problem;
+    const char* new_name;
+    GFile* file;
+
+    new_name = file_list_model_get_new_name(store, iter);
+    problem = file_list_model_get_problem(store, iter);
+    if (problem == RENAME_DIR_INDEX_OK)
+	return new_name;
+
+    file = g_file_get_child(dir, name);
+    log_rename_problem(file, new_name, problem, context);
+    g_object_unref(file);
+
+    return NULL;
+}
+
+static void
+report_dir_problem(guint32 id, const char* name, const char* new_name,
+	RenameDirIndexProblem problem, DirRenames* renames)
+{
+    GFile* file;
+
+    if (problem == RENAME_DIR_INDEX_OK)
 	return;
 
-    src_name = g_file_get_basename(src);
-    if (strcmp(src_name, dst_name) != 0) {
-	parent = g_file_get_parent(src);
-	dst = g_file_get_child(parent, dst_name);
+    file = g_file_get_child(renames->dir, name);
+    log_rename_problem(file, new_name, problem, renames->context);
+    g_object_unref(file);
 
-	res = g_file_move(src, dst, G_FILE_COPY_NOFOLLOW_SYMLINKS,
-		NULL, NULL, NULL, &error);
+    repair_progress_add_entry(renames->context->progress, name);
+    repair_progress_add_done(renames->context->progress, 1);
+}
 
-	if (!res) {
-	    GtkWidget* dialog;
-	    char* display_name;
-	    gboolean do_free = FALSE;;
+static void
+do_dir_rename(guint32 id, const char* name, const char* new_name,
+	DirRenames* renames)
+{
+    if (!repair_error_log_is_stopped(renames->context->log))
+	change_filename(renames->dir, name, new_name, renames->context);
+}
 
-	    if (g_utf8_validate(src_name, -1, NULL)) {
-		display_name = src_name;
-	    } else {
-		display_name = get_display_name(src_name);
-		do_free = TRUE;
-	    }
+/*
+ * The index finds an order in which no rename takes a name which is still
+ * there, going through a temporary name where the renames make a cycle.
+ * It also finds the collisions among rows added after the model looked
+ * for them.
+ */
+static void
+repair_dir_renames(RenameDirIndex* index, GFile* dir, RepairContext* context)
+{
+    DirRenames renames;
+
+    renames.dir = dir;
+    renames.context = context;
+    rename_dir_index_foreach(index,
+	    (RenameDirIndexFunc)report_dir_problem, &renames);
+    rename_dir_index_foreach_move(index,
+	    (RenameDirIndexMoveFunc)do_dir_rename, &renames);
+    rename_dir_index_clear(index);
+}
 
-	    dialog = gtk_message_dialog_new_with_markup(GTK_WINDOW(parent_window),
-                GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
-                GTK_MESSAGE_ERROR,
-                GTK_BUTTONS_CLOSE,
-                _("<span size=\"larger\" weight=\"bold\">There was an error renaming \"%s\" to \"%s\"</span>"),
-		display_name, dst_name);
-	    gtk_message_dialog_format_secondary_markup(GTK_MESSAGE_DIALOG(dialog),
-		"%s", error->message);
-	    gtk_dialog_run(GTK_DIALOG(dialog));
-	    gtk_widget_destroy(dialog);
+static void
+repair_context_enter(RepairContext* context, const char* name)
+{
+    if (context->executor != NULL)
+	rename_executor_enter(context->executor, name);
+}
 
-	    g_error_free(error);
+static void
+repair_context_leave(RepairContext* context)
+{
+    if (context->executor != NULL)
+	rename_executor_leave(context->executor);
+}
 
-	    if (do_free)
-		g_free(display_name);
-	}
+static void
+apply_plan(RenamePlan* plan, RepairProgress* progress, RepairContext* context)
+{
+    GError* error = NULL;
+    gboolean res;
 
-	g_object_unref(G_OBJECT(dst));
+    rename_plan_set_progress(plan, progress);
+    rename_plan_set_jobs(plan, context->n_jobs);
+    rename_plan_set_journal(plan, context->journal);
+    rename_plan_set_throttle(plan, context->throttle);
+    res = rename_plan_apply(plan, (RenamePlanErrorFunc)on_plan_rename_error,
+	    context, &error);
+    if (!res) {
+	GtkWidget* message;
+
+	message = gtk_message_dialog_new(GTK_WINDOW(context->parent_window),
+		GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+		GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+		"%s", error->message);
+	gtk_dialog_run(GTK_DIALOG(message));
+	gtk_widget_destroy(message);
+	g_error_free(error);
+    }
+}
+
+/*
+ * The executor is already in the parent of the scanned directory, which
+ * is the root of the plan.  The directory itself is renamed with the other
+ * rows of its parent, so its own rename in the plan is left out.
+ */
+static gboolean
+replay_plan_op(RenamePlanOp op, const char* name, const char* new_name,
+	RepairContext* context)
+{
+    switch (op) {
+    case RENAME_PLAN_ROOT:
+	break;
+    case RENAME_PLAN_ENTER:
+	context->replay_depth++;
+	repair_context_enter(context, name);
+	break;
+    case RENAME_PLAN_LEAVE:
+	context->replay_depth--;
+	repair_context_leave(context);
+	break;
+    case RENAME_PLAN_MOVE:
+	if (context->replay_depth == 0)
+	    break;
+	return rename_executor_rename(context->executor, name, new_name);
     }
 
-    g_free(src_name);
+    return TRUE;
+}
+
+/*
+ * The contents of a directory which was never expanded are not in the
+ * model, so they are scanned now and renamed from a plan.  The renames of
+ * the plan go to the executor in their place among the others, so they
+ * keep the same order; without the executor the plan is applied as it
+ * is, together with the directory itself.
+ */
+static void
+repair_unloaded_dir(GFile* dir, RepairContext* context)
+{
+    RenamePlan* plan;
+    RepairScanner* scanner;
+    GSList* files;
+    GError* error = NULL;
+
+    files = g_slist_prepend(NULL, dir);
+    plan = rename_plan_new(REPAIR_DIALOG_MEMORY_BUDGET);
+    scanner = repair_scanner_new(files, context->encoding, TRUE, plan);
+    repair_scanner_set_problem_func(scanner,
+	    (RepairScannerProblemFunc)log_rename_problem, context);
+    // The directory itself is checked and renamed with the model.
+    repair_scanner_set_report_top_level(scanner, FALSE);
+    while (repair_scanner_step(scanner, 1000))
+	continue;
+    repair_scanner_free(scanner);
+    g_slist_free(files);
+
+    context->replay_depth = 0;
+    if (context->executor == NULL) {
+	// The plan would start the progress of the whole run over.
+	apply_plan(plan, NULL, context);
+    } else if (!rename_plan_foreach(plan, (RenamePlanFunc)replay_plan_op,
+		context, &error)) {
+	repair_error_log_add(context->log, dir, NULL, error);
+	g_error_free(error);
+    }
+    rename_plan_free(plan);
 }
 
+/*
+ * The names are read from the model without copies; nothing changes the
+ * model while the renames are done.  A GFile is made only for the
+ * directories, which the renames of local files don't need but the
+ * errors and the unloaded directories do.
+ */
 static void
-repair_filenames_subdir(GtkTreeModel* model, GtkTreeIter* iterparent,
-	GFile* dir, GtkWidget* parent_window)
+repair_filenames_subdir(FileListModel* store, GtkTreeIter* iterparent,
+	GFile* dir, RepairContext* context)
 {
+    GtkTreeModel* model;
     GtkTreeIter iter;
+    GtkTreeIter placeholder;
+    RenameDirIndex* index;
     gboolean res;
 
+    index = rename_dir_index_new();
+    model = GTK_TREE_MODEL(store);
     res = gtk_tree_model_iter_children(model, &iter, iterparent);
-    while (res) {
-	char* name;
-	char* new_name;
+    while (res && !repair_error_log_is_stopped(context->log)) {
+	const char* name;
 	GFile* file;
 
-	gtk_tree_model_get(model, &iter, FILE_COLUMN_NAME, &name,
-					 FILE_COLUMN_NEW_NAME, &new_name, -1);
-
-	file = g_file_get_child(dir, name);
+	// the placeholder of a directory which is being loaded
+	name = file_list_model_get_name(store, &iter);
+	if (name == NULL) {
+	    res = gtk_tree_model_iter_next(model, &iter);
+	    continue;
+	}
 
-	res = gtk_tree_model_iter_has_child(model, &iter);
-	if (res) {
-	    repair_filenames_subdir(model, &iter, file, parent_window);
+	if (file_list_model_get_placeholder(store, &iter, &placeholder)) {
+	    file = g_file_get_child(dir, name);
+	    repair_unloaded_dir(file, context);
+	    g_object_unref(file);
+	} else {
+	    res = gtk_tree_model_iter_has_child(model, &iter);
+	    if (res) {
+		file = g_file_get_child(dir, name);
+		repair_context_enter(context, name);
+		repair_filenames_subdir(store, &iter, file, context);
+		repair_context_leave(context);
+		g_object_unref(file);
+	    }
 	}
 
-	change_filename(file, new_name, parent_window);
+	// A directory is not renamed when the run stopped inside it.
+	if (!repair_error_log_is_stopped(context->log) &&
+	    (context->executor != NULL ||
+	     !file_list_model_get_placeholder(store, &iter, &placeholder))) {
+	    repair_context_add_row(context, index, name,
+		    get_checked_new_name(store, &iter, dir, name, context));
+	}
 
-	g_free(name);
-	g_free(new_name);
+	repair_progress_tick(context->progress);
 
 	res = gtk_tree_model_iter_next(model, &iter);
     }
+
+    if (!repair_error_log_is_stopped(context->log))
+	repair_dir_renames(index, dir, context);
+    rename_dir_index_free(index);
 }
 
+/*
+ * The executor starts at the parent of the top level files, once for
+ * each folder they are in; files which are not local are renamed
+ * through GIO.  The renames of the files in one folder are done when the
+ * next file is in another one.  The executor is finished at the end,
+ * which waits for the renames and reports the last failures.
+ */
 static void
-repair_filenames(GtkTreeModel* model, GtkWidget* parent_window)
+repair_filenames(FileListModel* store, RepairContext* context)
 {
+    GtkTreeModel* model;
     GtkTreeIter iter;
+    GtkTreeIter placeholder;
+    RenameExecutor* executor;
+    RenameDirIndex* index;
+    GFile* index_dir;
+    char* root;
     gboolean res;
 
+    executor = rename_executor_new(context->n_jobs,
+	    (RenamePlanErrorFunc)on_plan_rename_error, context,
+	    context->progress);
+    rename_executor_set_journal(executor, context->journal);
+    rename_executor_set_throttle(executor, context->throttle);
+    root = NULL;
+    index = rename_dir_index_new();
+    index_dir = NULL;
+
+    model = GTK_TREE_MODEL(store);
     res = gtk_tree_model_get_iter_first(model, &iter);
-    while (res) {
+    while (res && !repair_error_log_is_stopped(context->log)) {
 	GFile* file = NULL;
-	char* new_name = NULL;
+	GFile* parent;
+	const char* name;
+	char* path;
+
+	gtk_tree_model_get(model, &iter, FILE_COLUMN_GFILE, &file, -1);
+	name = file_list_model_get_name(store, &iter);
+
+	parent = g_file_get_parent(file);
+	if (index_dir != NULL &&
+	    (parent == NULL || !g_file_equal(parent, index_dir))) {
+	    repair_dir_renames(index, index_dir, context);
+	    g_object_unref(index_dir);
+	    index_dir = NULL;
+	}
+
+	path = parent != NULL ? g_file_get_path(parent) : NULL;
+	context->executor = NULL;
+	if (path != NULL) {
+	    if (g_strcmp0(path, root) != 0) {
+		rename_executor_open(executor, path);
+		g_free(root);
+		root = path;
+	    } else {
+		g_free(path);
+	    }
+	    context->executor = executor;
+	}
 
-	gtk_tree_model_get(model, &iter, FILE_COLUMN_GFILE, &file,
-					 FILE_COLUMN_NEW_NAME, &new_name, -1);
+	if (file_list_model_get_placeholder(store, &iter, &placeholder)) {
+	    repair_unloaded_dir(file, context);
+	} else {
+	    res = gtk_tree_model_iter_has_child(model, &iter);
+	    if (res) {
+		repair_context_enter(context, name);
+		repair_filenames_subdir(store, &iter, file, context);
+		repair_context_leave(context);
+	    }
+	}
 
-	res = gtk_tree_model_iter_has_child(model, &iter);
-	if (res) {
-	    repair_filenames_subdir(model, &iter, file, parent_window);
+	// the root of the file system has no name to change
+	if (parent != NULL && !repair_error_log_is_stopped(context->log) &&
+	    (context->executor != NULL ||
+	     !file_list_model_get_placeholder(store, &iter, &placeholder))) {
+	    repair_context_add_row(context, index, name,
+		    get_checked_new_name(store, &iter, parent, name, context));
+	    if (index_dir == NULL)
+		index_dir = g_object_ref(parent);
 	}
 
-	change_filename(file, new_name, parent_window);
+	if (parent != NULL)
+	    g_object_unref(parent);
 
-	g_free(new_name);
+	repair_progress_tick(context->progress);
 
 	res = gtk_tree_model_iter_next(model, &iter);
     }
+
+    if (index_dir != NULL) {
+	if (!repair_error_log_is_stopped(context->log))
+	    repair_dir_renames(index, index_dir, context);
+	g_object_unref(index_dir);
+    }
+    rename_dir_index_free(index);
+
+    context->executor = NULL;
+    rename_executor_finish(executor);
+    rename_executor_free(executor);
+    g_free(root);
 }
 
 static GtkListStore*
@@ -291,28 +746,24 @@ encoding_list_model_new()
 {
     int i;
     GtkListStore* store;
-    GtkTreeIter iter;
 
     store = gtk_list_store_new(ENCODING_NUM_COLUMNS, G_TYPE_STRING, G_TYPE_STRING);
 
     i = 0;
     while (encoding_list[i][0] != NULL) {
-	gtk_list_store_append(store, &iter);
-	gtk_list_store_set(store, &iter,
+	gtk_list_store_insert_with_values(store, NULL, -1,
 		ENCODING_COLUMN_LABEL, _(encoding_list[i][0]),
 		ENCODING_COLUMN_ENCODING, encoding_list[i][1],
 		-1);
 	i++;
     }
 
-    gtk_list_store_append(store, &iter);
-    gtk_list_store_set(store, &iter,
+    gtk_list_store_insert_with_values(store, NULL, -1,
 	    ENCODING_COLUMN_LABEL, NULL,
 	    ENCODING_COLUMN_ENCODING, NULL,
 	    -1);
 
-    gtk_list_store_append(store, &iter);
-    gtk_list_store_set(store, &iter,
+    gtk_list_store_insert_with_values(store, NULL, -1,
 	    ENCODING_COLUMN_LABEL, _("Other ..."),
 	    ENCODING_COLUMN_ENCODING, NULL,
 	    -1);
@@ -320,72 +771,6 @@ encoding_list_model_new()
     return store;
 }
 
-static const char*
-get_codepage_from_current_locale()
-{
-    static const char* codepage_table[][2] = {
-	{ "ar",    "CP1256"  },
-	{ "az",    "CP1251"  },
-	{ "az",    "CP1254"  },
-	{ "be",    "CP1251"  },
-	{ "bg",    "CP1251"  },
-	{ "cs",    "CP1250"  },
-	{ "cy",    "CP1253"  },
-	{ "el",    "CP1253"  },
-	{ "et",    "CP1257"  },
-	{ "fa",    "CP1256"  },
-	{ "he",    "CP1255"  },
-	{ "hr",    "CP1250"  },
-	{ "hu",    "CP1250"  },
-	{ "ja",    "CP932"   },
-	{ "kk",    "CP1251"  },
-	{ "ko",    "CP949"   },
-	{ "ky",    "CP1251"  },
-	{ "lt",    "CP1257"  },
-	{ "lv",    "CP1257"  },
-	{ "mk",    "CP1251"  },
-	{ "mn",    "CP1251"  },
-	{ "pl",    "CP1250"  },
-	{ "ro",    "CP1250"  },
-	{ "ru",    "CP1251"  },
-	{ "sk",    "CP1250"  },
-	{ "sl",    "CP1250"  },
-	{ "sq",    "CP1250"  },
-	{ "sr",    "CP1250"  },
-	{ "sr",    "CP1251"  },
-	{ "th",    "CP874"   },
-	{ "tr",    "CP1254"  },
-	{ "tt",    "CP1251"  },
-	{ "uk",    "CP1251"  },
-	{ "ur",    "CP1256"  },
-	{ "uz",    "CP1251"  },
-	{ "uz",    "CP1254"  },
-	{ "vi",    "CP1258"  },
-	{ "zh_CN", "CP936"   },
-	{ "zh_HK", "CP950"   },
-	{ "zh_MO", "CP950"   },
-	{ "zh_SG", "CP936"   },
-	{ "zh_TW", "CP950"   },
-	{ NULL,    NULL      }
-    };
-
-    int i;
-    const char* locale;
-    size_t len;
-
-    locale = setlocale(LC_CTYPE, NULL);
-    i = 0;
-    while (codepage_table[i][0] != NULL) {
-	len = strlen(codepage_table[i][0]);
-	if (strncmp(codepage_table[i][0], locale, len) == 0) {
-	    return codepage_table[i][1];
-	}
-	i++;
-    }
-
-    return "CP1252";
-}
-
 static void
 select_default_encoding(GtkComboBox* combo, GtkTreeModel* model)
 {
@@ -393,7 +778,7 @@ select_default_encoding(GtkComboBox* combo, GtkTreeModel* model)
     gboolean res;
     const char* codepage;
 
-    codepage = get_codepage_from_current_locale();
+    codepage = filename_converter_get_default_encoding();
 
     res = gtk_tree_model_get_iter_first(model, &iter);
     while (res) {
@@ -409,6 +794,50 @@ select_default_encoding(GtkComboBox* combo, GtkTreeModel* model)
     }
 }
 
+static ScanDir*
+scan_dir_new(FileListModel* store, GFile* file, GtkTreeIter* iter)
+{
+    ScanDir* dir;
+
+    dir = g_new0(ScanDir, 1);
+    dir->file = file;
+    dir->iter = *iter;
+    dir->depth = file_list_model_iter_depth(store, iter);
+
+    return dir;
+}
+
+static void
+scan_dir_free(ScanDir* dir)
+{
+    if (dir == NULL)
+	return;
+
+    g_object_unref(dir->file);
+    if (dir->e != NULL)
+	g_object_unref(dir->e);
+    g_free(dir);
+}
+
+/*
+ * The promoted directories come first, the last promoted one first of
+ * all.  The others are in breadth first order.
+ */
+static gint
+scan_dir_compare(const ScanDir* a, const ScanDir* b, gpointer data)
+{
+    if (a->promoted != b->promoted)
+	return a->promoted ? -1 : 1;
+
+    if (a->promoted)
+	return a->serial > b->serial ? -1 : 1;
+
+    if (a->depth != b->depth)
+	return a->depth < b->depth ? -1 : 1;
+
+    return a->serial < b->serial ? -1 : 1;
+}
+
 static UpdateContext*
 update_context_new()
 {
@@ -417,152 +846,268 @@ update_context_new()
     context->dialog = NULL;
     context->store = NULL;
     context->file_stack = NULL;
-    context->iter_stack = NULL;
-    context->enum_stack = NULL;
+    context->queue = g_sequence_new(NULL);
+    context->queued = g_hash_table_new(g_direct_hash, g_direct_equal);
+    context->current = NULL;
+    context->serial = 0;
     context->encoding = NULL;
     context->include_subdir = FALSE;
-    context->success_all = TRUE;
+    context->only_broken = FALSE;
+    context->n_rows = 0;
+    context->source_id = 0;
+    context->progress = repair_progress_new(REPAIR_DIALOG_PROGRESS_INTERVAL);
+    context->loading_top_level = FALSE;
+    context->holding = FALSE;
+    context->held_expanded = FALSE;
     return context;
 }
 
+/*
+ * The top level rows are added in one batch while the view has let the
+ * model go, and the view reads them all when it gets it back.
+ */
 static void
-update_context_free(UpdateContext* context)
+update_context_load_top_level(UpdateContext* context)
 {
-    g_slist_free(context->file_stack);
-    g_slist_free(context->iter_stack);
-    g_slist_free(context->enum_stack);
-    g_free(context->encoding);
-    g_free(context);
+    g_object_ref(context->store);
+    gtk_tree_view_set_model(context->treeview, NULL);
+    file_list_model_begin_batch(context->store);
+    context->loading_top_level = TRUE;
 }
 
 static void
-update_context_push(UpdateContext* context,
-	GFile* file, GtkTreeIter* iter, GFileEnumerator* e)
+update_context_show_top_level(UpdateContext* context)
 {
-    context->file_stack = g_slist_prepend(context->file_stack, file);
-    context->iter_stack = g_slist_prepend(context->iter_stack, iter);
-    context->enum_stack = g_slist_prepend(context->enum_stack, e);
-}
+    if (!context->loading_top_level)
+	return;
 
-static void
-update_context_pop(UpdateContext* context)
-{
-    context->file_stack = g_slist_delete_link(context->file_stack, context->file_stack);
-    context->iter_stack = g_slist_delete_link(context->iter_stack, context->iter_stack);
-    context->enum_stack = g_slist_delete_link(context->enum_stack, context->enum_stack);
+    context->loading_top_level = FALSE;
+    file_list_model_sort_pending(context->store);
+    file_list_model_end_batch(context->store);
+    gtk_tree_view_set_model(context->treeview,
+	    GTK_TREE_MODEL(context->store));
+    g_object_unref(context->store);
 }
 
-static gboolean
-update_new_name_in_a_row(GtkTreeStore* store, GtkTreeIter* iter, const char* encoding)
+static void
+update_context_show_held_dir(UpdateContext* context)
 {
-    char* old_name;
-    char* new_name;
-    gboolean res;
+    GtkTreeModel* model;
+    GtkTreePath* path;
 
-    old_name = NULL;
-    gtk_tree_model_get(GTK_TREE_MODEL(store), iter,
-	    FILE_COLUMN_NAME, &old_name, -1);
+    if (!context->holding)
+	return;
 
-    new_name = get_new_name(old_name, encoding);
-    if (new_name != NULL) {
-	gtk_tree_store_set(store, iter, FILE_COLUMN_NEW_NAME, new_name, -1);
-	g_free(new_name);
-	res = TRUE;
-    } else {
-	gtk_tree_store_set(store, iter, FILE_COLUMN_NEW_NAME, "", -1);
-	res = FALSE;
-    }
-    g_free(old_name);
+    context->holding = FALSE;
+    file_list_model_end_batch(context->store);
 
-    return res;
+    model = GTK_TREE_MODEL(context->store);
+    path = gtk_tree_model_get_path(model, &context->held_iter);
+    gtk_tree_model_row_has_child_toggled(model, path, &context->held_iter);
+    if (context->held_expanded)
+	gtk_tree_view_expand_row(context->treeview, path, FALSE);
+    gtk_tree_path_free(path);
 }
 
-static gboolean
-update_children_new_names(GtkTreeStore* store, GtkTreeIter* iter,
-	 const char* encoding)
+/*
+ * The rows of a directory which has only its placeholder in the view
+ * are added in a batch while its row is collapsed, and the view reads
+ * them when the row is expanded again at the end of the slice.  Once the
+ * view shows some, the rest of a big directory is added row by row, as
+ * the view has no way to take many rows at once below an expanded row.
+ * The view of the filtered list is left alone.
+ */
+static void
+update_context_hold_dir(UpdateContext* context, ScanDir* dir)
 {
     GtkTreeModel* model;
-    gboolean success_all;
-    gboolean res;
+    GtkTreePath* path;
+    GtkTreeIter placeholder;
 
-    model = GTK_TREE_MODEL(store);
-
-    success_all = TRUE;
-    do {
-	GtkTreeIter child_iter;
-
-	res = update_new_name_in_a_row(store, iter, encoding);
-	if (!res)
-	    success_all = FALSE;
+    if (context->holding) {
+	if (context->held_iter.user_data == dir->iter.user_data)
+	    return;
+	update_context_show_held_dir(context);
+    }
 
-	res = gtk_tree_model_iter_children(model, &child_iter, iter);
-	if (res) {
-	    res = update_children_new_names(store, &child_iter, encoding);
-	    if (!res)
-		success_all = FALSE;
-	}
+    model = GTK_TREE_MODEL(context->store);
+    if (context->loading_top_level ||
+	g_object_get_data(G_OBJECT(context->dialog), "expanded_rows") != NULL ||
+	!file_list_model_get_placeholder(context->store, &dir->iter,
+	    &placeholder) ||
+	gtk_tree_model_iter_n_children(model, &dir->iter) != 1)
+	return;
 
-	res = gtk_tree_model_iter_next(model, iter);
-    } while (res);
+    path = gtk_tree_model_get_path(model, &dir->iter);
+    context->held_expanded = gtk_tree_view_row_expanded(context->treeview,
+	    path);
+    if (context->held_expanded)
+	gtk_tree_view_collapse_row(context->treeview, path);
+    gtk_tree_path_free(path);
 
-    return success_all;
+    context->held_iter = dir->iter;
+    context->holding = TRUE;
+    file_list_model_begin_batch(context->store);
 }
 
-static gboolean
-file_list_model_update_new_names(GtkTreeStore* store, const char* encoding)
+/*
+ * The iters of the file list persist, so the row number in the iter of
+ * a row can be used to find the queued directory of the row.
+ */
+static void
+update_context_enqueue(UpdateContext* context, ScanDir* dir)
 {
-    GtkTreeModel* model;
-    GtkTreeIter iter;
-    gboolean res;
-    gboolean success_all;
-
-    success_all = TRUE;
-    model = GTK_TREE_MODEL(store);
-    res = gtk_tree_model_get_iter_first(model, &iter);
-    while (res) {
-	GtkTreeIter child_iter;
+    dir->serial = context->serial++;
+    dir->queue_iter = g_sequence_insert_sorted(context->queue, dir,
+	    (GCompareDataFunc)scan_dir_compare, NULL);
+    g_hash_table_insert(context->queued, dir->iter.user_data, dir);
+}
 
-	res = update_new_name_in_a_row(store, &iter, encoding);
-	if (!res)
-	    success_all = FALSE;
+static ScanDir*
+update_context_dequeue(UpdateContext* context)
+{
+    GSequenceIter* first;
+    ScanDir* dir;
 
-	res = gtk_tree_model_iter_children(model, &child_iter, &iter);
-	if (res) {
-	    res = update_children_new_names(store, &child_iter, encoding);
-	    if (!res)
-		success_all = FALSE;
-	}
+    first = g_sequence_get_begin_iter(context->queue);
+    if (g_sequence_iter_is_end(first))
+	return NULL;
 
-	res = gtk_tree_model_iter_next(model, &iter);
-    }
+    dir = g_sequence_get(first);
+    g_sequence_remove(first);
+    dir->queue_iter = NULL;
+    g_hash_table_remove(context->queued, dir->iter.user_data);
 
-    return success_all;
+    return dir;
 }
 
-static GtkTreeStore*
-file_list_model_new(GSList* files, gboolean include_subdir)
+static gboolean
+update_context_promote(UpdateContext* context, GtkTreeIter* iter)
 {
-    GtkTreeStore* store;
+    ScanDir* dir;
 
-    store = gtk_tree_store_new(FILE_NUM_COLUMNS,
-	     G_TYPE_POINTER, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+    dir = g_hash_table_lookup(context->queued, iter->user_data);
+    if (dir == NULL)
+	return FALSE;
 
-    return store;
-}
+    if (!dir->promoted) {
+	g_sequence_remove(dir->queue_iter);
+	g_hash_table_remove(context->queued, iter->user_data);
+	dir->promoted = TRUE;
+	update_context_enqueue(context, dir);
+    }
 
+    return TRUE;
+}
+
+/*
+ * A directory which is known to have names to repair, or to have one
+ * below it, is loaded at once, before the others, without waiting for
+ * its row to be expanded.
+ */
 static void
-file_list_model_append(GtkTreeStore* store,
-	GtkTreeIter* iter, GtkTreeIter* parent_iter,
-	GFile* file, const char* name,
-	const char* display_name, const char* new_name)
+update_context_load_broken_dir(UpdateContext* context, GtkTreeIter* iter,
+	GFile* file)
 {
-    gtk_tree_store_append(store, iter, parent_iter);
-    gtk_tree_store_set(store, iter,
-	    FILE_COLUMN_GFILE, file,
-	    FILE_COLUMN_NAME, name,
-	    FILE_COLUMN_DISPLAY_NAME, display_name,
-	    FILE_COLUMN_NEW_NAME, new_name,
-	    -1);
+    GHashTable* broken_dirs;
+    ScanDir* dir;
+    char* path;
+    gboolean found;
+
+    broken_dirs = g_object_get_data(G_OBJECT(context->dialog), "broken_dirs");
+    if (broken_dirs == NULL)
+	return;
+
+    path = g_file_get_path(file);
+    found = path != NULL && g_hash_table_contains(broken_dirs, path);
+    g_free(path);
+    if (!found)
+	return;
+
+    dir = scan_dir_new(context->store, g_object_ref(file), iter);
+    dir->promoted = TRUE;
+    update_context_enqueue(context, dir);
+    repair_progress_add_pending_dirs(context->progress, 1);
+}
+
+static gboolean
+update_context_is_loading(UpdateContext* context, GtkTreeIter* iter)
+{
+    if (context->current != NULL &&
+	context->current->iter.user_data == iter->user_data)
+	return TRUE;
+
+    return g_hash_table_lookup(context->queued, iter->user_data) != NULL;
+}
+
+static gboolean
+update_context_is_done(UpdateContext* context)
+{
+    return context->file_stack == NULL && context->current == NULL &&
+	   g_sequence_iter_is_end(g_sequence_get_begin_iter(context->queue));
+}
+
+/*
+ * Makes the directory to enumerate the current one.  A promoted
+ * directory takes over from one which is not, which goes back to the
+ * queue with its enumerator.
+ */
+static void
+update_context_next_dir(UpdateContext* context)
+{
+    GSequenceIter* first;
+    ScanDir* current;
+
+    current = context->current;
+    first = g_sequence_get_begin_iter(context->queue);
+    if (!g_sequence_iter_is_end(first)) {
+	ScanDir* head = g_sequence_get(first);
+
+	if (current == NULL || (head->promoted && !current->promoted)) {
+	    if (current != NULL)
+		update_context_enqueue(context, current);
+	    current = update_context_dequeue(context);
+	}
+    }
+
+    if (current != NULL && !current->opened) {
+	current->e = g_file_enumerate_children(current->file,
+		G_FILE_ATTRIBUTE_STANDARD_NAME ","
+		G_FILE_ATTRIBUTE_STANDARD_TYPE,
+		G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	current->opened = TRUE;
+    }
+
+    context->current = current;
+}
+
+static void
+update_context_drop_frames(UpdateContext* context)
+{
+    ScanDir* dir;
+
+    scan_dir_free(context->current);
+    context->current = NULL;
+
+    while ((dir = update_context_dequeue(context)) != NULL) {
+	scan_dir_free(dir);
+    }
+}
+
+static void
+update_context_free(UpdateContext* context)
+{
+    update_context_show_held_dir(context);
+    update_context_show_top_level(context);
+    update_context_drop_frames(context);
+    g_sequence_free(context->queue);
+    g_hash_table_destroy(context->queued);
+    // the file stack is the top level files not visited yet
+    g_slist_foreach(context->file_stack, (GFunc)g_object_unref, NULL);
+    g_slist_free(context->file_stack);
+    g_free(context->encoding);
+    repair_progress_free(context->progress);
+    g_free(context);
 }
 
 static void
@@ -570,6 +1115,12 @@ on_dialog_destroy(GtkWidget* dialog, gpointer data)
 {
     GSList* files;
 
+    // An unfinished scan can be resumed next time.
+    repair_dialog_stop_update(GTK_DIALOG(dialog));
+    repair_dialog_stop_streaming(GTK_DIALOG(dialog), FALSE);
+    repair_dialog_stop_counting(GTK_DIALOG(dialog));
+    repair_dialog_stop_resolving(GTK_DIALOG(dialog));
+
     files = repair_dialog_get_file_list(GTK_DIALOG(dialog));
     repair_dialog_set_file_list(GTK_DIALOG(dialog), NULL);
 
@@ -580,7 +1131,7 @@ on_dialog_destroy(GtkWidget* dialog, gpointer data)
 static void
 on_encoding_changed(GtkComboBox* combo, GtkDialog* dialog)
 {
-    GtkTreeStore* store;
+    FileListModel* store;
     GtkTreeModel* model;
     GtkTreeIter iter;
     char* encoding;
@@ -613,11 +1164,29 @@ on_encoding_changed(GtkComboBox* combo, GtkDialog* dialog)
 	} else {
 	    select_default_encoding(combo, model);
 	}
+    } else if (repair_dialog_get_only_broken_flag(dialog) &&
+	       repair_dialog_get_include_subdir_flag(dialog) &&
+	       repair_dialog_get_stream_context(dialog) == NULL) {
+	// Which rows are shown depends on the new names, so we have
+	// to scan again.
+	repair_dialog_update_file_list_model(dialog);
+	g_free(encoding);
     } else {
+	// Only the rows on the screen get their new names now, unless
+	// the encoding was used a short while ago.
+	repair_dialog_stop_resolving(dialog);
 	store = repair_dialog_get_file_list_model(dialog);
-
-	res = file_list_model_update_new_names(store, encoding);
-	repair_dialog_set_conversion_state(dialog, res);
+	file_list_model_set_encoding(store, encoding);
+	repair_dialog_refresh_visible_rows(dialog);
+	repair_dialog_recount(dialog, encoding);
+
+	// The renames below the top level are only in the plan,
+	// so they have to be scanned again.
+	if (repair_dialog_get_stream_context(dialog) != NULL) {
+	    repair_dialog_start_streaming(dialog);
+	} else if (repair_dialog_get_update_context(dialog) == NULL) {
+	    repair_dialog_start_resolving(dialog);
+	}
 
 	g_free(encoding);
     }
@@ -626,7 +1195,313 @@ on_encoding_changed(GtkComboBox* combo, GtkDialog* dialog)
 static void
 on_subdir_check_toggled(GtkToggleButton* button, GtkDialog* dialog)
 {
-    repair_dialog_update_file_list_model(dialog, TRUE);
+    gboolean include_subdir;
+
+    include_subdir = gtk_toggle_button_get_active(button);
+    if (include_subdir) {
+	repair_dialog_add_subdirs(dialog);
+    } else {
+	repair_dialog_remove_subdirs(dialog);
+    }
+}
+
+static void
+on_only_broken_check_toggled(GtkToggleButton* button, GtkDialog* dialog)
+{
+    // The top level rows are always shown.
+    if (repair_dialog_get_include_subdir_flag(dialog))
+	repair_dialog_update_file_list_model(dialog);
+}
+
+/*
+ * Loads the contents of a directory row the first time it is expanded.
+ * The directory goes to the front of the queue.
+ */
+static void
+on_file_list_row_expanded(GtkTreeView* treeview, GtkTreeIter* iter,
+	GtkTreePath* path, GtkDialog* dialog)
+{
+    FileListModel* store;
+    GtkTreeIter placeholder;
+    UpdateContext* context;
+    ScanDir* dir;
+    GFile* file;
+
+    store = repair_dialog_get_file_list_model(dialog);
+    if (!file_list_model_get_placeholder(store, iter, &placeholder))
+	return;
+
+    context = repair_dialog_start_update(dialog);
+    if (update_context_promote(context, iter) ||
+	update_context_is_loading(context, iter))
+	return;
+
+    file = file_list_model_get_file(store, iter);
+    if (file == NULL)
+	return;
+
+    dir = scan_dir_new(store, file, iter);
+    dir->promoted = TRUE;
+    update_context_enqueue(context, dir);
+    repair_progress_add_pending_dirs(context->progress, 1);
+}
+
+static gboolean
+tree_view_get_next_row(GtkTreeView* treeview, GtkTreeIter* iter)
+{
+    GtkTreeModel* model;
+    GtkTreePath* path;
+    GtkTreeIter next;
+    gboolean expanded;
+
+    model = gtk_tree_view_get_model(treeview);
+
+    path = gtk_tree_model_get_path(model, iter);
+    expanded = gtk_tree_view_row_expanded(treeview, path);
+    gtk_tree_path_free(path);
+
+    if (expanded && gtk_tree_model_iter_children(model, &next, iter)) {
+	*iter = next;
+	return TRUE;
+    }
+
+    while (TRUE) {
+	next = *iter;
+	if (gtk_tree_model_iter_next(model, &next)) {
+	    *iter = next;
+	    return TRUE;
+	}
+	if (!gtk_tree_model_iter_parent(model, &next, iter))
+	    return FALSE;
+	*iter = next;
+    }
+}
+
+/*
+ * The directories scrolled into view are enumerated before the rest of
+ * the queue.
+ */
+static void
+on_file_list_scrolled(GtkAdjustment* adjustment, GtkDialog* dialog)
+{
+    GtkTreeView* treeview;
+    GtkTreeModel* model;
+    GtkTreePath* start;
+    GtkTreePath* end;
+    GtkTreePath* path;
+    GtkTreeIter iter;
+    UpdateContext* context;
+    gboolean res;
+    int i;
+
+    context = repair_dialog_get_update_context(dialog);
+    if (context == NULL)
+	return;
+
+    treeview = context->treeview;
+    if (!gtk_tree_view_get_visible_range(treeview, &start, &end))
+	return;
+
+    model = gtk_tree_view_get_model(treeview);
+    res = gtk_tree_model_get_iter(model, &iter, start);
+    // Don't walk too far, if the view is very tall.
+    for (i = 0; res && i < 200; i++) {
+	update_context_promote(context, &iter);
+
+	path = gtk_tree_model_get_path(model, &iter);
+	res = gtk_tree_path_compare(path, end) < 0;
+	gtk_tree_path_free(path);
+
+	if (res)
+	    res = tree_view_get_next_row(treeview, &iter);
+    }
+
+    gtk_tree_path_free(start);
+    gtk_tree_path_free(end);
+}
+
+/*
+ * Tells the view that the rows on the screen have changed, when their
+ * names change without the model emitting signals for every row.
+ */
+static void
+repair_dialog_refresh_visible_rows(GtkDialog* dialog)
+{
+    GtkTreeView* treeview;
+    GtkTreeModel* model;
+    GtkTreePath* start;
+    GtkTreePath* end;
+    GtkTreePath* path;
+    GtkTreeIter iter;
+    gboolean res;
+    int i;
+
+    treeview = repair_dialog_get_file_list_view(dialog);
+    if (!gtk_tree_view_get_visible_range(treeview, &start, &end))
+	return;
+
+    model = gtk_tree_view_get_model(treeview);
+    res = gtk_tree_model_get_iter(model, &iter, start);
+    for (i = 0; res && i < 200; i++) {
+	path = gtk_tree_model_get_path(model, &iter);
+	gtk_tree_model_row_changed(model, path, &iter);
+	res = gtk_tree_path_compare(path, end) < 0;
+	gtk_tree_path_free(path);
+
+	if (res)
+	    res = tree_view_get_next_row(treeview, &iter);
+    }
+
+    gtk_tree_path_free(start);
+    gtk_tree_path_free(end);
+}
+
+/*
+ * Expands the directories until about a screenful of rows is shown.  The
+ * user expands the rest, so the view never builds the whole tree.
+ */
+static void
+tree_view_expand_first_rows(GtkTreeView* treeview)
+{
+    GtkTreeModel* model;
+    GtkTreePath* path;
+    GtkTreeIter iter;
+    gboolean res;
+    int i;
+
+    model = gtk_tree_view_get_model(treeview);
+    res = gtk_tree_model_get_iter_first(model, &iter);
+    for (i = 0; res && i < REPAIR_DIALOG_FIRST_SCREEN_ROWS; i++) {
+	if (gtk_tree_model_iter_has_child(model, &iter)) {
+	    path = gtk_tree_model_get_path(model, &iter);
+	    gtk_tree_view_expand_row(treeview, path, FALSE);
+	    gtk_tree_path_free(path);
+	}
+	res = tree_view_get_next_row(treeview, &iter);
+    }
+}
+
+static void
+remember_expanded_row(GtkTreeView* treeview, GtkTreePath* path, GArray* rows)
+{
+    GtkTreeIter iter;
+
+    if (gtk_tree_model_get_iter(gtk_tree_view_get_model(treeview), &iter, path))
+	g_array_append_val(rows, iter);
+}
+
+/*
+ * The model changes from the tree to the filtered list and back at once,
+ * so the view lets it go meanwhile.  The rows which were expanded before
+ * the filter are expanded again after it.
+ */
+static void
+repair_dialog_set_filter(GtkDialog* dialog, const char* text)
+{
+    GtkTreeView* treeview;
+    FileListModel* store;
+    GArray* expanded;
+    GtkTreePath* path;
+    guint i;
+
+    treeview = repair_dialog_get_file_list_view(dialog);
+    store = repair_dialog_get_file_list_model(dialog);
+
+    expanded = g_object_get_data(G_OBJECT(dialog), "expanded_rows");
+    if (expanded == NULL) {
+	if (text == NULL || text[0] == '\0')
+	    return;
+
+	expanded = g_array_new(FALSE, FALSE, sizeof(GtkTreeIter));
+	gtk_tree_view_map_expanded_rows(treeview,
+		(GtkTreeViewMappingFunc)remember_expanded_row, expanded);
+	g_object_set_data_full(G_OBJECT(dialog), "expanded_rows", expanded,
+		(GDestroyNotify)g_array_unref);
+    }
+
+    g_object_ref(store);
+    gtk_tree_view_set_model(treeview, NULL);
+    file_list_model_set_filter(store, text);
+    gtk_tree_view_set_model(treeview, GTK_TREE_MODEL(store));
+    g_object_unref(store);
+
+    if (text == NULL || text[0] == '\0') {
+	// the parents come before their children
+	for (i = 0; i < expanded->len; i++) {
+	    GtkTreeIter* iter = &g_array_index(expanded, GtkTreeIter, i);
+
+	    if (!file_list_model_iter_is_valid(store, iter))
+		continue;
+	    path = gtk_tree_model_get_path(GTK_TREE_MODEL(store), iter);
+	    gtk_tree_view_expand_row(treeview, path, FALSE);
+	    gtk_tree_path_free(path);
+	}
+	g_object_set_data(G_OBJECT(dialog), "expanded_rows", NULL);
+    }
+}
+
+/*
+ * For whatever walks the tree in the model.
+ */
+static void
+repair_dialog_clear_filter(GtkDialog* dialog)
+{
+    GtkEntry* entry;
+
+    entry = g_object_get_data(G_OBJECT(dialog), "filter_entry");
+    if (entry != NULL)
+	gtk_entry_set_text(entry, "");
+    repair_dialog_set_filter(dialog, NULL);
+}
+
+static void
+on_filter_changed(GtkSearchEntry* entry, GtkDialog* dialog)
+{
+    repair_dialog_set_filter(dialog, gtk_entry_get_text(GTK_ENTRY(entry)));
+}
+
+static void
+file_list_display_name_data_func(GtkTreeViewColumn* column,
+	GtkCellRenderer* renderer, GtkTreeModel* model,
+	GtkTreeIter* iter, gpointer data)
+{
+    const char* display_name;
+
+    display_name = file_list_model_get_display_name(FILE_LIST_MODEL(model), iter);
+    g_object_set(renderer, "text", display_name, NULL);
+}
+
+static void
+file_list_new_name_data_func(GtkTreeViewColumn* column,
+	GtkCellRenderer* renderer, GtkTreeModel* model,
+	GtkTreeIter* iter, gpointer data)
+{
+    RenameDirIndexProblem problem;
+    const char* new_name;
+    char* text;
+
+    new_name = file_list_model_get_new_name(FILE_LIST_MODEL(model), iter);
+    problem = file_list_model_get_problem(FILE_LIST_MODEL(model), iter);
+    switch (problem) {
+    case RENAME_DIR_INDEX_COLLISION:
+	text = g_strdup_printf(_("%s (already taken)"), new_name);
+	break;
+    case RENAME_DIR_INDEX_TOO_LONG:
+	text = g_strdup_printf(_("%s (too long)"), new_name);
+	break;
+    default:
+	text = NULL;
+	break;
+    }
+
+    if (text != NULL) {
+	g_object_set(renderer, "text", text,
+		"foreground", "red", "foreground-set", TRUE, NULL);
+	g_free(text);
+    } else {
+	g_object_set(renderer, "text", new_name,
+		"foreground-set", FALSE, NULL);
+    }
 }
 
 static gboolean
@@ -645,6 +1520,40 @@ is_separator(GtkTreeModel* model, GtkTreeIter* iter, gpointer data)
     return res;
 }
 
+/*
+ * Takes the directories the index of the extension knows to have names
+ * to repair.  They and the directories above them are loaded first.
+ */
+void
+repair_dialog_set_broken_dirs(GtkDialog* dialog, char** dirs)
+{
+    GHashTable* table;
+    guint i;
+
+    if (dirs == NULL)
+	return;
+
+    table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 0; dirs[i] != NULL; i++) {
+	char* dir = g_strdup(dirs[i]);
+
+	while (dir != NULL && !g_hash_table_contains(table, dir)) {
+	    char* parent = g_path_get_dirname(dir);
+
+	    g_hash_table_add(table, dir);
+	    if (strcmp(parent, dir) == 0) {
+		g_free(parent);
+		parent = NULL;
+	    }
+	    dir = parent;
+	}
+	g_free(dir);
+    }
+
+    g_object_set_data_full(G_OBJECT(dialog), "broken_dirs", table,
+	    (GDestroyNotify)g_hash_table_destroy);
+}
+
 GtkDialog*
 repair_dialog_new(GSList* files)
 {
@@ -656,16 +1565,10 @@ repair_dialog_new(GSList* files)
     GtkTreeViewColumn* column;
     GtkCellRenderer* renderer;
     GtkBuilder* builder;
-    gboolean include_subdir = FALSE;
-    gchar* ui_path;
 
-    ui_path = repairer_utils_get_ui_path("repair-dialog.ui");
-    
     builder = gtk_builder_new();
     gtk_builder_set_translation_domain(builder, GETTEXT_PACKAGE);
-    gtk_builder_add_from_file(builder, ui_path, NULL);
-
-    g_free(ui_path);
+    repairer_utils_add_ui(builder, "repair-dialog.ui", NULL);
 
     object = gtk_builder_get_object(builder, "repair_dialog");
     if (object == NULL)
@@ -704,36 +1607,94 @@ repair_dialog_new(GSList* files)
 
     object = gtk_builder_get_object(builder, "subdir_check_button");
     if (object != NULL) {
-	include_subdir = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(object));
 	g_object_set_data(G_OBJECT(dialog), "subdir_check_button", object);
 	g_signal_connect(G_OBJECT(object), "toggled",
 			 G_CALLBACK(on_subdir_check_toggled), dialog);
     }
 
+    object = gtk_builder_get_object(builder, "only_broken_check_button");
+    if (object != NULL) {
+	g_object_set_data(G_OBJECT(dialog), "only_broken_check_button", object);
+	g_signal_connect(G_OBJECT(object), "toggled",
+			 G_CALLBACK(on_only_broken_check_toggled), dialog);
+    }
+
+    object = gtk_builder_get_object(builder, "filter_entry");
+    if (object != NULL) {
+	g_object_set_data(G_OBJECT(dialog), "filter_entry", object);
+	g_signal_connect(G_OBJECT(object), "search-changed",
+			 G_CALLBACK(on_filter_changed), dialog);
+    }
+
+    object = gtk_builder_get_object(builder, "status_label");
+    if (object != NULL) {
+	g_object_set_data(G_OBJECT(dialog), "status_label", object);
+    }
+
+    object = gtk_builder_get_object(builder, "max_errors_spin_button");
+    if (object != NULL) {
+	g_object_set_data(G_OBJECT(dialog), "max_errors_spin_button", object);
+    }
+
+    object = gtk_builder_get_object(builder, "n_jobs_spin_button");
+    if (object != NULL) {
+	g_object_set_data(G_OBJECT(dialog), "n_jobs_spin_button", object);
+    }
+
+    object = gtk_builder_get_object(builder, "rate_spin_button");
+    if (object != NULL) {
+	g_object_set_data(G_OBJECT(dialog), "rate_spin_button", object);
+    }
+
+    object = gtk_builder_get_object(builder, "max_in_flight_spin_button");
+    if (object != NULL) {
+	g_object_set_data(G_OBJECT(dialog), "max_in_flight_spin_button", object);
+    }
+
+    object = gtk_builder_get_object(builder, "max_latency_spin_button");
+    if (object != NULL) {
+	g_object_set_data(G_OBJECT(dialog), "max_latency_spin_button", object);
+    }
+
     object = gtk_builder_get_object(builder, "file_list_view");
     if (object == NULL)
 	return NULL;
 
     treeview = GTK_TREE_VIEW(object);
     repair_dialog_set_file_list_view(dialog, treeview);
+    g_signal_connect(G_OBJECT(treeview), "row-expanded",
+		     G_CALLBACK(on_file_list_row_expanded), dialog);
+    g_signal_connect(G_OBJECT(gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(treeview))),
+		     "value-changed", G_CALLBACK(on_file_list_scrolled), dialog);
 
-    model = (GtkTreeModel*)file_list_model_new(files, include_subdir);
+    model = GTK_TREE_MODEL(file_list_model_new());
     repair_dialog_set_file_list_model(dialog, model);
-    repair_dialog_update_file_list_model(dialog, TRUE);
     gtk_tree_view_set_model(treeview, model);
     g_object_unref(G_OBJECT(model));
+    repair_dialog_update_file_list_model(dialog);
 
+    // The names are made only for the rows which are drawn.
     renderer = gtk_cell_renderer_text_new();
     column = gtk_tree_view_column_new_with_attributes(_("As is"),
-	    renderer, "text", FILE_COLUMN_DISPLAY_NAME, NULL);
-    gtk_tree_view_column_set_sort_column_id(column, FILE_COLUMN_NAME);
+	    renderer, NULL);
+    gtk_tree_view_column_set_cell_data_func(column, renderer,
+	    file_list_display_name_data_func, NULL, NULL);
     gtk_tree_view_column_set_resizable(column, TRUE);
+    gtk_tree_view_column_set_sort_column_id(column, FILE_COLUMN_NAME);
     gtk_tree_view_append_column(treeview, column);
 
     renderer = gtk_cell_renderer_text_new();
     column = gtk_tree_view_column_new_with_attributes(_("To be"),
-	    renderer, "text", FILE_COLUMN_NEW_NAME, NULL);
+	    renderer, NULL);
+    gtk_tree_view_column_set_cell_data_func(column, renderer,
+	    file_list_new_name_data_func, NULL, NULL);
+    gtk_tree_view_column_set_resizable(column, TRUE);
     gtk_tree_view_column_set_sort_column_id(column, FILE_COLUMN_NEW_NAME);
+    gtk_tree_view_append_column(treeview, column);
+
+    renderer = gtk_cell_renderer_text_new();
+    column = gtk_tree_view_column_new_with_attributes(_("Contents"),
+	    renderer, "text", FILE_COLUMN_SUMMARY, NULL);
     gtk_tree_view_column_set_resizable(column, TRUE);
     gtk_tree_view_append_column(treeview, column);
 
@@ -742,34 +1703,267 @@ repair_dialog_new(GSList* files)
     return dialog;
 }
 
-void
-repair_dialog_do_repair(GtkDialog* dialog)
+static void
+on_repair_progress(RepairProgress* progress, GtkWidget* window)
 {
-    GtkTreeModel* model;
-
-    model = GTK_TREE_MODEL(repair_dialog_get_file_list_model(dialog));
-
-    repair_filenames(model, GTK_WIDGET(dialog));
+    GtkWidget* bar;
+    GtkWidget* label;
+    gdouble fraction;
+    char* text;
+
+    bar = g_object_get_data(G_OBJECT(window), "progress_bar");
+    label = g_object_get_data(G_OBJECT(window), "progress_label");
+
+    fraction = repair_progress_get_fraction(progress);
+    if (fraction < 0.0)
+	gtk_progress_bar_pulse(GTK_PROGRESS_BAR(bar));
+    else
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(bar), fraction);
+
+    text = repair_progress_format(progress);
+    gtk_label_set_text(GTK_LABEL(label), text);
+    g_free(text);
+
+    // The renames keep the main loop from running, so draw the window
+    // here.
+    while (gtk_events_pending())
+	gtk_main_iteration();
 }
 
-static GtkComboBox*
-repair_dialog_get_encoding_combo_box(GtkDialog* dialog)
+/*
+ * The dialog is hidden while the files are renamed, so this small window
+ * shows how far it went.  It cannot be closed; the renames don't stop
+ * in the middle.
+ */
+static GtkWidget*
+repair_progress_window_new(RepairProgress* progress)
 {
-    return g_object_get_data(G_OBJECT(dialog), "encoding_combo_box");
+    GtkWidget* window;
+    GtkWidget* box;
+    GtkWidget* bar;
+    GtkWidget* label;
+
+    window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(window), _("Repairing filenames"));
+    gtk_window_set_default_size(GTK_WINDOW(window), 480, -1);
+    gtk_window_set_deletable(GTK_WINDOW(window), FALSE);
+    gtk_container_set_border_width(GTK_CONTAINER(window), 12);
+    g_signal_connect(G_OBJECT(window), "delete-event",
+	    G_CALLBACK(gtk_true), NULL);
+
+    box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+    gtk_container_add(GTK_CONTAINER(window), box);
+
+    bar = gtk_progress_bar_new();
+    gtk_box_pack_start(GTK_BOX(box), bar, FALSE, FALSE, 0);
+    g_object_set_data(G_OBJECT(window), "progress_bar", bar);
+
+    label = gtk_label_new(NULL);
+    gtk_widget_set_halign(label, GTK_ALIGN_START);
+    gtk_box_pack_start(GTK_BOX(box), label, FALSE, FALSE, 0);
+    g_object_set_data(G_OBJECT(window), "progress_label", label);
+
+    repair_progress_set_func(progress,
+	    (RepairProgressFunc)on_repair_progress, window);
+
+    gtk_widget_show_all(window);
+    on_repair_progress(progress, window);
+
+    return window;
 }
 
-static void
-repair_dialog_set_encoding_combo_box(GtkDialog* dialog, GtkComboBox* combo)
+static gboolean
+on_replay_error(GFile* file, const char* new_name, GError* error,
+	RepairErrorLog* log)
 {
-    g_object_set_data(G_OBJECT(dialog), "encoding_combo_box", combo);
+    return repair_error_log_add(log, file, new_name, error);
 }
 
-static char*
-repair_dialog_get_current_encoding(GtkDialog* dialog)
+/*
+ * A run which was cut off is finished or undone before a new one starts
+ * over its journal.  Returns FALSE when the user would rather leave it
+ * as it is, or when it could not be done.
+ */
+gboolean
+repair_dialog_check_last_run(GtkWindow* parent)
 {
-    GtkComboBox* combo;
-    GtkTreeModel* model;
-    GtkTreeIter iter;
+    GtkWidget* message;
+    RepairErrorLog* log;
+    char* path;
+    gint response;
+    gboolean res;
+    GError* error = NULL;
+
+    path = rename_journal_get_default_path();
+    if (rename_journal_is_in_use(path)) {
+	message = gtk_message_dialog_new(parent,
+		GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+		GTK_MESSAGE_INFO, GTK_BUTTONS_CLOSE,
+		_("Another run is going on"));
+	gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message),
+		_("Try again when it ends."));
+	gtk_dialog_run(GTK_DIALOG(message));
+	gtk_widget_destroy(message);
+	g_free(path);
+	return FALSE;
+    }
+
+    if (!rename_journal_is_cut_off(path)) {
+	g_free(path);
+	return TRUE;
+    }
+
+    message = gtk_message_dialog_new(parent,
+	    GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+	    GTK_MESSAGE_WARNING, GTK_BUTTONS_NONE,
+	    _("The last run was cut off"));
+    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message),
+	    _("Some of its files may be renamed and others not. "
+	      "Finish its renames or undo them before a new run."));
+    gtk_dialog_add_buttons(GTK_DIALOG(message),
+	    GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+	    _("_Undo It"), REPAIR_DIALOG_RESPONSE_UNDO,
+	    _("_Finish It"), REPAIR_DIALOG_RESPONSE_RECOVER,
+	    NULL);
+    gtk_dialog_set_default_response(GTK_DIALOG(message),
+	    REPAIR_DIALOG_RESPONSE_RECOVER);
+    response = gtk_dialog_run(GTK_DIALOG(message));
+    gtk_widget_destroy(message);
+
+    log = repair_error_log_new(0);
+    if (response == REPAIR_DIALOG_RESPONSE_UNDO) {
+	res = rename_journal_undo(path,
+		(RenamePlanErrorFunc)on_replay_error, log, &error);
+    } else if (response == REPAIR_DIALOG_RESPONSE_RECOVER) {
+	res = rename_journal_recover(path,
+		(RenamePlanErrorFunc)on_replay_error, log, &error);
+    } else {
+	res = FALSE;
+    }
+
+    if (error != NULL) {
+	message = gtk_message_dialog_new(parent,
+		GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_MODAL,
+		GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+		"%s", error->message);
+	gtk_dialog_run(GTK_DIALOG(message));
+	gtk_widget_destroy(message);
+	g_error_free(error);
+    }
+    show_rename_errors(log, GTK_WIDGET(parent));
+    repair_error_log_free(log);
+
+    // An undo which failed somewhere leaves the journal as it was.
+    if (res)
+	res = !rename_journal_is_cut_off(path);
+    g_free(path);
+
+    return res;
+}
+
+void
+repair_dialog_do_repair(GtkDialog* dialog)
+{
+    StreamContext* stream;
+    FileListModel* store;
+    RepairContext context;
+    RenameJournal* journal;
+    GtkWidget* window;
+    char* encoding = NULL;
+    char* journal_path;
+    GError* error = NULL;
+
+    // The last run may have been cut off while this dialog was open.
+    if (!repair_dialog_check_last_run(GTK_WINDOW(dialog)))
+	return;
+
+    // The renames of files which are not local are not in the journal.
+    journal_path = rename_journal_get_default_path();
+    journal = rename_journal_new(journal_path, &error);
+    g_free(journal_path);
+    if (journal == NULL &&
+	g_error_matches(error, G_IO_ERROR, G_IO_ERROR_BUSY)) {
+	// Another run started since the check.
+	g_error_free(error);
+	repair_dialog_check_last_run(GTK_WINDOW(dialog));
+	return;
+    }
+    if (journal == NULL) {
+	g_warning("%s", error->message);
+	g_clear_error(&error);
+    }
+
+    context.encoding = NULL;
+    context.progress = repair_progress_new(REPAIR_DIALOG_PROGRESS_INTERVAL);
+    context.log = repair_error_log_new(repair_dialog_get_max_errors(dialog));
+    context.executor = NULL;
+    context.n_jobs = repair_dialog_get_n_jobs(dialog);
+    context.throttle = repair_dialog_new_throttle(dialog, context.progress);
+    context.parent_window = GTK_WIDGET(dialog);
+    context.journal = journal;
+
+    stream = repair_dialog_get_stream_context(dialog);
+    if (stream != NULL) {
+	window = repair_progress_window_new(context.progress);
+	apply_plan(repair_scanner_get_plan(stream->scanner), context.progress,
+		&context);
+	repair_scanner_discard_checkpoint(stream->scanner);
+    } else {
+	// Whatever is still loading is left to repair_unloaded_dir().
+	repair_dialog_clear_filter(dialog);
+	repair_dialog_stop_update(dialog);
+	repair_dialog_stop_counting(dialog);
+	repair_dialog_stop_resolving(dialog);
+
+	encoding = repair_dialog_get_current_encoding(dialog);
+	context.encoding = encoding;
+	store = repair_dialog_get_file_list_model(dialog);
+
+	// The rows of unloaded directories are not known, so the time
+	// left is only a guess from the rows in the model.
+	repair_progress_start(context.progress,
+		file_list_model_get_n_rows(store));
+	window = repair_progress_window_new(context.progress);
+
+	repair_filenames(store, &context);
+    }
+
+    gtk_widget_destroy(window);
+
+    if (context.journal != NULL) {
+	if (!rename_journal_finish(context.journal, &error)) {
+	    g_warning("%s", error->message);
+	    g_clear_error(&error);
+	}
+	rename_journal_free(context.journal);
+    }
+    rename_throttle_free(context.throttle);
+
+    show_rename_errors(context.log, GTK_WIDGET(dialog));
+
+    repair_error_log_free(context.log);
+    repair_progress_free(context.progress);
+    g_free(encoding);
+}
+
+static GtkComboBox*
+repair_dialog_get_encoding_combo_box(GtkDialog* dialog)
+{
+    return g_object_get_data(G_OBJECT(dialog), "encoding_combo_box");
+}
+
+static void
+repair_dialog_set_encoding_combo_box(GtkDialog* dialog, GtkComboBox* combo)
+{
+    g_object_set_data(G_OBJECT(dialog), "encoding_combo_box", combo);
+}
+
+static char*
+repair_dialog_get_current_encoding(GtkDialog* dialog)
+{
+    GtkComboBox* combo;
+    GtkTreeModel* model;
+    GtkTreeIter iter;
     gboolean res;
     char* encoding;
 
@@ -795,6 +1989,81 @@ repair_dialog_get_include_subdir_flag(GtkDialog* dialog)
     return state;
 }
 
+static gboolean
+repair_dialog_get_only_broken_flag(GtkDialog* dialog)
+{
+    GtkToggleButton* button;
+
+    button = g_object_get_data(G_OBJECT(dialog), "only_broken_check_button");
+    if (button == NULL)
+	return FALSE;
+
+    return gtk_toggle_button_get_active(button);
+}
+
+/*
+ * 0 means the renames go on whatever fails.
+ */
+static guint
+repair_dialog_get_max_errors(GtkDialog* dialog)
+{
+    GtkSpinButton* button;
+
+    button = g_object_get_data(G_OBJECT(dialog), "max_errors_spin_button");
+    if (button == NULL)
+	return 0;
+
+    return MAX(gtk_spin_button_get_value_as_int(button), 0);
+}
+
+/*
+ * The number of folders which are renamed in at the same time.
+ */
+static guint
+repair_dialog_get_n_jobs(GtkDialog* dialog)
+{
+    GtkSpinButton* button;
+
+    button = g_object_get_data(G_OBJECT(dialog), "n_jobs_spin_button");
+    if (button == NULL)
+	return 1;
+
+    return MAX(gtk_spin_button_get_value_as_int(button), 1);
+}
+
+static guint
+repair_dialog_get_spin_button_value(GtkDialog* dialog, const char* key)
+{
+    GtkSpinButton* button;
+
+    button = g_object_get_data(G_OBJECT(dialog), key);
+    if (button == NULL)
+	return 0;
+
+    return MAX(gtk_spin_button_get_value_as_int(button), 0);
+}
+
+/*
+ * The limits on the renames, or NULL when there are none.
+ */
+static RenameThrottle*
+repair_dialog_new_throttle(GtkDialog* dialog, RepairProgress* progress)
+{
+    guint rate;
+    guint max_in_flight;
+    guint max_latency;
+
+    rate = repair_dialog_get_spin_button_value(dialog, "rate_spin_button");
+    max_in_flight = repair_dialog_get_spin_button_value(dialog,
+	    "max_in_flight_spin_button");
+    max_latency = repair_dialog_get_spin_button_value(dialog,
+	    "max_latency_spin_button");
+    if (rate == 0 && max_in_flight == 0 && max_latency == 0)
+	return NULL;
+
+    return rename_throttle_new(rate, max_in_flight, max_latency, progress);
+}
+
 static void
 repair_dialog_set_conversion_state(GtkDialog* dialog, gboolean state)
 {
@@ -816,7 +2085,7 @@ repair_dialog_set_file_list(GtkDialog* dialog, GSList* list)
     g_object_set_data(G_OBJECT(dialog), "file_list", list);
 }
 
-static GtkTreeStore*
+static FileListModel*
 repair_dialog_get_file_list_model(GtkDialog* dialog)
 {
     return g_object_get_data(G_OBJECT(dialog), "file_list_model");
@@ -852,165 +2121,701 @@ repair_dialog_set_update_context(GtkDialog* dialog, UpdateContext* context)
     g_object_set_data(G_OBJECT(dialog), "update_context", context);
 }
 
-static gboolean
-append_dir(GtkTreeStore* store, GtkTreeIter* parent_iter,
-	GFile* dir, const char* encoding)
+static StreamContext*
+repair_dialog_get_stream_context(GtkDialog* dialog)
 {
-    GtkTreeIter iter;
-    GFileInfo* info;
-    GFileEnumerator* e;
-    gboolean success_all = TRUE;
+    return g_object_get_data(G_OBJECT(dialog), "stream_context");
+}
 
-    e = g_file_enumerate_children(dir,
-	    G_FILE_ATTRIBUTE_STANDARD_NAME ","
-	    G_FILE_ATTRIBUTE_STANDARD_TYPE,
-	    G_FILE_QUERY_INFO_NONE, NULL, NULL);
-    if (e == NULL)
-	return success_all;
-
-    info = g_file_enumerator_next_file(e, NULL, NULL);
-    while (info != NULL) {
-	const char* name = g_file_info_get_name(info);
-	char* display_name = get_display_name(name);
-	char* new_name = get_new_name(name, encoding);
-	GFileType ftype;
-
-	file_list_model_append(store, &iter, parent_iter,
-		NULL, name, display_name, new_name);
-
-	if (new_name == NULL)
-	    success_all = FALSE;
-
-	ftype = g_file_info_get_file_type(info);
-	if (ftype == G_FILE_TYPE_DIRECTORY) {
-	    gboolean res;
-	    GFile* child = g_file_get_child(dir, name);
-	    res = append_dir(store, &iter, child, encoding);
-	    g_object_unref(child);
-	    if (!res)
-		success_all = FALSE;
-	}
+static void
+repair_dialog_set_stream_context(GtkDialog* dialog, StreamContext* stream)
+{
+    g_object_set_data(G_OBJECT(dialog), "stream_context", stream);
+}
 
-	g_object_unref(info);
-	g_free(display_name);
-	g_free(new_name);
-	
-	info = g_file_enumerator_next_file(e, NULL, NULL);
+static void
+repair_dialog_set_status(GtkDialog* dialog, const char* status)
+{
+    GtkWidget* label;
+
+    label = g_object_get_data(G_OBJECT(dialog), "status_label");
+    if (label == NULL)
+	return;
+
+    if (status != NULL) {
+	gtk_label_set_text(GTK_LABEL(label), status);
+	gtk_widget_show(label);
+    } else {
+	gtk_widget_hide(label);
     }
-    g_object_unref(e);
+}
 
-    return success_all;
+static void
+on_update_progress(RepairProgress* progress, GtkDialog* dialog)
+{
+    char* text;
+    char* status;
+
+    text = repair_progress_format(progress);
+    status = g_strdup_printf(_("Loading: %s"), text);
+    repair_dialog_set_status(dialog, status);
+    g_free(status);
+    g_free(text);
 }
 
+/*
+ * The streaming scan shows its own status in the same label.
+ */
 static void
-repair_dialog_update_file_list_model(GtkDialog* dialog, gboolean async)
+repair_dialog_clear_update_status(GtkDialog* dialog)
 {
-    GtkTreeStore* store;
-    GtkTreeView* treeview;
-    GSList* files;
-    gboolean include_subdir;
+    if (repair_dialog_get_stream_context(dialog) == NULL)
+	repair_dialog_set_status(dialog, NULL);
+}
+
+static void
+repair_dialog_stop_update(GtkDialog* dialog)
+{
+    UpdateContext* context;
+
+    context = repair_dialog_get_update_context(dialog);
+    if (context != NULL) {
+	g_source_remove(context->source_id);
+	repair_dialog_set_update_context(dialog, NULL);
+	update_context_free(context);
+	repair_dialog_clear_update_status(dialog);
+    }
+}
+
+static void
+repair_dialog_update_file_list_model(GtkDialog* dialog)
+{
+    FileListModel* store;
     GtkComboBox* combobox;
     UpdateContext* context;
-    gboolean success_all = TRUE;
+    char* encoding;
 
     store = repair_dialog_get_file_list_model(dialog);
-    files = repair_dialog_get_file_list(dialog);
-    treeview = repair_dialog_get_file_list_view(dialog);
-    include_subdir = repair_dialog_get_include_subdir_flag(dialog);
 
     combobox = repair_dialog_get_encoding_combo_box(dialog);
     gtk_widget_set_sensitive(GTK_WIDGET(combobox), FALSE);
 
-    gtk_tree_store_clear(store);
+    repair_dialog_stop_streaming(dialog, TRUE);
+    repair_dialog_stop_counting(dialog);
+    repair_dialog_stop_resolving(dialog);
+    repair_dialog_stop_update(dialog);
+    file_list_model_clear(store);
+
+    encoding = repair_dialog_get_current_encoding(dialog);
+    file_list_model_set_encoding(store, encoding);
+
+    context = update_context_new();
+    context->dialog = dialog;
+    repair_progress_set_func(context->progress,
+	    (RepairProgressFunc)on_update_progress, dialog);
+    context->treeview = repair_dialog_get_file_list_view(dialog);
+    context->store = store;
+    context->file_stack = g_slist_copy(repair_dialog_get_file_list(dialog));
+    context->encoding = encoding;
+    context->include_subdir = repair_dialog_get_include_subdir_flag(dialog);
+    context->only_broken = repair_dialog_get_only_broken_flag(dialog);
+
+    g_slist_foreach(context->file_stack, (GFunc)g_object_ref, NULL);
+    update_context_load_top_level(context);
+
+    repair_dialog_set_update_context(dialog, context);
+
+    context->source_id = g_idle_add(
+	    (GSourceFunc)repair_dialog_on_idle_update, dialog);
+}
 
-    if (async) {
-	context = repair_dialog_get_update_context(dialog);
-	if (context != NULL) {
-	    g_idle_remove_by_data(dialog);
-	    update_context_free(context);
+/*
+ * Returns the running update, or starts one for loading rows on
+ * expansion when the top level scan is over.
+ */
+static UpdateContext*
+repair_dialog_start_update(GtkDialog* dialog)
+{
+    GtkComboBox* combobox;
+    UpdateContext* context;
+
+    context = repair_dialog_get_update_context(dialog);
+    if (context != NULL)
+	return context;
+
+    combobox = repair_dialog_get_encoding_combo_box(dialog);
+    gtk_widget_set_sensitive(GTK_WIDGET(combobox), FALSE);
+
+    context = update_context_new();
+    context->dialog = dialog;
+    repair_progress_set_func(context->progress,
+	    (RepairProgressFunc)on_update_progress, dialog);
+    context->treeview = repair_dialog_get_file_list_view(dialog);
+    context->store = repair_dialog_get_file_list_model(dialog);
+    context->encoding = repair_dialog_get_current_encoding(dialog);
+    context->include_subdir = repair_dialog_get_include_subdir_flag(dialog);
+    context->only_broken = repair_dialog_get_only_broken_flag(dialog);
+
+    repair_dialog_set_update_context(dialog, context);
+    context->source_id = g_idle_add(
+	    (GSourceFunc)repair_dialog_on_idle_update, dialog);
+
+    return context;
+}
+
+/*
+ * Gives the top level directories a placeholder to expand and starts
+ * counting their contents.  Nothing is loaded until a row is expanded.
+ */
+static void
+repair_dialog_add_subdirs(GtkDialog* dialog)
+{
+    FileListModel* store;
+    GtkTreeModel* model;
+    GtkTreeIter iter;
+    UpdateContext* context;
+    gboolean res;
+
+    repair_dialog_clear_filter(dialog);
+
+    // The top level files not visited yet get theirs when they are.
+    context = repair_dialog_get_update_context(dialog);
+    if (context != NULL)
+	context->include_subdir = TRUE;
+
+    store = repair_dialog_get_file_list_model(dialog);
+    model = GTK_TREE_MODEL(store);
+    res = gtk_tree_model_get_iter_first(model, &iter);
+    while (res) {
+	GFile* file = NULL;
+
+	gtk_tree_model_get(model, &iter, FILE_COLUMN_GFILE, &file, -1);
+	if (g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, NULL) ==
+		G_FILE_TYPE_DIRECTORY) {
+	    file_list_model_add_placeholder(store, &iter);
+	    repair_dialog_add_count_job(dialog, &iter, file);
 	}
+	res = gtk_tree_model_iter_next(model, &iter);
+    }
+}
 
-	context = update_context_new();
-	context->dialog = dialog;
-	context->treeview = treeview;
-	context->store = store;
-	context->file_stack = g_slist_copy(files);
-	context->encoding = repair_dialog_get_current_encoding(dialog);
-	context->include_subdir = include_subdir;
+/*
+ * Drops the child rows without touching the disk.  A running scan goes
+ * on with the top level files it has not visited yet.
+ */
+static void
+repair_dialog_remove_subdirs(GtkDialog* dialog)
+{
+    FileListModel* store;
+    UpdateContext* context;
 
-	g_slist_foreach(context->file_stack, (GFunc)g_object_ref, NULL);
+    repair_dialog_stop_streaming(dialog, TRUE);
+    repair_dialog_stop_counting(dialog);
 
-	repair_dialog_set_update_context(dialog, context);
+    context = repair_dialog_get_update_context(dialog);
+    if (context != NULL) {
+	update_context_drop_frames(context);
+	context->include_subdir = FALSE;
+    }
 
-	g_idle_add((GSourceFunc)repair_dialog_on_idle_update, dialog);
+    store = repair_dialog_get_file_list_model(dialog);
+    file_list_model_drop_children(store);
+
+    // A running scan checks the names when it ends.
+    if (context == NULL)
+	repair_dialog_start_resolving(dialog);
+}
+
+static void
+repair_dialog_on_update_end(GtkDialog* dialog)
+{
+    GtkComboBox* combobox;
+    combobox = repair_dialog_get_encoding_combo_box(dialog);
+    gtk_widget_set_sensitive(GTK_WIDGET(combobox), TRUE);
+    repair_dialog_clear_update_status(dialog);
+
+    repair_dialog_start_resolving(dialog);
+}
+
+static void
+on_new_names_resolved(FileListModel* store, GAsyncResult* result,
+	GtkDialog* dialog)
+{
+    GError* error = NULL;
+    gboolean res;
+    guint n_problems;
+
+    // A cancelled run may outlive the dialog, so don't touch it.
+    res = file_list_model_resolve_new_names_finish(store, result, &error);
+    if (!res) {
+	g_error_free(error);
+	return;
+    }
+
+    g_object_set_data(G_OBJECT(dialog), "resolve_cancellable", NULL);
+    res = file_list_model_can_convert_all(store);
+    repair_dialog_set_conversion_state(dialog, res);
+
+    // The others can still be renamed, so Apply is not held back.
+    n_problems = file_list_model_get_n_problems(store);
+    if (n_problems > 0) {
+	char* status;
+
+	status = g_strdup_printf(_("%u files cannot be renamed, "
+		    "because their new names are taken or too long."),
+		n_problems);
+	repair_dialog_set_status(dialog, status);
+	g_free(status);
+    } else {
+	repair_dialog_clear_update_status(dialog);
+    }
+
+    // The rows on the screen may have been marked.
+    gtk_widget_queue_draw(GTK_WIDGET(repair_dialog_get_file_list_view(dialog)));
+}
+
+/*
+ * Makes the new names of the rows which were not drawn in a worker
+ * thread, to tell whether everything can be converted.  Apply is not
+ * possible until then.
+ */
+static void
+repair_dialog_start_resolving(GtkDialog* dialog)
+{
+    GCancellable* cancellable;
+
+    repair_dialog_stop_resolving(dialog);
+    repair_dialog_set_conversion_state(dialog, FALSE);
+
+    cancellable = g_cancellable_new();
+    g_object_set_data_full(G_OBJECT(dialog), "resolve_cancellable",
+	    cancellable, g_object_unref);
+    file_list_model_resolve_new_names_async(
+	    repair_dialog_get_file_list_model(dialog), cancellable,
+	    (GAsyncReadyCallback)on_new_names_resolved, dialog);
+}
+
+static void
+repair_dialog_stop_resolving(GtkDialog* dialog)
+{
+    GCancellable* cancellable;
+
+    cancellable = g_object_get_data(G_OBJECT(dialog), "resolve_cancellable");
+    if (cancellable == NULL)
+	return;
+
+    g_cancellable_cancel(cancellable);
+    g_object_set_data(G_OBJECT(dialog), "resolve_cancellable", NULL);
+}
+
+static void
+repair_dialog_update_stream_status(GtkDialog* dialog, gboolean done)
+{
+    StreamContext* stream;
+    const RepairScannerStats* stats;
+    char* n_entries;
+    char* n_renames;
+    char* n_failures;
+    char* n_conflicts;
+    char* progress;
+    char* status;
+
+    stream = repair_dialog_get_stream_context(dialog);
+    stats = repair_scanner_get_stats(stream->scanner);
+
+    n_entries = g_strdup_printf("%" G_GUINT64_FORMAT, stats->n_entries);
+    n_renames = g_strdup_printf("%" G_GUINT64_FORMAT, stats->n_renames);
+    n_failures = g_strdup_printf("%" G_GUINT64_FORMAT, stats->n_failures);
+    n_conflicts = g_strdup_printf("%" G_GUINT64_FORMAT, stats->n_conflicts);
+    if (done) {
+	status = g_strdup_printf(_("Too many files to show. "
+		    "%s files scanned, %s to rename, %s cannot be converted, "
+		    "%s taken or too long."),
+		n_entries, n_renames, n_failures, n_conflicts);
     } else {
-	char* encoding = repair_dialog_get_current_encoding(dialog);
+	progress = repair_progress_format(stream->progress);
+	status = g_strdup_printf(_("Too many files to show. "
+		    "Scanning: %s files, %s to rename, %s cannot be converted, "
+		    "%s taken or too long...\n%s"),
+		n_entries, n_renames, n_failures, n_conflicts, progress);
+	g_free(progress);
+    }
+    repair_dialog_set_status(dialog, status);
+
+    g_free(status);
+    g_free(n_entries);
+    g_free(n_renames);
+    g_free(n_failures);
+    g_free(n_conflicts);
+}
+
+static gboolean
+repair_dialog_on_idle_stream(GtkDialog* dialog)
+{
+    StreamContext* stream;
+    GtkComboBox* combobox;
+    const RepairScannerStats* stats;
+    gboolean res;
+
+    stream = repair_dialog_get_stream_context(dialog);
+    if (stream == NULL)
+	return FALSE;
+
+    res = repair_scanner_step(stream->scanner, 1000);
+    repair_dialog_update_stream_status(dialog, !res);
+    if (res)
+	return TRUE;
+
+    // Keep the scanner for its counts, the plan is what we apply.
+    stream->source_id = 0;
+    stats = repair_scanner_get_stats(stream->scanner);
+    combobox = repair_dialog_get_encoding_combo_box(dialog);
+    gtk_widget_set_sensitive(GTK_WIDGET(combobox), TRUE);
+    repair_dialog_set_conversion_state(dialog, stats->n_failures == 0);
+
+    return FALSE;
+}
+
+/*
+ * Switches the dialog to the streaming mode: only the top level rows are
+ * shown and everything below them is scanned again without keeping the
+ * entries which need no change.
+ */
+static void
+repair_dialog_start_streaming(GtkDialog* dialog)
+{
+    StreamContext* stream;
+    GtkComboBox* combobox;
+    char* encoding;
+
+    repair_dialog_stop_streaming(dialog, TRUE);
+    repair_dialog_stop_counting(dialog);
+    repair_dialog_stop_resolving(dialog);
+
+    file_list_model_drop_children(repair_dialog_get_file_list_model(dialog));
+
+    combobox = repair_dialog_get_encoding_combo_box(dialog);
+    gtk_widget_set_sensitive(GTK_WIDGET(combobox), FALSE);
+    repair_dialog_set_conversion_state(dialog, FALSE);
+
+    encoding = repair_dialog_get_current_encoding(dialog);
+
+    // If an earlier dialog was closed in the middle of the same scan,
+    // this picks it up where it stopped.
+    stream = g_new0(StreamContext, 1);
+    stream->scanner = repair_scanner_new_with_checkpoint(
+	    repair_dialog_get_file_list(dialog), encoding, TRUE,
+	    REPAIR_DIALOG_MEMORY_BUDGET);
+    stream->progress = repair_progress_new(REPAIR_DIALOG_PROGRESS_INTERVAL);
+    repair_scanner_set_progress(stream->scanner, stream->progress);
+    stream->source_id = g_idle_add((GSourceFunc)repair_dialog_on_idle_stream,
+	    dialog);
+    repair_dialog_set_stream_context(dialog, stream);
+
+    g_free(encoding);
+
+    repair_dialog_update_stream_status(dialog, FALSE);
+}
+
+static void
+repair_dialog_stop_streaming(GtkDialog* dialog, gboolean discard)
+{
+    StreamContext* stream;
+
+    stream = repair_dialog_get_stream_context(dialog);
+    if (stream == NULL)
+	return;
+
+    if (stream->source_id != 0)
+	g_source_remove(stream->source_id);
+    repair_dialog_set_stream_context(dialog, NULL);
+    if (discard)
+	repair_scanner_discard_checkpoint(stream->scanner);
+    repair_scanner_free(stream->scanner);
+    repair_progress_free(stream->progress);
+    g_free(stream);
+
+    repair_dialog_set_status(dialog, NULL);
+}
+
+static CountContext*
+repair_dialog_get_count_context(GtkDialog* dialog)
+{
+    return g_object_get_data(G_OBJECT(dialog), "count_context");
+}
+
+static void
+repair_dialog_set_count_context(GtkDialog* dialog, CountContext* context)
+{
+    g_object_set_data(G_OBJECT(dialog), "count_context", context);
+}
+
+static void
+count_job_free(CountJob* job)
+{
+    g_object_unref(job->dir);
+    g_slist_free_full(job->dir_stack, g_object_unref);
+    g_slist_free_full(job->enum_stack, g_object_unref);
+    g_free(job);
+}
+
+static void
+count_job_start(CountJob* job, FileListModel* store)
+{
+    GFileEnumerator* e;
+
+    g_slist_free_full(job->dir_stack, g_object_unref);
+    g_slist_free_full(job->enum_stack, g_object_unref);
+    job->dir_stack = NULL;
+    job->enum_stack = NULL;
+    job->n_entries = 0;
+    job->n_broken = 0;
+
+    e = g_file_enumerate_children(job->dir,
+	    G_FILE_ATTRIBUTE_STANDARD_NAME ","
+	    G_FILE_ATTRIBUTE_STANDARD_TYPE,
+	    G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+    if (e != NULL) {
+	job->dir_stack = g_slist_prepend(NULL, g_object_ref(job->dir));
+	job->enum_stack = g_slist_prepend(NULL, e);
+    }
+
+    file_list_model_set_summary(store, &job->iter, _("Counting..."));
+}
+
+static void
+count_job_set_summary(CountJob* job, FileListModel* store)
+{
+    char* n_entries;
+    char* n_broken;
+    char* summary;
+
+    n_entries = g_strdup_printf("%" G_GUINT64_FORMAT, job->n_entries);
+    n_broken = g_strdup_printf("%" G_GUINT64_FORMAT, job->n_broken);
+    summary = g_strdup_printf(_("%s entries, %s need repair"),
+	    n_entries, n_broken);
+    file_list_model_set_summary(store, &job->iter, summary);
+
+    g_free(summary);
+    g_free(n_entries);
+    g_free(n_broken);
+}
+
+/*
+ * In the "only show entries that need repair" mode a directory row which
+ * turns out to have nothing to repair is removed, unless the user has
+ * looked into it.  Returns TRUE when the row was removed.
+ */
+static gboolean
+count_job_check_row(CountJob* job, CountContext* context)
+{
+    GtkTreeModel* model;
+    GtkTreeIter placeholder;
+    GtkTreePath* path;
+    GtkTreeView* treeview;
+    UpdateContext* update;
+    const char* name;
+    const char* new_name;
+    gboolean remove;
+
+    if (job->n_broken > 0 ||
+	!repair_dialog_get_only_broken_flag(context->dialog))
+	return FALSE;
+
+    model = GTK_TREE_MODEL(context->store);
+    if (file_list_model_iter_depth(context->store, &job->iter) == 0 ||
+	!file_list_model_get_placeholder(context->store, &job->iter, &placeholder))
+	return FALSE;
+
+    update = repair_dialog_get_update_context(context->dialog);
+    if (update != NULL && update_context_is_loading(update, &job->iter))
+	return FALSE;
+
+    treeview = repair_dialog_get_file_list_view(context->dialog);
+    path = gtk_tree_model_get_path(model, &job->iter);
+    remove = !gtk_tree_view_row_expanded(treeview, path);
+    gtk_tree_path_free(path);
+
+    name = file_list_model_get_name(context->store, &job->iter);
+    new_name = file_list_model_get_new_name(context->store, &job->iter);
+    if (new_name == NULL || strcmp(name, new_name) != 0)
+	remove = FALSE;
+
+    if (remove)
+	file_list_model_remove(context->store, &job->iter);
+
+    return remove;
+}
+
+static gboolean
+repair_dialog_on_idle_count(CountContext* context)
+{
+    int i;
+
+    for (i = 0; i < 500; i++) {
+	CountJob* job;
+	GFileInfo* info;
 
-	while (files != NULL) {
-	    GtkTreeIter iter;
-	    char* name;
-	    char* display_name;
+	job = g_queue_peek_head(context->jobs);
+	if (job == NULL) {
+	    context->source_id = 0;
+	    return FALSE;
+	}
+
+	if (job->enum_stack == NULL) {
+	    // done, or the directory could not be read
+	    g_queue_pop_head(context->jobs);
+	    count_job_set_summary(job, context->store);
+	    if (count_job_check_row(job, context))
+		count_job_free(job);
+	    else
+		g_queue_push_tail(context->done, job);
+	    continue;
+	}
+
+	info = g_file_enumerator_next_file(job->enum_stack->data, NULL, NULL);
+	if (info != NULL) {
+	    const char* name = g_file_info_get_name(info);
 	    char* new_name;
-	    GFile* file;
 
-	    file = files->data;
-	    name = g_file_get_basename(file);
-	    display_name = get_display_name(name);
-	    new_name = get_new_name(name, encoding);
-
-	    file_list_model_append(store, &iter, NULL,
-		    file, name, display_name, new_name);
-	    if (new_name == NULL)
-		success_all = FALSE;
-	    
-	    if (include_subdir) {
-		GFileType file_type;
-		file_type = g_file_query_file_type(file,
-			G_FILE_QUERY_INFO_NONE, NULL);
-		if (file_type == G_FILE_TYPE_DIRECTORY) {
-		    gboolean res;
-		    res = append_dir(store, &iter, file, encoding);
-		    if (!res)
-			success_all = FALSE;
+	    job->n_entries++;
+	    new_name = filename_converter_get_new_name(name, context->encoding);
+	    if (new_name == NULL || strcmp(name, new_name) != 0)
+		job->n_broken++;
+	    g_free(new_name);
+
+	    if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY) {
+		GFile* child;
+		GFileEnumerator* e;
+
+		child = g_file_get_child(job->dir_stack->data, name);
+		e = g_file_enumerate_children(child,
+			G_FILE_ATTRIBUTE_STANDARD_NAME ","
+			G_FILE_ATTRIBUTE_STANDARD_TYPE,
+			G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+		if (e != NULL) {
+		    job->dir_stack = g_slist_prepend(job->dir_stack, child);
+		    job->enum_stack = g_slist_prepend(job->enum_stack, e);
+		} else {
+		    g_object_unref(child);
 		}
 	    }
+	    g_object_unref(info);
+	} else {
+	    g_object_unref(job->dir_stack->data);
+	    g_object_unref(job->enum_stack->data);
+	    job->dir_stack = g_slist_delete_link(job->dir_stack, job->dir_stack);
+	    job->enum_stack = g_slist_delete_link(job->enum_stack, job->enum_stack);
+	}
+    }
 
-	    g_free(name);
-	    g_free(display_name);
-	    g_free(new_name);
+    return TRUE;
+}
 
-	    files = g_slist_next(files);
-	}
+/*
+ * Queues the counting of the entries below the directory of the row.
+ * The newest rows are counted first, as they are the ones the user has
+ * just opened.
+ */
+static void
+repair_dialog_add_count_job(GtkDialog* dialog, GtkTreeIter* iter, GFile* dir)
+{
+    CountContext* context;
+    CountJob* job;
 
-	gtk_tree_view_expand_all(treeview);
-	g_free(encoding);
+    context = repair_dialog_get_count_context(dialog);
+    if (context == NULL) {
+	context = g_new0(CountContext, 1);
+	context->dialog = dialog;
+	context->store = repair_dialog_get_file_list_model(dialog);
+	context->encoding = repair_dialog_get_current_encoding(dialog);
+	context->jobs = g_queue_new();
+	context->done = g_queue_new();
+	repair_dialog_set_count_context(dialog, context);
+    }
 
-	repair_dialog_on_update_end(dialog, success_all);
+    job = g_new0(CountJob, 1);
+    job->iter = *iter;
+    job->dir = g_object_ref(dir);
+    count_job_start(job, context->store);
+    g_queue_push_head(context->jobs, job);
+
+    if (context->source_id == 0) {
+	context->source_id = g_idle_add_full(G_PRIORITY_LOW,
+		(GSourceFunc)repair_dialog_on_idle_count, context, NULL);
     }
 }
 
 static void
-repair_dialog_on_update_end(GtkDialog* dialog, gboolean success_all)
+repair_dialog_stop_counting(GtkDialog* dialog)
 {
-    GtkComboBox* combobox;
-    combobox = repair_dialog_get_encoding_combo_box(dialog);
-    gtk_widget_set_sensitive(GTK_WIDGET(combobox), TRUE);
+    CountContext* context;
+
+    context = repair_dialog_get_count_context(dialog);
+    if (context == NULL)
+	return;
+
+    if (context->source_id != 0)
+	g_source_remove(context->source_id);
+    g_queue_free_full(context->jobs, (GDestroyNotify)count_job_free);
+    g_queue_free_full(context->done, (GDestroyNotify)count_job_free);
+    g_free(context->encoding);
+    g_free(context);
 
-    repair_dialog_set_conversion_state(dialog, success_all);
+    repair_dialog_set_count_context(dialog, NULL);
+}
+
+/*
+ * Counts every directory again with the new encoding, the queued ones
+ * from their start.  A row which went away in the meantime is dropped.
+ */
+static void
+repair_dialog_recount(GtkDialog* dialog, const char* encoding)
+{
+    CountContext* context;
+    CountJob* job;
+    GQueue* jobs;
+
+    context = repair_dialog_get_count_context(dialog);
+    if (context == NULL)
+	return;
+
+    g_free(context->encoding);
+    context->encoding = g_strdup(encoding);
+
+    jobs = g_queue_new();
+    while ((job = g_queue_pop_head(context->jobs)) != NULL)
+	g_queue_push_tail(jobs, job);
+    while ((job = g_queue_pop_head(context->done)) != NULL)
+	g_queue_push_tail(jobs, job);
+
+    while ((job = g_queue_pop_head(jobs)) != NULL) {
+	if (!file_list_model_iter_is_valid(context->store, &job->iter)) {
+	    count_job_free(job);
+	    continue;
+	}
+	count_job_start(job, context->store);
+	g_queue_push_tail(context->jobs, job);
+    }
+    g_queue_free(jobs);
+
+    if (context->source_id == 0 && !g_queue_is_empty(context->jobs)) {
+	context->source_id = g_idle_add_full(G_PRIORITY_LOW,
+		(GSourceFunc)repair_dialog_on_idle_count, context, NULL);
+    }
 }
 
 static gboolean
 repair_dialog_on_idle_update(GtkDialog* dialog)
 {
     GtkTreeIter iter;
-    GtkTreeIter* parent_iter;
     char* name;
-    char* display_name;
     char* new_name;
     GFile* file;
     GFileType ftype;
+    GFileInfo* info;
+    ScanDir* dir;
     UpdateContext* context;
-    gint n;
     int i;
 
     context = repair_dialog_get_update_context(dialog);
@@ -1020,101 +2825,123 @@ repair_dialog_on_idle_update(GtkDialog* dialog)
     }
 
     for (i = 0; i < 500; i++) {
-	if (context->file_stack == NULL) {
+	if (update_context_is_done(context)) {
+	    update_context_show_held_dir(context);
 	    repair_dialog_set_update_context(dialog, NULL);
-	    repair_dialog_on_update_end(dialog, context->success_all);
 	    update_context_free(context);
+	    repair_dialog_on_update_end(dialog);
 	    return FALSE;
 	}
 
-	file = context->file_stack->data;
-
-	if (context->enum_stack != NULL) {
-	    GFileInfo* info;
-	    GFileEnumerator* e;
-
-	    parent_iter = context->iter_stack->data;
-	    e = context->enum_stack->data;
-
-	    info = g_file_enumerator_next_file(e, NULL, NULL);
-	    if (info != NULL) {
-		const char* name_const;
-		name_const = g_file_info_get_name(info);
-		display_name = get_display_name(name_const);
-		new_name = get_new_name(name_const, context->encoding);
-
-		file_list_model_append(context->store, &iter, parent_iter,
-			NULL, name_const, display_name, new_name);
-		if (new_name == NULL)
-		    context->success_all = FALSE;
-
-		ftype = g_file_info_get_file_type(info);
-		if (ftype == G_FILE_TYPE_DIRECTORY) {
-		    GFile* child;
-		    GFileEnumerator* child_e;
-		    GtkTreeIter* tmp_iter;
-
-		    tmp_iter = gtk_tree_iter_copy(&iter);
-		    child = g_file_get_child(file, name_const);
-		    child_e = g_file_enumerate_children(child,
-			    G_FILE_ATTRIBUTE_STANDARD_NAME ","
-			    G_FILE_ATTRIBUTE_STANDARD_TYPE,
-			    G_FILE_QUERY_INFO_NONE, NULL, NULL);
-		    
-		    update_context_push(context, child, tmp_iter, child_e);
-		}
+	if (context->include_subdir &&
+	    context->n_rows >= REPAIR_DIALOG_MAX_PREVIEW_ROWS) {
+	    GSList* item;
+
+	    // The rest of the top level is still shown in the preview.
+	    update_context_drop_frames(context);
+	    for (item = context->file_stack; item != NULL; item = item->next) {
+		file = item->data;
+		name = g_file_get_basename(file);
+		file_list_model_append(context->store, &iter, NULL, file, name);
+		g_free(name);
+	    }
 
-		g_object_unref(info);
-		g_free(display_name);
-		g_free(new_name);
+	    update_context_show_held_dir(context);
+	    update_context_show_top_level(context);
+	    repair_dialog_set_update_context(dialog, NULL);
+	    update_context_free(context);
+	    repair_dialog_start_streaming(dialog);
+	    return FALSE;
+	}
 
-		n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(context->store), parent_iter);
-		if (n == 1) {
-		    GtkTreePath* path;
-		    path = gtk_tree_model_get_path(GTK_TREE_MODEL(context->store), parent_iter);
-		    gtk_tree_view_expand_row(context->treeview, path, FALSE);
-		    gtk_tree_path_free(path);
-		}
-	    } else {
-		g_object_unref(file);
-		gtk_tree_iter_free(parent_iter);
-		g_object_unref(e);
-		update_context_pop(context);
-	    }
-	} else {
+	// The top level comes first, then the queued directories.
+	if (context->file_stack != NULL) {
+	    file = context->file_stack->data;
 	    context->file_stack = g_slist_delete_link(context->file_stack, context->file_stack);
 
 	    name = g_file_get_basename(file);
-	    display_name = get_display_name(name);
-	    new_name = get_new_name(name, context->encoding);
-
-	    file_list_model_append(context->store, &iter, NULL,
-		    file, name, display_name, new_name);
-
-	    if (new_name == NULL)
-		context->success_all = FALSE;
+	    file_list_model_append(context->store, &iter, NULL, file, name);
+	    context->n_rows++;
+	    repair_progress_add_entry(context->progress, name);
 
 	    if (context->include_subdir) {
 		ftype = g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, NULL);
 		if (ftype == G_FILE_TYPE_DIRECTORY) {
-		    GtkTreeIter* tmp_iter;
-		    GFileEnumerator* e;
-
-		    tmp_iter = gtk_tree_iter_copy(&iter);
-		    e = g_file_enumerate_children(file,
-			    G_FILE_ATTRIBUTE_STANDARD_NAME ","
-			    G_FILE_ATTRIBUTE_STANDARD_TYPE,
-			    G_FILE_QUERY_INFO_NONE, NULL, NULL);
-
-		    update_context_push(context, file, tmp_iter, e);
+		    file_list_model_add_placeholder(context->store, &iter);
+		    repair_dialog_add_count_job(dialog, &iter, file);
+		    update_context_load_broken_dir(context, &iter, file);
 		}
 	    }
 
+	    g_object_unref(file);
 	    g_free(name);
-	    g_free(display_name);
-	    g_free(new_name);
+
+	    if (context->file_stack == NULL) {
+		update_context_show_top_level(context);
+		tree_view_expand_first_rows(context->treeview);
+	    }
+	    continue;
+	}
+
+	update_context_next_dir(context);
+	dir = context->current;
+	update_context_hold_dir(context, dir);
+
+	info = NULL;
+	if (dir->e != NULL)
+	    info = g_file_enumerator_next_file(dir->e, NULL, NULL);
+	if (info != NULL) {
+	    const char* name_const;
+	    gboolean need_row;
+
+	    name_const = g_file_info_get_name(info);
+	    ftype = g_file_info_get_file_type(info);
+	    repair_progress_add_entry(context->progress, name_const);
+
+	    // The directories are shown until their count says there
+	    // is nothing to repair in them.  Otherwise the new names
+	    // are made when the rows are drawn.
+	    need_row = TRUE;
+	    if (context->only_broken && ftype != G_FILE_TYPE_DIRECTORY) {
+		new_name = filename_converter_get_new_name(name_const,
+			context->encoding);
+		need_row = new_name == NULL || strcmp(name_const, new_name) != 0;
+		g_free(new_name);
+	    }
+	    if (need_row) {
+		file_list_model_append(context->store, &iter, &dir->iter,
+			NULL, name_const);
+		context->n_rows++;
+	    }
+
+	    if (ftype == G_FILE_TYPE_DIRECTORY) {
+		GFile* child = g_file_get_child(dir->file, name_const);
+		file_list_model_add_placeholder(context->store, &iter);
+		repair_dialog_add_count_job(dialog, &iter, child);
+		update_context_load_broken_dir(context, &iter, child);
+		g_object_unref(child);
+	    }
+
+	    g_object_unref(info);
+	} else {
+	    GtkTreeIter placeholder;
+
+	    // Removed only now, so a directory is either loaded or has
+	    // its placeholder when the renames are done.
+	    if (file_list_model_get_placeholder(context->store,
+			&dir->iter, &placeholder))
+		file_list_model_remove(context->store, &placeholder);
+	    file_list_model_sort_pending(context->store);
+	    update_context_show_held_dir(context);
+
+	    context->current = NULL;
+	    scan_dir_free(dir);
+	    repair_progress_add_pending_dirs(context->progress, -1);
 	}
     }
 
+    update_context_show_held_dir(context);
+    repair_progress_tick(context->progress);
+
     return TRUE;
 }
@@ -27,5 +27,7 @@
 
 GtkDialog* repair_dialog_new(GSList* files);
 void       repair_dialog_do_repair(GtkDialog* dialog);
+gboolean   repair_dialog_check_last_run(GtkWindow* parent);
+void       repair_dialog_set_broken_dirs(GtkDialog* dialog, char** dirs);
 
 #endif // nautilus_filename_repairer_repair_dialog_h
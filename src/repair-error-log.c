@@ -0,0 +1,189 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "repair-error-log.h"
+
+/*
+ * The renames which failed in a run, collected so that the run can go on
+ * and the failures can be shown together at the end.  The paths are kept
+ * as raw bytes, like the names in the file system.
+ *
+ * With max_errors other than 0, the run is to stop when that many renames
+ * have failed: repair_error_log_add() returns FALSE then.
+ */
+typedef struct _RepairError {
+    char* path;
+    char* new_name;
+    GQuark domain;
+    gint code;
+    char* message;
+} RepairError;
+
+struct _RepairErrorLog {
+    GArray* errors;
+    guint max_errors;
+};
+
+RepairErrorLog*
+repair_error_log_new(guint max_errors)
+{
+    RepairErrorLog* log;
+
+    log = g_new(RepairErrorLog, 1);
+    log->errors = g_array_new(FALSE, FALSE, sizeof(RepairError));
+    log->max_errors = max_errors;
+
+    return log;
+}
+
+void
+repair_error_log_free(RepairErrorLog* log)
+{
+    guint i;
+
+    for (i = 0; i < log->errors->len; i++) {
+	RepairError* e = &g_array_index(log->errors, RepairError, i);
+	g_free(e->path);
+	g_free(e->new_name);
+	g_free(e->message);
+    }
+    g_array_free(log->errors, TRUE);
+    g_free(log);
+}
+
+gboolean
+repair_error_log_add(RepairErrorLog* log, GFile* file,
+	const char* new_name, const GError* error)
+{
+    RepairError e;
+
+    e.path = g_file_get_path(file);
+    if (e.path == NULL)
+	e.path = g_file_get_uri(file);
+    e.new_name = g_strdup(new_name);
+    e.domain = error->domain;
+    e.code = error->code;
+    e.message = g_strdup(error->message);
+    g_array_append_val(log->errors, e);
+
+    return !repair_error_log_is_stopped(log);
+}
+
+guint
+repair_error_log_get_n_errors(RepairErrorLog* log)
+{
+    return log->errors->len;
+}
+
+gboolean
+repair_error_log_is_stopped(RepairErrorLog* log)
+{
+    return log->max_errors > 0 && log->errors->len >= log->max_errors;
+}
+
+const char*
+repair_error_log_get_path(RepairErrorLog* log, guint i)
+{
+    return g_array_index(log->errors, RepairError, i).path;
+}
+
+/*
+ * NULL when the failure was not that of a single rename.
+ */
+const char*
+repair_error_log_get_new_name(RepairErrorLog* log, guint i)
+{
+    return g_array_index(log->errors, RepairError, i).new_name;
+}
+
+const char*
+repair_error_log_get_message(RepairErrorLog* log, guint i)
+{
+    return g_array_index(log->errors, RepairError, i).message;
+}
+
+/*
+ * A tab or a new line in a name would break the line into fields.  A
+ * NULL string, like the new name of a directory whose renames failed
+ * all at once, is an empty field.
+ */
+static void
+append_field(GString* line, const char* str)
+{
+    if (str == NULL)
+	return;
+
+    for (; *str != '\0'; str++) {
+	switch (*str) {
+	case '\\':
+	    g_string_append(line, "\\\\");
+	    break;
+	case '\t':
+	    g_string_append(line, "\\t");
+	    break;
+	case '\n':
+	    g_string_append(line, "\\n");
+	    break;
+	default:
+	    g_string_append_c(line, *str);
+	    break;
+	}
+    }
+}
+
+/*
+ * Writes one line per failure: the path, the new name, the error as
+ * domain and code, and the message, separated with tabs.
+ */
+gboolean
+repair_error_log_save(RepairErrorLog* log, const char* filename,
+	GError** error)
+{
+    GString* text;
+    gboolean res;
+    guint i;
+
+    text = g_string_new(NULL);
+    for (i = 0; i < log->errors->len; i++) {
+	RepairError* e = &g_array_index(log->errors, RepairError, i);
+
+	append_field(text, e->path);
+	g_string_append_c(text, '\t');
+	append_field(text, e->new_name);
+	g_string_append_printf(text, "\t%s:%d\t",
+		g_quark_to_string(e->domain), e->code);
+	append_field(text, e->message);
+	g_string_append_c(text, '\n');
+    }
+
+    res = g_file_set_contents(filename, text->str, text->len, error);
+    g_string_free(text, TRUE);
+
+    return res;
+}
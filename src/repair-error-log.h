@@ -0,0 +1,45 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_repair_error_log_h
+#define nautilus_filename_repairer_repair_error_log_h
+
+#include <gio/gio.h>
+
+typedef struct _RepairErrorLog RepairErrorLog;
+
+RepairErrorLog* repair_error_log_new(guint max_errors);
+void            repair_error_log_free(RepairErrorLog* log);
+
+gboolean        repair_error_log_add(RepairErrorLog* log, GFile* file,
+			const char* new_name, const GError* error);
+guint           repair_error_log_get_n_errors(RepairErrorLog* log);
+gboolean        repair_error_log_is_stopped(RepairErrorLog* log);
+
+const char*     repair_error_log_get_path(RepairErrorLog* log, guint i);
+const char*     repair_error_log_get_new_name(RepairErrorLog* log, guint i);
+const char*     repair_error_log_get_message(RepairErrorLog* log, guint i);
+
+gboolean        repair_error_log_save(RepairErrorLog* log,
+			const char* filename, GError** error);
+
+#endif // nautilus_filename_repairer_repair_error_log_h
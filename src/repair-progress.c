@@ -0,0 +1,233 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <glib.h>
+
+#include "nautilus-filename-repairer-i18n.h"
+#include "repair-progress.h"
+
+/*
+ * Counters of a scan or of the renames, for telling how fast it goes and
+ * how long it will take.  The loops which do the work only add to the
+ * counters, with atomic operations so a worker thread may do it too, and
+ * call repair_progress_tick(), which calls the report function at most
+ * once per interval.  The report function runs in the thread which called
+ * repair_progress_tick().
+ *
+ * The time left is known only when the total is: the number of renames
+ * when a plan is applied, or the number of top level files for a scan,
+ * which is a rough guess for trees of different sizes.
+ *
+ * When the renames are held back by a RenameThrottle, the rate it lets
+ * through is shown too.
+ */
+struct _RepairProgress {
+    volatile gsize n_entries;
+    volatile gsize n_bytes;         /* of the names of the entries */
+    volatile gsize n_done;
+    volatile gssize n_pending_dirs;
+    volatile gint rate_limit;       /* renames per second, 0 for none */
+    guint64 n_total;
+
+    gint64 start_time;
+    gint64 last_report;
+    gint64 interval;
+    RepairProgressFunc func;
+    gpointer data;
+};
+
+RepairProgress*
+repair_progress_new(gint64 interval)
+{
+    RepairProgress* progress;
+
+    progress = g_new0(RepairProgress, 1);
+    progress->interval = interval;
+    progress->start_time = g_get_monotonic_time();
+    progress->last_report = progress->start_time;
+
+    return progress;
+}
+
+void
+repair_progress_free(RepairProgress* progress)
+{
+    g_free(progress);
+}
+
+void
+repair_progress_start(RepairProgress* progress, guint64 n_total)
+{
+    progress->n_entries = 0;
+    progress->n_bytes = 0;
+    progress->n_done = 0;
+    progress->n_pending_dirs = 0;
+    progress->n_total = n_total;
+    progress->start_time = g_get_monotonic_time();
+    progress->last_report = progress->start_time;
+}
+
+void
+repair_progress_set_func(RepairProgress* progress,
+	RepairProgressFunc func, gpointer data)
+{
+    progress->func = func;
+    progress->data = data;
+}
+
+void
+repair_progress_add_entry(RepairProgress* progress, const char* name)
+{
+    if (progress == NULL)
+	return;
+
+    g_atomic_pointer_add(&progress->n_entries, 1);
+    g_atomic_pointer_add(&progress->n_bytes, strlen(name));
+}
+
+void
+repair_progress_add_done(RepairProgress* progress, guint n)
+{
+    if (progress == NULL)
+	return;
+
+    g_atomic_pointer_add(&progress->n_done, n);
+}
+
+void
+repair_progress_add_pending_dirs(RepairProgress* progress, gint n)
+{
+    if (progress == NULL)
+	return;
+
+    g_atomic_pointer_add(&progress->n_pending_dirs, n);
+}
+
+void
+repair_progress_set_rate_limit(RepairProgress* progress, guint rate)
+{
+    if (progress == NULL)
+	return;
+
+    g_atomic_int_set(&progress->rate_limit, rate);
+}
+
+void
+repair_progress_tick(RepairProgress* progress)
+{
+    gint64 now;
+
+    if (progress == NULL || progress->func == NULL)
+	return;
+
+    now = g_get_monotonic_time();
+    if (now - progress->last_report < progress->interval)
+	return;
+
+    progress->last_report = now;
+    progress->func(progress, progress->data);
+}
+
+/*
+ * Returns -1 when the total is not known.
+ */
+gdouble
+repair_progress_get_fraction(RepairProgress* progress)
+{
+    gsize n_done;
+
+    if (progress->n_total == 0)
+	return -1.0;
+
+    n_done = GPOINTER_TO_SIZE(g_atomic_pointer_get(&progress->n_done));
+    return MIN((gdouble)n_done / progress->n_total, 1.0);
+}
+
+char*
+repair_progress_format(RepairProgress* progress)
+{
+    GString* text;
+    gsize n_entries;
+    gsize n_bytes;
+    gssize n_pending_dirs;
+    guint rate_limit;
+    gdouble elapsed;
+    gdouble fraction;
+    char* entries;
+    char* rate;
+    char* bytes;
+
+    n_entries = GPOINTER_TO_SIZE(g_atomic_pointer_get(&progress->n_entries));
+    n_bytes = GPOINTER_TO_SIZE(g_atomic_pointer_get(&progress->n_bytes));
+    n_pending_dirs = (gssize)g_atomic_pointer_get(&progress->n_pending_dirs);
+
+    elapsed = (g_get_monotonic_time() - progress->start_time) /
+	      (gdouble)G_USEC_PER_SEC;
+    elapsed = MAX(elapsed, 0.001);
+
+    entries = g_strdup_printf("%" G_GSIZE_FORMAT, n_entries);
+    rate = g_strdup_printf("%.0f", n_entries / elapsed);
+    bytes = g_format_size(n_bytes);
+
+    text = g_string_new(NULL);
+    g_string_append_printf(text, _("%s entries, %s per second, %s of names"),
+	    entries, rate, bytes);
+    if (n_pending_dirs > 0) {
+	char* dirs = g_strdup_printf("%" G_GSSIZE_FORMAT, n_pending_dirs);
+
+	g_string_append(text, ", ");
+	g_string_append_printf(text, _("%s folders pending"), dirs);
+	g_free(dirs);
+    }
+
+    rate_limit = g_atomic_int_get(&progress->rate_limit);
+    if (rate_limit > 0) {
+	char* limit = g_strdup_printf("%u", rate_limit);
+
+	g_string_append(text, ", ");
+	g_string_append_printf(text, _("limited to %s per second"), limit);
+	g_free(limit);
+    }
+
+    fraction = repair_progress_get_fraction(progress);
+    if (fraction > 0.0 && fraction < 1.0) {
+	guint64 left = elapsed * (1.0 - fraction) / fraction;
+	char* time_left;
+
+	time_left = g_strdup_printf("%" G_GUINT64_FORMAT ":%02u:%02u",
+		left / 3600, (guint)(left / 60 % 60), (guint)(left % 60));
+	g_string_append(text, ", ");
+	g_string_append_printf(text, _("about %s left"), time_left);
+	g_free(time_left);
+    }
+
+    g_free(entries);
+    g_free(rate);
+    g_free(bytes);
+
+    return g_string_free(text, FALSE);
+}
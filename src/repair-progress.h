@@ -0,0 +1,51 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_repair_progress_h
+#define nautilus_filename_repairer_repair_progress_h
+
+#include <glib.h>
+
+typedef struct _RepairProgress RepairProgress;
+
+typedef void (*RepairProgressFunc)(RepairProgress* progress, gpointer data);
+
+RepairProgress* repair_progress_new(gint64 interval);
+void            repair_progress_free(RepairProgress* progress);
+
+void            repair_progress_start(RepairProgress* progress, guint64 n_total);
+void            repair_progress_set_func(RepairProgress* progress,
+			RepairProgressFunc func, gpointer data);
+
+void            repair_progress_add_entry(RepairProgress* progress,
+			const char* name);
+void            repair_progress_add_done(RepairProgress* progress, guint n);
+void            repair_progress_add_pending_dirs(RepairProgress* progress,
+			gint n);
+void            repair_progress_set_rate_limit(RepairProgress* progress,
+			guint rate);
+void            repair_progress_tick(RepairProgress* progress);
+
+gdouble         repair_progress_get_fraction(RepairProgress* progress);
+char*           repair_progress_format(RepairProgress* progress);
+
+#endif // nautilus_filename_repairer_repair_progress_h
@@ -0,0 +1,1057 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "repair-scanner.h"
+#include "filename-converter.h"
+
+#ifndef NAME_MAX
+#define NAME_MAX 255
+#endif
+
+/*
+ * The scanner walks the selected files depth first, like the repair
+ * dialog does, but it keeps nothing of the entries which need no change.
+ * The renames go into a RenamePlan in the order they must be done, so
+ * the memory use depends only on the depth of the tree and on the
+ * budget of the plan.
+ *
+ * The entries of each directory go into an index of the names they will
+ * have, and the renames of a directory are put into the plan when it has
+ * been enumerated, but for those which would take a name which another
+ * entry has or will have, or which would be too long.  The same is
+ * checked for the top level files against the names on the disk, since
+ * their directories are not enumerated.  The renames which are left out
+ * are passed to the problem function.  The index puts the renames in an
+ * order in which none of them takes a name which is still there, with
+ * temporary names for the cycles; the top level renames are put into
+ * the plan the same way when all the files in their directory are done.
+ */
+
+// How often a checkpointed scan saves its state
+#define REPAIR_SCANNER_CHECKPOINT_INTERVAL  (30 * G_USEC_PER_SEC)
+
+typedef struct _ScanFrame {
+    GFile* dir;
+    GFileEnumerator* e;
+    char* name;             /* NULL for a top level directory without parent */
+    guint64 position;       /* entries taken from e so far */
+    RenameDirIndex* index;  /* of the entries taken */
+} ScanFrame;
+
+struct _RepairScanner {
+    GSList* files;          /* top level files not visited yet */
+    GSList* frames;         /* directories being enumerated, innermost first */
+    char* encoding;
+    gboolean include_subdir;
+    RenamePlan* plan;
+    char* root;
+    RepairScannerStats stats;
+    RepairProgress* progress;
+    RepairScannerProblemFunc problem_func;
+    gpointer problem_data;
+    gboolean report_top_level;
+    GHashTable* selected;   /* paths of the top level files */
+    GHashTable* root_targets;   /* new names of the top level files in root */
+    RenameDirIndex* root_index; /* their renames */
+
+    guint n_files;          /* top level files given */
+    char** uris;            /* of the top level files, for the checkpoint */
+    char** mtimes;          /* and their modification times */
+    char* checkpoint;       /* key file path, NULL if not checkpointed */
+    FILE* dirs;             /* modification times of the directories entered */
+    gint64 last_checkpoint;
+    gboolean owns_plan;
+    gboolean resumed;
+    gboolean finished;
+};
+
+RepairScanner*
+repair_scanner_new(GSList* files, const char* encoding,
+	gboolean include_subdir, RenamePlan* plan)
+{
+    RepairScanner* scanner;
+    GSList* item;
+
+    scanner = g_new0(RepairScanner, 1);
+    scanner->files = g_slist_copy(files);
+    g_slist_foreach(scanner->files, (GFunc)g_object_ref, NULL);
+    scanner->selected = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, NULL);
+    for (item = files; item != NULL; item = item->next) {
+	char* path = g_file_get_path(item->data);
+	if (path != NULL)
+	    g_hash_table_add(scanner->selected, path);
+    }
+    scanner->root_targets = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, NULL);
+    scanner->root_index = rename_dir_index_new();
+    scanner->encoding = g_strdup(encoding);
+    scanner->include_subdir = include_subdir;
+    scanner->plan = plan;
+    scanner->n_files = g_slist_length(files);
+    scanner->report_top_level = TRUE;
+
+    return scanner;
+}
+
+static void
+scan_frame_free(ScanFrame* frame)
+{
+    g_object_unref(frame->dir);
+    if (frame->e != NULL)
+	g_object_unref(frame->e);
+    g_free(frame->name);
+    rename_dir_index_free(frame->index);
+    g_free(frame);
+}
+
+void
+repair_scanner_free(RepairScanner* scanner)
+{
+    if (scanner == NULL)
+	return;
+
+    g_slist_free_full(scanner->frames, (GDestroyNotify)scan_frame_free);
+    g_slist_free_full(scanner->files, g_object_unref);
+    if (scanner->owns_plan)
+	rename_plan_free(scanner->plan);
+    g_hash_table_destroy(scanner->selected);
+    g_hash_table_destroy(scanner->root_targets);
+    rename_dir_index_free(scanner->root_index);
+    g_strfreev(scanner->uris);
+    g_strfreev(scanner->mtimes);
+    g_free(scanner->checkpoint);
+    if (scanner->dirs != NULL)
+	fclose(scanner->dirs);
+    g_free(scanner->encoding);
+    g_free(scanner->root);
+    g_free(scanner);
+}
+
+/*
+ * The progress counts the top level files as its total, and starts from
+ * where a resumed scan is.
+ */
+void
+repair_scanner_set_progress(RepairScanner* scanner, RepairProgress* progress)
+{
+    guint n_done;
+
+    scanner->progress = progress;
+    if (progress == NULL)
+	return;
+
+    n_done = scanner->n_files - g_slist_length(scanner->files);
+    if (scanner->frames != NULL)
+	n_done--;
+    repair_progress_start(progress, scanner->n_files);
+    repair_progress_add_done(progress, n_done);
+    repair_progress_add_pending_dirs(progress, g_slist_length(scanner->frames));
+}
+
+void
+repair_scanner_set_problem_func(RepairScanner* scanner,
+	RepairScannerProblemFunc func, gpointer data)
+{
+    scanner->problem_func = func;
+    scanner->problem_data = data;
+}
+
+/*
+ * A caller which renames the top level files itself, and checks them on
+ * its own, doesn't want their problems reported again.  They are still
+ * left out of the plan.
+ */
+void
+repair_scanner_set_report_top_level(RepairScanner* scanner, gboolean report)
+{
+    scanner->report_top_level = report;
+}
+
+const RepairScannerStats*
+repair_scanner_get_stats(RepairScanner* scanner)
+{
+    return &scanner->stats;
+}
+
+static char*
+repair_scanner_get_new_name(RepairScanner* scanner, const char* name)
+{
+    char* new_name;
+
+    scanner->stats.n_entries++;
+    repair_progress_add_entry(scanner->progress, name);
+    new_name = filename_converter_get_new_name(name, scanner->encoding);
+    if (new_name == NULL)
+	scanner->stats.n_failures++;
+
+    return new_name;
+}
+
+static void
+repair_scanner_report(RepairScanner* scanner, GFile* dir,
+	const char* name, const char* new_name, RenameDirIndexProblem problem)
+{
+    GFile* file;
+
+    scanner->stats.n_conflicts++;
+    if (scanner->problem_func == NULL)
+	return;
+
+    file = g_file_get_child(dir, name);
+    scanner->problem_func(file, new_name, problem, scanner->problem_data);
+    g_object_unref(file);
+}
+
+typedef struct _FlushContext {
+    RepairScanner* scanner;
+    GFile* dir;
+} FlushContext;
+
+static void
+repair_scanner_count_rename(guint32 id, const char* name, const char* new_name,
+	RenameDirIndexProblem problem, FlushContext* context)
+{
+    if (problem == RENAME_DIR_INDEX_OK)
+	context->scanner->stats.n_renames++;
+    else
+	repair_scanner_report(context->scanner, context->dir,
+		name, new_name, problem);
+}
+
+static void
+repair_scanner_add_move(guint32 id, const char* name, const char* new_name,
+	RepairScanner* scanner)
+{
+    rename_plan_add_move(scanner->plan, name, new_name);
+}
+
+/*
+ * Puts the renames of a directory into the plan, where the plan is in
+ * that directory.
+ */
+static void
+repair_scanner_flush(RepairScanner* scanner, RenameDirIndex* index,
+	GFile* dir)
+{
+    FlushContext flush;
+
+    flush.scanner = scanner;
+    flush.dir = dir;
+    rename_dir_index_foreach(index,
+	    (RenameDirIndexFunc)repair_scanner_count_rename, &flush);
+    rename_dir_index_foreach_move(index,
+	    (RenameDirIndexMoveFunc)repair_scanner_add_move, scanner);
+    rename_dir_index_clear(index);
+}
+
+static void
+repair_scanner_flush_root(RepairScanner* scanner)
+{
+    GFile* dir;
+
+    if (scanner->root == NULL)
+	return;
+
+    dir = g_file_new_for_path(scanner->root);
+    repair_scanner_flush(scanner, scanner->root_index, dir);
+    g_object_unref(dir);
+}
+
+/*
+ * A top level file is checked against the names in its directory on the
+ * disk, which it may only take when the file which has it is selected too
+ * and gets a new name of its own, and against the new names of the top
+ * level files before it.  Returns new_name, or NULL when it cannot be
+ * renamed, which is reported if report is TRUE.
+ */
+static char*
+repair_scanner_check_top_level(RepairScanner* scanner, GFile* parent,
+	const char* name, char* new_name, gboolean report)
+{
+    RenameDirIndexProblem problem;
+    GFile* target;
+
+    if (new_name == NULL || strcmp(name, new_name) == 0)
+	return new_name;
+
+    problem = RENAME_DIR_INDEX_OK;
+    if (strlen(new_name) > NAME_MAX) {
+	problem = RENAME_DIR_INDEX_TOO_LONG;
+    } else if (g_hash_table_contains(scanner->root_targets, new_name)) {
+	problem = RENAME_DIR_INDEX_COLLISION;
+    } else {
+	target = g_file_get_child(parent, new_name);
+	if (g_file_query_file_type(target, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+		    NULL) != G_FILE_TYPE_UNKNOWN) {
+	    char* path = g_file_get_path(target);
+	    char* other = NULL;
+
+	    if (path != NULL && g_hash_table_contains(scanner->selected, path))
+		other = filename_converter_get_new_name(new_name,
+			scanner->encoding);
+	    if (other == NULL || strcmp(other, new_name) == 0)
+		problem = RENAME_DIR_INDEX_COLLISION;
+	    g_free(other);
+	    g_free(path);
+	}
+	g_object_unref(target);
+    }
+
+    if (problem != RENAME_DIR_INDEX_OK) {
+	if (report)
+	    repair_scanner_report(scanner, parent, name, new_name, problem);
+	g_free(new_name);
+	return NULL;
+    }
+
+    g_hash_table_add(scanner->root_targets, g_strdup(new_name));
+    rename_dir_index_add(scanner->root_index, 0, name, new_name);
+    return new_name;
+}
+
+static ScanFrame*
+scan_frame_new(GFile* dir, const char* name)
+{
+    ScanFrame* frame;
+
+    frame = g_new(ScanFrame, 1);
+    frame->dir = dir;
+    frame->e = g_file_enumerate_children(dir,
+	    G_FILE_ATTRIBUTE_STANDARD_NAME ","
+	    G_FILE_ATTRIBUTE_STANDARD_TYPE,
+	    G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+    frame->name = g_strdup(name);
+    frame->position = 0;
+    frame->index = rename_dir_index_new();
+
+    return frame;
+}
+
+static char* get_modification_time(GFile* file);
+
+static void
+repair_scanner_push(RepairScanner* scanner, GFile* dir, const char* name)
+{
+    ScanFrame* frame;
+
+    // Taken before the enumeration, so a change while it runs is seen
+    // when the checkpoint is resumed.
+    if (scanner->dirs != NULL) {
+	char* mtime = get_modification_time(dir);
+	char* uri = g_file_get_uri(dir);
+	fprintf(scanner->dirs, "%s %s\n", mtime, uri);
+	g_free(uri);
+	g_free(mtime);
+    }
+
+    frame = scan_frame_new(dir, name);
+    scanner->frames = g_slist_prepend(scanner->frames, frame);
+    repair_progress_add_pending_dirs(scanner->progress, 1);
+    if (name != NULL)
+	rename_plan_enter(scanner->plan, name);
+}
+
+static void
+repair_scanner_pop(RepairScanner* scanner)
+{
+    ScanFrame* frame;
+    FlushContext flush;
+
+    frame = scanner->frames->data;
+    scanner->frames = g_slist_delete_link(scanner->frames, scanner->frames);
+    repair_progress_add_pending_dirs(scanner->progress, -1);
+
+    // a top level directory is done
+    if (scanner->frames == NULL)
+	repair_progress_add_done(scanner->progress, 1);
+
+    repair_scanner_flush(scanner, frame->index, frame->dir);
+
+    // The directory itself is renamed after its contents, with the
+    // others in its parent.
+    if (frame->name != NULL)
+	rename_plan_leave(scanner->plan);
+
+    scan_frame_free(frame);
+}
+
+static void
+repair_scanner_set_root(RepairScanner* scanner, char* dir)
+{
+    if (g_strcmp0(dir, scanner->root) != 0) {
+	repair_scanner_flush_root(scanner);
+	rename_plan_add_root(scanner->plan, dir);
+	g_hash_table_remove_all(scanner->root_targets);
+	g_free(scanner->root);
+	scanner->root = dir;
+    } else {
+	g_free(dir);
+    }
+}
+
+static void
+repair_scanner_visit_top_level(RepairScanner* scanner)
+{
+    GFile* file;
+    GFile* parent;
+    GFileType type;
+    char* name;
+    char* new_name;
+    char* dir;
+
+    file = scanner->files->data;
+    scanner->files = g_slist_delete_link(scanner->files, scanner->files);
+
+    type = G_FILE_TYPE_UNKNOWN;
+    if (scanner->include_subdir)
+	type = g_file_query_file_type(file,
+		G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL);
+
+    parent = g_file_get_parent(file);
+    if (parent == NULL) {
+	// The file system root has no name to repair, but its
+	// contents may have.
+	dir = g_file_get_path(file);
+	if (dir != NULL && type == G_FILE_TYPE_DIRECTORY) {
+	    repair_scanner_set_root(scanner, dir);
+	    repair_scanner_push(scanner, file, NULL);
+	} else {
+	    g_free(dir);
+	    g_object_unref(file);
+	    repair_progress_add_done(scanner->progress, 1);
+	}
+	return;
+    }
+
+    dir = g_file_get_path(parent);
+    if (dir == NULL) {
+	// only local files can be put in the plan
+	scanner->stats.n_failures++;
+	g_object_unref(parent);
+	g_object_unref(file);
+	repair_progress_add_done(scanner->progress, 1);
+	return;
+    }
+    repair_scanner_set_root(scanner, dir);
+
+    name = g_file_get_basename(file);
+    new_name = repair_scanner_get_new_name(scanner, name);
+    new_name = repair_scanner_check_top_level(scanner, parent, name, new_name,
+	    scanner->report_top_level);
+    g_object_unref(parent);
+    g_free(new_name);
+
+    if (type == G_FILE_TYPE_DIRECTORY) {
+	repair_scanner_push(scanner, file, name);
+    } else {
+	g_object_unref(file);
+	repair_progress_add_done(scanner->progress, 1);
+    }
+    g_free(name);
+}
+
+/*
+ * Visits at most n entries.  Returns FALSE when there is nothing left to
+ * scan, so it can be used as an idle function body as well as in a loop.
+ */
+gboolean
+repair_scanner_step(RepairScanner* scanner, guint n)
+{
+    if (scanner->finished)
+	return FALSE;
+
+    while (n-- > 0) {
+	ScanFrame* frame;
+	GFileInfo* info;
+
+	if (scanner->frames == NULL) {
+	    // The renames of the last root are in the plan now, so a
+	    // resumed finished scan must not check them again.
+	    if (scanner->files == NULL) {
+		repair_scanner_flush_root(scanner);
+		g_free(scanner->root);
+		scanner->root = NULL;
+		scanner->finished = TRUE;
+		break;
+	    }
+
+	    repair_scanner_visit_top_level(scanner);
+	    continue;
+	}
+
+	frame = scanner->frames->data;
+	info = NULL;
+	if (frame->e != NULL)
+	    info = g_file_enumerator_next_file(frame->e, NULL, NULL);
+
+	if (info != NULL) {
+	    const char* name;
+	    char* new_name;
+
+	    frame->position++;
+	    name = g_file_info_get_name(info);
+	    new_name = repair_scanner_get_new_name(scanner, name);
+	    rename_dir_index_add(frame->index, 0, name, new_name);
+	    g_free(new_name);
+
+	    if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY) {
+		repair_scanner_push(scanner, g_file_get_child(frame->dir, name),
+			name);
+	    }
+	    g_object_unref(info);
+	} else {
+	    repair_scanner_pop(scanner);
+	}
+	repair_progress_tick(scanner->progress);
+    }
+
+    if (scanner->checkpoint != NULL) {
+	gint64 now = g_get_monotonic_time();
+
+	// A finished scan is saved too, so the plan can be applied
+	// later without scanning again.
+	if (scanner->finished || now - scanner->last_checkpoint >=
+		REPAIR_SCANNER_CHECKPOINT_INTERVAL) {
+	    GError* error = NULL;
+
+	    if (!repair_scanner_save_checkpoint(scanner, &error)) {
+		g_warning("%s", error->message);
+		g_error_free(error);
+	    }
+	    scanner->last_checkpoint = now;
+	}
+    }
+
+    return !scanner->finished;
+}
+
+/*
+ * Checkpoints
+ *
+ * A checkpointed scan keeps its plan in the cache directory and from
+ * time to time writes the traversal frontier next to it: how many top
+ * level files are done, and for each directory being enumerated how
+ * many of its entries were taken.  A new scan of the same files with
+ * the same options picks it up, as long as none of the top level files
+ * and none of the directories entered were modified in between; the
+ * modification times of the directories are kept in a third file, one
+ * line for each.  Names are saved URI escaped, since a key file only
+ * holds UTF-8.
+ */
+
+static char*
+repair_scanner_get_checkpoint_key(char** uris,
+	const char* encoding, gboolean include_subdir)
+{
+    GChecksum* checksum;
+    char* key;
+    int i;
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    for (i = 0; uris[i] != NULL; i++) {
+	g_checksum_update(checksum, (const guchar*)uris[i], strlen(uris[i]) + 1);
+    }
+    g_checksum_update(checksum, (const guchar*)encoding, strlen(encoding) + 1);
+    g_checksum_update(checksum, (const guchar*)(include_subdir ? "1" : "0"), 1);
+
+    key = g_strdup(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+
+    return key;
+}
+
+static char*
+repair_scanner_get_path(const char* checkpoint, const char* suffix)
+{
+    char* base;
+    char* path;
+
+    base = g_strndup(checkpoint, strlen(checkpoint) - strlen(".checkpoint"));
+    path = g_strconcat(base, suffix, NULL);
+    g_free(base);
+
+    return path;
+}
+
+static char*
+get_modification_time(GFile* file)
+{
+    GFileInfo* info;
+    guint64 mtime = 0;
+    guint32 usec = 0;
+
+    info = g_file_query_info(file,
+	    G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+	    G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+	    G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+    if (info != NULL) {
+	mtime = g_file_info_get_attribute_uint64(info,
+		G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	usec = g_file_info_get_attribute_uint32(info,
+		G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+	g_object_unref(info);
+    }
+
+    return g_strdup_printf("%" G_GUINT64_FORMAT ".%06u", mtime, usec);
+}
+
+static char**
+get_modification_times(GSList* files)
+{
+    char** mtimes;
+    GSList* item;
+    int i;
+
+    mtimes = g_new0(char*, g_slist_length(files) + 1);
+    for (item = files, i = 0; item != NULL; item = item->next, i++) {
+	mtimes[i] = get_modification_time(item->data);
+    }
+
+    return mtimes;
+}
+
+/*
+ * Checks the directories entered before the checkpoint against their
+ * modification times, and keeps the file to add the ones entered after
+ * it.  A line cut off after the checkpoint is dropped.
+ */
+static gboolean
+repair_scanner_load_dirs(RepairScanner* scanner, guint64 size)
+{
+    char* path;
+    FILE* fp;
+    char* line;
+    size_t line_size;
+    ssize_t len;
+    guint64 offset;
+    gboolean res;
+
+    path = repair_scanner_get_path(scanner->checkpoint, ".dirs");
+    fp = fopen(path, "r+e");
+    g_free(path);
+    if (fp == NULL)
+	return FALSE;
+
+    res = TRUE;
+    line = NULL;
+    line_size = 0;
+    offset = 0;
+    while (res && offset < size &&
+	   (len = getline(&line, &line_size, fp)) > 0) {
+	char* uri;
+	char* mtime;
+	GFile* dir;
+
+	offset += len;
+	if (offset > size || line[len - 1] != '\n') {
+	    res = FALSE;
+	    break;
+	}
+	line[len - 1] = '\0';
+
+	uri = strchr(line, ' ');
+	if (uri == NULL) {
+	    res = FALSE;
+	    break;
+	}
+	*uri++ = '\0';
+
+	dir = g_file_new_for_uri(uri);
+	mtime = get_modification_time(dir);
+	res = strcmp(mtime, line) == 0;
+	g_free(mtime);
+	g_object_unref(dir);
+    }
+    free(line);
+
+    if (!res || offset != size ||
+	ftruncate(fileno(fp), size) != 0 ||
+	fseeko(fp, size, SEEK_SET) != 0) {
+	fclose(fp);
+	return FALSE;
+    }
+
+    scanner->dirs = fp;
+    return TRUE;
+}
+
+/*
+ * The renames of the top level files in the current root, which are done
+ * before a checkpoint, are not in the plan yet, so they are checked again.
+ * Nothing is renamed before the plan is applied, so the check finds the
+ * same, and what it left out is reported already.
+ */
+static void
+repair_scanner_restore_root_rename(RepairScanner* scanner, GFile* file)
+{
+    GFile* parent;
+    char* dir;
+    char* name;
+    char* new_name;
+
+    parent = g_file_get_parent(file);
+    if (parent == NULL)
+	return;
+
+    dir = g_file_get_path(parent);
+    if (g_strcmp0(dir, scanner->root) == 0) {
+	name = g_file_get_basename(file);
+	new_name = filename_converter_get_new_name(name, scanner->encoding);
+	new_name = repair_scanner_check_top_level(scanner, parent,
+		name, new_name, FALSE);
+	g_free(new_name);
+	g_free(name);
+    }
+    g_object_unref(parent);
+    g_free(dir);
+}
+
+static gboolean
+repair_scanner_load_checkpoint(RepairScanner* scanner, gsize memory_budget)
+{
+    GKeyFile* key_file;
+    char** uris;
+    char** mtimes;
+    char** groups;
+    char* plan_path;
+    char* root;
+    guint64 plan_size;
+    guint64 n_moves;
+    guint n_done;
+    guint depth;
+    gsize n_groups;
+    gsize i;
+    gboolean res;
+
+    key_file = g_key_file_new();
+    if (!g_key_file_load_from_file(key_file, scanner->checkpoint,
+		G_KEY_FILE_NONE, NULL)) {
+	g_key_file_free(key_file);
+	return FALSE;
+    }
+
+    res = FALSE;
+    uris = g_key_file_get_string_list(key_file, "scan", "files", NULL, NULL);
+    mtimes = g_key_file_get_string_list(key_file, "scan", "mtimes", NULL, NULL);
+    if (uris == NULL || mtimes == NULL ||
+	g_strv_length(uris) != scanner->n_files ||
+	g_strv_length(mtimes) != scanner->n_files)
+	goto out;
+
+    for (i = 0; uris[i] != NULL; i++) {
+	if (strcmp(uris[i], scanner->uris[i]) != 0 ||
+	    strcmp(mtimes[i], scanner->mtimes[i]) != 0)
+	    goto out;
+    }
+
+    if (!g_key_file_has_key(key_file, "scan", "dirs-size", NULL) ||
+	!repair_scanner_load_dirs(scanner,
+		g_key_file_get_uint64(key_file, "scan", "dirs-size", NULL)))
+	goto out;
+
+    n_done = g_key_file_get_integer(key_file, "scan", "files-done", NULL);
+    plan_size = g_key_file_get_uint64(key_file, "plan", "size", NULL);
+    n_moves = g_key_file_get_uint64(key_file, "plan", "moves", NULL);
+    if (n_done > scanner->n_files)
+	goto out;
+
+    // The frames are saved outermost first.
+    groups = g_key_file_get_groups(key_file, &n_groups);
+    depth = 0;
+    for (i = 0; i < n_groups; i++) {
+	char* uri;
+	char* name;
+	guint64 position;
+	ScanFrame* frame;
+
+	if (!g_str_has_prefix(groups[i], "frame "))
+	    continue;
+
+	uri = g_key_file_get_string(key_file, groups[i], "dir", NULL);
+	name = g_key_file_get_string(key_file, groups[i], "name", NULL);
+	position = g_key_file_get_uint64(key_file, groups[i], "position", NULL);
+	if (uri == NULL) {
+	    g_free(name);
+	    continue;
+	}
+
+	if (name != NULL) {
+	    char* tmp = g_uri_unescape_string(name, NULL);
+	    g_free(name);
+	    name = tmp;
+	    depth++;
+	}
+
+	// The renames of the entries taken so far are put into the
+	// plan with the rest of the directory, so their names go into
+	// the index again.
+	frame = scan_frame_new(g_file_new_for_uri(uri), name);
+	while (frame->e != NULL && frame->position < position) {
+	    GFileInfo* info;
+	    const char* entry_name;
+	    char* entry_new_name;
+
+	    info = g_file_enumerator_next_file(frame->e, NULL, NULL);
+	    if (info == NULL)
+		break;
+	    entry_name = g_file_info_get_name(info);
+	    entry_new_name = filename_converter_get_new_name(entry_name,
+		    scanner->encoding);
+	    rename_dir_index_add(frame->index, 0, entry_name, entry_new_name);
+	    g_free(entry_new_name);
+	    g_object_unref(info);
+	    frame->position++;
+	}
+	scanner->frames = g_slist_prepend(scanner->frames, frame);
+
+	g_free(uri);
+	g_free(name);
+    }
+    g_strfreev(groups);
+
+    plan_path = repair_scanner_get_path(scanner->checkpoint, ".plan");
+    scanner->plan = rename_plan_open(memory_budget, plan_path,
+	    plan_size, n_moves, depth, NULL);
+    g_free(plan_path);
+    if (scanner->plan == NULL) {
+	g_slist_free_full(scanner->frames, (GDestroyNotify)scan_frame_free);
+	scanner->frames = NULL;
+	goto out;
+    }
+
+    root = g_key_file_get_string(key_file, "scan", "root", NULL);
+    if (root != NULL) {
+	scanner->root = g_uri_unescape_string(root, NULL);
+	g_free(root);
+    }
+
+    for (i = 0; i < n_done; i++) {
+	repair_scanner_restore_root_rename(scanner, scanner->files->data);
+	g_object_unref(scanner->files->data);
+	scanner->files = g_slist_delete_link(scanner->files, scanner->files);
+    }
+
+    scanner->stats.n_entries = g_key_file_get_uint64(key_file,
+	    "scan", "entries", NULL);
+    scanner->stats.n_renames = g_key_file_get_uint64(key_file,
+	    "scan", "renames", NULL);
+    scanner->stats.n_failures = g_key_file_get_uint64(key_file,
+	    "scan", "failures", NULL);
+    scanner->stats.n_conflicts = g_key_file_get_uint64(key_file,
+	    "scan", "conflicts", NULL);
+    res = TRUE;
+
+out:
+    if (!res && scanner->dirs != NULL) {
+	fclose(scanner->dirs);
+	scanner->dirs = NULL;
+    }
+    g_strfreev(uris);
+    g_strfreev(mtimes);
+    g_key_file_free(key_file);
+
+    return res;
+}
+
+/*
+ * Creates a scanner which checkpoints itself into the user cache
+ * directory, resuming an earlier scan of the same files if there is one.
+ * The scanner owns the plan; get it with repair_scanner_get_plan().
+ */
+RepairScanner*
+repair_scanner_new_with_checkpoint(GSList* files, const char* encoding,
+	gboolean include_subdir, gsize memory_budget)
+{
+    RepairScanner* scanner;
+    GSList* item;
+    char* dir;
+    char* key;
+    char* name;
+    char* plan_path;
+    char* dirs_path;
+    int i;
+
+    scanner = repair_scanner_new(files, encoding, include_subdir, NULL);
+    scanner->owns_plan = TRUE;
+    scanner->last_checkpoint = g_get_monotonic_time();
+
+    scanner->uris = g_new0(char*, scanner->n_files + 1);
+    for (item = files, i = 0; item != NULL; item = item->next, i++) {
+	scanner->uris[i] = g_file_get_uri(item->data);
+    }
+    scanner->mtimes = get_modification_times(files);
+
+    dir = g_build_filename(g_get_user_cache_dir(), PACKAGE, NULL);
+    g_mkdir_with_parents(dir, 0700);
+    key = repair_scanner_get_checkpoint_key(scanner->uris,
+	    encoding, include_subdir);
+    name = g_strconcat(key, ".checkpoint", NULL);
+    scanner->checkpoint = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(key);
+    g_free(dir);
+
+    scanner->resumed = repair_scanner_load_checkpoint(scanner, memory_budget);
+    if (!scanner->resumed) {
+	plan_path = repair_scanner_get_path(scanner->checkpoint, ".plan");
+	scanner->plan = rename_plan_new_with_file(memory_budget, plan_path);
+	g_free(plan_path);
+
+	// Without it the checkpoint can not be checked, so it is not
+	// resumed.
+	dirs_path = repair_scanner_get_path(scanner->checkpoint, ".dirs");
+	scanner->dirs = fopen(dirs_path, "we");
+	g_free(dirs_path);
+    }
+
+    return scanner;
+}
+
+RenamePlan*
+repair_scanner_get_plan(RepairScanner* scanner)
+{
+    return scanner->plan;
+}
+
+gboolean
+repair_scanner_is_resumed(RepairScanner* scanner)
+{
+    return scanner->resumed;
+}
+
+gboolean
+repair_scanner_save_checkpoint(RepairScanner* scanner, GError** error)
+{
+    GKeyFile* key_file;
+    GSList* frames;
+    GSList* item;
+    char* data;
+    gsize len;
+    guint64 plan_size;
+    gboolean res;
+    int i;
+
+    if (scanner->checkpoint == NULL)
+	return TRUE;
+
+    // The plan must be on the disk before the key file points into it.
+    if (!rename_plan_sync(scanner->plan, &plan_size, error))
+	return FALSE;
+    if (scanner->dirs != NULL &&
+	(fflush(scanner->dirs) != 0 || fdatasync(fileno(scanner->dirs)) != 0)) {
+	int saved_errno = errno;
+	g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+		"%s", g_strerror(saved_errno));
+	return FALSE;
+    }
+
+    key_file = g_key_file_new();
+
+    g_key_file_set_string_list(key_file, "scan", "files",
+	    (const char* const*)scanner->uris, scanner->n_files);
+    g_key_file_set_string_list(key_file, "scan", "mtimes",
+	    (const char* const*)scanner->mtimes, scanner->n_files);
+    g_key_file_set_integer(key_file, "scan", "files-done",
+	    scanner->n_files - g_slist_length(scanner->files));
+    if (scanner->root != NULL) {
+	char* root = g_uri_escape_string(scanner->root, "/", FALSE);
+	g_key_file_set_string(key_file, "scan", "root", root);
+	g_free(root);
+    }
+    g_key_file_set_uint64(key_file, "scan", "entries", scanner->stats.n_entries);
+    g_key_file_set_uint64(key_file, "scan", "renames", scanner->stats.n_renames);
+    g_key_file_set_uint64(key_file, "scan", "failures", scanner->stats.n_failures);
+    g_key_file_set_uint64(key_file, "scan", "conflicts", scanner->stats.n_conflicts);
+    if (scanner->dirs != NULL)
+	g_key_file_set_uint64(key_file, "scan", "dirs-size", ftello(scanner->dirs));
+
+    g_key_file_set_uint64(key_file, "plan", "size", plan_size);
+    g_key_file_set_uint64(key_file, "plan", "moves",
+	    rename_plan_get_n_moves(scanner->plan));
+
+    frames = g_slist_reverse(g_slist_copy(scanner->frames));
+    for (item = frames, i = 0; item != NULL; item = item->next, i++) {
+	ScanFrame* frame = item->data;
+	char* group;
+	char* uri;
+
+	group = g_strdup_printf("frame %d", i);
+	uri = g_file_get_uri(frame->dir);
+	g_key_file_set_string(key_file, group, "dir", uri);
+	if (frame->name != NULL) {
+	    char* name = g_uri_escape_string(frame->name, NULL, FALSE);
+	    g_key_file_set_string(key_file, group, "name", name);
+	    g_free(name);
+	}
+	g_key_file_set_uint64(key_file, group, "position", frame->position);
+	g_free(uri);
+	g_free(group);
+    }
+    g_slist_free(frames);
+
+    data = g_key_file_to_data(key_file, &len, NULL);
+    res = g_file_set_contents(scanner->checkpoint, data, len, error);
+    g_free(data);
+    g_key_file_free(key_file);
+
+    return res;
+}
+
+/*
+ * Removes the checkpoint and the plan file.  Call it when the plan was
+ * applied or is not wanted any more, before freeing the scanner.
+ */
+void
+repair_scanner_discard_checkpoint(RepairScanner* scanner)
+{
+    char* plan_path;
+    char* dirs_path;
+
+    if (scanner->checkpoint == NULL)
+	return;
+
+    plan_path = repair_scanner_get_path(scanner->checkpoint, ".plan");
+    dirs_path = repair_scanner_get_path(scanner->checkpoint, ".dirs");
+    g_unlink(scanner->checkpoint);
+    g_unlink(plan_path);
+    g_unlink(dirs_path);
+    g_free(dirs_path);
+    g_free(plan_path);
+
+    g_free(scanner->checkpoint);
+    scanner->checkpoint = NULL;
+}
@@ -0,0 +1,68 @@
+/*
+ * Nautilus Filename Repairer Extension
+ *
+ * Copyright (C) 2026 Choe Hwanjin
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * Author: Choe Hwajin <choe.hwanjin@gmail.com>
+ */
+
+#ifndef nautilus_filename_repairer_repair_scanner_h
+#define nautilus_filename_repairer_repair_scanner_h
+
+#include <gio/gio.h>
+
+#include "rename-plan.h"
+#include "rename-dir-index.h"
+#include "repair-progress.h"
+
+typedef struct _RepairScanner RepairScanner;
+
+typedef struct _RepairScannerStats {
+    guint64 n_entries;      /* files and directories visited */
+    guint64 n_renames;      /* entries put into the plan */
+    guint64 n_failures;     /* names which cannot be converted */
+    guint64 n_conflicts;    /* renames left out of the plan */
+} RepairScannerStats;
+
+typedef void (*RepairScannerProblemFunc)(GFile* file, const char* new_name,
+					 RenameDirIndexProblem problem,
+					 gpointer data);
+
+RepairScanner* repair_scanner_new(GSList* files, const char* encoding,
+				  gboolean include_subdir, RenamePlan* plan);
+RepairScanner* repair_scanner_new_with_checkpoint(GSList* files,
+				  const char* encoding, gboolean include_subdir,
+				  gsize memory_budget);
+void           repair_scanner_free(RepairScanner* scanner);
+
+gboolean       repair_scanner_step(RepairScanner* scanner, guint n);
+void           repair_scanner_set_progress(RepairScanner* scanner,
+					   RepairProgress* progress);
+void           repair_scanner_set_problem_func(RepairScanner* scanner,
+					       RepairScannerProblemFunc func,
+					       gpointer data);
+void           repair_scanner_set_report_top_level(RepairScanner* scanner,
+						   gboolean report);
+const RepairScannerStats* repair_scanner_get_stats(RepairScanner* scanner);
+RenamePlan*    repair_scanner_get_plan(RepairScanner* scanner);
+
+gboolean       repair_scanner_is_resumed(RepairScanner* scanner);
+gboolean       repair_scanner_save_checkpoint(RepairScanner* scanner,
+					      GError** error);
+void           repair_scanner_discard_checkpoint(RepairScanner* scanner);
+
+#endif /* nautilus_filename_repairer_repair_scanner_h */
@@ -25,9 +25,12 @@
 #endif
 
 #include <glib.h>
+#include <gtk/gtk.h>
 
 #include "repairer-utils.h"
 
+#define REPAIRER_RESOURCE_PATH "/org/gnome/nautilus-filename-repairer/"
+
 static const char* app_path = NULL;
 
 void
@@ -36,12 +39,12 @@ repairer_utils_set_app_path(const char* path)
     app_path = path;
 }
 
-gchar*
-repairer_utils_get_ui_path(const char* name)
+#if ENABLE_DEBUG
+static gchar*
+repairer_utils_find_ui_file(const char* name)
 {
     gchar* path;
 
-#if ENABLE_DEBUG
     if (g_file_test(name, G_FILE_TEST_EXISTS)) {
 	return g_strdup(name);
     }
@@ -56,9 +59,35 @@ repairer_utils_get_ui_path(const char* name)
 	}
 	g_free(path);
     }
+
+    return NULL;
+}
+#endif
+
+/*
+ * The UI files are built into the program as a GResource, so nothing is
+ * looked up on disk at startup.  With the debugging features, a file in
+ * the current directory or next to the program comes first, so it can be
+ * edited without building again.
+ */
+gboolean
+repairer_utils_add_ui(GtkBuilder* builder, const char* name, GError** error)
+{
+    gchar* path;
+    gboolean res;
+
+#if ENABLE_DEBUG
+    path = repairer_utils_find_ui_file(name);
+    if (path != NULL) {
+	res = gtk_builder_add_from_file(builder, path, error);
+	g_free(path);
+	return res;
+    }
 #endif
 
-    path = g_build_path(PKGDATADIR, name, NULL);
+    path = g_strconcat(REPAIRER_RESOURCE_PATH, name, NULL);
+    res = gtk_builder_add_from_resource(builder, path, error);
+    g_free(path);
 
-    return path;
+    return res;
 }
@@ -23,9 +23,10 @@
 #ifndef nautilus_filename_repairer_repairer_utils_h
 #define nautilus_filename_repairer_repairer_utils_h
 
-#include <glib.h>
+#include <gtk/gtk.h>
 
 void repairer_utils_set_app_path(const char* path);
-gchar* repairer_utils_get_ui_path(const char* name);
+gboolean repairer_utils_add_ui(GtkBuilder* builder, const char* name,
+			       GError** error);
 
 #endif /* nautilus_filename_repairer_repairer_utils_h */
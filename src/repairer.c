@@ -24,17 +24,405 @@
 #include <config.h>
 #endif
 
+#include <locale.h>
+#include <unistd.h>
 #include <gtk/gtk.h>
 
 #include "nautilus-filename-repairer-i18n.h"
 #include "repair-dialog.h"
+#include "repairer-utils.h"
+#include "filename-converter.h"
+#include "rename-plan.h"
+#include "repair-scanner.h"
+#include "repair-error-log.h"
+#include "rename-journal.h"
+
+static gboolean batch_mode = FALSE;
+static gboolean recursive = FALSE;
+static gboolean dry_run = FALSE;
+static char* encoding = NULL;
+static gint memory_budget = 64;
+static gint max_errors = 0;
+static gint n_jobs = 1;
+static gint rate = 0;
+static gint max_in_flight = 0;
+static gint max_latency = 0;
+static char* error_log = NULL;
+static char* journal_path = NULL;
+static gboolean undo = FALSE;
+static gboolean recover = FALSE;
+static gboolean timing = FALSE;
+static gint64 start_time = 0;
+static char** broken_dirs = NULL;
+static char** file_args = NULL;
+static gboolean progress_shown = FALSE;
+
+static GOptionEntry option_entries[] = {
+    { "batch", 'b', 0, G_OPTION_ARG_NONE, &batch_mode,
+      N_("Repair the files without showing the dialog"), NULL },
+    { "encoding", 'e', 0, G_OPTION_ARG_STRING, &encoding,
+      N_("Encoding of the broken file names in batch mode"), N_("ENCODING") },
+    { "recursive", 'r', 0, G_OPTION_ARG_NONE, &recursive,
+      N_("Repair the files in subdirectories too in batch mode"), NULL },
+    { "dry-run", 'n', 0, G_OPTION_ARG_NONE, &dry_run,
+      N_("Print the renames instead of doing them in batch mode"), NULL },
+    { "memory-budget", 'm', 0, G_OPTION_ARG_INT, &memory_budget,
+      N_("Memory for the pending renames before they are written to a temporary file"), N_("MiB") },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &n_jobs,
+      N_("Rename in this many folders at the same time"), N_("N") },
+    { "rate", 0, 0, G_OPTION_ARG_INT, &rate,
+      N_("Do at most this many renames per second, 0 for no limit"), N_("N") },
+    { "max-in-flight", 0, 0, G_OPTION_ARG_INT, &max_in_flight,
+      N_("Have at most this many renames going at once, 0 for no limit"), N_("N") },
+    { "max-latency", 0, 0, G_OPTION_ARG_INT, &max_latency,
+      N_("Slow down while renames take longer than this"), N_("MS") },
+    { "max-errors", 0, 0, G_OPTION_ARG_INT, &max_errors,
+      N_("Stop after this many renames have failed, 0 for never"), N_("N") },
+    { "error-log", 0, 0, G_OPTION_ARG_FILENAME, &error_log,
+      N_("Write the failed renames to a file"), N_("FILE") },
+    { "journal", 0, 0, G_OPTION_ARG_FILENAME, &journal_path,
+      N_("Journal of the renames in batch mode, --undo and --recover"), N_("FILE") },
+    { "undo", 0, 0, G_OPTION_ARG_NONE, &undo,
+      N_("Undo the renames of the last run, as kept in its journal"), NULL },
+    { "recover", 0, 0, G_OPTION_ARG_NONE, &recover,
+      N_("Finish the renames of a run which was cut off, as kept in its journal"), NULL },
+    { "timing", 0, 0, G_OPTION_ARG_NONE, &timing,
+      N_("Print how long the startup takes"), NULL },
+    { "broken-dir", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &broken_dirs,
+      N_("Load this folder first in the dialog, as it has names to repair"), N_("DIR") },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &file_args,
+      NULL, N_("[FILE...]") },
+    { NULL }
+};
+
+static void
+print_timing(const char* stage)
+{
+    if (!timing)
+	return;
+
+    g_printerr("%s: %.1f ms\n", stage,
+	    (g_get_monotonic_time() - start_time) / 1000.0);
+}
+
+static gboolean
+on_first_draw(GtkWidget* widget, cairo_t* cr, gpointer data)
+{
+    g_signal_handlers_disconnect_by_func(widget, on_first_draw, data);
+    print_timing("first frame");
+    return FALSE;
+}
+
+typedef struct _PrintContext {
+    GString* path;
+    GArray* lengths;
+} PrintContext;
+
+static void
+print_context_append(PrintContext* context, const char* name)
+{
+    if (context->path->len == 0 ||
+	context->path->str[context->path->len - 1] != G_DIR_SEPARATOR)
+	g_string_append_c(context->path, G_DIR_SEPARATOR);
+    g_string_append(context->path, name);
+}
+
+static gboolean
+print_rename(RenamePlanOp op, const char* name, const char* new_name,
+	PrintContext* context)
+{
+    gsize len;
+    char* display_name;
+
+    switch (op) {
+    case RENAME_PLAN_ROOT:
+	g_string_assign(context->path, name);
+	g_array_set_size(context->lengths, 0);
+	break;
+    case RENAME_PLAN_ENTER:
+	len = context->path->len;
+	g_array_append_val(context->lengths, len);
+	print_context_append(context, name);
+	break;
+    case RENAME_PLAN_LEAVE:
+	len = g_array_index(context->lengths, gsize, context->lengths->len - 1);
+	g_array_set_size(context->lengths, context->lengths->len - 1);
+	g_string_truncate(context->path, len);
+	break;
+    case RENAME_PLAN_MOVE:
+	len = context->path->len;
+	print_context_append(context, name);
+	display_name = filename_converter_get_display_name(context->path->str);
+	g_string_truncate(context->path, len);
+	print_context_append(context, new_name);
+	g_print("%s -> %s\n", display_name, context->path->str);
+	g_string_truncate(context->path, len);
+	g_free(display_name);
+	break;
+    }
+
+    return TRUE;
+}
+
+/*
+ * The line is written over, so only when it goes to a terminal.
+ */
+static void
+print_progress(RepairProgress* progress, gpointer data)
+{
+    char* text;
+
+    text = repair_progress_format(progress);
+    g_printerr("\r%s\033[K", text);
+    g_free(text);
+
+    progress_shown = TRUE;
+}
+
+static void
+end_progress(void)
+{
+    if (progress_shown)
+	g_printerr("\n");
+    progress_shown = FALSE;
+}
+
+static gboolean
+on_rename_error(GFile* file, const char* new_name, GError* error,
+	RepairErrorLog* log)
+{
+    char* path;
+    char* display_name;
+
+    end_progress();
+    path = g_file_get_path(file);
+    display_name = filename_converter_get_display_name(path);
+    g_printerr(_("There was an error renaming \"%s\" to \"%s\": %s\n"),
+	    display_name, new_name, error->message);
+    g_free(display_name);
+    g_free(path);
+
+    return repair_error_log_add(log, file, new_name, error);
+}
+
+static void
+on_rename_problem(GFile* file, const char* new_name,
+	RenameDirIndexProblem problem, RepairErrorLog* log)
+{
+    char* path;
+    char* display_name;
+    GError* error = NULL;
+
+    end_progress();
+    path = g_file_get_path(file);
+    display_name = filename_converter_get_display_name(path);
+    if (problem == RENAME_DIR_INDEX_TOO_LONG)
+	g_printerr(_("\"%s\" is not renamed: \"%s\" is too long\n"),
+		display_name, new_name);
+    else
+	g_printerr(_("\"%s\" is not renamed: \"%s\" is already taken\n"),
+		display_name, new_name);
+    g_free(display_name);
+    g_free(path);
+
+    rename_dir_index_set_error(problem, &error);
+    repair_error_log_add(log, file, new_name, error);
+    g_error_free(error);
+}
+
+static void
+finish_error_log(RepairErrorLog* log)
+{
+    char* n_errors;
+    GError* error = NULL;
+
+    if (repair_error_log_get_n_errors(log) == 0)
+	return;
+
+    n_errors = g_strdup_printf("%u", repair_error_log_get_n_errors(log));
+    if (repair_error_log_is_stopped(log))
+	g_printerr(_("Stopped after %s renames failed\n"), n_errors);
+    else
+	g_printerr(_("%s renames failed\n"), n_errors);
+    g_free(n_errors);
+
+    if (error_log != NULL &&
+	!repair_error_log_save(log, error_log, &error)) {
+	g_printerr("%s\n", error->message);
+	g_error_free(error);
+    }
+}
+
+static int
+repair_files_in_batch(GSList* files)
+{
+    RenamePlan* plan;
+    RepairScanner* scanner;
+    const RepairScannerStats* stats;
+    char* n_entries;
+    char* n_renames;
+    char* n_failures;
+    char* n_conflicts;
+    RepairErrorLog* log;
+    RepairProgress* progress;
+    RenameJournal* journal;
+    RenameThrottle* throttle;
+    gboolean res;
+    GError* error = NULL;
+
+    if (!dry_run && rename_journal_is_in_use(journal_path)) {
+	g_printerr(_("Another run is going on; try again when it ends\n"));
+	return 1;
+    }
+
+    // Its journal is all there is to finish or undo the last run with.
+    if (!dry_run && rename_journal_is_cut_off(journal_path)) {
+	g_printerr(_("The last run was cut off: finish it with --recover "
+		    "or undo it with --undo first\n"));
+	return 1;
+    }
+
+    if (encoding == NULL)
+	encoding = g_strdup(filename_converter_get_default_encoding());
+
+    progress = NULL;
+    if (isatty(STDERR_FILENO)) {
+	progress = repair_progress_new(G_USEC_PER_SEC);
+	repair_progress_set_func(progress, print_progress, NULL);
+    }
+
+    scanner = repair_scanner_new_with_checkpoint(files, encoding, recursive,
+	    (gsize)MAX(memory_budget, 1) * 1024 * 1024);
+    if (repair_scanner_is_resumed(scanner))
+	g_printerr(_("Resuming an earlier scan of the same files\n"));
+    repair_scanner_set_progress(scanner, progress);
+    log = repair_error_log_new(MAX(max_errors, 0));
+    repair_scanner_set_problem_func(scanner,
+	    (RepairScannerProblemFunc)on_rename_problem, log);
+    while (repair_scanner_step(scanner, 1000))
+	continue;
+    end_progress();
+
+    stats = repair_scanner_get_stats(scanner);
+    n_entries = g_strdup_printf("%" G_GUINT64_FORMAT, stats->n_entries);
+    n_renames = g_strdup_printf("%" G_GUINT64_FORMAT, stats->n_renames);
+    n_failures = g_strdup_printf("%" G_GUINT64_FORMAT, stats->n_failures);
+    n_conflicts = g_strdup_printf("%" G_GUINT64_FORMAT, stats->n_conflicts);
+    g_printerr(_("%s files scanned, %s to rename, %s cannot be converted, "
+		"%s taken or too long\n"),
+	    n_entries, n_renames, n_failures, n_conflicts);
+    g_free(n_entries);
+    g_free(n_renames);
+    g_free(n_failures);
+    g_free(n_conflicts);
+
+    plan = repair_scanner_get_plan(scanner);
+    journal = NULL;
+    throttle = NULL;
+    if (dry_run) {
+	PrintContext context;
+
+	// A dry run leaves the finished scan for the real one.
+	context.path = g_string_new(NULL);
+	context.lengths = g_array_new(FALSE, FALSE, sizeof(gsize));
+	res = rename_plan_foreach(plan, (RenamePlanFunc)print_rename,
+		&context, &error);
+	g_string_free(context.path, TRUE);
+	g_array_free(context.lengths, TRUE);
+    } else {
+	// Another run may have started during the scan; the scan is
+	// kept for later.
+	journal = rename_journal_new(journal_path, &error);
+	if (journal == NULL &&
+	    g_error_matches(error, G_IO_ERROR, G_IO_ERROR_BUSY)) {
+	    res = FALSE;
+	    goto out;
+	}
+	if (journal == NULL) {
+	    g_printerr("%s\n", error->message);
+	    g_clear_error(&error);
+	}
+
+	rename_plan_set_progress(plan, progress);
+	rename_plan_set_jobs(plan, MAX(n_jobs, 1));
+	rename_plan_set_journal(plan, journal);
+	if (rate > 0 || max_in_flight > 0 || max_latency > 0) {
+	    throttle = rename_throttle_new(MAX(rate, 0), MAX(max_in_flight, 0),
+		    MAX(max_latency, 0), progress);
+	    rename_plan_set_throttle(plan, throttle);
+	}
+	res = rename_plan_apply(plan, (RenamePlanErrorFunc)on_rename_error,
+		log, &error);
+	end_progress();
+	if (res && journal != NULL)
+	    res = rename_journal_finish(journal, &error);
+	finish_error_log(log);
+	repair_scanner_discard_checkpoint(scanner);
+    }
+
+out:
+    if (!res) {
+	g_printerr("%s\n", error->message);
+	g_error_free(error);
+    }
+
+    if (res)
+	res = repair_error_log_get_n_errors(log) == 0;
+
+    if (journal != NULL)
+	rename_journal_free(journal);
+    rename_throttle_free(throttle);
+    repair_error_log_free(log);
+    repair_scanner_free(scanner);
+    if (progress != NULL)
+	repair_progress_free(progress);
+
+    return res ? 0 : 1;
+}
+
+/*
+ * Undoes the last run or finishes it, from its journal.
+ */
+static int
+replay_journal(void)
+{
+    RepairErrorLog* log;
+    gboolean res;
+    GError* error = NULL;
+
+    log = repair_error_log_new(MAX(max_errors, 0));
+    if (undo)
+	res = rename_journal_undo(journal_path,
+		(RenamePlanErrorFunc)on_rename_error, log, &error);
+    else
+	res = rename_journal_recover(journal_path,
+		(RenamePlanErrorFunc)on_rename_error, log, &error);
+
+    if (res) {
+	finish_error_log(log);
+	res = repair_error_log_get_n_errors(log) == 0;
+    } else {
+	g_printerr("%s\n", error->message);
+	g_error_free(error);
+    }
+
+    repair_error_log_free(log);
+
+    return res ? 0 : 1;
+}
 
 int main(int argc, char** argv)
 {
     int i;
     GtkDialog* dialog;
+    GOptionContext* context;
     GSList* files;
     gint res;
+    GError* error = NULL;
+
+    start_time = g_get_monotonic_time();
+
+    setlocale(LC_ALL, "");
 
 #ifdef ENABLE_NLS
     bindtextdomain(GETTEXT_PACKAGE, GNOMELOCALEDIR);
@@ -44,10 +432,56 @@ int main(int argc, char** argv)
 
     repairer_utils_set_app_path(argv[0]);
 
-    gtk_init(&argc, &argv);
+    context = g_option_context_new(NULL);
+    g_option_context_add_main_entries(context, option_entries, GETTEXT_PACKAGE);
+    g_option_context_add_group(context, gtk_get_option_group(FALSE));
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+	g_printerr("%s\n", error->message);
+	g_error_free(error);
+	g_option_context_free(context);
+	return 1;
+    }
+    g_option_context_free(context);
+    print_timing("options parsed");
+
+    if (journal_path == NULL)
+	journal_path = rename_journal_get_default_path();
+
+    if (undo || recover) {
+	res = replay_journal();
+	g_free(journal_path);
+	g_strfreev(file_args);
+	return res;
+    }
 
     files = NULL;
-    if (argc == 1) {
+    if (file_args != NULL) {
+	for (i = 0; file_args[i] != NULL; i++) {
+	    GFile* file = g_file_new_for_commandline_arg(file_args[i]);
+	    files = g_slist_prepend(files, file);
+	}
+	files = g_slist_reverse(files);
+	g_strfreev(file_args);
+    }
+
+    if (batch_mode) {
+	res = 0;
+	if (files != NULL)
+	    res = repair_files_in_batch(files);
+
+	g_slist_foreach(files, (GFunc)g_object_unref, NULL);
+	g_slist_free(files);
+	g_free(encoding);
+	g_free(error_log);
+	g_free(journal_path);
+	repairer_utils_set_app_path(NULL);
+	return res;
+    }
+
+    gtk_init(&argc, &argv);
+    print_timing("gtk initialized");
+
+    if (files == NULL) {
 	dialog = GTK_DIALOG(gtk_file_chooser_dialog_new(
 			_("Nautilus Filename Repairer: Select Files To Rename"),
 			NULL,
@@ -61,18 +495,27 @@ int main(int argc, char** argv)
 	    files = gtk_file_chooser_get_files(GTK_FILE_CHOOSER(dialog));
 	}
 	gtk_widget_destroy(GTK_WIDGET(dialog));
-    } else {
-	for (i = 1; i < argc; i++) {
-	    GFile* file = g_file_new_for_path(argv[i]);
-	    files = g_slist_prepend(files, file);
-	}
-	files = g_slist_reverse(files);
     }
 
     if (files == NULL)
 	return 0;
 
+    if (!repair_dialog_check_last_run(NULL)) {
+	g_slist_foreach(files, (GFunc)g_object_unref, NULL);
+	g_slist_free(files);
+	g_free(journal_path);
+	repairer_utils_set_app_path(NULL);
+	return 0;
+    }
+
     dialog = repair_dialog_new(files);
+    repair_dialog_set_broken_dirs(dialog, broken_dirs);
+    g_strfreev(broken_dirs);
+    print_timing("dialog built");
+    if (timing) {
+	g_signal_connect_after(G_OBJECT(dialog), "draw",
+		G_CALLBACK(on_first_draw), NULL);
+    }
     res = gtk_dialog_run(dialog);
     gtk_widget_hide(GTK_WIDGET(dialog));
 